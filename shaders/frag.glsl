@@ -12,21 +12,14 @@ in vec2 fragTexCoord;
 out vec4 finalColor;
 
 struct Column {
-    int padding;
+    float depth;
     int textureId;
-    float brightness;
+    uint luxels;
     float lineHeight;
     float lineOffset;
     float textureColumnOffset;
 };
 
-struct Tile {
-    int ceiling;
-    int wall;
-    int floor;
-    int padding;
-};
-
 layout (std430, binding = 1) readonly buffer Columns {
     Column inputData[];
 };
@@ -36,16 +29,20 @@ layout (std430, binding = 2) readonly buffer Constants {
     int viewportWidth;
     int viewportHeight;
     float viewportHalfHeight;
-    float columnAngleStart;
-    float columnAngleStep;
     ivec2 tileSize;
     ivec2 tileMapSize;
 };
 
+// Only the chunks of the map around the player are loaded, in the slots of
+// the chunk cache (see map.h). Each slot holds a layer of wall ids, one of
+// ceiling ids and one of floor ids, with a byte for every cell of the chunk
+// (row by row), so every uint packs the ids of 4 cells
 layout (std430, binding = 3) readonly restrict buffer MapData {
     int mapWidth;
     int mapHeight;
-    Tile mapData[];
+    int chunksX;
+    int chunkShift;
+    uint chunkTiles[];
 };
 
 layout (std430, binding = 4) readonly restrict buffer FrameData {
@@ -56,8 +53,86 @@ layout (std430, binding = 4) readonly restrict buffer FrameData {
     vec2 cameraPlane;
 };
 
+// Slot of every chunk of the map, -1 if the chunk isn't loaded
+layout (std430, binding = 6) readonly restrict buffer ChunkTable {
+    int chunkSlots[];
+};
+
+// Tables that only depend on the resolution: the offset along the camera plane
+// (between -1 and 1) of every column, then the distance of the floor and
+// ceiling seen by every row above the horizon
+layout (std430, binding = 7) readonly restrict buffer ViewTables {
+    float viewTables[];
+};
+
+// Luxels of the chunks in the slots of the chunk cache, a byte for every luxel
+// (see lightmap.h): the 4 faces of a wall cell or the floor and the ceiling of
+// an empty cell, every cell after the previous one (row by row)
+layout (std430, binding = 8) readonly restrict buffer ChunkLuxels {
+    uint chunkLuxels[];
+};
+
 uniform sampler2D tileMap;
 
+#define LAYER_WALLS 0
+#define LAYER_CEILINGS 1
+#define LAYER_FLOORS 2
+
+// Same as lightmap.h
+#define LIGHTMAP_RESOLUTION 2
+#define LIGHTMAP_SURFACE_LUXELS (LIGHTMAP_RESOLUTION * LIGHTMAP_RESOLUTION)
+#define LIGHTMAP_CELL_LUXELS (4 * LIGHTMAP_SURFACE_LUXELS)
+#define LIGHTMAP_FLOOR 0
+#define LIGHTMAP_CEILING 1
+#define LIGHTMAP_FACE_LEFT 0
+#define LIGHTMAP_FACE_RIGHT 1
+#define LIGHTMAP_FACE_UP 2
+#define LIGHTMAP_FACE_DOWN 3
+
+// Returns the offset (in bytes) of a cell (inside the map) in the wall
+// layer of its slot, -1 if the chunk of the cell isn't loaded
+int getTileOffset(ivec2 cell) {
+    int slot = chunkSlots[(cell.y >> chunkShift) * chunksX + (cell.x >> chunkShift)];
+    if (slot < 0) {
+        return -1;
+    }
+    ivec2 offset = cell & ((1 << chunkShift) - 1);
+    return ((slot * 3) << (2 * chunkShift)) + (offset.y << chunkShift) + offset.x;
+}
+
+// Returns the id of a cell in one of the layers, given its offset
+int getTileId(int offset, int layer) {
+    int byteOffset = offset + (layer << (2 * chunkShift));
+    return int((chunkTiles[byteOffset >> 2] >> ((byteOffset & 3) << 3)) & 0xFFu);
+}
+
+// Returns the offset (in bytes) of the luxels of a cell in the luxels
+// of the cache, given the offset of the cell in its wall layer
+int getLuxelOffset(int tileOffset) {
+    int cells = 1 << (2 * chunkShift);
+    int slot = tileOffset / (3 * cells);
+    return (slot * cells + tileOffset - slot * 3 * cells) * LIGHTMAP_CELL_LUXELS;
+}
+
+// Returns a luxel (255 is full brightness), given its offset
+uint getLuxel(int offset) {
+    return (chunkLuxels[offset >> 2] >> ((offset & 3) << 3)) & 0xFFu;
+}
+
+// Returns the brightness of a wall column at texY (from 0 at the top to 1 at the bottom)
+float getColumnBrightness(uint luxels, float texY) {
+    int v = clamp(int(texY * LIGHTMAP_RESOLUTION), 0, LIGHTMAP_RESOLUTION - 1);
+    return float((luxels >> (8 * v)) & 0xFFu) / 255.0;
+}
+
+// Returns the brightness of the floor or the ceiling of a cell at
+// position, given the offset of the cell in its wall layer
+float getSurfaceBrightness(int tileOffset, vec2 position, bool isCeiling) {
+    ivec2 luxel = clamp(ivec2(fract(position) * LIGHTMAP_RESOLUTION), ivec2(0), ivec2(LIGHTMAP_RESOLUTION - 1));
+    int surface = (isCeiling) ? LIGHTMAP_CEILING : LIGHTMAP_FLOOR;
+    return float(getLuxel(getLuxelOffset(tileOffset) + surface * LIGHTMAP_SURFACE_LUXELS + luxel.y * LIGHTMAP_RESOLUTION + luxel.x)) / 255.0;
+}
+
 void main() {
     // Get the size of the tile map in pixels
     ivec2 size = textureSize(tileMap, 0);
@@ -78,10 +153,10 @@ void main() {
         // Flip the coordinate if the pixel belongs to the floor
         // for the rest of the calculation to work correctly
         float yCorrected = (isCeiling) ? yPosition : (viewportHeight - yPosition);
-        // Compute the distance in pixels from horizon
-        float pixelsFromHorizon = viewportHalfHeight - yCorrected;
-        // Compute the distance of the pixel ray (range is from 1.0 to +inf)
-        float distance = viewportHalfHeight / pixelsFromHorizon;
+        // Look up the distance of the pixel ray (range is from 1.0 to +inf),
+        // the rows are counted from the top (or the bottom for the floor)
+        int row = min(int(yCorrected), (viewportHeight + 1) / 2 - 1);
+        float distance = viewTables[viewportWidth + row];
         // Compute the left and right segments of the camera frustum
         vec2 cameraPlaneLeft = playerDirection - cameraPlane;
         vec2 cameraPlaneRight = playerDirection + cameraPlane;
@@ -91,11 +166,11 @@ void main() {
         vec2 position = playerPosition + (cameraPlaneLeft * distance) + (step * xPosition);
         // Get the coordinates of the cell that was hit by the ray
         ivec2 cell = ivec2(position);
-        // Check if the cell is valid
-        int cellOffset = cell.y * mapWidth + cell.x;
-        if (cellOffset >= 0 && cellOffset < mapWidth * mapHeight) {
+        // Check if the cell is valid (inside the map and in a loaded chunk)
+        int tileOffset = (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, ivec2(mapWidth, mapHeight)))) ? getTileOffset(cell) : -1;
+        if (tileOffset >= 0) {
             // Get the id of the cell and check if it's not empty
-            int cellId = (isCeiling) ? mapData[cellOffset].ceiling : mapData[cellOffset].floor;
+            int cellId = getTileId(tileOffset, (isCeiling) ? LAYER_CEILINGS : LAYER_FLOORS);
             if (cellId != 0) {
                 // Get the texture id
                 int textureId = cellId - 1;
@@ -103,8 +178,8 @@ void main() {
                 ivec2 tileCoords = ivec2(textureId % tileMapSize.x, int(textureId / tileMapSize.x));
                 // Compute texture coordinates
                 vec2 texCoords = (position - cell) + tileCoords;
-                // Get the brightness of the pixel
-                float brightness = (isCeiling) ? 0.85 : 1.0;
+                // Get the brightness of the pixel from the luxel it falls on
+                float brightness = getSurfaceBrightness(tileOffset, position, isCeiling);
                 // Sample the tile map
                 vec4 color = texture(tileMap, texCoords * tileSize / size);
                 // Adjust the brightness
@@ -117,7 +192,15 @@ void main() {
     } else if (lineHeight > 0) {
         // If the height of the column is not zero, set
         // the pixel to the color of the texture in the tilemap with id textureId
-        float brightness = inputData[column].brightness;
+        // Calculate the percentage of the column shown currently shown on screen
+        float columnShownPerc = (lineHeight / (lineHeight + inputData[column].lineOffset));
+        // Calculate the texture Y coordinate range (from 0.0 to 1.0)
+        float texYRange = ((yPosition - (viewportHalfHeight - halfLineHeight)) / lineHeight);
+        // Adjust the texture Y coordinate to account for the part
+        // of the column not shown on screen
+        float texY = (texYRange * columnShownPerc) + (1.0 - columnShownPerc) / 2.0;
+        // Get the brightness of the pixel from the luxel it falls on
+        float brightness = getColumnBrightness(inputData[column].luxels, texY);
         // Get the column texture id
         int textureId = inputData[column].textureId;
         // If the texture id is not valid make the pixel the default color
@@ -126,17 +209,10 @@ void main() {
             finalColor = vec4(WALL_COLOR * brightness, 1.0);
             return;
         }
-        // Calculate the percentage of the column shown currently shown on screen
-        float columnShownPerc = (lineHeight / (lineHeight + inputData[column].lineOffset));
         // Get the texture coordinates in the tile map
         ivec2 tileCoords = ivec2(textureId % tileMapSize.x, int(textureId / tileMapSize.x));
         // Get the texture X coordinate already computed in the compute shader
         float texX = inputData[column].textureColumnOffset;
-        // Calculate the texture Y coordinate range (from 0.0 to 1.0)
-        float texYRange = ((yPosition - (viewportHalfHeight - halfLineHeight)) / lineHeight);
-        // Adjust the texture Y coordinate to account for the part
-        // of the column not shown on screen
-        float texY = (texYRange * columnShownPerc) + (1.0 - columnShownPerc) / 2.0;
         // Compute the texture coordinates for the tile map
         vec2 texCoords = (tileCoords + vec2(texX, texY));
         // Sample the texture
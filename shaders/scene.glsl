@@ -0,0 +1,424 @@
+#version 430
+
+// Every workgroup owns a strip of TILE_SIZE columns: it casts their rays
+// once, then shades the strip a tile of TILE_SIZE x TILE_SIZE pixels at a
+// time, top to bottom, writing the pixels straight into the scene image.
+// Every row of workgroups draws the view of one of the cameras
+#define TILE_SIZE 16
+
+layout (local_size_x = TILE_SIZE, local_size_y = TILE_SIZE, local_size_z = 1) in;
+
+#define SKY_COLOR vec4(0.25, 0.5, 1.0, 1.0)
+#define FLOOR_COLOR vec4(0.1, 0.1, 0.1, 1.0)
+#define WALL_COLOR vec3(1.0, 0.5, 0.0)
+
+struct Column {
+    float depth;
+    int textureId;
+    uint luxels;            // Luxels of the wall going down the column, a byte each
+    float lineHeight;
+    float lineOffset;
+    float textureColumnOffset;
+};
+
+// Scene at the render resolution, the first row is the top of the screen
+// (the views of a batch of cameras are tiled in it)
+layout (rgba8, binding = 0) writeonly restrict uniform image2D scene;
+
+layout (binding = 1) uniform sampler2D tileMap;
+
+// The columns are kept for the passes drawn over the scene
+// (the sprites are clipped against the depth of the walls),
+// the ones of every camera follow the ones of the previous camera
+layout (std430, binding = 1) writeonly restrict buffer Columns {
+    Column outputData[];
+};
+
+layout (std430, binding = 2) readonly restrict buffer Constants {
+    int depthOfField;
+    int viewportWidth;
+    int viewportHeight;
+    float viewportHalfHeight;
+    ivec2 tileSize;
+    ivec2 tileMapSize;
+};
+
+// Only the chunks of the map around the player are loaded, in the slots of
+// the chunk cache (see map.h). Each slot holds a layer of wall ids, one of
+// ceiling ids and one of floor ids, with a byte for every cell of the chunk
+// (row by row), so every uint packs the ids of 4 cells
+layout (std430, binding = 3) readonly restrict buffer MapData {
+    int mapWidth;
+    int mapHeight;
+    int chunksX;
+    int chunkShift;
+    uint chunkTiles[];
+};
+
+// The first camera starts out the same as the frame data of wall.glsl
+struct Camera {
+    vec2 position;
+    ivec2 mapCoords;
+    vec2 tileCoords;
+    vec2 direction;
+    vec2 cameraPlane;
+    ivec2 origin;       // Top left pixel of the view in the scene image
+};
+
+layout (std430, binding = 4) readonly restrict buffer FrameData {
+    Camera cameras[];
+};
+
+// Camera of the workgroup
+Camera camera;
+
+// Slot of every chunk of the map, -1 if the chunk isn't loaded
+layout (std430, binding = 6) readonly restrict buffer ChunkTable {
+    int chunkSlots[];
+};
+
+// Tables that only depend on the resolution: the offset along the camera plane
+// (between -1 and 1) of every column, then the distance of the floor and
+// ceiling seen by every row above the horizon
+layout (std430, binding = 7) readonly restrict buffer ViewTables {
+    float viewTables[];
+};
+
+// Bitmap pyramid of the walls, level 0 has 1 bit per cell and every level
+// above ORs together 2x2 blocks of the level below (see map.h)
+layout (std430, binding = 5) readonly restrict buffer Occupancy {
+    int occupancyLevels;
+    int occupancyWords;
+    int occupancyWidth;
+    int occupancyHeight;
+    ivec4 occupancyLevel[16];   // offset, stride, width, height
+    uint occupancyBits[];
+};
+
+// Luxels of the chunks in the slots of the chunk cache, a byte for every luxel
+// (see lightmap.h): the 4 faces of a wall cell or the floor and the ceiling of
+// an empty cell, every cell after the previous one (row by row)
+layout (std430, binding = 8) readonly restrict buffer ChunkLuxels {
+    uint chunkLuxels[];
+};
+
+#define LAYER_WALLS 0
+#define LAYER_CEILINGS 1
+#define LAYER_FLOORS 2
+
+// Same as lightmap.h
+#define LIGHTMAP_RESOLUTION 2
+#define LIGHTMAP_SURFACE_LUXELS (LIGHTMAP_RESOLUTION * LIGHTMAP_RESOLUTION)
+#define LIGHTMAP_CELL_LUXELS (4 * LIGHTMAP_SURFACE_LUXELS)
+#define LIGHTMAP_FLOOR 0
+#define LIGHTMAP_CEILING 1
+#define LIGHTMAP_FACE_LEFT 0
+#define LIGHTMAP_FACE_RIGHT 1
+#define LIGHTMAP_FACE_UP 2
+#define LIGHTMAP_FACE_DOWN 3
+
+// Returns the offset (in bytes) of a cell (inside the map) in the wall
+// layer of its slot, -1 if the chunk of the cell isn't loaded
+int getTileOffset(ivec2 cell) {
+    int slot = chunkSlots[(cell.y >> chunkShift) * chunksX + (cell.x >> chunkShift)];
+    if (slot < 0) {
+        return -1;
+    }
+    ivec2 offset = cell & ((1 << chunkShift) - 1);
+    return ((slot * 3) << (2 * chunkShift)) + (offset.y << chunkShift) + offset.x;
+}
+
+// Returns the id of a cell in one of the layers, given its offset
+int getTileId(int offset, int layer) {
+    int byteOffset = offset + (layer << (2 * chunkShift));
+    return int((chunkTiles[byteOffset >> 2] >> ((byteOffset & 3) << 3)) & 0xFFu);
+}
+
+// Returns the offset (in bytes) of the luxels of a cell in the luxels
+// of the cache, given the offset of the cell in its wall layer
+int getLuxelOffset(int tileOffset) {
+    int cells = 1 << (2 * chunkShift);
+    int slot = tileOffset / (3 * cells);
+    return (slot * cells + tileOffset - slot * 3 * cells) * LIGHTMAP_CELL_LUXELS;
+}
+
+// Returns a luxel (255 is full brightness), given its offset
+uint getLuxel(int offset) {
+    return (chunkLuxels[offset >> 2] >> ((offset & 3) << 3)) & 0xFFu;
+}
+
+// Returns the brightness of a wall column at texY (from 0 at the top to 1 at the bottom)
+float getColumnBrightness(uint luxels, float texY) {
+    int v = clamp(int(texY * LIGHTMAP_RESOLUTION), 0, LIGHTMAP_RESOLUTION - 1);
+    return float((luxels >> (8 * v)) & 0xFFu) / 255.0;
+}
+
+// Returns the brightness of the floor or the ceiling of a cell at
+// position, given the offset of the cell in its wall layer
+float getSurfaceBrightness(int tileOffset, vec2 position, bool isCeiling) {
+    ivec2 luxel = clamp(ivec2(fract(position) * LIGHTMAP_RESOLUTION), ivec2(0), ivec2(LIGHTMAP_RESOLUTION - 1));
+    int surface = (isCeiling) ? LIGHTMAP_CEILING : LIGHTMAP_FLOOR;
+    return float(getLuxel(getLuxelOffset(tileOffset) + surface * LIGHTMAP_SURFACE_LUXELS + luxel.y * LIGHTMAP_RESOLUTION + luxel.x)) / 255.0;
+}
+
+// Returns whether a block of the level contains any wall
+bool isOccupied(int level, ivec2 block) {
+    ivec4 l = occupancyLevel[level];
+    return ((occupancyBits[l.x + block.y * l.y + (block.x >> 5)] >> (block.x & 31)) & 1u) != 0u;
+}
+
+// Returns how many grid lines (placed every delta along the ray, starting at distance)
+// the ray crosses strictly before limit, at most maxCrossings
+int countCrossings(float distance, float delta, float limit, int maxCrossings) {
+    if (!(limit > distance)) {
+        return 0;
+    }
+    int crossings = int(ceil((limit - distance) / delta));
+    if (distance + (crossings - 1) * delta >= limit) {
+        crossings--;
+    }
+    return min(crossings, maxCrossings);
+}
+
+// Casts the ray of a column (same as wall.glsl)
+Column castColumn(uint n) {
+    Column column = Column(1e30, -1, 0xFFFFFFFFu, 0.0, 0.0, 0.0);
+
+    // cameraX = coordinate (between -1 and 1) of the ray on the x-axis
+    //           of the camera plane
+    float cameraX = viewTables[n];
+
+    // Compute the ray direction
+    vec2 rayDirection = camera.direction + camera.cameraPlane * cameraX;
+
+    // Compute the distance along the ray direction to the next intersection
+    // with the y-axis
+    float yDeltaDistance = (rayDirection.x == 0) ? 1e30 : abs(1.0 / rayDirection.x);
+    // Compute the distance along the ray direction to the next intersection
+    // with the x-axis
+    float xDeltaDistance = (rayDirection.y == 0) ? 1e30 : abs(1.0 / rayDirection.y);
+
+    // Compute the distance in the horizontal direction of the ray to
+    // the border of the cell
+    float xDistance = (rayDirection.x > 0.0) ? (1.0 - camera.tileCoords.x) : camera.tileCoords.x;
+    // Compute the distance in the vertical direction of the ray to
+    // the border of the cell
+    float yDistance = (rayDirection.y > 0.0) ? (1.0 - camera.tileCoords.y) : camera.tileCoords.y;
+
+    // Compute the distance along the ray direction to the first intersection
+    // with the y-axis
+    float yIntersectionDistance = yDeltaDistance * xDistance;
+    // Compute the distance along the ray direction to the first intersection
+    // with the x-axis
+    float xIntersectionDistance = xDeltaDistance * yDistance;
+
+    // Find the direction we are moving in the map
+    ivec2 step = ivec2(sign(rayDirection));
+
+    // Ray's map coordinates
+    ivec2 mapCoords = camera.mapCoords;
+
+    int cellId = 0;
+    bool vertical = false;
+    // Step the rays until one hits, they move up the occupancy pyramid
+    // after leaving an empty block and down when a block isn't empty
+    int topLevel = occupancyLevels - 1;
+    int level = 0;
+    int i;
+    for (i = 0; i < depthOfField; i++) {
+        ivec2 skip = ivec2(0);
+        if (all(greaterThanEqual(mapCoords, ivec2(0))) && all(lessThan(mapCoords, ivec2(mapWidth, mapHeight)))) {
+            if (isOccupied(level, mapCoords >> level)) {
+                if (level == 0) {
+                    // Walls in chunks that aren't loaded read as empty
+                    int tileOffset = getTileOffset(mapCoords);
+                    cellId = (tileOffset >= 0) ? getTileId(tileOffset, LAYER_WALLS) : 0;
+                    break;
+                }
+                // Look at the smaller blocks inside this one
+                level--;
+                continue;
+            }
+            // Count the cells left in the empty block, in the stepping direction
+            int blockMask = (1 << level) - 1;
+            ivec2 offset = mapCoords & blockMask;
+            skip = ivec2(
+                (step.x > 0) ? (blockMask - offset.x) : offset.x,
+                (step.y > 0) ? (blockMask - offset.y) : offset.y
+            );
+        } else if (((step.x < 0) ? (mapCoords.x < 0) : (mapCoords.x >= mapWidth)) || ((step.y < 0) ? (mapCoords.y < 0) : (mapCoords.y >= mapHeight))) {
+            // The ray left the map and moves away from it
+            break;
+        }
+        // Jump straight to the last cell the ray crosses inside the block...
+        if (any(greaterThan(skip, ivec2(0)))) {
+            float limit = min(yIntersectionDistance + skip.x * yDeltaDistance, xIntersectionDistance + skip.y * xDeltaDistance);
+            ivec2 steps = ivec2(
+                countCrossings(yIntersectionDistance, yDeltaDistance, limit, skip.x),
+                countCrossings(xIntersectionDistance, xDeltaDistance, limit, skip.y)
+            );
+            yIntersectionDistance += steps.x * yDeltaDistance;
+            xIntersectionDistance += steps.y * xDeltaDistance;
+            mapCoords += steps * step;
+        }
+        // ...then step out of it and look at the bigger block around the next cell
+        if (yIntersectionDistance < xIntersectionDistance) {
+            yIntersectionDistance += yDeltaDistance;
+            mapCoords.x += step.x;
+            vertical = true;
+        } else {
+            xIntersectionDistance += xDeltaDistance;
+            mapCoords.y += step.y;
+            vertical = false;
+        }
+        level = min(level + 1, topLevel);
+    }
+
+    // Check if the ray hit an empty cell
+    if (cellId == 0) {
+        if (i == depthOfField) {
+            column.lineHeight = 0.1;
+        }
+        return column;
+    }
+
+    // If we didn't, store the hit information for the first
+    // ray to hit a wall
+    float rayDistance;
+    if (vertical) {
+        rayDistance = yIntersectionDistance - yDeltaDistance;
+    } else {
+        rayDistance = xIntersectionDistance - xDeltaDistance;
+    }
+    vec2 coordinates = camera.position + rayDirection * rayDistance;
+    float textureColumnOffset;
+    if (vertical) {
+        textureColumnOffset = coordinates.y - mapCoords.y;
+        textureColumnOffset = (step.x > 0) ? textureColumnOffset : (1.0 - textureColumnOffset);
+    } else {
+        textureColumnOffset = coordinates.x - mapCoords.x;
+        textureColumnOffset = (step.y < 0) ? textureColumnOffset : (1.0 - textureColumnOffset);
+    }
+
+    // Pack the luxels of the face that was hit going down the column, a byte
+    // each (the ray hits the face looking back at where it came from)
+    int face = (vertical) ? ((step.x > 0) ? LIGHTMAP_FACE_LEFT : LIGHTMAP_FACE_RIGHT) : ((step.y > 0) ? LIGHTMAP_FACE_UP : LIGHTMAP_FACE_DOWN);
+    int u = clamp(int(((vertical) ? coordinates.y - mapCoords.y : coordinates.x - mapCoords.x) * LIGHTMAP_RESOLUTION), 0, LIGHTMAP_RESOLUTION - 1);
+    int luxelOffset = getLuxelOffset(getTileOffset(mapCoords)) + face * LIGHTMAP_SURFACE_LUXELS + u;
+    uint luxels = 0u;
+    for (int v = 0; v < LIGHTMAP_RESOLUTION; v++) {
+        luxels |= getLuxel(luxelOffset + v * LIGHTMAP_RESOLUTION) << (8 * v);
+    }
+
+    float lineHeight = viewportHeight / rayDistance;
+    float lineOffset = 0.0;
+    if (lineHeight > viewportHeight) {
+        lineOffset = lineHeight - viewportHeight;
+        lineHeight = viewportHeight;
+    }
+
+    column.depth = rayDistance;
+    column.textureId = cellId - 1;
+    column.luxels = luxels;
+    column.lineHeight = lineHeight;
+    column.lineOffset = lineOffset;
+    column.textureColumnOffset = textureColumnOffset;
+    return column;
+}
+
+// Columns of the strip, cast once by the first row of threads
+shared Column columns[TILE_SIZE];
+// Floor or ceiling constants of every row of the tile, computed once by the
+// first column of threads: where the row ray hits at the left edge of the
+// screen and how far it moves from one pixel to the next
+shared vec2 rowOrigin[TILE_SIZE];
+shared vec2 rowStep[TILE_SIZE];
+
+// Returns the color of a pixel of the floor or the ceiling
+vec4 shadeSurface(vec2 position, bool isCeiling) {
+    // Get the coordinates of the cell that was hit by the ray
+    ivec2 cell = ivec2(position);
+    // Check if the cell is valid (inside the map and in a loaded chunk)
+    int tileOffset = (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, ivec2(mapWidth, mapHeight)))) ? getTileOffset(cell) : -1;
+    if (tileOffset >= 0) {
+        int cellId = getTileId(tileOffset, (isCeiling) ? LAYER_CEILINGS : LAYER_FLOORS);
+        if (cellId != 0) {
+            int textureId = cellId - 1;
+            ivec2 tileCoords = ivec2(textureId % tileMapSize.x, int(textureId / tileMapSize.x));
+            vec2 texCoords = (position - cell) + tileCoords;
+            float brightness = getSurfaceBrightness(tileOffset, position, isCeiling);
+            vec4 color = textureLod(tileMap, texCoords * tileSize / textureSize(tileMap, 0), 0.0);
+            return vec4(color.xyz * brightness, color.w);
+        }
+    }
+    // If the cell is not valid draw the sky or floor color, accordingly
+    return (isCeiling) ? SKY_COLOR : FLOOR_COLOR;
+}
+
+// Returns the color of a pixel of a wall
+vec4 shadeWall(Column column, float yPosition) {
+    // Part of the column shown on screen
+    float columnShownPerc = column.lineHeight / (column.lineHeight + column.lineOffset);
+    float texYRange = (yPosition - (viewportHalfHeight - column.lineHeight / 2.0)) / column.lineHeight;
+    float texY = (texYRange * columnShownPerc) + (1.0 - columnShownPerc) / 2.0;
+    float brightness = getColumnBrightness(column.luxels, texY);
+    int textureId = column.textureId;
+    // If the texture id is not valid use the default color for a wall
+    if (textureId < 0 || textureId >= tileMapSize.x * tileMapSize.y) {
+        return vec4(WALL_COLOR * brightness, 1.0);
+    }
+    ivec2 tileCoords = ivec2(textureId % tileMapSize.x, int(textureId / tileMapSize.x));
+    vec2 texCoords = tileCoords + vec2(column.textureColumnOffset, texY);
+    vec4 color = textureLod(tileMap, texCoords * tileSize / textureSize(tileMap, 0), 0.0);
+    return vec4(color.xyz * brightness, color.w);
+}
+
+void main() {
+    uvec2 local = gl_LocalInvocationID.xy;
+    uint x = gl_WorkGroupID.x * TILE_SIZE + local.x;
+    bool inside = x < viewportWidth;
+    camera = cameras[gl_WorkGroupID.y];
+
+    if (local.y == 0 && inside) {
+        columns[local.x] = castColumn(x);
+        outputData[gl_WorkGroupID.y * viewportWidth + x] = columns[local.x];
+    }
+    // The camera frustum is the same for every row
+    vec2 cameraPlaneLeft = camera.direction - camera.cameraPlane;
+    vec2 cameraPlaneRight = camera.direction + camera.cameraPlane;
+    float xPosition = x + 0.5;
+
+    for (int top = 0; top < viewportHeight; top += TILE_SIZE) {
+        int y = top + int(local.y);
+        float yPosition = y + 0.5;
+        // Rows above the horizon can only show the ceiling, the ones below only the floor
+        bool isCeilingRow = yPosition < viewportHalfHeight;
+        if (local.x == 0 && y < viewportHeight) {
+            // Look up the distance of the row ray, the rows are counted
+            // from the top (or the bottom for the floor)
+            float yCorrected = (isCeilingRow) ? yPosition : (viewportHeight - yPosition);
+            int row = min(int(yCorrected), (viewportHeight + 1) / 2 - 1);
+            float distance = viewTables[viewportWidth + row];
+            rowOrigin[local.y] = camera.position + cameraPlaneLeft * distance;
+            rowStep[local.y] = (cameraPlaneRight - cameraPlaneLeft) * (distance / viewportWidth);
+        }
+        barrier();
+        if (inside && y < viewportHeight) {
+            Column column = columns[local.x];
+            float halfLineHeight = column.lineHeight / 2.0;
+            bool isCeiling = yPosition < viewportHalfHeight - halfLineHeight;
+            bool isFloor = yPosition >= viewportHalfHeight + halfLineHeight;
+            vec4 color;
+            if (isCeiling || isFloor) {
+                color = shadeSurface(rowOrigin[local.y] + rowStep[local.y] * xPosition, isCeiling);
+            } else if (column.lineHeight > 0) {
+                color = shadeWall(column, yPosition);
+            } else {
+                color = vec4(0.0, 0.0, 0.0, 1.0);
+            }
+            imageStore(scene, camera.origin + ivec2(x, y), color);
+        }
+        // The next tile overwrites the row constants
+        barrier();
+    }
+}
@@ -0,0 +1,47 @@
+#version 430
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+in float fragDepth;
+
+out vec4 finalColor;
+
+struct Column {
+    float depth;
+    int textureId;
+    uint luxels;
+    float lineHeight;
+    float lineOffset;
+    float textureColumnOffset;
+};
+
+layout (std430, binding = 1) readonly buffer Columns {
+    Column inputData[];
+};
+
+layout (std430, binding = 2) readonly buffer Constants {
+    int depthOfField;
+    int viewportWidth;
+    int viewportHeight;
+    float viewportHalfHeight;
+    ivec2 tileSize;
+    ivec2 tileMapSize;
+};
+
+uniform sampler2D texture0;
+// Columns of the scene per pixel of the target the sprites are drawn on
+uniform float columnScale;
+
+void main() {
+    // Skip the pixels of the columns where a wall is in front of the sprite
+    int column = min(int(gl_FragCoord.x * columnScale), viewportWidth - 1);
+    if (fragDepth >= inputData[column].depth) {
+        discard;
+    }
+    // Same as the CPU renderer, only the texels that are mostly opaque are drawn
+    vec4 color = texture(texture0, fragTexCoord);
+    if (color.a < 0.5) {
+        discard;
+    }
+    finalColor = color * fragColor;
+}
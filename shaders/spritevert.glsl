@@ -0,0 +1,20 @@
+#version 430
+
+// Same as vert.glsl, but the z coordinate of the vertices is the depth of
+// the sprite (the quads are flat on the screen)
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec2 vertexTexCoord;
+layout (location = 3) in vec4 vertexColor;
+
+out vec2 fragTexCoord;
+out vec4 fragColor;
+out float fragDepth;
+
+uniform mat4 mvp;
+
+void main() {
+    fragTexCoord = vertexTexCoord;
+    fragColor = vertexColor;
+    fragDepth = vertexPosition.z;
+    gl_Position = mvp * vec4(vertexPosition.xy, 0.0, 1.0);
+}
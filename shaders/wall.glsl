@@ -1,25 +1,16 @@
 #version 430
 
-#define PI 3.14159265358979323846
-
 layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
 struct Column {
-    int padding;
+    float depth;            // Distance of the wall (projected onto the camera direction), 1e30 if there is none
     int textureId;
-    float brightness;
+    uint luxels;            // Luxels of the wall going down the column, a byte each
     float lineHeight;
     float lineOffset;
     float textureColumnOffset;
 };
 
-struct Tile {
-    int ceiling;
-    int wall;
-    int floor;
-    int padding;
-};
-
 layout (std430, binding = 1) writeonly restrict buffer Columns {
     Column outputData[];
 };
@@ -29,16 +20,20 @@ layout (std430, binding = 2) readonly restrict buffer Constants {
     int viewportWidth;
     int viewportHeight;
     float viewportHalfHeight;
-    float columnAngleStart;
-    float columnAngleStep;
     ivec2 tileSize;
     ivec2 tileMapSize;
 };
 
+// Only the chunks of the map around the player are loaded, in the slots of
+// the chunk cache (see map.h). Each slot holds a layer of wall ids, one of
+// ceiling ids and one of floor ids, with a byte for every cell of the chunk
+// (row by row), so every uint packs the ids of 4 cells
 layout (std430, binding = 3) readonly restrict buffer MapData {
     int mapWidth;
     int mapHeight;
-    Tile mapData[];
+    int chunksX;
+    int chunkShift;
+    uint chunkTiles[];
 };
 
 layout (std430, binding = 4) readonly restrict buffer FrameData {
@@ -49,6 +44,100 @@ layout (std430, binding = 4) readonly restrict buffer FrameData {
     vec2 cameraPlane;
 };
 
+// Slot of every chunk of the map, -1 if the chunk isn't loaded
+layout (std430, binding = 6) readonly restrict buffer ChunkTable {
+    int chunkSlots[];
+};
+
+// Tables that only depend on the resolution: the offset along the camera plane
+// (between -1 and 1) of every column, then the distance of the floor and
+// ceiling seen by every row above the horizon
+layout (std430, binding = 7) readonly restrict buffer ViewTables {
+    float viewTables[];
+};
+
+// Bitmap pyramid of the walls, level 0 has 1 bit per cell and every level
+// above ORs together 2x2 blocks of the level below (see map.h)
+layout (std430, binding = 5) readonly restrict buffer Occupancy {
+    int occupancyLevels;
+    int occupancyWords;
+    int occupancyWidth;
+    int occupancyHeight;
+    ivec4 occupancyLevel[16];   // offset, stride, width, height
+    uint occupancyBits[];
+};
+
+// Luxels of the chunks in the slots of the chunk cache, a byte for every luxel
+// (see lightmap.h): the 4 faces of a wall cell or the floor and the ceiling of
+// an empty cell, every cell after the previous one (row by row)
+layout (std430, binding = 8) readonly restrict buffer ChunkLuxels {
+    uint chunkLuxels[];
+};
+
+#define LAYER_WALLS 0
+#define LAYER_CEILINGS 1
+#define LAYER_FLOORS 2
+
+// Same as lightmap.h
+#define LIGHTMAP_RESOLUTION 2
+#define LIGHTMAP_SURFACE_LUXELS (LIGHTMAP_RESOLUTION * LIGHTMAP_RESOLUTION)
+#define LIGHTMAP_CELL_LUXELS (4 * LIGHTMAP_SURFACE_LUXELS)
+#define LIGHTMAP_FLOOR 0
+#define LIGHTMAP_CEILING 1
+#define LIGHTMAP_FACE_LEFT 0
+#define LIGHTMAP_FACE_RIGHT 1
+#define LIGHTMAP_FACE_UP 2
+#define LIGHTMAP_FACE_DOWN 3
+
+// Returns the offset (in bytes) of a cell (inside the map) in the wall
+// layer of its slot, -1 if the chunk of the cell isn't loaded
+int getTileOffset(ivec2 cell) {
+    int slot = chunkSlots[(cell.y >> chunkShift) * chunksX + (cell.x >> chunkShift)];
+    if (slot < 0) {
+        return -1;
+    }
+    ivec2 offset = cell & ((1 << chunkShift) - 1);
+    return ((slot * 3) << (2 * chunkShift)) + (offset.y << chunkShift) + offset.x;
+}
+
+// Returns the id of a cell in one of the layers, given its offset
+int getTileId(int offset, int layer) {
+    int byteOffset = offset + (layer << (2 * chunkShift));
+    return int((chunkTiles[byteOffset >> 2] >> ((byteOffset & 3) << 3)) & 0xFFu);
+}
+
+// Returns the offset (in bytes) of the luxels of a cell in the luxels
+// of the cache, given the offset of the cell in its wall layer
+int getLuxelOffset(int tileOffset) {
+    int cells = 1 << (2 * chunkShift);
+    int slot = tileOffset / (3 * cells);
+    return (slot * cells + tileOffset - slot * 3 * cells) * LIGHTMAP_CELL_LUXELS;
+}
+
+// Returns a luxel (255 is full brightness), given its offset
+uint getLuxel(int offset) {
+    return (chunkLuxels[offset >> 2] >> ((offset & 3) << 3)) & 0xFFu;
+}
+
+// Returns whether a block of the level contains any wall
+bool isOccupied(int level, ivec2 block) {
+    ivec4 l = occupancyLevel[level];
+    return ((occupancyBits[l.x + block.y * l.y + (block.x >> 5)] >> (block.x & 31)) & 1u) != 0u;
+}
+
+// Returns how many grid lines (placed every delta along the ray, starting at distance)
+// the ray crosses strictly before limit, at most maxCrossings
+int countCrossings(float distance, float delta, float limit, int maxCrossings) {
+    if (!(limit > distance)) {
+        return 0;
+    }
+    int crossings = int(ceil((limit - distance) / delta));
+    if (distance + (crossings - 1) * delta >= limit) {
+        crossings--;
+    }
+    return min(crossings, maxCrossings);
+}
+
 void main() {
     uint n = gl_GlobalInvocationID.x;
     if (n >= viewportWidth) {
@@ -57,17 +146,7 @@ void main() {
     
     // cameraX = coordinate (between -1 and 1) of the ray on the x-axis
     //           of the camera plane
-    float cameraX = (2.0f * (float(n) / viewportWidth)) - 1.0f;
-    
-    // Compute the angle of the ray
-    float angle = columnAngleStart + n * columnAngleStep;
-    // Clamp the angle between 0 and 2*PI
-    while (angle > 2 * PI) {
-        angle -= 2 * PI;
-    }
-    while (angle < 0.0) {
-        angle += 2 * PI;
-    }
+    float cameraX = viewTables[n];
 
     // Compute the ray direction
     vec2 rayDirection = playerDirection + cameraPlane * cameraX;
@@ -101,13 +180,48 @@ void main() {
 
     int cellId = 0;
     bool vertical = false;
-    // Step the rays until one hits
+    // Step the rays until one hits, they move up the occupancy pyramid
+    // after leaving an empty block and down when a block isn't empty
+    int topLevel = occupancyLevels - 1;
+    int level = 0;
     int i;
     for (i = 0; i < depthOfField; i++) {
-        int mapOffset = mapCoords.y * mapWidth + mapCoords.x;
-        if (mapOffset >= 0 && mapOffset < (mapWidth * mapHeight) && (cellId = mapData[mapOffset].wall) != 0) {
+        ivec2 skip = ivec2(0);
+        if (all(greaterThanEqual(mapCoords, ivec2(0))) && all(lessThan(mapCoords, ivec2(mapWidth, mapHeight)))) {
+            if (isOccupied(level, mapCoords >> level)) {
+                if (level == 0) {
+                    // Walls in chunks that aren't loaded read as empty
+                    int tileOffset = getTileOffset(mapCoords);
+                    cellId = (tileOffset >= 0) ? getTileId(tileOffset, LAYER_WALLS) : 0;
+                    break;
+                }
+                // Look at the smaller blocks inside this one
+                level--;
+                continue;
+            }
+            // Count the cells left in the empty block, in the stepping direction
+            int blockMask = (1 << level) - 1;
+            ivec2 offset = mapCoords & blockMask;
+            skip = ivec2(
+                (step.x > 0) ? (blockMask - offset.x) : offset.x,
+                (step.y > 0) ? (blockMask - offset.y) : offset.y
+            );
+        } else if (((step.x < 0) ? (mapCoords.x < 0) : (mapCoords.x >= mapWidth)) || ((step.y < 0) ? (mapCoords.y < 0) : (mapCoords.y >= mapHeight))) {
+            // The ray left the map and moves away from it
             break;
         }
+        // Jump straight to the last cell the ray crosses inside the block...
+        if (any(greaterThan(skip, ivec2(0)))) {
+            float limit = min(yIntersectionDistance + skip.x * yDeltaDistance, xIntersectionDistance + skip.y * xDeltaDistance);
+            ivec2 steps = ivec2(
+                countCrossings(yIntersectionDistance, yDeltaDistance, limit, skip.x),
+                countCrossings(xIntersectionDistance, xDeltaDistance, limit, skip.y)
+            );
+            yIntersectionDistance += steps.x * yDeltaDistance;
+            xIntersectionDistance += steps.y * xDeltaDistance;
+            mapCoords += steps * step;
+        }
+        // ...then step out of it and look at the bigger block around the next cell
         if (yIntersectionDistance < xIntersectionDistance) {
             yIntersectionDistance += yDeltaDistance;
             mapCoords.x += step.x;
@@ -117,25 +231,26 @@ void main() {
             mapCoords.y += step.y;
             vertical = false;
         }
+        level = min(level + 1, topLevel);
     }
 
-    // Check if the ray hit an empty cell
+    // Check if the ray hit an empty cell (the sprites can be
+    // seen all the way through the column)
     if (cellId == 0) {
         if (i == depthOfField) {
             outputData[n].lineHeight = 0.1;
         }
+        outputData[n].depth = 1e30;
         return;
     }
 
     // If we didn't, store the hit information for the first
     // ray to hit a wall
-    float rayDistance, brightness;
+    float rayDistance;
     if (vertical) {
         rayDistance = yIntersectionDistance - yDeltaDistance;
-        brightness = 1.0;
     } else {
         rayDistance = xIntersectionDistance - xDeltaDistance;
-        brightness = 0.85;
     }
     vec2 coordinates = playerPosition + rayDirection * rayDistance;
     float textureColumnOffset;
@@ -147,6 +262,16 @@ void main() {
         textureColumnOffset = (step.y < 0) ? textureColumnOffset : (1.0 - textureColumnOffset);
     }
 
+    // Pack the luxels of the face that was hit going down the column, a byte
+    // each (the ray hits the face looking back at where it came from)
+    int face = (vertical) ? ((step.x > 0) ? LIGHTMAP_FACE_LEFT : LIGHTMAP_FACE_RIGHT) : ((step.y > 0) ? LIGHTMAP_FACE_UP : LIGHTMAP_FACE_DOWN);
+    int u = clamp(int(((vertical) ? coordinates.y - mapCoords.y : coordinates.x - mapCoords.x) * LIGHTMAP_RESOLUTION), 0, LIGHTMAP_RESOLUTION - 1);
+    int luxelOffset = getLuxelOffset(getTileOffset(mapCoords)) + face * LIGHTMAP_SURFACE_LUXELS + u;
+    uint luxels = 0u;
+    for (int v = 0; v < LIGHTMAP_RESOLUTION; v++) {
+        luxels |= getLuxel(luxelOffset + v * LIGHTMAP_RESOLUTION) << (8 * v);
+    }
+
     float lineHeight = viewportHeight / rayDistance;
     float lineOffset = 0.0;
     if (lineHeight > viewportHeight) {
@@ -154,8 +279,9 @@ void main() {
         lineHeight = viewportHeight;
     }
 
+    outputData[n].depth = rayDistance;
     outputData[n].textureId = cellId - 1;
-    outputData[n].brightness = brightness;
+    outputData[n].luxels = luxels;
     outputData[n].lineHeight = lineHeight;
     outputData[n].lineOffset = lineOffset;
     outputData[n].textureColumnOffset = textureColumnOffset;
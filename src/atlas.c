@@ -0,0 +1,154 @@
+#include "atlas.h"
+#include <string.h>
+
+bool LoadTileAtlas(TileAtlas *atlas, const char *fileName, int tileSize) {
+    *atlas = (TileAtlas) {0};
+    Image image = LoadImage(fileName);
+    if (!image.data) {
+        return false;
+    }
+    if (tileSize <= 0 || (tileSize & (tileSize - 1)) || tileSize >= (1 << ATLAS_MAX_LEVELS) || image.width < tileSize || image.height < tileSize) {
+        TraceLog(LOG_WARNING, "ATLAS: [%s] Tiles of %dx%d texels are not supported", fileName, tileSize, tileSize);
+        UnloadImage(image);
+        return false;
+    }
+    ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    int columns = image.width / tileSize;
+    int rows = image.height / tileSize;
+    atlas->count = columns * rows;
+    // Lay the levels out one after the other in a single allocation,
+    // every level is stored twice (row by row and column by column)
+    size_t texels = 0;
+    for (int size = tileSize; size; size >>= 1) {
+        texels += (size_t) atlas->count * size * size;
+        atlas->levels++;
+    }
+    Color *data = MemAlloc(2 * texels * sizeof(Color));
+    if (!data) {
+        UnloadImage(image);
+        return false;
+    }
+    for (int i = 0, size = tileSize; i < atlas->levels; i++, size >>= 1) {
+        atlas->level[i] = (AtlasLevel) {
+            .size = size,
+            .texels = data,
+            .columns = data + texels
+        };
+        data += atlas->count * size * size;
+    }
+    // Copy the tiles out of the image
+    const Color *pixels = image.data;
+    AtlasLevel *base = &atlas->level[0];
+    for (int tile = 0; tile < atlas->count; tile++) {
+        const Color *source = &pixels[(tile / columns) * tileSize * image.width + (tile % columns) * tileSize];
+        for (int y = 0; y < tileSize; y++) {
+            memcpy(&base->texels[(tile * tileSize + y) * tileSize], &source[y * image.width], tileSize * sizeof(Color));
+        }
+    }
+    UnloadImage(image);
+    // Average every 2x2 block of texels into the level below
+    for (int i = 1; i < atlas->levels; i++) {
+        const AtlasLevel *above = &atlas->level[i - 1];
+        AtlasLevel *level = &atlas->level[i];
+        for (int tile = 0; tile < atlas->count; tile++) {
+            const Color *source = &above->texels[tile * above->size * above->size];
+            Color *destination = &level->texels[tile * level->size * level->size];
+            for (int y = 0; y < level->size; y++) {
+                for (int x = 0; x < level->size; x++) {
+                    const Color *texel = &source[2 * y * above->size + 2 * x];
+                    const Color *quad[4] = { &texel[0], &texel[1], &texel[above->size], &texel[above->size + 1] };
+                    destination[y * level->size + x] = (Color) {
+                        (quad[0]->r + quad[1]->r + quad[2]->r + quad[3]->r + 2) / 4,
+                        (quad[0]->g + quad[1]->g + quad[2]->g + quad[3]->g + 2) / 4,
+                        (quad[0]->b + quad[1]->b + quad[2]->b + quad[3]->b + 2) / 4,
+                        (quad[0]->a + quad[1]->a + quad[2]->a + quad[3]->a + 2) / 4
+                    };
+                }
+            }
+        }
+    }
+    // Transpose every tile, so the wall columns can be read front to back
+    for (int i = 0; i < atlas->levels; i++) {
+        AtlasLevel *level = &atlas->level[i];
+        for (int tile = 0; tile < atlas->count; tile++) {
+            const Color *source = &level->texels[tile * level->size * level->size];
+            Color *destination = &level->columns[tile * level->size * level->size];
+            for (int y = 0; y < level->size; y++) {
+                for (int x = 0; x < level->size; x++) {
+                    destination[x * level->size + y] = source[y * level->size + x];
+                }
+            }
+        }
+    }
+    TraceLog(LOG_INFO, "ATLAS: [%s] Tile atlas loaded successfully (%d tiles, %dx%d texels, %d levels)", fileName, atlas->count, tileSize, tileSize, atlas->levels);
+    return true;
+}
+
+void UnloadTileAtlas(TileAtlas *atlas) {
+    MemFree(atlas->level[0].texels);
+    MemFree(atlas->level[0].indices);
+    *atlas = (TileAtlas) {0};
+}
+
+int GetTileAtlasLevel(const TileAtlas *atlas, float footprint) {
+    int level = 0;
+    while (level + 1 < atlas->levels && footprint >= 2.0f) {
+        footprint *= 0.5f;
+        level++;
+    }
+    return level;
+}
+
+void BlitTextureColumn(Color *pixels, int stride, int count, const Color *column, int size, unsigned int position, unsigned int step, int brightness) {
+    unsigned int last = size - 1;
+    for (int i = 0; i < count; i++) {
+        // The position can round past the last texel at the bottom of the column
+        unsigned int texel = position >> 16;
+        Color color = column[(texel < last) ? texel : last];
+        *pixels = (Color) {
+            (color.r * brightness) >> 8,
+            (color.g * brightness) >> 8,
+            (color.b * brightness) >> 8,
+            color.a
+        };
+        pixels += stride;
+        position += step;
+    }
+}
+
+void BlitMaskedTextureColumn(Color *pixels, int stride, int count, const Color *column, int size, unsigned int position, unsigned int step) {
+    unsigned int last = size - 1;
+    for (int i = 0; i < count; i++) {
+        unsigned int texel = position >> 16;
+        Color color = column[(texel < last) ? texel : last];
+        // The smaller levels average the alpha, keep the texels that are mostly opaque
+        if (color.a >= 128) {
+            *pixels = color;
+        }
+        pixels += stride;
+        position += step;
+    }
+}
+
+void BlitIndexedTextureColumn(unsigned char *pixels, int stride, int count, const unsigned char *column, int size, unsigned int position, unsigned int step, const unsigned char *shades) {
+    unsigned int last = size - 1;
+    for (int i = 0; i < count; i++) {
+        unsigned int texel = position >> 16;
+        *pixels = shades[column[(texel < last) ? texel : last]];
+        pixels += stride;
+        position += step;
+    }
+}
+
+void BlitMaskedIndexedTextureColumn(unsigned char *pixels, int stride, int count, const unsigned char *column, int size, unsigned int position, unsigned int step) {
+    unsigned int last = size - 1;
+    for (int i = 0; i < count; i++) {
+        unsigned int texel = position >> 16;
+        unsigned char index = column[(texel < last) ? texel : last];
+        if (index != 0) {
+            *pixels = index;
+        }
+        pixels += stride;
+        position += step;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <raylib.h>
+#include <stdbool.h>
+
+// Enough levels for tiles up to 128x128 texels
+#define ATLAS_MAX_LEVELS    8
+
+typedef struct {
+    int size;               // Size (in texels) of the tiles of the level
+    Color *texels;          // Tiles one after the other, row by row
+    Color *columns;         // Same as texels but column by column, for the walls
+    unsigned char *indices;         // Same as texels as palette indices (only once indexed, see palette.h)
+    unsigned char *indexColumns;    // Same as columns as palette indices
+} AtlasLevel;
+
+// Square tiles cut out of a tile map image, with a chain of smaller copies
+// of every tile (each level halves the size of the one before it, down to 1x1)
+typedef struct {
+    int count;
+    int levels;
+    AtlasLevel level[ATLAS_MAX_LEVELS];
+} TileAtlas;
+
+// Splits the image in tiles of tileSize x tileSize texels (row by row, the
+// tile in the top left corner is tile 0) and builds the smaller levels
+bool LoadTileAtlas(TileAtlas *atlas, const char *fileName, int tileSize);
+void UnloadTileAtlas(TileAtlas *atlas);
+// Returns the level to sample when a pixel covers footprint texels
+// of the largest level (the largest one that isn't minified)
+int GetTileAtlasLevel(const TileAtlas *atlas, float footprint);
+
+// Returns the texels of a column of a tile, from top to bottom
+static inline const Color *GetTileAtlasColumn(const AtlasLevel *level, int tile, int column) {
+    return &level->columns[(tile * level->size + column) * level->size];
+}
+
+// Returns the palette indices of a column of a tile, from top to bottom
+static inline const unsigned char *GetTileAtlasIndexColumn(const AtlasLevel *level, int tile, int column) {
+    return &level->indexColumns[(tile * level->size + column) * level->size];
+}
+
+// Fills count pixels going down a framebuffer column (stride pixels apart) from
+// a column of size texels. The first pixel samples texel position and every
+// pixel moves step texels further (both in 16.16 fixed point), the colors are
+// scaled by brightness (256 leaves them as they are)
+void BlitTextureColumn(Color *pixels, int stride, int count, const Color *column, int size, unsigned int position, unsigned int step, int brightness);
+// Same as BlitTextureColumn() but leaves the pixels of the transparent texels
+// alone (for the sprites) and never changes the brightness
+void BlitMaskedTextureColumn(Color *pixels, int stride, int count, const Color *column, int size, unsigned int position, unsigned int step);
+// Paletted versions of both, the texels and the pixels are palette indices.
+// The texels are lit through a row of the shade table (see GetShadeOffset()),
+// and the masked version skips the transparent ones
+void BlitIndexedTextureColumn(unsigned char *pixels, int stride, int count, const unsigned char *column, int size, unsigned int position, unsigned int step, const unsigned char *shades);
+void BlitMaskedIndexedTextureColumn(unsigned char *pixels, int stride, int count, const unsigned char *column, int size, unsigned int position, unsigned int step);
+
+#endif
@@ -0,0 +1,241 @@
+#include "bench.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAX_STAGES    16
+
+typedef struct {
+    int stageCount;
+    int frameCount;
+    int frame;
+    int views;              // Rendered by every frame
+    bool running;
+    double startTime;
+    double endTime;
+    const char *stageNames[BENCH_MAX_STAGES];
+    double *samples[BENCH_MAX_STAGES];
+    bool recorded[BENCH_MAX_STAGES];    // The stage was recorded in at least a frame
+} Bench;
+
+// Singletons
+static Bench B = {0};
+
+bool LoadCameraPath(const char *fileName, CameraPath *path) {
+    char *text = LoadFileText(fileName);
+    if (!text) {
+        return false;
+    }
+    path->count = 0;
+    path->keys = NULL;
+    int capacity = 0;
+    // Parse the file line by line
+    for (char *line = text; *line; ) {
+        char *next = line;
+        while (*next && *next != '\n') {
+            next++;
+        }
+        if (*next) {
+            *next++ = '\0';
+        }
+        CameraKey key;
+        float degrees;
+        if (*line != '#' && sscanf(line, "%f %f %f %f", &key.time, &key.position.x, &key.position.y, &degrees) == 4) {
+            key.rotation = degrees * DEG2RAD;
+            // Grow the keys array if necessary
+            if (path->count == capacity) {
+                capacity = (capacity) ? (capacity * 2) : 16;
+                path->keys = MemRealloc(path->keys, capacity * sizeof(CameraKey));
+            }
+            path->keys[path->count++] = key;
+        }
+        line = next;
+    }
+    UnloadFileText(text);
+    if (!path->count) {
+        TraceLog(LOG_WARNING, "BENCH: [%s] Camera path has no keys", fileName);
+        return false;
+    }
+    TraceLog(LOG_INFO, "BENCH: [%s] Camera path loaded (%d keys, %.2f seconds)", fileName, path->count, GetCameraPathDuration(path));
+    return true;
+}
+
+void UnloadCameraPath(CameraPath *path) {
+    MemFree(path->keys);
+    path->keys = NULL;
+    path->count = 0;
+}
+
+float GetCameraPathDuration(const CameraPath *path) {
+    return (path->count) ? path->keys[path->count - 1].time : 0.0f;
+}
+
+void SampleCameraPath(const CameraPath *path, float time, Vector2 *position, float *rotation) {
+    // Find the first key past the requested time
+    int i = 0;
+    while (i < path->count && path->keys[i].time <= time) {
+        i++;
+    }
+    // Clamp to the first and last keys
+    if (i == 0 || i == path->count) {
+        CameraKey *key = &path->keys[(i) ? (i - 1) : 0];
+        *position = key->position;
+        *rotation = key->rotation;
+        return;
+    }
+    CameraKey *from = &path->keys[i - 1];
+    CameraKey *to = &path->keys[i];
+    float t = (time - from->time) / (to->time - from->time);
+    position->x = from->position.x + (to->position.x - from->position.x) * t;
+    position->y = from->position.y + (to->position.y - from->position.y) * t;
+    // Rotate the shortest way around and wrap the result between 0 and 2*PI
+    float delta = fmodf(to->rotation - from->rotation, 2.0f * PI);
+    if (delta > PI) {
+        delta -= 2.0f * PI;
+    } else if (delta < -PI) {
+        delta += 2.0f * PI;
+    }
+    *rotation = fmodf(from->rotation + delta * t + 2.0f * PI, 2.0f * PI);
+}
+
+void SampleCameraPathPoses(const CameraPath *path, float time, CameraPose *poses, int count) {
+    float duration = GetCameraPathDuration(path);
+    for (int i = 0; i < count; i++) {
+        float t = time + duration * i / count;
+        t = (duration > 0.0f) ? fmodf(t, duration) : 0.0f;
+        SampleCameraPath(path, t, &poses[i].position, &poses[i].rotation);
+    }
+}
+
+double GetBenchTime(void) {
+    struct timespec now;
+#ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+bool InitBench(const char **stageNames, int stageCount, int frameCount) {
+    if (stageCount > BENCH_MAX_STAGES || frameCount <= 0) {
+        return false;
+    }
+    B.stageCount = stageCount;
+    B.frameCount = frameCount;
+    B.frame = 0;
+    B.views = 1;
+    for (int i = 0; i < stageCount; i++) {
+        B.stageNames[i] = stageNames[i];
+        B.samples[i] = MemAlloc(frameCount * sizeof(double));
+        B.recorded[i] = false;
+    }
+    B.running = true;
+    B.startTime = GetBenchTime();
+    return true;
+}
+
+void ShutdownBench(void) {
+    for (int i = 0; i < B.stageCount; i++) {
+        MemFree(B.samples[i]);
+        B.samples[i] = NULL;
+    }
+    B.stageCount = 0;
+    B.running = false;
+}
+
+bool IsBenchRunning(void) {
+    return B.running;
+}
+
+void RecordBenchStage(int stage, double seconds) {
+    if (B.running && stage >= 0 && stage < B.stageCount) {
+        B.samples[stage][B.frame] = seconds * 1000.0;
+        B.recorded[stage] = true;
+    }
+}
+
+void SetBenchViewCount(int count) {
+    B.views = count;
+}
+
+bool NextBenchFrame(void) {
+    if (!B.running) {
+        return false;
+    }
+    if (++B.frame == B.frameCount) {
+        B.endTime = GetBenchTime();
+        B.running = false;
+    }
+    return B.running;
+}
+
+static int CompareSamples(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double Percentile(const double *sorted, int count, double percentile) {
+    // Nearest rank percentile
+    int rank = (int) ceil(percentile / 100.0 * count);
+    return sorted[(rank > 0) ? (rank - 1) : 0];
+}
+
+bool ExportBenchReport(const char *fileName, const char *renderer, const char *info) {
+    int frames = B.frame;
+    if (!frames) {
+        return false;
+    }
+    FILE *file = (fileName) ? fopen(fileName, "w") : stdout;
+    if (!file) {
+        TraceLog(LOG_WARNING, "BENCH: [%s] Failed to open report file", fileName);
+        return false;
+    }
+    double seconds = ((B.running) ? GetBenchTime() : B.endTime) - B.startTime;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"renderer\": \"%s\",\n", renderer);
+    if (info && *info) {
+        fprintf(file, "  %s,\n", info);
+    }
+    fprintf(file, "  \"frames\": %d,\n", frames);
+    fprintf(file, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(file, "  \"fps\": %.3f,\n", frames / seconds);
+    if (B.views > 1) {
+        fprintf(file, "  \"views\": %d,\n", B.views);
+        fprintf(file, "  \"views_per_second\": %.3f,\n", frames * B.views / seconds);
+    }
+    fprintf(file, "  \"stages\": {\n");
+    double *sorted = MemAlloc(frames * sizeof(double));
+    const char *separator = "";
+    for (int i = 0; i < B.stageCount; i++) {
+        // Leave out the stages the run never went through
+        if (!B.recorded[i]) {
+            continue;
+        }
+        double total = 0.0;
+        for (int j = 0; j < frames; j++) {
+            sorted[j] = B.samples[i][j];
+            total += sorted[j];
+        }
+        qsort(sorted, frames, sizeof(double), CompareSamples);
+        fprintf(file, "%s    \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+            separator,
+            B.stageNames[i],
+            total / frames,
+            Percentile(sorted, frames, 50.0),
+            Percentile(sorted, frames, 95.0),
+            Percentile(sorted, frames, 99.0),
+            sorted[frames - 1]
+        );
+        separator = ",\n";
+    }
+    MemFree(sorted);
+    fprintf(file, "\n  }\n");
+    fprintf(file, "}\n");
+    if (file != stdout) {
+        fclose(file);
+    }
+    return true;
+}
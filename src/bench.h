@@ -0,0 +1,53 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <raylib.h>
+#include <stdbool.h>
+
+typedef struct {
+    float time;
+    Vector2 position;
+    float rotation;
+} CameraKey;
+
+typedef struct {
+    int count;
+    CameraKey *keys;
+} CameraPath;
+
+// Camera of one of the views rendered in a batch
+typedef struct {
+    Vector2 position;
+    float rotation;
+} CameraPose;
+
+// Loads a camera path from a text file, every line holds a key as
+// "<time in seconds> <x> <y> <rotation in degrees>" (sorted by time),
+// empty lines and lines starting with '#' are skipped
+bool LoadCameraPath(const char *fileName, CameraPath *path);
+void UnloadCameraPath(CameraPath *path);
+float GetCameraPathDuration(const CameraPath *path);
+// Interpolates the keys surrounding time (rotations take the shortest way around)
+void SampleCameraPath(const CameraPath *path, float time, Vector2 *position, float *rotation);
+// Spreads count cameras evenly along the path: camera i is where the path is
+// i / count of its duration after time (wrapping around at the end)
+void SampleCameraPathPoses(const CameraPath *path, float time, CameraPose *poses, int count);
+
+// Monotonic clock in seconds that doesn't need a window
+double GetBenchTime(void);
+// Starts collecting the frame times of each stage for the given number of frames
+bool InitBench(const char **stageNames, int stageCount, int frameCount);
+void ShutdownBench(void);
+bool IsBenchRunning(void);
+// Records how long a stage took in the current frame (ignored if the bench isn't running)
+void RecordBenchStage(int stage, double seconds);
+// Every frame renders count views (call it after InitBench()), the report
+// then also gets the total number of views rendered per second
+void SetBenchViewCount(int count);
+// Moves on to the next frame, returns false once all the frames have been recorded
+bool NextBenchFrame(void);
+// Writes fps and mean/p50/p95/p99/max times (in ms) of the stages recorded in
+// the run as JSON, info is an optional list of extra "key": value pairs for the report
+bool ExportBenchReport(const char *fileName, const char *renderer, const char *info);
+
+#endif
@@ -0,0 +1,69 @@
+#include "collision.h"
+#include <math.h>
+
+// Gap left between a body and the wall that stopped it, so that sliding
+// along the wall afterwards doesn't catch on the edges between its cells
+#define COLLISION_SKIN          1e-4f
+
+// Returns whether cell (p, q) is a wall, p runs along the axis of the
+// motion (x when axis is 0, y otherwise) and q along the other one
+static inline bool IsSolid(const OccupancyGrid *grid, int axis, int p, int q) {
+    int x = (axis) ? q : p;
+    int y = (axis) ? p : q;
+    const OccupancyLevel *level = &grid->level[0];
+    if (x < 0 || y < 0 || x >= level->width || y >= level->height) {
+        return true;
+    }
+    return IsOccupied(grid, 0, x, y);
+}
+
+// Returns where a circle centered at (p, q) moving by delta along p stops.
+// A wall cell touches the circle when the circle gets within radius of the
+// closest point of the cell: its near edge when the cell spans q, one of its
+// corners otherwise. Only the cells within radius of q on the other axis
+// can be hit, so every cell column crossed costs at most a couple of lookups
+static float SweepAxis(const OccupancyGrid *grid, int axis, float p, float q, float delta, float radius) {
+    float target = p + delta;
+    int first = (int) floorf(q - radius);
+    int last = (int) ceilf(q + radius) - 1;
+    int step = (delta > 0.0f) ? 1 : -1;
+    // Cells next to the one of the center, up to the last one the circle reaches
+    int from = (int) floorf(p) + step;
+    int to = (int) floorf(target + radius * step);
+    for (int cell = from; (to - cell) * step >= 0; cell += step) {
+        // Edge of the cell facing the circle
+        float edge = (step > 0) ? (float) cell : (float) (cell + 1);
+        float limit = target;
+        for (int other = first; other <= last; other++) {
+            if (!IsSolid(grid, axis, cell, other)) {
+                continue;
+            }
+            // Distance from the center to the cell on the other axis
+            float gap = (q < other) ? (other - q) : (q > other + 1) ? (q - (other + 1)) : 0.0f;
+            if (gap >= radius) {
+                continue;
+            }
+            float reach = edge - (sqrtf(radius * radius - gap * gap) + COLLISION_SKIN) * step;
+            limit = (step > 0) ? fminf(limit, reach) : fmaxf(limit, reach);
+        }
+        // The cells further away are always reached later, since bodies are smaller than a cell
+        if ((target - limit) * step > 0.0f) {
+            // Never push the body back (if it started inside a wall it just doesn't move)
+            return ((limit - p) * step > 0.0f) ? limit : p;
+        }
+    }
+    return target;
+}
+
+Vector2 MoveBody(const OccupancyGrid *grid, Vector2 position, Vector2 displacement, float radius) {
+    // Keep the body smaller than a cell, the sweep only looks for the walls
+    // in the cells right next to the ones it crosses
+    radius = fminf(radius, COLLISION_MAX_RADIUS);
+    if (displacement.x != 0.0f) {
+        position.x = SweepAxis(grid, 0, position.x, position.y, displacement.x, radius);
+    }
+    if (displacement.y != 0.0f) {
+        position.y = SweepAxis(grid, 1, position.y, position.x, displacement.y, radius);
+    }
+    return position;
+}
@@ -0,0 +1,17 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <raylib.h>
+#include "map.h"
+
+// Bodies are circles smaller than a cell, so they never fit between two walls
+#define COLLISION_MAX_RADIUS    0.5f
+
+// Moves a circle by displacement, one axis at a time: along each axis it
+// stops just short of the first wall it would touch, then slides along
+// the other one. The cells outside the map count as walls. The cost only
+// depends on the cells the circle sweeps over, not on how fast it moves.
+// Radii larger than COLLISION_MAX_RADIUS are clamped to it
+Vector2 MoveBody(const OccupancyGrid *grid, Vector2 position, Vector2 displacement, float radius);
+
+#endif
@@ -1,13 +1,51 @@
 #include <raylib.h>
 #include <raymath.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atlas.h"
+#include "bench.h"
+#include "lightmap.h"
+#include "map.h"
+#include "palette.h"
+#include "pool.h"
+#include "profile.h"
+#include "raycast.h"
+#include "resolution.h"
+#include "sim.h"
+#include "sprite.h"
+#include "video.h"
+#include "visibility.h"
 
 // Defaults
 #define DEFAULT_WINDOW_TITLE        "RECOIL"
 #define DEFAULT_VIEWPORT_WIDTH      1366
 #define DEFAULT_VIEWPORT_HEIGHT     768
-#define DEFAULT_VIEWPORT_DOF        16
+#define DEFAULT_VIEWPORT_DOF        64
 #define DEFAULT_VIEWPORT_FOV        (66.0f * DEG2RAD)
-#define DEFAULT_VIEWPORT_SCALING    0.25f
+#define DEFAULT_VIEWPORT_SCALING    1.0f
+#define DEFAULT_MIN_SCALING         0.25f
+#define DEFAULT_CEILING_COLOR       BLUE
+#define DEFAULT_FLOOR_COLOR         BLACK
+#define DEFAULT_MAX_LINE_OVERHANG   16777216.0f
+#define DEFAULT_ROWS_PER_TASK       8
+#define DEFAULT_COLUMNS_PER_TASK    32
+#define DEFAULT_SCALING_FRAMES      120
+#define DEFAULT_BENCH_TIMESTEP      (1.0f / 60.0f)
+#define DEFAULT_BENCH_WARMUP_FRAMES 10
+#define DEFAULT_MAP_FILE            "assets/maps/small.map"
+#define DEFAULT_CHUNK_RADIUS        2
+#define DEFAULT_TILE_MAP_FILE       "assets/textures/tilemap.png"
+#define DEFAULT_TILE_SIZE           16
+#define DEFAULT_TICK_RATE           120.0f
+#define DEFAULT_TRACE_FILE          "trace.json"
+#define DEFAULT_SPRITE_SEED         1
+#define DEFAULT_CAMERA_WIDTH        128
+#define DEFAULT_CAMERA_HEIGHT       72
+#define DEFAULT_CAMERAS_PER_TASK    1
+#define DEFAULT_ROW_SPAN_PIXELS     16
+#define DEFAULT_ROW_CULL_DISTANCE   1e6f
 
 typedef struct {
     int width;
@@ -20,92 +58,113 @@ typedef struct {
 typedef struct {
     int columns;
     int rows;
-    float prevTime;
     float viewportHalfHeight;
     float cameraPlaneHalfWidth;
-    float columnAngleStart;
-    float columnAngleStep;
     float columnPixelWidth;
     float rowPixelHeight;
+    float *columnCameraX;   // Offset (between -1 and 1) of every column along the camera plane
+    float *rowDistances;    // Distance of the floor and ceiling seen by every row above the horizon
     Vector2 playerDirection;
     Vector2 cameraPlane;
 } Computed;
 
 typedef struct {
-    Vector2 position;
-    float rotation;
-    float movementSpeed;
-    float rotationSpeed;
-} Player;
-
-typedef struct {
-    int forward;
-    int right;
-    float xMouseDelta;
-} PlayerInput;
-
-typedef struct {
-    int ceiling;
-    int wall;
-    int floor;
-} Tile;
+    int width;
+    int height;
+    Color *pixels;
+    float *depths;          // Distance of the wall drawn in every column (infinity if there is none)
+    unsigned char *indices; // Palette indices the pixels are expanded from (paletted mode only)
+    Texture2D texture;
+} Framebuffer;
 
+// Everything the passes need to draw the view of a camera, the view
+// covers width x height pixels of a framebuffer (stride pixels per row)
 typedef struct {
+    Vector2 position;
+    Vector2 direction;
+    Vector2 cameraPlane;
+    Vector2 cameraPlaneLeft;
+    Vector2 cameraPlaneRight;
     int width;
     int height;
-    int data[];
-} TileTexture;
+    int stride;
+    float rowPixelHeight;   // Viewport pixels covered by every row
+    const float *columnCameraX;
+    const float *rowDistances;
+    Color *pixels;          // Top left pixel of the view
+    unsigned char *indices; // Top left palette index of the view, drawn instead of the pixels (NULL if not paletted)
+    float *depths;          // Distance of the wall drawn in every column of the view
+    const SpriteList *sprites;
+    VisibleBlocks visible;  // Blocks potentially visible from the camera (nothing is culled without bits)
+    RowCastParams rows;
+    RayCastParams rays;
+} FrameData;
 
+// Views of many cameras rendered at once, tiled in a single framebuffer
+// (camera i gets the tile i % tilesX, i / tilesX). The views all have the
+// same resolution, so they share their tables
 typedef struct {
-    int width;
+    int count;
+    int width;              // Of every view
     int height;
-    float wallHeight;
-    Tile data[];
-} Map;
-
-// Test data
-static Map TestMap = {
-    .width = 10,
-    .height = 12,
-    .wallHeight = 800.0f,
-    .data = {
-        {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 1}, {1, 0, 1}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {1, 0, 1}, {0, 1, 0},
-        {0, 1, 0}, {0, 0, 1}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {1, 0, 1}, {0, 1, 0},
-        {0, 1, 0}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 0, 0}, {1, 0, 1}, {0, 1, 0},
-        {0, 1, 0}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 1}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {1, 0, 1}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 1, 0},
-        {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0},
-    }
-};
+    int tilesX;
+    float rowPixelHeight;
+    float *columnCameraX;
+    float *rowDistances;
+    CameraPose *poses;
+    FrameData *frames;
+    Framebuffer framebuffer;
+} CameraBatch;
 
-static TileTexture smiley = {
-    .width = 8,
-    .height = 8,
-    .data = {
-        0, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 0, 1, 1, 0, 1, 1,
-        1, 1, 0, 1, 1, 0, 1, 1,
-        1, 1, 0, 1, 1, 0, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1,
-        1, 0, 1, 1, 1, 1, 0, 1,
-        1, 1, 0, 0, 0, 0, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1,
-    }
-};
-static TileTexture *T[] = {
-    &smiley
-};
+typedef struct {
+    int threads;
+    bool scaling;
+    RayCastKernel kernel;
+    const char *pathFileName;
+    const char *reportFileName;
+    const char *mapFileName;
+    float timestep;
+    float tickRate;
+    float budget;
+    const char *traceFileName;
+    int sprites;
+    int cameras;
+    int cameraWidth;
+    int cameraHeight;
+    bool noVisibility;
+    bool paletted;
+    const char *videoFileName;
+    VideoFormat videoFormat;
+} Options;
+
+typedef enum {
+    STAGE_UPDATE,
+    STAGE_ROWS,
+    STAGE_COLUMNS,
+    STAGE_SPRITES,
+    STAGE_CAMERAS,
+    STAGE_FRAME,
+    STAGE_COUNT
+} Stage;
 
 // Singletons
+static Options O = {0};
+static TileAtlas A = {0};
+static Framebuffer F = {0};
 static Computed C = {0};
+static Map M = {0};
+static ChunkCache K = {0};
+static SpriteStore S = {0};
+static SpriteList L = {0};
+static CameraBatch B = {0};
+static VisibilitySet Z = {0};
+static Lightmap W = {0};
+static LightmapCache Y = {0};
+static Palette H = {0};
+#ifndef HEADLESS
 static PlayerInput I = {false};
-static Map *M = &TestMap;
+static ResolutionController R = {0};
+#endif
 static Viewport V = {
     .width = DEFAULT_VIEWPORT_WIDTH,
     .height = DEFAULT_VIEWPORT_HEIGHT,
@@ -120,13 +179,32 @@ static Player P = {
     },
     .rotation = 0.0f,
     .movementSpeed = 2.5f,
-    .rotationSpeed = PI
+    .rotationSpeed = PI,
+    .radius = 0.125f
 };
 
-// Useful defines
-#define MAPSZ   (M->width * M->height)
-#define HALF_PI (PI / 2.0f)
-#define absf(x) ((x < 0.0f) ? -x : x)
+// Fills the tables of a view of columns x rows stretched over the viewport
+static void ComputeViewTables(int columns, int rows, float *columnCameraX, float *rowDistances) {
+    float halfHeight = V.height / 2.0f;
+    float rowPixelHeight = (float) V.height / rows;
+    for (int n = 0; n < columns; n++) {
+        // cameraX = coordinate (between -1 and 1) of the ray on the x-axis
+        //           of the camera plane
+        columnCameraX[n] = (2.0f * ((float) n / columns)) - 1.0f;
+    }
+    for (int n = 0; n < (rows + 1) / 2; n++) {
+        // Calculate the row's y pixel position on the screen
+        float y = n * rowPixelHeight;
+        // Calculate how many pixel aways the row is from the horizon
+        float pixelsFromHorizon = halfHeight - y;
+        // Compute the distance of the pixel from the camera plane
+        // (the further the row is from the center of the screen,
+        // the closer it should be to the camera)
+        // distance = +1 <== pixelsFromHorizon = halfHeight <== y = 0
+        // distance = +inf <== pixelsFromHorizon = 0 <== y = halfHeight
+        rowDistances[n] = halfHeight / pixelsFromHorizon;
+    }
+}
 
 static void RecomputeValues(void) {
     C.viewportHalfHeight = V.height / 2.0f;
@@ -138,157 +216,137 @@ static void RecomputeValues(void) {
     C.rows = (V.height % scanlines) ? (scanlines + 1) : scanlines;
     // Compute half the width of the camera plane
     C.cameraPlaneHalfWidth = 1.0f / (2.0f * tanf(V.fov / 2.0f));
-    // Calculate the angle increment for each column ray
-    C.columnAngleStep = V.fov / C.columns;
-    // Calculate the angle for the first column ray
-    C.columnAngleStart = P.rotation - V.fov / 2.0f;
     // Calculate the width of each pixel in a column
     C.columnPixelWidth = (float) V.width / C.columns;
     // Calculate the width of each pixel in a row
     C.rowPixelHeight = (float) V.height / C.rows;
+    // Rebuild the tables that only depend on the resolution
+    C.columnCameraX = MemRealloc(C.columnCameraX, C.columns * sizeof(float));
+    C.rowDistances = MemRealloc(C.rowDistances, ((C.rows + 1) / 2) * sizeof(float));
+    ComputeViewTables(C.columns, C.rows, C.columnCameraX, C.rowDistances);
+    // Recreate the framebuffer if its size changed, every column
+    // and row gets exactly one pixel
+    if (F.width != C.columns || F.height != C.rows) {
+#ifndef HEADLESS
+        if (F.texture.id) {
+            UnloadTexture(F.texture);
+        }
+#endif
+        MemFree(F.pixels);
+        MemFree(F.depths);
+        MemFree(F.indices);
+        F.width = C.columns;
+        F.height = C.rows;
+        F.pixels = MemAlloc(F.width * F.height * sizeof(Color));
+        F.depths = MemAlloc(F.width * sizeof(float));
+        F.indices = (O.paletted) ? MemAlloc(F.width * F.height) : NULL;
+#ifndef HEADLESS
+        F.texture = LoadTextureFromImage((Image) {
+            .data = F.pixels,
+            .width = F.width,
+            .height = F.height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+        });
+#endif
+    }
+}
+
+// Casts pixels first to end - 1 of the ceiling and floor rows starting at
+// the given offsets of the view, as colors or as palette indices
+static void CastFrameRow(const FrameData *frame, const RowCastParams *params, Vector2 position, Vector2 step, int ceilingRow, int floorRow, int first, int end) {
+    if (frame->indices) {
+        CastIndexedRow(params, position, step, &frame->indices[ceilingRow], &frame->indices[floorRow], first, end);
+    } else {
+        CastRow(params, position, step, &frame->pixels[ceilingRow], &frame->pixels[floorRow], first, end);
+    }
 }
 
-static void DrawRow(Vector2 cameraPlaneLeft, Vector2 cameraPlaneRight, int n) {
-    // Calculate the row's y pixel position on the screen
-    float y = n * C.rowPixelHeight;
-    // Calculate how many pixel aways the row is from the horizon
-    int pixelsFromHorizon = C.viewportHalfHeight - y;
-    // Compute the distance of the pixel from the camera plane
-    // (the further the row is from the center of the screen,
-    // the closer it should be to the camera)
-    // distance = +1 <== pixelsFromHorizon = C.viewportHalfHeight <== y = 0
-    // distance = +inf <== pixelsFromHorizon = 0 <== y = C.viewportHalfHeight
-    float distance = C.viewportHalfHeight / pixelsFromHorizon;
+static void DrawRow(const FrameData *frame, int n) {
+    // Get the distance of the row from the camera plane
+    float distance = frame->rowDistances[n];
     // Compute the step for each pixel in the row
-    Vector2 step = Vector2Scale(Vector2Subtract(cameraPlaneRight, cameraPlaneLeft), distance / C.columns);
+    Vector2 step = Vector2Scale(Vector2Subtract(frame->cameraPlaneRight, frame->cameraPlaneLeft), distance / frame->width);
     // Compute the starting position
-    Vector2 position = Vector2Add(P.position, Vector2Scale(cameraPlaneLeft, distance));
-    for (int x = 0; x < C.columns; x++) {
-        // Get the current cell position
-        int cellX = (int) position.x;
-        int cellY = (int) position.y;
-        // Compute the map offset and check if it's
-        // in inside the map
-        int cellOffset = cellY * M->width + cellX;
-        if (cellOffset >= 0 && cellOffset < MAPSZ) {
-            // Draw the ceiling first and the the floor
-            for (int floor = 0; floor < 2; floor++) {
-                // Get the current cell id
-                int cellId = (floor) ? M->data[cellOffset].floor : M->data[cellOffset].ceiling;
-                // If the cell is empty, skip the draw call
-                if (!cellId) {
-                    continue;
-                }
-                // If it's not, get the texture
-                TileTexture *texture = T[cellId - 1];
-                // Compute the texture coordinates
-                int textureX = texture->width * (position.x - (float) cellX);
-                int textureY = texture->height * (position.y - (float) cellY);
-                // Compute the offset inside the texture and check if it's in bounds
-                int textureOffset = textureY * texture->width + textureX;
-                if (textureOffset < 0 || textureOffset >= texture->width * texture->height) {
-                    continue;
-                }
-                // Sample the texture
-                Color color = (texture->data[textureOffset]) ? RED : GREEN;
-                // Draw the pixel onto the screen
-                int xStart = x * C.columnPixelWidth;
-                int yStart = (floor) ? (V.height - y) : y;
-                DrawRectangle(xStart, yStart, ceilf(C.columnPixelWidth), ceilf(C.rowPixelHeight), color);
+    Vector2 position = Vector2Add(frame->position, Vector2Scale(frame->cameraPlaneLeft, distance));
+    // Pick the mip level from the number of texels each pixel covers, the
+    // whole row is at the same distance so they all use the same level
+    const AtlasLevel *level = &A.level[GetTileAtlasLevel(&A, Vector2Length(step) * A.level[0].size)];
+    RowCastParams params = frame->rows;
+    params.texels = level->texels;
+    params.indices = level->indices;
+    params.textureSize = level->size;
+    // Get the ceiling and floor rows inside the framebuffer
+    int ceilingRow = n * frame->stride;
+    int floorRow = (frame->height - 1 - n) * frame->stride;
+    // Cast the whole row (ceiling and floor together) when nothing can be culled,
+    // or when the row is so far away (around the horizon) that it can't be
+    if (!frame->visible.bits || !(distance < DEFAULT_ROW_CULL_DISTANCE)) {
+        CastFrameRow(frame, &params, position, step, ceilingRow, floorRow, 0, frame->width);
+        return;
+    }
+    // Otherwise only cast the spans of pixels over potentially visible blocks,
+    // the walls drawn later cover the others so a flat color is enough there
+    int first = 0;
+    for (int x = 0; x < frame->width; x += DEFAULT_ROW_SPAN_PIXELS) {
+        int end = (x + DEFAULT_ROW_SPAN_PIXELS < frame->width) ? x + DEFAULT_ROW_SPAN_PIXELS : frame->width;
+        // The pixels of the span sample the segment from its first pixel to the next span
+        Vector2 from = Vector2Add(position, Vector2Scale(step, x));
+        Vector2 to = Vector2Add(position, Vector2Scale(step, end));
+        if (IsAreaVisible(&frame->visible,
+                          (int) floorf(fminf(from.x, to.x) - 1e-3f), (int) floorf(fminf(from.y, to.y) - 1e-3f),
+                          (int) floorf(fmaxf(from.x, to.x) + 1e-3f), (int) floorf(fmaxf(from.y, to.y) + 1e-3f))) {
+            continue;
+        }
+        // Cast the visible pixels before the span in one go
+        if (first < x) {
+            CastFrameRow(frame, &params, position, step, ceilingRow, floorRow, first, x);
+        }
+        if (frame->indices) {
+            memset(&frame->indices[ceilingRow + x], params.ceilingIndex, end - x);
+            memset(&frame->indices[floorRow + x], params.floorIndex, end - x);
+        } else {
+            for (int i = x; i < end; i++) {
+                frame->pixels[ceilingRow + i] = params.ceilingColor;
+                frame->pixels[floorRow + i] = params.floorColor;
             }
         }
-        // Step the ray
-        position.x += step.x;
-        position.y += step.y;
+        first = end;
+    }
+    if (first < frame->width) {
+        CastFrameRow(frame, &params, position, step, ceilingRow, floorRow, first, frame->width);
     }
 }
 
-static void DrawColumn(Vector2 *worldCoords, Vector2 *tileCoords, int n) {
-    // Compute the angle of the ray
-    float angle = C.columnAngleStart + n * C.columnAngleStep;
-    // cameraX = coordinate (between -1 and 1) of the ray on the x-axis
-    //           of the camera plane
-    float cameraX = (2.0f * ((float) n / C.columns)) - 1.0f; 
-    
-    // Clamp angle between 0 and 2*PI
-    if (angle < 0.0f) {
-        angle += 2 * PI;
-    } else if (angle > 2 * PI) {
-        angle -= 2 * PI;
+static void DrawColumn(const FrameData *frame, const RayHit *hit, int n) {
+    // Check if the ray hit an empty cell (or one without a texture),
+    // the sprites can be seen all the way through these columns
+    int cellId = hit->cellId;
+    if (!cellId || cellId > A.count) {
+        frame->depths[n] = INFINITY;
+        return;
     }
 
     // Compute the ray direction
-    Vector2 rayDirection = Vector2Add(C.playerDirection, Vector2Scale(C.cameraPlane, cameraX));
-    
-    // Compute the distance along the ray direction to the next intersection
-    // with the y-axis
-    float yDeltaDistance = absf(1.0f / rayDirection.x);
-    // Compute the distance along the ray direction to the next intersection
-    // with the x-axis
-    float xDeltaDistance = absf(1.0f / rayDirection.y);
-
-    // Compute the distance in the horizontal direction of the ray to
-    // the border of the cell
-    float xDistance = (rayDirection.x > 0.0f) ? (1.0f - tileCoords->x) : tileCoords->x;
-    // Compute the distance in the vertical direction of the ray to
-    // the border of the cell
-    float yDistance = (rayDirection.y > 0.0f) ? (1.0f - tileCoords->y) : tileCoords->y;
-
-    // Compute the distance along the ray direction to the first intersection
-    // with the y-axis
-    float yIntersectionDistance = yDeltaDistance * xDistance;
-    // Compute the distance along the ray direction to the first intersection
-    // with the x-axis
-    float xIntersectionDistance = xDeltaDistance * yDistance;
-
-    // Find the direction we are moving in the map
+    Vector2 rayDirection = Vector2Add(frame->direction, Vector2Scale(frame->cameraPlane, frame->columnCameraX[n]));
+
+    // Find the direction we moved in the map
     int stepX = (rayDirection.x < 0.0f) ? -1 : +1;
     int stepY = (rayDirection.y < 0.0f) ? -1 : +1;
 
-    // Find map coordinates
-    int mapX = (int) worldCoords->x;
-    int mapY = (int) worldCoords->y;
-
-    // Step the rays until one hits
-    int cellId = 0;
-    bool vertical = true;
-    for (int i = 0; i < V.dof; i++) {
-        int mapOffset = mapY * M->width + mapX;
-        if (mapOffset >= 0 && mapOffset < MAPSZ && (cellId = M->data[mapOffset].wall)) {
-            break;
-        }
-        if (yIntersectionDistance < xIntersectionDistance) {
-            yIntersectionDistance += yDeltaDistance;
-            mapX += stepX;
-            vertical = true;
-        } else {
-            xIntersectionDistance += xDeltaDistance;
-            mapY += stepY;
-            vertical = false;
-        }
-    }
-
-    // Check if the ray hit an empty cell
-    if (!cellId) {
+    // Get the hit information for the first ray to hit a wall
+    // (the distance is already projected onto the camera direction)
+    bool vertical = hit->vertical;
+    int mapX = hit->mapX;
+    int mapY = hit->mapY;
+    float rayDistance = hit->distance;
+    // Keep the depth of the wall for the sprites
+    frame->depths[n] = rayDistance;
+    // Nothing of the wall can be seen from inside of it
+    if (!(rayDistance > 0.0f)) {
         return;
     }
-    // If we didn't, get that cell's texture
-    TileTexture *texture = T[cellId - 1];
-
-    // Get the hit information for the first ray
-    // to hit a wall
-    float rayDistance, colorBrightness;
-    if (vertical) {
-        // yDeltaDistance is subracted from the total to
-        // obtain the distance projected onto the camera direction
-        // This is done to fix the fisheye effect
-        rayDistance = yIntersectionDistance - yDeltaDistance;
-        colorBrightness = 1.0f;
-    } else {
-        rayDistance = xIntersectionDistance - xDeltaDistance;
-        colorBrightness = 0.75f;
-    }
-    Vector2 coordinates = Vector2Add(P.position, Vector2Scale(rayDirection, rayDistance));
+    Vector2 coordinates = Vector2Add(frame->position, Vector2Scale(rayDirection, rayDistance));
     float textureColumnOffset;
     // Compute the correct offset for the column in the texture
     if (vertical) {
@@ -299,40 +357,378 @@ static void DrawColumn(Vector2 *worldCoords, Vector2 *tileCoords, int n) {
         textureColumnOffset = (stepY < 0) ? textureColumnOffset : (1.0f - textureColumnOffset);
     }
 
-    // Calculate the height of the pixel column
-    float lineHeight = M->wallHeight / rayDistance;
-    // Calculate the height of each pixel in the column
-    float dotHeight = (float) lineHeight / texture->height;
+    // Calculate the height of the pixel column in framebuffer pixels
+    float lineHeight = (M.wallHeight / rayDistance) / frame->rowPixelHeight;
+    // Compute the (unclipped) top of the column and clip the visible part
+    // against the framebuffer (the top of the walls right in front of the
+    // camera is clamped, so the pixels above it still fit in an int)
+    float lineTop = fmaxf((frame->height - lineHeight) / 2.0f, -DEFAULT_MAX_LINE_OVERHANG);
+    int yStart = (lineTop > 0.0f) ? (int) lineTop : 0;
+    int yEnd = (lineTop + lineHeight < frame->height) ? (int) (lineTop + lineHeight) : frame->height;
+    if (yEnd <= yStart) {
+        return;
+    }
+    // Pick the mip level from the number of texels each pixel covers
+    const AtlasLevel *level = &A.level[GetTileAtlasLevel(&A, A.level[0].size / lineHeight)];
+    int textureSize = level->size;
     // Find the corresponding texture column
-    int textureColumn = textureColumnOffset * texture->width;
-    // Clip the height of the column if it's higher than the
-    // viewport's height and offset the texture 
-    float textureOffset = 0.0f;
-    if (lineHeight > V.height) {
-        textureOffset = (lineHeight - V.height) / 2.0f;
-        lineHeight = V.height;
-    }
-    // Compute the starting point of the column
-    float xStart = n * C.columnPixelWidth;
-    float yStart = C.viewportHalfHeight - lineHeight / 2.0f - textureOffset;
-    // Draw each pixel (of size C.columnPixelWidth x dotHeight)
-    // in the texture column
-    for (int i = 0; i < texture->height; i++) {
-        Color color = (texture->data[i * texture->width + textureColumn]) ? GOLD : WHITE;
-        // Shade the color accordingly
-        color.r *= colorBrightness;
-        color.g *= colorBrightness;
-        color.b *= colorBrightness;
-        // Draw the i-th pixel
-        DrawRectangle(xStart, yStart + roundf(i * dotHeight), ceilf(C.columnPixelWidth), ceilf(dotHeight), color);
+    int textureColumn = textureColumnOffset * textureSize;
+    textureColumn = (textureColumn < textureSize) ? textureColumn : (textureSize - 1);
+    const Color *texture = GetTileAtlasColumn(level, cellId - 1, textureColumn);
+    // Compute how many texels correspond to a single pixel
+    // and the texel of the first visible pixel (in 16.16 fixed point)
+    float textureStep = textureSize / lineHeight;
+    unsigned int position = (unsigned int) ((yStart - lineTop) * textureStep * 65536.0f);
+    unsigned int step = (unsigned int) (textureStep * 65536.0f);
+    // Find the luxels of the face that was hit, going down the column
+    // (the ray hits the face looking back at where it came from)
+    int face = (vertical) ? ((stepX > 0) ? LIGHTMAP_FACE_LEFT : LIGHTMAP_FACE_RIGHT) : ((stepY > 0) ? LIGHTMAP_FACE_UP : LIGHTMAP_FACE_DOWN);
+    int luxelOffset = GetCachedLuxelOffset(&K, mapX, mapY);
+    const unsigned char *luxels = NULL;
+    if (luxelOffset >= 0) {
+        int u = GetLuxelCoordinate((vertical) ? coordinates.y - (float) mapY : coordinates.x - (float) mapX);
+        luxels = &Y.luxels[luxelOffset + face * LIGHTMAP_SURFACE_LUXELS + u];
     }
+    // Copy the visible part of the texture column into the framebuffer, one
+    // luxel at a time (each one lights an equal part of the texture)
+    const unsigned char *indices = (frame->indices) ? GetTileAtlasIndexColumn(level, cellId - 1, textureColumn) : NULL;
+    int offset = yStart * frame->stride + n;
+    int remaining = yEnd - yStart;
+    for (int v = 0; v < LIGHTMAP_RESOLUTION && remaining > 0; v++) {
+        // Count the pixels that sample the texels above the end of the luxel
+        unsigned int luxelEnd = (unsigned int) ((((uint64_t) textureSize << 16) * (v + 1)) / LIGHTMAP_RESOLUTION);
+        int count = remaining;
+        if (v < LIGHTMAP_RESOLUTION - 1 && step > 0) {
+            unsigned int pixelsLeft = (position < luxelEnd) ? (luxelEnd - position + step - 1) / step : 0;
+            count = (pixelsLeft < (unsigned int) remaining) ? (int) pixelsLeft : remaining;
+        }
+        unsigned char luxel = (luxels != NULL) ? luxels[v * LIGHTMAP_RESOLUTION] : 255;
+        if (indices) {
+            BlitIndexedTextureColumn(&frame->indices[offset], frame->stride, count, indices, textureSize, position, step, &H.shades[GetShadeOffset(luxel)]);
+        } else {
+            BlitTextureColumn(&frame->pixels[offset], frame->stride, count, texture, textureSize, position, step, GetLuxelBrightness(luxel));
+        }
+        offset += count * frame->stride;
+        position += count * step;
+        remaining -= count;
+    }
+}
+
+static void DrawRows(void *data, int start, int end) {
+    ProfileZone zone = BeginProfileZone("row task");
+    FrameData *frame = data;
+    for (int r = start; r < end; r++) {
+        DrawRow(frame, r);
+    }
+    EndProfileZone(zone);
+}
+
+static void DrawColumns(void *data, int start, int end) {
+    ProfileZone zone = BeginProfileZone("column task");
+    FrameData *frame = data;
+    // Cast the whole chunk of rays at once, then draw the columns
+    RayHit hits[DEFAULT_COLUMNS_PER_TASK];
+    CastRays(&frame->rays, hits, start, end);
+    for (int c = start; c < end; c++) {
+        DrawColumn(frame, &hits[c - start], c);
+    }
+    EndProfileZone(zone);
+}
+
+static void DrawSprite(const FrameData *frame, const ProjectedSprite *sprite, int start, int end) {
+    // Find the columns of the chunk covered by the sprite (column n is
+    // covered when its ray goes through the sprite, like for the walls)
+    float left = sprite->center - sprite->halfWidth;
+    int from = (int) ceilf(left);
+    int to = (int) ceilf(sprite->center + sprite->halfWidth);
+    from = (from > start) ? from : start;
+    to = (to < end) ? to : end;
+    if (from >= to) {
+        return;
+    }
+    // Sprites stand on the floor and are as tall as a wall times their size
+    float lineHeight = (M.wallHeight / sprite->depth) / frame->rowPixelHeight;
+    float spriteHeight = lineHeight * sprite->size;
+    float spriteTop = (frame->height + lineHeight) / 2.0f - spriteHeight;
+    int yStart = (spriteTop > 0.0f) ? (int) spriteTop : 0;
+    int yEnd = (spriteTop + spriteHeight < frame->height) ? (int) (spriteTop + spriteHeight) : frame->height;
+    if (yEnd <= yStart) {
+        return;
+    }
+    // Pick the mip level and step through the texture as for the walls
+    const AtlasLevel *level = &A.level[GetTileAtlasLevel(&A, A.level[0].size / spriteHeight)];
+    int textureSize = level->size;
+    float textureStep = textureSize / spriteHeight;
+    unsigned int position = (unsigned int) ((yStart - spriteTop) * textureStep * 65536.0f);
+    unsigned int step = (unsigned int) (textureStep * 65536.0f);
+    float columnStep = textureSize / (2.0f * sprite->halfWidth);
+    for (int c = from; c < to; c++) {
+        // Skip the columns where a wall is in front of the sprite
+        if (sprite->depth >= frame->depths[c]) {
+            continue;
+        }
+        int textureColumn = (int) ((c - left) * columnStep);
+        textureColumn = (textureColumn < textureSize) ? textureColumn : (textureSize - 1);
+        if (frame->indices) {
+            const unsigned char *indices = GetTileAtlasIndexColumn(level, sprite->textureId, textureColumn);
+            BlitMaskedIndexedTextureColumn(&frame->indices[yStart * frame->stride + c], frame->stride, yEnd - yStart, indices, textureSize, position, step);
+        } else {
+            const Color *texture = GetTileAtlasColumn(level, sprite->textureId, textureColumn);
+            BlitMaskedTextureColumn(&frame->pixels[yStart * frame->stride + c], frame->stride, yEnd - yStart, texture, textureSize, position, step);
+        }
+    }
+}
+
+// Converts the palette indices of rows start to end - 1 of a framebuffer to its pixels
+static void ExpandRows(void *data, int start, int end) {
+    ProfileZone zone = BeginProfileZone("expand task");
+    Framebuffer *framebuffer = data;
+    int offset = start * framebuffer->width;
+    ExpandPaletteIndices(&H, &framebuffer->indices[offset], &framebuffer->pixels[offset], (end - start) * framebuffer->width);
+    EndProfileZone(zone);
+}
+
+static void DrawSprites(void *data, int start, int end) {
+    ProfileZone zone = BeginProfileZone("sprite task");
+    const FrameData *frame = data;
+    // Every task draws all the sprites (back to front) over its own columns
+    for (int i = 0; i < frame->sprites->count; i++) {
+        DrawSprite(frame, &frame->sprites->sprites[i], start, end);
+    }
+    EndProfileZone(zone);
 }
 
+// Fills in the camera of a frame, along with the parameters of the row and
+// ray casting (the resolution and the framebuffer have to be set already)
+static void SetupFrame(FrameData *frame, Vector2 position, Vector2 direction, Vector2 cameraPlane) {
+    frame->position = position;
+    frame->direction = direction;
+    frame->cameraPlane = cameraPlane;
+    // Look up what can be seen from the cell of the camera
+    frame->visible = GetVisibleBlocks(&Z, &M, (int) position.x, (int) position.y);
+    // Compute left most pixel position
+    frame->cameraPlaneLeft = Vector2Subtract(direction, cameraPlane);
+    // Compute right most pixel position
+    frame->cameraPlaneRight = Vector2Add(direction, cameraPlane);
+    // Compute the cell coordinates
+    Vector2 worldCoords = { .x = (int) position.x, .y = (int) position.y };
+    // Setup the floor and ceiling scanlines
+    frame->rows = (RowCastParams) {
+        .chunks = &K,
+        .mapWidth = M.width,
+        .mapHeight = M.height,
+        .texels = A.level[0].texels,
+        .textureSize = A.level[0].size,
+        .textureCount = A.count,
+        .ceilingColor = DEFAULT_CEILING_COLOR,
+        .floorColor = DEFAULT_FLOOR_COLOR,
+        .luxels = Y.luxels,
+        .indices = A.level[0].indices,
+        .shades = H.shades,
+        .ceilingIndex = FindPaletteColor(&H, DEFAULT_CEILING_COLOR),
+        .floorIndex = FindPaletteColor(&H, DEFAULT_FLOOR_COLOR)
+    };
+    // Setup the wall rays
+    frame->rays = (RayCastParams) {
+        .chunks = &K,
+        .occupancy = &M.occupancy,
+        .mapWidth = M.width,
+        .mapHeight = M.height,
+        .dof = V.dof,
+        .cameraX = frame->columnCameraX,
+        .mapX = (int) worldCoords.x,
+        .mapY = (int) worldCoords.y,
+        // Compute the coordinates inside the cell
+        .tileCoords = Vector2Subtract(position, worldCoords),
+        .direction = direction,
+        .cameraPlane = cameraPlane
+    };
+}
+
+static void RenderFrame(void) {
+    FrameData frame = {
+        .width = C.columns,
+        .height = C.rows,
+        .stride = F.width,
+        .rowPixelHeight = C.rowPixelHeight,
+        .columnCameraX = C.columnCameraX,
+        .rowDistances = C.rowDistances,
+        .pixels = F.pixels,
+        .indices = F.indices,
+        .depths = F.depths,
+        .sprites = &L
+    };
+    SetupFrame(&frame, P.position, C.playerDirection, C.cameraPlane);
+    // Bring in the chunks around the player before anything reads them,
+    // leaving out the ones that can't be seen from where the player is
+    UpdateChunkCache(&K, &M, (int) P.position.x, (int) P.position.y, IsChunkVisible, &frame.visible);
+    UpdateLightmapCache(&Y, &K, &W);
+    // Draw floors and ceilings (the middle row is shared when
+    // the number of rows is odd)
+    double rowsStart = GetBenchTime();
+    ProfileZone zone = BeginProfileZone("rows");
+    RunPoolTask(DrawRows, &frame, (C.rows + 1) / 2, DEFAULT_ROWS_PER_TASK);
+    EndProfileZone(zone);
+    // Draw walls, this has to happen after all the rows are
+    // done since walls overwrite the floor and ceiling pixels
+    double columnsStart = GetBenchTime();
+    zone = BeginProfileZone("columns");
+    RunPoolTask(DrawColumns, &frame, C.columns, DEFAULT_COLUMNS_PER_TASK);
+    EndProfileZone(zone);
+    // Draw the sprites over the walls, clipped against the depth of every column
+    double spritesStart = GetBenchTime();
+    zone = BeginProfileZone("sprites");
+    SpriteCamera camera = {
+        .position = P.position,
+        .direction = C.playerDirection,
+        .cameraPlane = C.cameraPlane,
+        .columns = C.columns,
+        .farPlane = V.dof,
+        .visible = &frame.visible
+    };
+    if (ProjectSprites(&S, &camera, &L)) {
+        RunPoolTask(DrawSprites, &frame, C.columns, DEFAULT_COLUMNS_PER_TASK);
+    }
+    EndProfileZone(zone);
+    RecordBenchStage(STAGE_ROWS, columnsStart - rowsStart);
+    RecordBenchStage(STAGE_COLUMNS, spritesStart - columnsStart);
+    RecordBenchStage(STAGE_SPRITES, GetBenchTime() - spritesStart);
+    // Convert the palette indices to colors once everything is drawn
+    if (F.indices) {
+        zone = BeginProfileZone("expand");
+        RunPoolTask(ExpandRows, &F, F.height, DEFAULT_ROWS_PER_TASK);
+        EndProfileZone(zone);
+    }
+}
+
+static bool InitCameraBatch(int count, int width, int height) {
+    B.count = count;
+    B.width = width;
+    B.height = height;
+    // Lay the views out in a grid as square as possible
+    B.tilesX = (int) ceilf(sqrtf((float) count));
+    int tilesY = (count + B.tilesX - 1) / B.tilesX;
+    // The views see as much as the window does, only with fewer pixels
+    B.rowPixelHeight = (float) V.height / height;
+    B.columnCameraX = MemAlloc(width * sizeof(float));
+    B.rowDistances = MemAlloc(((height + 1) / 2) * sizeof(float));
+    B.poses = MemAlloc(count * sizeof(CameraPose));
+    B.frames = MemAlloc(count * sizeof(FrameData));
+    B.framebuffer.width = B.tilesX * width;
+    B.framebuffer.height = tilesY * height;
+    B.framebuffer.pixels = MemAlloc(B.framebuffer.width * B.framebuffer.height * sizeof(Color));
+    B.framebuffer.depths = MemAlloc(count * width * sizeof(float));
+    B.framebuffer.indices = (O.paletted) ? MemAlloc(B.framebuffer.width * B.framebuffer.height) : NULL;
+    if (!B.columnCameraX || !B.rowDistances || !B.poses || !B.frames || !B.framebuffer.pixels || !B.framebuffer.depths || (O.paletted && !B.framebuffer.indices)) {
+        return false;
+    }
+    ComputeViewTables(width, height, B.columnCameraX, B.rowDistances);
+    // Point every view at its tile, the cameras are set when rendering
+    for (int i = 0; i < count; i++) {
+        int tile = (i / B.tilesX) * height * B.framebuffer.width + (i % B.tilesX) * width;
+        B.frames[i] = (FrameData) {
+            .width = width,
+            .height = height,
+            .stride = B.framebuffer.width,
+            .rowPixelHeight = B.rowPixelHeight,
+            .columnCameraX = B.columnCameraX,
+            .rowDistances = B.rowDistances,
+            .pixels = &B.framebuffer.pixels[tile],
+            .indices = (B.framebuffer.indices) ? &B.framebuffer.indices[tile] : NULL,
+            .depths = &B.framebuffer.depths[i * width],
+            .sprites = NULL
+        };
+    }
+#ifndef HEADLESS
+    B.framebuffer.texture = LoadTextureFromImage((Image) {
+        .data = B.framebuffer.pixels,
+        .width = B.framebuffer.width,
+        .height = B.framebuffer.height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+    });
+#endif
+    return true;
+}
+
+static void UnloadCameraBatch(void) {
+#ifndef HEADLESS
+    if (B.framebuffer.texture.id) {
+        UnloadTexture(B.framebuffer.texture);
+    }
+#endif
+    MemFree(B.framebuffer.pixels);
+    MemFree(B.framebuffer.depths);
+    MemFree(B.framebuffer.indices);
+    MemFree(B.frames);
+    MemFree(B.poses);
+    MemFree(B.rowDistances);
+    MemFree(B.columnCameraX);
+    B = (CameraBatch) {0};
+}
+
+static void DrawCameras(void *data, int start, int end) {
+    ProfileZone zone = BeginProfileZone("camera task");
+    FrameData *frames = data;
+    // Every task draws whole views, so the views never have to wait on
+    // each other between the rows and the walls
+    for (int i = start; i < end; i++) {
+        FrameData *frame = &frames[i];
+        DrawRows(frame, 0, (frame->height + 1) / 2);
+        for (int c = 0; c < frame->width; c += DEFAULT_COLUMNS_PER_TASK) {
+            int columnsEnd = c + DEFAULT_COLUMNS_PER_TASK;
+            DrawColumns(frame, c, (columnsEnd < frame->width) ? columnsEnd : frame->width);
+        }
+    }
+    EndProfileZone(zone);
+}
+
+// Renders the views of the first count cameras of the batch into their
+// tiles, spread across the threads a view at a time. The sprites aren't
+// drawn, and the cameras only see the chunks cached around the first one
+static void RenderCameras(const CameraPose *poses, int count) {
+    if (count > B.count) {
+        count = B.count;
+    }
+    if (count <= 0) {
+        return;
+    }
+    double camerasStart = GetBenchTime();
+    ProfileZone zone = BeginProfileZone("cameras");
+    for (int i = 0; i < count; i++) {
+        Vector2 direction = { cosf(poses[i].rotation), sinf(poses[i].rotation) };
+        Vector2 cameraPlane = { -direction.y * C.cameraPlaneHalfWidth, +direction.x * C.cameraPlaneHalfWidth };
+        SetupFrame(&B.frames[i], poses[i].position, direction, cameraPlane);
+    }
+    UpdateChunkCache(&K, &M, (int) poses[0].position.x, (int) poses[0].position.y, NULL, NULL);
+    UpdateLightmapCache(&Y, &K, &W);
+    RunPoolTask(DrawCameras, B.frames, count, DEFAULT_CAMERAS_PER_TASK);
+    if (B.framebuffer.indices) {
+        RunPoolTask(ExpandRows, &B.framebuffer, B.framebuffer.height, DEFAULT_ROWS_PER_TASK);
+    }
+    EndProfileZone(zone);
+    RecordBenchStage(STAGE_CAMERAS, GetBenchTime() - camerasStart);
+}
+
+static void UpdateCamera(void) {
+    // Compute player direction
+    C.playerDirection.x = cosf(P.rotation);
+    C.playerDirection.y = sinf(P.rotation);
+    // Compute camera plane offset
+    C.cameraPlane.x = -C.playerDirection.y * C.cameraPlaneHalfWidth;
+    C.cameraPlane.y = +C.playerDirection.x * C.cameraPlaneHalfWidth;
+}
+
+#ifndef HEADLESS
+
 static void ProcessInput(void) {
+    ProfileZone zone = BeginProfileZone("input");
     I.forward = IsKeyDown(KEY_W) - IsKeyDown(KEY_S);
     I.right = IsKeyDown(KEY_D) - IsKeyDown(KEY_A);
-    I.xMouseDelta = GetMouseDelta().x;
-    
+    I.xMouse += GetMouseDelta().x;
+    // The simulation thread picks the input up on its next tick
+    SubmitPlayerInput(&I);
+
     switch (GetKeyPressed()) {
         case KEY_F:
             ToggleFullscreen();
@@ -344,130 +740,190 @@ static void ProcessInput(void) {
                 DisableCursor();
             }
             break;
+        case KEY_P:
+            SetProfilerEnabled(!IsProfilerEnabled());
+            break;
+        case KEY_T:
+            ExportProfilerTrace(O.traceFileName);
+            break;
         default:
             break;
     }
+    EndProfileZone(zone);
 }
 
 static void Update(void) {
-    // Calculate frame delta time
-    float nowTime = GetTime();
-    float delta = nowTime - C.prevTime;
-    C.prevTime = nowTime;
-
+    ProfileZone zone = BeginProfileZone("update");
     // Resize viewport and recalculate halfHeight and planeDistance
     if (IsWindowResized()) {
         V.width = GetRenderWidth();
         V.height = GetRenderHeight();
         RecomputeValues();
     }
-
-    // Camera horizontal rotation
-    P.rotation += I.xMouseDelta * P.rotationSpeed * delta;
-    if (P.rotation < 0.0f) {
-        P.rotation += 2.0f * PI;
-    } else if (P.rotation > 2.0f * PI) {
-        P.rotation -= 2.0f * PI;
+    // Start culling once the visibility set is built in the background
+    FinishVisibilitySetBuild(&Z);
+    // Scale the resolution to keep the frame time under the budget
+    if (O.budget > 0.0f && UpdateResolutionController(&R, GetFrameTime())) {
+        V.scaling = R.scale;
+        RecomputeValues();
     }
-    // Compute player direction
-    C.playerDirection.x = cosf(P.rotation);
-    C.playerDirection.y = sinf(P.rotation);
-    // Compute camera plane offset
-    C.cameraPlane.x = -C.playerDirection.y * C.cameraPlaneHalfWidth;
-    C.cameraPlane.y = +C.playerDirection.x * C.cameraPlaneHalfWidth;
+    // Render the player in between the last two ticks of the simulation
+    SamplePlayerSnapshot(GetPlayerSnapshot(), GetBenchTime(), &P.position, &P.rotation);
+    // Compute player direction and camera plane
+    UpdateCamera();
+    EndProfileZone(zone);
+}
 
-    // Calculate the sign of the direction along which we are moving
-    // on the x and y axis respectively
-    float xSign = (P.rotation <= HALF_PI || P.rotation > 3 * HALF_PI) ? +1.0f : -1.0f;
-    float ySign = (P.rotation >= 0.0f && P.rotation < PI) ? +1.0f : -1.0f;
-    // Calculate the padding necessary to not slam the player into a wall
-    float xPad = 0.125f * xSign;
-    float yPad = 0.125f * ySign;
-    // Calculate the distance delta on the x and y axis
-    float x = C.playerDirection.x * delta * P.movementSpeed;
-    float y = C.playerDirection.y * delta * P.movementSpeed;
-    // Player movement
-    Vector2 newPosition = P.position;
-    if (I.forward) {
-        // Remember to add the padding to the distance delta
-        //                              vvvvvvvv
-        newPosition.x = P.position.x + (x + xPad) * I.forward;
-        newPosition.y = P.position.y + (y + yPad) * I.forward;
-        // Check if the newPosition on the x-axis is inside the map
-        if ((int) newPosition.x < M->width) {
-            // Check for player longitudinal collision on the x-axis
-            while (M->data[((int) P.position.y) * M->width + ((int) newPosition.x)].wall) {
-                newPosition.x -= x * I.forward;
-            }
-            // Remember to subtract the padding once we are done
-            // computing the corrected position along the x-axis
-            P.position.x = newPosition.x - (xPad * I.forward);
-        }
-        // Check if the newPosition on the y-axis is inside the map
-        if ((int) newPosition.y < M->height) {
-            // Check for player longitudinal collision on the y-axis
-            while (M->data[((int) newPosition.y) * M->width + ((int) P.position.x)].wall) {
-                newPosition.y -= y * I.forward;
-            }
-            // Same as above, we have to subtract the padding once
-            // we are done correcting the position along the y-axis
-            P.position.y = newPosition.y - (yPad * I.forward);
+static void Render(void) {
+    // With a batch of cameras, show their views instead of the player's
+    // (the cameras stand where the player is and look all around)
+    Framebuffer *framebuffer = &F;
+    if (B.count) {
+        for (int i = 0; i < B.count; i++) {
+            B.poses[i] = (CameraPose) { P.position, P.rotation + 2.0f * PI * i / B.count };
         }
+        RenderCameras(B.poses, B.count);
+        framebuffer = &B.framebuffer;
+    } else {
+        RenderFrame();
     }
-    if (I.right) {
-        // Remember to add the padding to the distance delta
-        //                              vvvvvvvv
-        newPosition.x = P.position.x - (y + yPad) * I.right;
-        newPosition.y = P.position.y + (x + xPad) * I.right;
-        // Check if the newPosition on the x-axis is inside the map
-        if ((int) newPosition.x < M->width) {
-            // Check for player lateral collision on the x-axis
-            while (M->data[((int) P.position.y) * M->width + ((int) newPosition.x)].wall) {
-                newPosition.x += y * I.right;
-            }
-            // Remember to subtract the padding once we are done
-            // computing the corrected position along the x-axis
-            P.position.x = newPosition.x + (yPad * I.right);
+
+    // Upload the framebuffer and stretch it over the whole window
+    ProfileZone zone = BeginProfileZone("upload");
+    UpdateTexture(framebuffer->texture, framebuffer->pixels);
+    EndProfileZone(zone);
+    DrawTexturePro(
+        framebuffer->texture,
+        (Rectangle) { 0.0f, 0.0f, framebuffer->width, framebuffer->height },
+        (Rectangle) { 0.0f, 0.0f, V.width, V.height },
+        (Vector2) { 0.0f, 0.0f },
+        0.0f,
+        WHITE
+    );
+
+    DrawFPS(10, 10);
+    if (O.budget > 0.0f) {
+        DrawText(TextFormat("%dx%d", C.columns, C.rows), 10, 30, 20, LIME);
+    }
+    DrawProfilerOverlay(10, 60);
+}
+
+static void ReportScaling(void) {
+    double baseline = 0.0;
+    printf("# kernel: %s\n", GetRayCastKernelName(GetRayCastKernel()));
+    printf("threads,frame_ms,speedup\n");
+    // Respawn the pool with a different number of workers for each run
+    ShutdownPool();
+    for (int threads = 1; threads <= O.threads; threads++) {
+        if (!InitPool(threads - 1)) {
+            TraceLog(LOG_WARNING, "POOL: Only %d of %d workers could be spawned", GetPoolWorkerCount(), threads - 1);
         }
-        // Check if the newPosition on the y-axis is inside the map
-        if ((int) newPosition.y < M->height) {
-            // Check for player lateral collision on the y-axis
-            while (M->data[((int) newPosition.y) * M->width + ((int) P.position.x)].wall) {
-                newPosition.y -= x * I.right;
-            }
-            // Same as above, we have to subtract the padding once
-            // we are done correcting the position along the y-axis
-            P.position.y = newPosition.y - (xPad * I.right);
+        // Warm up the caches and the workers before timing
+        RenderFrame();
+        double start = GetBenchTime();
+        for (int i = 0; i < DEFAULT_SCALING_FRAMES; i++) {
+            RenderFrame();
         }
+        double frameTime = (GetBenchTime() - start) / DEFAULT_SCALING_FRAMES;
+        ShutdownPool();
+        if (threads == 1) {
+            baseline = frameTime;
+        }
+        printf("%d,%.3f,%.2f\n", GetPoolWorkerCount() + 1, frameTime * 1000.0, baseline / frameTime);
+    }
+    if (!InitPool(O.threads - 1)) {
+        TraceLog(LOG_WARNING, "POOL: Only %d of %d workers could be spawned", GetPoolWorkerCount(), O.threads - 1);
     }
 }
 
-static void Render(void) {
-    ClearBackground(BLACK);
-    // Draw the sky
-    DrawRectangle(0, 0, V.width, V.height / 2, BLUE);
+#endif
 
-    // Compute left most pixel position
-    Vector2 cameraPlaneLeft = Vector2Subtract(C.playerDirection, C.cameraPlane);
-    // Compute right most pixel position
-    Vector2 cameraPlaneRight = Vector2Add(C.playerDirection, C.cameraPlane);
-    // Compute the cell coordinates
-    Vector2 worldCoords = { .x = (int) P.position.x, .y = (int) P.position.y };
-    // Compute the coordinates inside the cell
-    Vector2 tileCoords = Vector2Subtract(P.position, worldCoords);
-    // Draw floors and ceilings
-    for (int r = 0; r < C.rows / 2; r++) {
-        DrawRow(cameraPlaneLeft, cameraPlaneRight, r);
+static void ParseArguments(int argc, char **argv) {
+    O.threads = GetProcessorCount();
+    O.kernel = GetBestRayCastKernel();
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            O.threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--kernel") && i + 1 < argc) {
+            const char *name = argv[++i];
+            for (int kernel = 0; kernel < RAYCAST_KERNEL_COUNT; kernel++) {
+                if (!strcmp(name, GetRayCastKernelName(kernel))) {
+                    O.kernel = kernel;
+                }
+            }
+        } else if (!strcmp(argv[i], "--scaling")) {
+            O.scaling = true;
+        } else if (!strcmp(argv[i], "--width") && i + 1 < argc) {
+            V.width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--height") && i + 1 < argc) {
+            V.height = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--path") && i + 1 < argc) {
+            O.pathFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--report") && i + 1 < argc) {
+            O.reportFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--timestep") && i + 1 < argc) {
+            O.timestep = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+            O.mapFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--tickrate") && i + 1 < argc) {
+            O.tickRate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--budget") && i + 1 < argc) {
+            O.budget = atof(argv[++i]) / 1000.0f;
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            O.traceFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--sprites") && i + 1 < argc) {
+            O.sprites = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cameras") && i + 1 < argc) {
+            O.cameras = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--camera-size") && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &O.cameraWidth, &O.cameraHeight);
+        } else if (!strcmp(argv[i], "--no-pvs")) {
+            O.noVisibility = true;
+        } else if (!strcmp(argv[i], "--paletted")) {
+            O.paletted = true;
+        } else if (!strcmp(argv[i], "--video") && i + 1 < argc) {
+            O.videoFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--video-format") && i + 1 < argc) {
+            const char *name = argv[++i];
+            for (int format = 0; format < VIDEO_FORMAT_COUNT; format++) {
+                if (!strcmp(name, GetVideoFormatName(format))) {
+                    O.videoFormat = format;
+                }
+            }
+        }
     }
-    // Draw walls
-    for (int c = 0; c < C.columns; c++) {
-        DrawColumn(&worldCoords, &tileCoords, c);
+    if (O.threads < 1) {
+        O.threads = 1;
     }
-
-    DrawFPS(10, 10);
+    if (O.timestep <= 0.0f) {
+        O.timestep = DEFAULT_BENCH_TIMESTEP;
+    }
+    if (!O.mapFileName) {
+        O.mapFileName = DEFAULT_MAP_FILE;
+    }
+    if (O.tickRate <= 0.0f) {
+        O.tickRate = DEFAULT_TICK_RATE;
+    }
+    if (O.sprites < 0) {
+        O.sprites = 0;
+    }
+    if (O.cameras < 0) {
+        O.cameras = 0;
+    }
+    if (O.cameraWidth <= 0 || O.cameraHeight <= 0) {
+        O.cameraWidth = DEFAULT_CAMERA_WIDTH;
+        O.cameraHeight = DEFAULT_CAMERA_HEIGHT;
+    }
+#ifndef HEADLESS
+    if (!O.traceFileName) {
+        O.traceFileName = DEFAULT_TRACE_FILE;
+    }
+#endif
 }
 
 static void Init(void) {
+    SetProfilerThreadName("main");
+#ifndef HEADLESS
     InitWindow(
         V.width, 
         V.height, 
@@ -475,23 +931,216 @@ static void Init(void) {
     );
     SetWindowState(FLAG_WINDOW_RESIZABLE);
     DisableCursor();
+#endif
     RecomputeValues();
-    C.prevTime = GetTime();
+    // Load the same tile map as the GPU renderer, split in tiles with their mip levels
+    if (!LoadTileAtlas(&A, DEFAULT_TILE_MAP_FILE, DEFAULT_TILE_SIZE)) {
+        TraceLog(LOG_FATAL, "ATLAS: Failed to load %s", DEFAULT_TILE_MAP_FILE);
+    }
+    // In paletted mode, draw with the palette indices of the tiles instead of their colors
+    if (O.paletted && (!BuildPalette(&H, &A, (Color[]) { DEFAULT_CEILING_COLOR, DEFAULT_FLOOR_COLOR }, 2) || !IndexTileAtlas(&A, &H))) {
+        TraceLog(LOG_FATAL, "PALETTE: Failed to build the palette of %s", DEFAULT_TILE_MAP_FILE);
+    }
+    // Map the map file, its chunks are only read once the player gets close to them
+    if (!LoadMap(&M, O.mapFileName)) {
+        TraceLog(LOG_FATAL, "MAP: Failed to load %s", O.mapFileName);
+    }
+    if (!InitChunkCache(&K, &M, DEFAULT_CHUNK_RADIUS)) {
+        TraceLog(LOG_FATAL, "MAP: Failed to allocate the chunk cache");
+    }
+    if (!InitLightmapCache(&Y, &K)) {
+        TraceLog(LOG_FATAL, "LIGHTMAP: Failed to allocate the lightmap cache");
+    }
+    // Scatter the sprites over the empty cells of the map
+    if (!InitSpriteStore(&S, O.sprites, M.width, M.height) || !InitSpriteList(&L, O.sprites)) {
+        TraceLog(LOG_FATAL, "SPRITE: Failed to allocate %d sprites", O.sprites);
+    }
+    ScatterSprites(&S, &M.occupancy, O.sprites, A.count, DEFAULT_SPRITE_SEED);
+    // Tile the views of the batch of cameras in their own framebuffer
+    if (O.cameras > 0 && !InitCameraBatch(O.cameras, O.cameraWidth, O.cameraHeight)) {
+        TraceLog(LOG_FATAL, "CAMERA: Failed to allocate %d views of %dx%d", O.cameras, O.cameraWidth, O.cameraHeight);
+    }
+    // Pick the wall traversal kernel, fall back to the
+    // scalar one if the CPU doesn't support the requested one
+    if (!SetRayCastKernel(O.kernel)) {
+        TraceLog(LOG_WARNING, "RAYCAST: Kernel %s is not supported, using %s", GetRayCastKernelName(O.kernel), GetRayCastKernelName(RAYCAST_KERNEL_SCALAR));
+        SetRayCastKernel(RAYCAST_KERNEL_SCALAR);
+    }
+    // The calling thread takes part in the work, so
+    // spawn one worker less than the requested threads
+    if (!InitPool(O.threads - 1)) {
+        TraceLog(LOG_WARNING, "POOL: Only %d of %d workers could be spawned", GetPoolWorkerCount(), O.threads - 1);
+    }
+    // Load what can be seen from every block of the map from next to the map
+    // file, or build it the first time: the benchmark waits for it on the pool,
+    // the window doesn't and builds it on the processors the pool leaves alone
+#ifdef HEADLESS
+    if (!O.noVisibility && !LoadOrBuildVisibilitySet(&Z, &M, V.dof, TextFormat("%s.pvs", O.mapFileName))) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to build the visibility set, nothing will be culled");
+    }
+#else
+    int spareThreads = GetProcessorCount() - O.threads;
+    if (!O.noVisibility && !LoadOrStartVisibilitySet(&Z, &M, V.dof, TextFormat("%s.pvs", O.mapFileName), (spareThreads > 1) ? spareThreads : 1)) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to build the visibility set, nothing will be culled");
+    }
+#endif
+    // Same for the light reaching the walls, the floors and the ceilings
+    if (!LoadOrBakeLightmap(&W, &M, TextFormat("%s.lightmap", O.mapFileName))) {
+        TraceLog(LOG_FATAL, "LIGHTMAP: Failed to bake the lightmap of %s", O.mapFileName);
+    }
+#ifdef HEADLESS
+    // Stream the frames rendered along the path, at the resolution of the framebuffer
+    const Framebuffer *framebuffer = (B.count) ? &B.framebuffer : &F;
+    if (O.videoFileName && !InitVideoWriter(O.videoFileName, O.videoFormat, framebuffer->width, framebuffer->height, 1.0f / O.timestep, false)) {
+        TraceLog(LOG_FATAL, "VIDEO: Failed to open %s", O.videoFileName);
+    }
+#else
+    // Move the player on its own thread at a fixed rate, so the
+    // cost of the simulation never adds up to the frame time
+    if (!InitSimulation(&P, &M, O.tickRate)) {
+        TraceLog(LOG_FATAL, "SIM: Failed to start the simulation thread");
+    }
+    // Start at full resolution and let the frame times bring it down
+    if (O.budget > 0.0f) {
+        InitResolutionController(&R, O.budget, DEFAULT_MIN_SCALING, V.scaling);
+    }
+#endif
 }
 
 static void Shutdown(void) {
+#ifdef HEADLESS
+    ShutdownVideoWriter();
+#else
+    ShutdownSimulation();
+#endif
+    ShutdownPool();
+    UnloadCameraBatch();
+    StopVisibilitySetBuild();
+    UnloadVisibilitySet(&Z);
+    UnloadLightmap(&W);
+    UnloadLightmapCache(&Y);
+    UnloadSpriteList(&L);
+    UnloadSpriteStore(&S);
+    UnloadChunkCache(&K);
+    UnloadMap(&M);
+    MemFree(F.pixels);
+    MemFree(F.depths);
+    MemFree(F.indices);
+    MemFree(C.columnCameraX);
+    MemFree(C.rowDistances);
+    UnloadTileAtlas(&A);
+    ShutdownProfiler();
+#ifndef HEADLESS
+    UnloadTexture(F.texture);
     CloseWindow();
+#endif
 }
 
+#ifdef HEADLESS
+
+static const char *stageNames[STAGE_COUNT] = {
+    [STAGE_UPDATE] = "update",
+    [STAGE_ROWS] = "rows",
+    [STAGE_COLUMNS] = "columns",
+    [STAGE_SPRITES] = "sprites",
+    [STAGE_CAMERAS] = "cameras",
+    [STAGE_FRAME] = "frame",
+};
+
+// Hands a copy of the pixels drawn last to the video writer, which
+// converts and writes them while the next frames are being drawn
+static void RecordFrame(const Framebuffer *framebuffer) {
+    ProfileZone zone = BeginProfileZone("video");
+    memcpy(BeginVideoFrame(), framebuffer->pixels, framebuffer->width * framebuffer->height * sizeof(Color));
+    EndVideoFrame();
+    EndProfileZone(zone);
+}
+
+int main(int argc, char **argv, char **envp) {
+    ParseArguments(argc, argv);
+    CameraPath path;
+    if (!O.pathFileName || !LoadCameraPath(O.pathFileName, &path)) {
+        TraceLog(LOG_ERROR, "BENCH: A valid camera path is required (--path <file>)");
+        return 1;
+    }
+    Init();
+    // Render a few frames from the start of the path
+    // to warm up the caches and the workers
+    SampleCameraPath(&path, 0.0f, &P.position, &P.rotation);
+    UpdateCamera();
+    for (int i = 0; i < DEFAULT_BENCH_WARMUP_FRAMES; i++) {
+        if (O.cameras > 0) {
+            SampleCameraPathPoses(&path, 0.0f, B.poses, O.cameras);
+            RenderCameras(B.poses, O.cameras);
+        } else {
+            RenderFrame();
+        }
+    }
+    // Follow the path with a fixed timestep
+    int frames = (int) (GetCameraPathDuration(&path) / O.timestep) + 1;
+    InitBench(stageNames, STAGE_COUNT, frames);
+    // With a batch of cameras, every frame renders one view per camera,
+    // the cameras spread evenly along the path
+    if (O.cameras > 0) {
+        SetBenchViewCount(O.cameras);
+    }
+    // Only profile the frames that are timed
+    SetProfilerEnabled(O.traceFileName != NULL);
+    for (int frame = 0; IsBenchRunning(); frame++) {
+        double frameStart = GetBenchTime();
+        SampleCameraPath(&path, frame * O.timestep, &P.position, &P.rotation);
+        UpdateCamera();
+        if (O.cameras > 0) {
+            SampleCameraPathPoses(&path, frame * O.timestep, B.poses, O.cameras);
+        }
+        RecordBenchStage(STAGE_UPDATE, GetBenchTime() - frameStart);
+        if (O.cameras > 0) {
+            RenderCameras(B.poses, O.cameras);
+        } else {
+            RenderFrame();
+        }
+        if (O.videoFileName) {
+            RecordFrame((O.cameras > 0) ? &B.framebuffer : &F);
+        }
+        RecordBenchStage(STAGE_FRAME, GetBenchTime() - frameStart);
+        NextBenchFrame();
+    }
+    // The resolution reported is the one of every view
+    ExportBenchReport(O.reportFileName, "cpu", TextFormat(
+        "\"width\": %d, \"height\": %d, \"columns\": %d, \"rows\": %d, \"threads\": %d, \"kernel\": \"%s\", \"sprites\": %d, \"pvs\": %s, \"paletted\": %s, \"timestep\": %f",
+        V.width, V.height, B.count ? B.width : C.columns, B.count ? B.height : C.rows, O.threads, GetRayCastKernelName(GetRayCastKernel()), O.sprites, Z.bits ? "true" : "false", O.paletted ? "true" : "false", O.timestep
+    ));
+    if (O.traceFileName) {
+        ExportProfilerTrace(O.traceFileName);
+    }
+    ShutdownBench();
+    UnloadCameraPath(&path);
+    Shutdown();
+    return 0;
+}
+
+#else
+
 int main(int argc, char **argv, char **envp) {
+    ParseArguments(argc, argv);
     Init();
+    if (O.scaling) {
+        // Compute the player's view once so the frames have something to render
+        Update();
+        ReportScaling();
+    }
     while (!WindowShouldClose()) {
         BeginDrawing();
         ProcessInput();
         Update();
         Render();
+        ProfileZone zone = BeginProfileZone("present");
         EndDrawing();
+        EndProfileZone(zone);
+        NextProfilerFrame();
     }
     Shutdown();
     return 0;
 }
+
+#endif
@@ -2,67 +2,152 @@
 #include <raymath.h>
 #include <rlgl.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "lightmap.h"
+#include "map.h"
+#include "pool.h"
+#include "profile.h"
+#include "program.h"
+#include "resolution.h"
+#include "sim.h"
+#include "sprite.h"
+#include "video.h"
+#include "visibility.h"
 
 // Defaults
 #define DEFAULT_WINDOW_TITLE        "RECOIL"
 #define DEFAULT_VIEWPORT_WIDTH      1366
 #define DEFAULT_VIEWPORT_HEIGHT     768
-#define DEFAULT_VIEWPORT_DOF        32
+#define DEFAULT_VIEWPORT_DOF        64
 #define DEFAULT_VIEWPORT_FOV        (66.0f * DEG2RAD)
+#define DEFAULT_VIEWPORT_SCALING    1.0f
+#define DEFAULT_MIN_SCALING         0.25f
+#define DEFAULT_BENCH_TIMESTEP      (1.0f / 60.0f)
+#define DEFAULT_BENCH_WARMUP_FRAMES 10
+#define DEFAULT_MAP_FILE            "assets/maps/room.map"
+#define DEFAULT_CHUNK_RADIUS        2
+#define DEFAULT_TICK_RATE           120.0f
+#define DEFAULT_TRACE_FILE          "trace.json"
+#define DEFAULT_PROGRAM_CACHE       "shadercache"
+#define DEFAULT_SPRITE_SEED         1
+#define DEFAULT_CAMERA_WIDTH        128
+#define DEFAULT_CAMERA_HEIGHT       72
+// Tiles of the tile map (and texels of every tile), has to match the Constants buffer
+#define DEFAULT_TILE_SIZE           16
+#define DEFAULT_TILE_MAP_SIZE       16
+// Directories above the executable searched for the shaders and assets
+#define DEFAULT_RESOURCE_DEPTH      3
+// Seconds between two checks for modified shaders (with --watch)
+#define DEFAULT_WATCH_INTERVAL      0.25
+
+// Columns (and rows) of the tiles the single pass pipeline shades at a time,
+// has to match TILE_SIZE in shaders/scene.glsl
+#define SCENE_TILE_SIZE             16
+
+// Frames the timestamp queries stay in flight before they are read back
+#define GPU_TIMER_FRAMES            4
+// Frames the per-frame data can be in flight before the CPU waits for the GPU
+#define FRAME_RING_FRAMES           3
+// Bytes of per-frame data every frame can push
+#define FRAME_RING_SIZE             4096
+// Frames the readbacks of the recorded frames stay in flight before they
+// are handed to the video writer
+#define READBACK_FRAMES             3
+
+// GL entry points that rlgl doesn't wrap (timestamp queries, persistently
+// mapped buffers, fences and reading pixels into a buffer)
+#ifndef APIENTRY
+#ifdef _WIN32
+#define APIENTRY __stdcall
+#else
+#define APIENTRY
+#endif
+#endif
+#define GL_TIMESTAMP                0x8E28
+#define GL_QUERY_RESULT             0x8866
+#define GL_QUERY_RESULT_AVAILABLE   0x8867
+#define GL_MAJOR_VERSION            0x821B
+#define GL_MINOR_VERSION            0x821C
+#define GL_NUM_EXTENSIONS           0x821D
+#define GL_EXTENSIONS               0x1F03
+#define GL_SHADER_STORAGE_BUFFER    0x90D2
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#define GL_MAP_WRITE_BIT            0x0002
+#define GL_MAP_PERSISTENT_BIT       0x0040
+#define GL_MAP_COHERENT_BIT         0x0080
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT  0x0001
+#define GL_TIMEOUT_EXPIRED          0x911B
+#define GL_WAIT_FAILED              0x911D
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x0008
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x2000
+#define GL_PIXEL_PACK_BUFFER        0x88EB
+#define GL_MAP_READ_BIT             0x0001
+#define GL_RGBA                     0x1908
+#define GL_UNSIGNED_BYTE            0x1401
+typedef void (APIENTRY *GenQueriesFunc)(int count, unsigned int *ids);
+typedef void (APIENTRY *DeleteQueriesFunc)(int count, const unsigned int *ids);
+typedef void (APIENTRY *QueryCounterFunc)(unsigned int id, unsigned int target);
+typedef void (APIENTRY *GetQueryObjectivFunc)(unsigned int id, unsigned int name, int *value);
+typedef void (APIENTRY *GetQueryObjectui64vFunc)(unsigned int id, unsigned int name, uint64_t *value);
+typedef void (APIENTRY *GetInteger64vFunc)(unsigned int name, int64_t *value);
+typedef void (APIENTRY *GetIntegervFunc)(unsigned int name, int *value);
+typedef const unsigned char *(APIENTRY *GetStringiFunc)(unsigned int name, unsigned int index);
+typedef void (APIENTRY *GenBuffersFunc)(int count, unsigned int *ids);
+typedef void (APIENTRY *DeleteBuffersFunc)(int count, const unsigned int *ids);
+typedef void (APIENTRY *BindBufferFunc)(unsigned int target, unsigned int id);
+typedef void (APIENTRY *BindBufferRangeFunc)(unsigned int target, unsigned int index, unsigned int id, intptr_t offset, intptr_t size);
+typedef void (APIENTRY *BufferStorageFunc)(unsigned int target, intptr_t size, const void *data, unsigned int flags);
+typedef void *(APIENTRY *MapBufferRangeFunc)(unsigned int target, intptr_t offset, intptr_t length, unsigned int access);
+typedef unsigned char (APIENTRY *UnmapBufferFunc)(unsigned int target);
+typedef void *(APIENTRY *FenceSyncFunc)(unsigned int condition, unsigned int flags);
+typedef unsigned int (APIENTRY *ClientWaitSyncFunc)(void *sync, unsigned int flags, uint64_t timeout);
+typedef void (APIENTRY *DeleteSyncFunc)(void *sync);
+typedef void (APIENTRY *MemoryBarrierFunc)(unsigned int barriers);
+typedef void (APIENTRY *ReadPixelsFunc)(int x, int y, int width, int height, unsigned int format, unsigned int type, void *pixels);
+// raylib creates its GL context with GLFW, which can look the entry points up
+typedef void (*GLFWglproc)(void);
+GLFWglproc glfwGetProcAddress(const char *procname);
 
 typedef struct {
     int width;
     int height;
     int dof;
     float fov;
+    float scaling;
 } Viewport;
 
 typedef struct {
-    float prevTime;
+    int columns;
+    int rows;
     float viewportHalfHeight;
     float cameraPlaneHalfWidth;
-    float columnAngleStart;
-    float columnAngleStep;
     Vector2 playerDirection;
     Vector2 cameraPlane;
 } Computed;
 
-typedef struct {
-    Vector2 position;
-    float rotation;
-    float movementSpeed;
-    float rotationSpeed;
-} Player;
-
-typedef struct {
-    int forward;
-    int right;
-    float xMouseDelta;
-} PlayerInput;
-
 typedef struct {
     int width;
     int height;
     int data[];
 } TileTexture;
 
-typedef struct {
-    int ceiling;
-    int wall;
-    int floor;
-    int padding;
-} Tile;
-
+// Header of the MapData buffer, the tiles of every slot of the chunk cache follow it
 typedef struct {
     int width;
     int height;
-    Tile data[];
-} Map;
+    int chunksX;
+    int chunkShift;
+} MapHeader;
 
 typedef struct {
-    int padding;
+    float depth;            // Distance of the wall, read back by the sprites (see wall.glsl)
     int textureId;
-    float brightness;
+    unsigned int luxels;    // Luxels of the wall going down the column, a byte each
     float lineHeight;
     float lineOffset;
     float textureColumnOffset;
@@ -73,68 +158,207 @@ typedef struct {
     int viewportWidth;
     int viewportHeight;
     float viewportHalfHeight;
-    float columnAngleStart;
-    float columnAngleStep;
     int tileSize[2];
     int tileMapSize[2];
 } Constants;
 
+// Camera of a view, the single pass pipeline reads an array of them (see
+// Camera in scene.glsl), the other shaders only read the first fields
 typedef struct {
     Vector2 playerPosition;
     int playerMapCoords[2];
     Vector2 playerTileCoords;
     Vector2 playerDirection;
     Vector2 cameraPlane;
+    int origin[2];          // Top left pixel of the view in the scene image
 } FrameData;
 
+// Wall columns in a compute pass then every pixel in a fragment pass, or
+// everything in a single compute pass that writes the pixels to an image
+typedef enum {
+    PIPELINE_FRAGMENT,
+    PIPELINE_COMPUTE,
+    PIPELINE_COUNT
+} Pipeline;
+
+typedef struct {
+    const char *pathFileName;
+    const char *reportFileName;
+    const char *mapFileName;
+    float timestep;
+    float tickRate;
+    float budget;
+    const char *traceFileName;
+    Pipeline pipeline;
+    bool watch;
+    const char *resourceDirectory;
+    int sprites;
+    int cameras;
+    int cameraWidth;
+    int cameraHeight;
+    bool noVisibility;
+    const char *videoFileName;
+    VideoFormat videoFormat;
+} Options;
+
+typedef enum {
+    STAGE_UPDATE,
+    STAGE_UPLOAD,
+    STAGE_COMPUTE,
+    STAGE_FRAGMENT,
+    STAGE_SPRITES,
+    STAGE_CAMERAS,
+    STAGE_FRAME,
+    STAGE_COUNT
+} Stage;
+
 typedef struct {
     int tileMapLocation;
+    int columnScaleLocation;
     unsigned int ssboColumnsData;
     unsigned int ssboConstants;
     unsigned int ssboMapData;
     unsigned int ssboFrameData;
-    unsigned int wallCompute;
-    Shader renderPipeline;
+    unsigned int ssboOccupancy;
+    unsigned int ssboChunkTable;
+    unsigned int ssboViewTables;
+    unsigned int ssboChunkLuxels;
+    Program wallCompute;
+    Program sceneCompute;
+    Program renderPipeline;
+    Program spritePipeline;
+    double nextWatch;
     RenderTexture2D renderTexture;
+    RenderTexture2D offscreenTexture;
     Texture2D tileMapTexture;
 } Graphics;
 
-// Test data
-static Map TestMap = {
-    .width = 10,
-    .height = 20,
-    .data = {
-        {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0}, {0, 0, 2, 0}, {0, 0, 2, 0}, {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0}, {0, 0, 2, 0}, {0, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {0, 0, 2, 0}, {0, 0, 2, 0}, {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0}, {0, 0, 2, 0}, {0, 0, 2, 0}, {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 0, 2, 0}, {2, 1, 2, 0},
-        {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0}, {2, 1, 2, 0},
-    }
+// Views of many cameras rendered by a single dispatch of the single pass
+// pipeline, tiled in their own render texture (camera i gets the tile
+// i % tilesX, i / tilesX). The views all have the same resolution, so they
+// share their constants and tables
+typedef struct {
+    int count;
+    int width;              // Of every view
+    int height;
+    int tilesX;
+    CameraPose *poses;
+    FrameData *frames;
+    unsigned int ssboColumnsData;
+    unsigned int ssboConstants;
+    unsigned int ssboViewTables;
+    unsigned int ssboFrameData; // Only when the frame ring isn't available
+    RenderTexture2D renderTexture;
+} CameraBatch;
+
+typedef struct {
+    GenQueriesFunc genQueries;
+    DeleteQueriesFunc deleteQueries;
+    QueryCounterFunc queryCounter;
+    GetQueryObjectivFunc getQueryObjectiv;
+    GetQueryObjectui64vFunc getQueryObjectui64v;
+    GetInteger64vFunc getInteger64v;
+    GetIntegervFunc getIntegerv;
+    GetStringiFunc getStringi;
+    GenBuffersFunc genBuffers;
+    DeleteBuffersFunc deleteBuffers;
+    BindBufferFunc bindBuffer;
+    BindBufferRangeFunc bindBufferRange;
+    BufferStorageFunc bufferStorage;
+    MapBufferRangeFunc mapBufferRange;
+    UnmapBufferFunc unmapBuffer;
+    FenceSyncFunc fenceSync;
+    ClientWaitSyncFunc clientWaitSync;
+    DeleteSyncFunc deleteSync;
+    MemoryBarrierFunc memoryBarrier;
+    ReadPixelsFunc readPixels;
+} GLFunctions;
+
+typedef enum {
+    TIMESTAMP_COMPUTE,
+    TIMESTAMP_FRAGMENT,
+    TIMESTAMP_END,
+    TIMESTAMP_COUNT
+} Timestamp;
+
+// Times the passes on the GPU with timestamp queries, the results are read
+// back a few frames later so the CPU never waits for them
+typedef struct {
+    bool available;
+    bool calibrated;
+    double clockOffset;         // GetBenchTime() minus the GPU clock, in seconds
+    int frame;
+    unsigned int queries[GPU_TIMER_FRAMES][TIMESTAMP_COUNT];
+    unsigned int issued[GPU_TIMER_FRAMES];  // Bit mask of the queries issued in every frame
+} GpuTimer;
+
+// Per-frame data goes through a persistently mapped buffer split in a region
+// per frame in flight: every frame writes its own region and binds ranges of
+// it, and a fence tells when the GPU is done with a region so it can be reused.
+// Nothing is ever uploaded into a buffer the GPU may still be reading
+typedef struct {
+    bool available;
+    unsigned int buffer;
+    unsigned char *data;        // Mapped for as long as the buffer exists
+    int alignment;              // Alignment of the ranges bound as storage buffers
+    int stride;                 // Bytes of every region
+    int frame;
+    int offset;                 // Bytes used in the region of the current frame
+    void *fences[FRAME_RING_FRAMES];
+} FrameRing;
+
+// Recorded frames are read back into a persistently mapped pixel buffer
+// split in a region per frame in flight: reading a frame only queues a copy
+// on the GPU, and the region is handed to the video writer READBACK_FRAMES
+// frames later once its fence is signaled, so the CPU never waits for the
+// frame it just submitted. The pixels come bottom up, as GL stores them
+typedef struct {
+    bool available;
+    unsigned int buffer;
+    unsigned char *data;        // Mapped for as long as the buffer exists
+    int width;
+    int height;
+    int frame;                  // Frames read so far
+    void *fences[READBACK_FRAMES];
+} FrameReadback;
+
+static const char *pipelineNames[PIPELINE_COUNT] = {
+    [PIPELINE_FRAGMENT] = "fragment",
+    [PIPELINE_COMPUTE] = "compute",
+};
+
+static const char *stageNames[STAGE_COUNT] = {
+    [STAGE_UPDATE] = "update",
+    [STAGE_UPLOAD] = "upload",
+    [STAGE_COMPUTE] = "compute",
+    [STAGE_FRAGMENT] = "fragment",
+    [STAGE_SPRITES] = "sprites",
+    [STAGE_CAMERAS] = "cameras",
+    [STAGE_FRAME] = "frame",
 };
 
 // Singletons
+static Options O = {0};
 static Graphics G = {0};
+static GpuTimer T = {0};
+static GLFunctions X = {0};
+static FrameRing U = {0};
+static FrameReadback Q = {0};
 static Computed C = {0};
 static PlayerInput I = {false};
-static Map *M = &TestMap;
+static Map M = {0};
+static ChunkCache K = {0};
+static ResolutionController R = {0};
+static SpriteStore S = {0};
+static SpriteList L = {0};
+static CameraBatch B = {0};
+static VisibilitySet Z = {0};
+static Lightmap W = {0};
+static LightmapCache Y = {0};
 static Viewport V = {
     .width = DEFAULT_VIEWPORT_WIDTH,
     .height = DEFAULT_VIEWPORT_HEIGHT,
+    .scaling = DEFAULT_VIEWPORT_SCALING,
     .dof = DEFAULT_VIEWPORT_DOF,
     .fov = DEFAULT_VIEWPORT_FOV,
 };
@@ -145,53 +369,143 @@ static Player P = {
     },
     .rotation = 0.0f,
     .movementSpeed = 2.5f,
-    .rotationSpeed = PI
+    .rotationSpeed = PI,
+    .radius = 0.125f
 };
 
-// Useful defines
-#define MAPSZ (M->width * M->height)
-#define HALF_PI (PI / 2.0f)
+// Creates the tables of a view of columns x rows: the offset of every column
+// along the camera plane, then the distance of the floor and ceiling seen by
+// every row above the horizon (sampled at the center of the pixels)
+static unsigned int LoadViewTables(int columns, int rows) {
+    float halfHeight = rows / 2.0f;
+    int halfRows = (rows + 1) / 2;
+    float *tables = MemAlloc((columns + halfRows) * sizeof(float));
+    for (int n = 0; n < columns; n++) {
+        tables[n] = (2.0f * ((float) n / columns)) - 1.0f;
+    }
+    for (int n = 0; n < halfRows; n++) {
+        tables[columns + n] = halfHeight / (halfHeight - (n + 0.5f));
+    }
+    unsigned int ssbo = rlLoadShaderBuffer((columns + halfRows) * sizeof(float), tables, RL_STATIC_DRAW);
+    MemFree(tables);
+    return ssbo;
+}
 
-static void OnResize(void) {
-    // Update viewport size
-    V.width = GetRenderWidth();
-    V.height = GetRenderHeight();
+static void UpdateConstants(unsigned int ssbo, int columns, int rows) {
+    rlUpdateShaderBufferElements(ssbo, &(Constants) {
+        .depthOfField = V.dof,
+        .viewportWidth = columns,
+        .viewportHeight = rows,
+        .viewportHalfHeight = rows / 2.0f,
+        .tileSize = { DEFAULT_TILE_SIZE, DEFAULT_TILE_SIZE },
+        .tileMapSize = { DEFAULT_TILE_MAP_SIZE, DEFAULT_TILE_MAP_SIZE }
+    }, sizeof(Constants), 0);
+}
+
+static void RecomputeValues(void) {
+    // Compute the resolution the scene is rendered at, it's
+    // stretched over the whole window when it's smaller
+    C.columns = (int) (V.width * V.scaling);
+    C.rows = (int) (V.height * V.scaling);
+    C.columns = (C.columns > 0) ? C.columns : 1;
+    C.rows = (C.rows > 0) ? C.rows : 1;
     // Compute the vertical center of the viewport
-    C.viewportHalfHeight = V.height / 2.0f;
+    C.viewportHalfHeight = C.rows / 2.0f;
     // Compute half the width of the camera plane
     C.cameraPlaneHalfWidth = 1.0f / (2.0f * tanf(V.fov / 2.0f));
-    // Calculate the angle increment for each column ray
-    C.columnAngleStep = V.fov / V.width;
-    // Calculate the angle for the first column ray
-    C.columnAngleStart = P.rotation - V.fov / 2.0f;
     // Recreate columns shader buffer
     if (G.ssboColumnsData) {
         rlUnloadShaderBuffer(G.ssboColumnsData);
     }
-    G.ssboColumnsData = rlLoadShaderBuffer(sizeof(Column) * V.width, NULL, RL_DYNAMIC_COPY);
+    G.ssboColumnsData = rlLoadShaderBuffer(sizeof(Column) * C.columns, NULL, RL_DYNAMIC_COPY);
+    // Rebuild the tables that only depend on the resolution
+    if (G.ssboViewTables) {
+        rlUnloadShaderBuffer(G.ssboViewTables);
+    }
+    G.ssboViewTables = LoadViewTables(C.columns, C.rows);
     // Update shader buffers
-    rlUpdateShaderBufferElements(G.ssboConstants, &(Constants) {
-        .depthOfField = V.dof,
-        .viewportWidth = V.width,
-        .viewportHeight = V.height,
-        .viewportHalfHeight = C.viewportHalfHeight,
-        .columnAngleStart = C.columnAngleStart,
-        .columnAngleStep = C.columnAngleStep,
-        .tileSize = { 16, 16 },
-        .tileMapSize = { 16, 16 }
-    }, sizeof(Constants), 0);
+    UpdateConstants(G.ssboConstants, C.columns, C.rows);
     // Recreate the render texture
     if (G.renderTexture.id) {
         UnloadRenderTexture(G.renderTexture);
     }
-    G.renderTexture = LoadRenderTexture(V.width, V.height);
+    G.renderTexture = LoadRenderTexture(C.columns, C.rows);
+}
+
+// Looks for the shaders next to the executable, then in the directories above
+// it (the build directory is usually inside the project), so the renderer
+// doesn't depend on the working directory. Falls back to the working directory
+static const char *FindResourceDirectory(void) {
+    static char directory[PROGRAM_MAX_PATH] = {0};
+    strncpy(directory, GetApplicationDirectory(), PROGRAM_MAX_PATH - 1);
+    for (int i = 0; i <= DEFAULT_RESOURCE_DEPTH; i++) {
+        // Drop the trailing separator, or the parent would be the directory itself
+        size_t length = strlen(directory);
+        if (length > 1 && (directory[length - 1] == '/' || directory[length - 1] == '\\')) {
+            directory[length - 1] = '\0';
+        }
+        if (FileExists(TextFormat("%s/shaders/wall.glsl", directory))) {
+            return directory;
+        }
+        strncpy(directory, GetPrevDirectoryPath(directory), PROGRAM_MAX_PATH - 1);
+    }
+    return ".";
+}
+
+// Returns the path of a file shipped with the renderer (shaders and assets)
+static const char *GetResourcePath(const char *fileName) {
+    return TextFormat("%s/%s", O.resourceDirectory, fileName);
+}
+
+static void LoadPrograms(void) {
+    double start = GetBenchTime();
+    bool loaded = LoadRenderProgram(&G.renderPipeline, GetResourcePath("shaders/vert.glsl"), GetResourcePath("shaders/frag.glsl"));
+    loaded &= LoadComputeProgram(&G.wallCompute, GetResourcePath("shaders/wall.glsl"));
+    loaded &= LoadComputeProgram(&G.sceneCompute, GetResourcePath("shaders/scene.glsl"));
+    loaded &= LoadRenderProgram(&G.spritePipeline, GetResourcePath("shaders/spritevert.glsl"), GetResourcePath("shaders/spritefrag.glsl"));
+    if (!loaded) {
+        TraceLog(LOG_FATAL, "PROGRAM: Failed to build the shaders");
+    }
+    G.tileMapLocation = GetShaderLocation(GetProgramShader(&G.renderPipeline), "tileMap");
+    G.columnScaleLocation = GetShaderLocation(GetProgramShader(&G.spritePipeline), "columnScale");
+    TraceLog(LOG_INFO, "PROGRAM: Shaders loaded in %.2f ms", (GetBenchTime() - start) * 1000.0);
+}
+
+// Swaps in the programs whose shader files changed, the ones
+// that fail to build keep running their previous version
+static void ReloadPrograms(void) {
+    if (ReloadProgram(&G.renderPipeline)) {
+        G.tileMapLocation = GetShaderLocation(GetProgramShader(&G.renderPipeline), "tileMap");
+    }
+    if (ReloadProgram(&G.spritePipeline)) {
+        G.columnScaleLocation = GetShaderLocation(GetProgramShader(&G.spritePipeline), "columnScale");
+    }
+    ReloadProgram(&G.wallCompute);
+    ReloadProgram(&G.sceneCompute);
+}
+
+static void OnResize(void) {
+    // Update viewport size
+    V.width = GetRenderWidth();
+    V.height = GetRenderHeight();
+    RecomputeValues();
+    // Recreate the offscreen target used when following a camera path
+    if (O.pathFileName) {
+        if (G.offscreenTexture.id) {
+            UnloadRenderTexture(G.offscreenTexture);
+        }
+        G.offscreenTexture = LoadRenderTexture(V.width, V.height);
+    }
 }
 
 static void ProcessInput(void) {
+    ProfileZone zone = BeginProfileZone("input");
     I.forward = IsKeyDown(KEY_W) - IsKeyDown(KEY_S);
     I.right = IsKeyDown(KEY_D) - IsKeyDown(KEY_A);
-    I.xMouseDelta = GetMouseDelta().x;
-    
+    I.xMouse += GetMouseDelta().x;
+    // The simulation thread picks the input up on its next tick
+    SubmitPlayerInput(&I);
+
     switch (GetKeyPressed()) {
         case KEY_F:
             ToggleFullscreen();
@@ -203,127 +517,558 @@ static void ProcessInput(void) {
                 DisableCursor();
             }
             break;
+        case KEY_P:
+            SetProfilerEnabled(!IsProfilerEnabled());
+            break;
+        case KEY_T:
+            ExportProfilerTrace(O.traceFileName);
+            break;
+        case KEY_C:
+            if (X.memoryBarrier) {
+                O.pipeline = (O.pipeline + 1) % PIPELINE_COUNT;
+            }
+            break;
         default:
             break;
     }
+    EndProfileZone(zone);
 }
 
-static void Update(void) {
-    // Calculate frame delta time
-    float nowTime = GetTime();
-    float delta = nowTime - C.prevTime;
-    C.prevTime = nowTime;
-    // Resize viewport and recalculate halfHeight and planeDistance
-    if (IsWindowResized()) {
-        OnResize();
-    }
-    // Camera horizontal rotation
-    P.rotation += I.xMouseDelta * P.rotationSpeed * delta;
-    if (P.rotation < 0.0f) {
-        P.rotation += 2.0f * PI;
-    } else if (P.rotation > 2.0f * PI) {
-        P.rotation -= 2.0f * PI;
-    }
+static void UpdateCamera(void) {
     // Compute player direction
     C.playerDirection.x = cosf(P.rotation);
     C.playerDirection.y = sinf(P.rotation);
     // Compute camera plane offset
     C.cameraPlane.x = -C.playerDirection.y * C.cameraPlaneHalfWidth;
     C.cameraPlane.y = +C.playerDirection.x * C.cameraPlaneHalfWidth;
-    // Calculate the sign of the direction along which we are moving
-    // on the x and y axis respectively
-    float xSign = (P.rotation <= HALF_PI || P.rotation > 3 * HALF_PI) ? +1.0f : -1.0f;
-    float ySign = (P.rotation >= 0.0f && P.rotation < PI) ? +1.0f : -1.0f;
-    // Calculate the padding necessary to not slam the player into a wall
-    float xPad = 0.125f * xSign;
-    float yPad = 0.125f * ySign;
-    // Calculate the distance delta on the x and y axis
-    float x = C.playerDirection.x * delta * P.movementSpeed;
-    float y = C.playerDirection.y * delta * P.movementSpeed;
-    // Player movement
-    Vector2 newPosition = P.position;
-    if (I.forward) {
-        // Remember to add the padding to the distance delta
-        //                              vvvvvvvv
-        newPosition.x = P.position.x + (x + xPad) * I.forward;
-        newPosition.y = P.position.y + (y + yPad) * I.forward;
-        // Check if the newPosition on the x-axis is inside the map
-        if ((int) newPosition.x < M->width) {
-            // Check for player longitudinal collision on the x-axis
-            while (M->data[((int) P.position.y) * M->width + ((int) newPosition.x)].wall) {
-                newPosition.x -= x * I.forward;
-            }
-            // Remember to subtract the padding once we are done
-            // computing the corrected position along the x-axis
-            P.position.x = newPosition.x - (xPad * I.forward);
+}
+
+static void Update(void) {
+    ProfileZone zone = BeginProfileZone("update");
+    // Resize viewport and recalculate halfHeight and planeDistance
+    if (IsWindowResized()) {
+        OnResize();
+    }
+    // Start culling once the visibility set is built in the background
+    FinishVisibilitySetBuild(&Z);
+    // Pick up the shaders edited since the last check
+    if (O.watch && GetBenchTime() >= G.nextWatch) {
+        ReloadPrograms();
+        G.nextWatch = GetBenchTime() + DEFAULT_WATCH_INTERVAL;
+    }
+    // Scale the resolution to keep the frame time under the budget
+    if (O.budget > 0.0f && UpdateResolutionController(&R, GetFrameTime())) {
+        V.scaling = R.scale;
+        RecomputeValues();
+    }
+    // Render the player in between the last two ticks of the simulation
+    SamplePlayerSnapshot(GetPlayerSnapshot(), GetBenchTime(), &P.position, &P.rotation);
+    // Compute player direction and camera plane
+    UpdateCamera();
+    // The cameras of the batch stand where the player is and look all around
+    for (int i = 0; i < B.count; i++) {
+        B.poses[i] = (CameraPose) { P.position, P.rotation + 2.0f * PI * i / B.count };
+    }
+    EndProfileZone(zone);
+}
+
+static void LoadGLFunctions(void) {
+    X.genQueries = (GenQueriesFunc) glfwGetProcAddress("glGenQueries");
+    X.deleteQueries = (DeleteQueriesFunc) glfwGetProcAddress("glDeleteQueries");
+    X.queryCounter = (QueryCounterFunc) glfwGetProcAddress("glQueryCounter");
+    X.getQueryObjectiv = (GetQueryObjectivFunc) glfwGetProcAddress("glGetQueryObjectiv");
+    X.getQueryObjectui64v = (GetQueryObjectui64vFunc) glfwGetProcAddress("glGetQueryObjectui64v");
+    X.getInteger64v = (GetInteger64vFunc) glfwGetProcAddress("glGetInteger64v");
+    X.getIntegerv = (GetIntegervFunc) glfwGetProcAddress("glGetIntegerv");
+    X.getStringi = (GetStringiFunc) glfwGetProcAddress("glGetStringi");
+    X.genBuffers = (GenBuffersFunc) glfwGetProcAddress("glGenBuffers");
+    X.deleteBuffers = (DeleteBuffersFunc) glfwGetProcAddress("glDeleteBuffers");
+    X.bindBuffer = (BindBufferFunc) glfwGetProcAddress("glBindBuffer");
+    X.bindBufferRange = (BindBufferRangeFunc) glfwGetProcAddress("glBindBufferRange");
+    X.bufferStorage = (BufferStorageFunc) glfwGetProcAddress("glBufferStorage");
+    X.mapBufferRange = (MapBufferRangeFunc) glfwGetProcAddress("glMapBufferRange");
+    X.unmapBuffer = (UnmapBufferFunc) glfwGetProcAddress("glUnmapBuffer");
+    X.fenceSync = (FenceSyncFunc) glfwGetProcAddress("glFenceSync");
+    X.clientWaitSync = (ClientWaitSyncFunc) glfwGetProcAddress("glClientWaitSync");
+    X.deleteSync = (DeleteSyncFunc) glfwGetProcAddress("glDeleteSync");
+    X.memoryBarrier = (MemoryBarrierFunc) glfwGetProcAddress("glMemoryBarrier");
+    X.readPixels = (ReadPixelsFunc) glfwGetProcAddress("glReadPixels");
+}
+
+// Returns whether the context is at least version major.minor or has the extension
+static bool IsGLSupported(int major, int minor, const char *extension) {
+    if (!X.getIntegerv || !X.getStringi) {
+        return false;
+    }
+    int contextMajor = 0, contextMinor = 0, extensions = 0;
+    X.getIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    X.getIntegerv(GL_MINOR_VERSION, &contextMinor);
+    if (contextMajor > major || (contextMajor == major && contextMinor >= minor)) {
+        return true;
+    }
+    X.getIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (int i = 0; i < extensions; i++) {
+        if (!strcmp((const char *) X.getStringi(GL_EXTENSIONS, i), extension)) {
+            return true;
         }
-        // Check if the newPosition on the y-axis is inside the map
-        if ((int) newPosition.y < M->height) {
-            // Check for player longitudinal collision on the y-axis
-            while (M->data[((int) newPosition.y) * M->width + ((int) P.position.x)].wall) {
-                newPosition.y -= y * I.forward;
-            }
-            // Same as above, we have to subtract the padding once
-            // we are done correcting the position along the y-axis
-            P.position.y = newPosition.y - (yPad * I.forward);
+    }
+    return false;
+}
+
+static void InitGpuTimer(void) {
+    if (!X.genQueries || !X.deleteQueries || !X.queryCounter || !X.getQueryObjectiv || !X.getQueryObjectui64v || !X.getInteger64v) {
+        TraceLog(LOG_WARNING, "PROFILE: Timestamp queries are not supported, the GPU passes won't be timed");
+        return;
+    }
+    X.genQueries(GPU_TIMER_FRAMES * TIMESTAMP_COUNT, &T.queries[0][0]);
+    T.available = true;
+}
+
+static void ShutdownGpuTimer(void) {
+    if (T.available) {
+        X.deleteQueries(GPU_TIMER_FRAMES * TIMESTAMP_COUNT, &T.queries[0][0]);
+    }
+    T = (GpuTimer) {0};
+}
+
+static void MarkGpuTimestamp(Timestamp timestamp) {
+    if (!T.available || !IsProfilerEnabled()) {
+        return;
+    }
+    int slot = T.frame % GPU_TIMER_FRAMES;
+    X.queryCounter(T.queries[slot][timestamp], GL_TIMESTAMP);
+    T.issued[slot] |= 1u << timestamp;
+}
+
+// Moves on to the next frame and records the passes of the oldest frame in flight
+static void ResolveGpuTimestamps(void) {
+    if (!T.available) {
+        return;
+    }
+    if (!IsProfilerEnabled()) {
+        for (int i = 0; i < GPU_TIMER_FRAMES; i++) {
+            T.issued[i] = 0;
         }
+        T.calibrated = false;
+        return;
     }
-    if (I.right) {
-        // Remember to add the padding to the distance delta
-        //                              vvvvvvvv
-        newPosition.x = P.position.x - (y + yPad) * I.right;
-        newPosition.y = P.position.y + (x + xPad) * I.right;
-        // Check if the newPosition on the x-axis is inside the map
-        if ((int) newPosition.x < M->width) {
-            // Check for player lateral collision on the x-axis
-            while (M->data[((int) P.position.y) * M->width + ((int) newPosition.x)].wall) {
-                newPosition.x += y * I.right;
-            }
-            // Remember to subtract the padding once we are done
-            // computing the corrected position along the x-axis
-            P.position.x = newPosition.x + (yPad * I.right);
+    // Line the GPU clock up with the CPU one every time the profiler is turned on
+    if (!T.calibrated) {
+        int64_t now;
+        X.getInteger64v(GL_TIMESTAMP, &now);
+        T.clockOffset = GetBenchTime() - now * 1e-9;
+        T.calibrated = true;
+    }
+    T.frame++;
+    int slot = T.frame % GPU_TIMER_FRAMES;
+    unsigned int issued = T.issued[slot];
+    T.issued[slot] = 0;
+    if (issued != (1u << TIMESTAMP_COUNT) - 1) {
+        return;
+    }
+    // Drop the frame rather than waiting if the GPU is that far behind
+    int available = 0;
+    X.getQueryObjectiv(T.queries[slot][TIMESTAMP_END], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    double times[TIMESTAMP_COUNT];
+    for (int i = 0; i < TIMESTAMP_COUNT; i++) {
+        uint64_t time;
+        X.getQueryObjectui64v(T.queries[slot][i], GL_QUERY_RESULT, &time);
+        times[i] = time * 1e-9 + T.clockOffset;
+    }
+    RecordGpuProfileZone("gpu compute", times[TIMESTAMP_COMPUTE], times[TIMESTAMP_FRAGMENT]);
+    RecordGpuProfileZone("gpu fragment", times[TIMESTAMP_FRAGMENT], times[TIMESTAMP_END]);
+}
+
+static bool InitFrameRing(int size) {
+    // Persistent mappings need GL 4.4 (or ARB_buffer_storage)
+    if (!X.genBuffers || !X.deleteBuffers || !X.bindBuffer || !X.bindBufferRange || !X.bufferStorage || !X.mapBufferRange || !X.unmapBuffer || !X.fenceSync || !X.clientWaitSync || !X.deleteSync || !IsGLSupported(4, 4, "GL_ARB_buffer_storage")) {
+        TraceLog(LOG_WARNING, "GPU: Persistently mapped buffers are not supported, the frame data will be uploaded every frame");
+        return false;
+    }
+    U.alignment = 1;
+    X.getIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &U.alignment);
+    U.alignment = (U.alignment > 0) ? U.alignment : 1;
+    U.stride = (size + U.alignment - 1) / U.alignment * U.alignment;
+    // Coherent, so the writes are visible to the GPU without flushing them
+    unsigned int flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    X.genBuffers(1, &U.buffer);
+    X.bindBuffer(GL_SHADER_STORAGE_BUFFER, U.buffer);
+    X.bufferStorage(GL_SHADER_STORAGE_BUFFER, U.stride * FRAME_RING_FRAMES, NULL, flags);
+    U.data = X.mapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, U.stride * FRAME_RING_FRAMES, flags);
+    X.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (!U.data) {
+        TraceLog(LOG_WARNING, "GPU: Failed to map the frame data buffer, the frame data will be uploaded every frame");
+        X.deleteBuffers(1, &U.buffer);
+        U = (FrameRing) {0};
+        return false;
+    }
+    U.available = true;
+    return true;
+}
+
+static void ShutdownFrameRing(void) {
+    if (!U.available) {
+        return;
+    }
+    for (int i = 0; i < FRAME_RING_FRAMES; i++) {
+        if (U.fences[i]) {
+            X.deleteSync(U.fences[i]);
         }
-        // Check if the newPosition on the y-axis is inside the map
-        if ((int) newPosition.y < M->height) {
-            // Check for player lateral collision on the y-axis
-            while (M->data[((int) newPosition.y) * M->width + ((int) P.position.x)].wall) {
-                newPosition.y -= x * I.right;
-            }
-            // Same as above, we have to subtract the padding once
-            // we are done correcting the position along the y-axis
-            P.position.y = newPosition.y - (xPad * I.right);
+    }
+    X.bindBuffer(GL_SHADER_STORAGE_BUFFER, U.buffer);
+    X.unmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    X.bindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    X.deleteBuffers(1, &U.buffer);
+    U = (FrameRing) {0};
+}
+
+// Waits until the GPU is done with the region of the frame, which was
+// last used FRAME_RING_FRAMES frames ago (so the wait is usually over at once)
+static void BeginFrameRing(void) {
+    int slot = U.frame % FRAME_RING_FRAMES;
+    U.offset = 0;
+    if (!U.fences[slot]) {
+        return;
+    }
+    unsigned int result;
+    do {
+        result = X.clientWaitSync(U.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    if (result == GL_WAIT_FAILED) {
+        TraceLog(LOG_WARNING, "GPU: Failed to wait for the frame data fence");
+    }
+    X.deleteSync(U.fences[slot]);
+    U.fences[slot] = NULL;
+}
+
+// Copies data in the region of the frame and binds it to a storage buffer binding
+static bool PushFrameRing(const void *data, int size, unsigned int binding) {
+    int offset = (U.offset + U.alignment - 1) / U.alignment * U.alignment;
+    if (offset + size > U.stride) {
+        TraceLog(LOG_WARNING, "GPU: The frame data doesn't fit in %d bytes", U.stride);
+        return false;
+    }
+    int start = (U.frame % FRAME_RING_FRAMES) * U.stride + offset;
+    memcpy(U.data + start, data, size);
+    X.bindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, U.buffer, start, size);
+    U.offset = offset + size;
+    return true;
+}
+
+// Fences the region once the GPU is done with every command of the frame
+static void EndFrameRing(void) {
+    U.fences[U.frame % FRAME_RING_FRAMES] = X.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    U.frame++;
+}
+
+static bool InitFrameReadback(int width, int height) {
+    Q.width = width;
+    Q.height = height;
+    // Same requirements as the frame ring, plus reading into a buffer
+    if (!X.genBuffers || !X.deleteBuffers || !X.bindBuffer || !X.bufferStorage || !X.mapBufferRange || !X.unmapBuffer || !X.fenceSync || !X.clientWaitSync || !X.deleteSync || !X.readPixels || !IsGLSupported(4, 4, "GL_ARB_buffer_storage")) {
+        TraceLog(LOG_WARNING, "GPU: Persistently mapped buffers are not supported, the recorded frames will be read back synchronously");
+        return false;
+    }
+    // Coherent, so the pixels are visible to the CPU once the fence is signaled
+    int size = width * height * (int) sizeof(Color);
+    unsigned int flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    X.genBuffers(1, &Q.buffer);
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, Q.buffer);
+    X.bufferStorage(GL_PIXEL_PACK_BUFFER, (intptr_t) size * READBACK_FRAMES, NULL, flags);
+    Q.data = X.mapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (intptr_t) size * READBACK_FRAMES, flags);
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!Q.data) {
+        TraceLog(LOG_WARNING, "GPU: Failed to map the readback buffer, the recorded frames will be read back synchronously");
+        X.deleteBuffers(1, &Q.buffer);
+        Q = (FrameReadback) { .width = width, .height = height };
+        return false;
+    }
+    Q.available = true;
+    return true;
+}
+
+static void ShutdownFrameReadback(void) {
+    if (!Q.available) {
+        return;
+    }
+    for (int i = 0; i < READBACK_FRAMES; i++) {
+        if (Q.fences[i]) {
+            X.deleteSync(Q.fences[i]);
         }
     }
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, Q.buffer);
+    X.unmapBuffer(GL_PIXEL_PACK_BUFFER);
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    X.deleteBuffers(1, &Q.buffer);
+    Q = (FrameReadback) {0};
 }
 
-static void Render(void) {
+// Waits for the copy of the frame in a region of the readback buffer
+// (queued READBACK_FRAMES frames ago, so it's usually done already)
+// and hands its pixels to the video writer
+static void WriteReadbackFrame(int slot) {
+    unsigned int result;
+    do {
+        result = X.clientWaitSync(Q.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    if (result == GL_WAIT_FAILED) {
+        TraceLog(LOG_WARNING, "GPU: Failed to wait for the readback fence");
+    }
+    X.deleteSync(Q.fences[slot]);
+    Q.fences[slot] = NULL;
+    size_t size = (size_t) Q.width * Q.height * sizeof(Color);
+    memcpy(BeginVideoFrame(), Q.data + slot * size, size);
+    EndVideoFrame();
+}
+
+// Queues the copy of the pixels of a render texture into the readback buffer,
+// after handing the frame read READBACK_FRAMES frames ago to the video writer
+static void ReadBackFrame(RenderTexture2D target) {
+    ProfileZone zone = BeginProfileZone("readback");
+    if (!Q.available) {
+        // Read the texture right away, the CPU waits for the GPU to finish the frame
+        unsigned char *pixels = rlReadTexturePixels(target.texture.id, Q.width, Q.height, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        if (pixels) {
+            memcpy(BeginVideoFrame(), pixels, (size_t) Q.width * Q.height * sizeof(Color));
+            EndVideoFrame();
+            MemFree(pixels);
+        }
+        EndProfileZone(zone);
+        return;
+    }
+    int slot = Q.frame % READBACK_FRAMES;
+    if (Q.fences[slot]) {
+        WriteReadbackFrame(slot);
+    }
+    size_t size = (size_t) Q.width * Q.height * sizeof(Color);
+    rlEnableFramebuffer(target.id);
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, Q.buffer);
+    X.readPixels(0, 0, Q.width, Q.height, GL_RGBA, GL_UNSIGNED_BYTE, (void *) (intptr_t) (slot * size));
+    X.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rlDisableFramebuffer();
+    Q.fences[slot] = X.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    Q.frame++;
+    EndProfileZone(zone);
+}
+
+// Hands the frames still being read back to the video writer, oldest first
+static void FlushFrameReadback(void) {
+    if (!Q.available) {
+        return;
+    }
+    for (int i = 0; i < READBACK_FRAMES; i++) {
+        int slot = (Q.frame + i) % READBACK_FRAMES;
+        if (Q.fences[slot]) {
+            WriteReadbackFrame(slot);
+        }
+    }
+}
+
+static void UploadChunks(void) {
+    // Drop the chunks that left the cache first, their slots may have been reused
+    for (int i = 0; i < K.evictedCount; i++) {
+        rlUpdateShaderBufferElements(G.ssboChunkTable, &(int) {-1}, sizeof(int), K.evicted[i] * sizeof(int));
+    }
+    // Upload the tiles and the luxels of the new chunks, then point the table at them
+    UpdateLightmapCache(&Y, &K, &W);
+    for (int i = 0; i < K.loadedCount; i++) {
+        int slot = K.loaded[i];
+        rlUpdateShaderBufferElements(G.ssboMapData, &K.tiles[slot], sizeof(ChunkTiles), sizeof(MapHeader) + slot * sizeof(ChunkTiles));
+        rlUpdateShaderBufferElements(G.ssboChunkLuxels, &Y.luxels[slot * LIGHTMAP_CHUNK_BYTES], LIGHTMAP_CHUNK_BYTES, slot * LIGHTMAP_CHUNK_BYTES);
+        rlUpdateShaderBufferElements(G.ssboChunkTable, &slot, sizeof(int), K.chunks[slot] * sizeof(int));
+    }
+}
+
+// Shades every pixel from the wall columns, any texture
+// gives the quad its texture coordinates
+static void RenderFragmentPass(void) {
+    bool scaled = C.columns != V.width || C.rows != V.height;
+    if (scaled) {
+        BeginTextureMode(G.renderTexture);
+    }
+    Shader shader = GetProgramShader(&G.renderPipeline);
+    BeginShaderMode(shader);
+    SetShaderValueTexture(shader, G.tileMapLocation, G.tileMapTexture);
+    DrawTexturePro(
+        G.tileMapTexture,
+        (Rectangle) { 0.0f, 0.0f, G.tileMapTexture.width, G.tileMapTexture.height },
+        (Rectangle) { 0.0f, 0.0f, C.columns, C.rows },
+        (Vector2) { 0.0f, 0.0f },
+        0.0f,
+        WHITE
+    );
+    EndShaderMode();
+    MarkGpuTimestamp(TIMESTAMP_END);
+    if (scaled) {
+        // Stretch the scene over the whole window (render textures are upside down)
+        EndTextureMode();
+        DrawTexturePro(
+            G.renderTexture.texture,
+            (Rectangle) { 0.0f, 0.0f, C.columns, -C.rows },
+            (Rectangle) { 0.0f, 0.0f, V.width, V.height },
+            (Vector2) { 0.0f, 0.0f },
+            0.0f,
+            WHITE
+        );
+    }
+}
+
+// Draws the sprites over the scene (at the window resolution), back to
+// front. Every quad carries the depth of its sprite, and the fragment
+// shader drops the pixels of the columns where a wall is closer
+static void RenderSprites(void) {
+    VisibleBlocks visible = GetVisibleBlocks(&Z, &M, (int) P.position.x, (int) P.position.y);
+    SpriteCamera camera = {
+        .position = P.position,
+        .direction = C.playerDirection,
+        .cameraPlane = C.cameraPlane,
+        .columns = C.columns,
+        .farPlane = V.dof,
+        .visible = &visible
+    };
+    int count = ProjectSprites(&S, &camera, &L);
+    if (!count) {
+        return;
+    }
+    float columnWidth = (float) V.width / C.columns;
+    float rowHeight = (float) V.height / C.rows;
+    float tileWidth = (float) DEFAULT_TILE_SIZE / G.tileMapTexture.width;
+    float tileHeight = (float) DEFAULT_TILE_SIZE / G.tileMapTexture.height;
+    Shader shader = GetProgramShader(&G.spritePipeline);
+    BeginShaderMode(shader);
+    SetShaderValue(shader, G.columnScaleLocation, &(float) { 1.0f / columnWidth }, SHADER_UNIFORM_FLOAT);
+    for (int i = 0; i < count; i++) {
+        const ProjectedSprite *sprite = &L.sprites[i];
+        // Sprites stand on the floor and are as tall as a wall times
+        // their size (the walls are rows / distance rows tall)
+        float lineHeight = C.rows / sprite->depth;
+        float bottom = (C.rows + lineHeight) / 2.0f * rowHeight;
+        float top = bottom - lineHeight * sprite->size * rowHeight;
+        float left = (sprite->center - sprite->halfWidth) * columnWidth;
+        float right = (sprite->center + sprite->halfWidth) * columnWidth;
+        float u = (sprite->textureId % DEFAULT_TILE_MAP_SIZE) * tileWidth;
+        float v = (sprite->textureId / DEFAULT_TILE_MAP_SIZE) * tileHeight;
+        // Same as DrawTexturePro(), the quads go into the current batch
+        rlCheckRenderBatchLimit(4);
+        rlSetTexture(G.tileMapTexture.id);
+        rlBegin(RL_QUADS);
+        rlColor4ub(255, 255, 255, 255);
+        rlTexCoord2f(u, v);
+        rlVertex3f(left, top, sprite->depth);
+        rlTexCoord2f(u, v + tileHeight);
+        rlVertex3f(left, bottom, sprite->depth);
+        rlTexCoord2f(u + tileWidth, v + tileHeight);
+        rlVertex3f(right, bottom, sprite->depth);
+        rlTexCoord2f(u + tileWidth, v);
+        rlVertex3f(right, top, sprite->depth);
+        rlEnd();
+    }
+    rlSetTexture(0);
+    EndShaderMode();
+}
+
+static void RenderScene(void) {
     // Compute the starting map coordinates
     Vector2 worldCoords = { (int) P.position.x, (int) P.position.y };
     // Compute the player's coordinates inside the tile
     Vector2 tileCoords = Vector2Subtract(P.position, worldCoords);
 
-    rlUpdateShaderBufferElements(G.ssboFrameData, &(FrameData) {
+    double uploadStart = GetBenchTime();
+    ProfileZone zone = BeginProfileZone("upload");
+    // Stream in the chunks around the player that can be seen from where it is
+    VisibleBlocks visible = GetVisibleBlocks(&Z, &M, (int) worldCoords.x, (int) worldCoords.y);
+    UpdateChunkCache(&K, &M, (int) worldCoords.x, (int) worldCoords.y, IsChunkVisible, &visible);
+    UploadChunks();
+    FrameData frameData = {
         .playerPosition = P.position,
         .playerMapCoords = { (int) worldCoords.x, (int) worldCoords.y },
         .playerTileCoords = tileCoords,
         .playerDirection = C.playerDirection,
         .cameraPlane = C.cameraPlane,
-    }, sizeof(FrameData), 0);
+    };
+    // Write the frame data straight into the mapped ring (binding its range),
+    // or upload it when persistent mappings are not available
+    if (U.available) {
+        BeginFrameRing();
+        PushFrameRing(&frameData, sizeof(FrameData), 4);
+    } else {
+        rlUpdateShaderBufferElements(G.ssboFrameData, &frameData, sizeof(FrameData), 0);
+        rlBindShaderBuffer(G.ssboFrameData, 4);
+    }
+
+    EndProfileZone(zone);
 
     rlBindShaderBuffer(G.ssboColumnsData, 1);
     rlBindShaderBuffer(G.ssboConstants, 2);
     rlBindShaderBuffer(G.ssboMapData, 3);
-    rlBindShaderBuffer(G.ssboFrameData, 4);
+    rlBindShaderBuffer(G.ssboOccupancy, 5);
+    rlBindShaderBuffer(G.ssboChunkTable, 6);
+    rlBindShaderBuffer(G.ssboViewTables, 7);
+    rlBindShaderBuffer(G.ssboChunkLuxels, 8);
 
     // Compute shader
-    rlEnableShader(G.wallCompute);
-    rlComputeShaderDispatch((unsigned int) ceilf((float) V.width / 256), 1, 1);
-    rlDisableShader();
-    // Fragment shader
-    BeginShaderMode(G.renderPipeline);
-    SetShaderValueTexture(G.renderPipeline, G.tileMapLocation, G.tileMapTexture);
-    DrawTexture(G.renderTexture.texture, 0, 0, WHITE);
-    EndShaderMode();
+    double computeStart = GetBenchTime();
+    zone = BeginProfileZone("compute");
+    MarkGpuTimestamp(TIMESTAMP_COMPUTE);
+    if (O.pipeline == PIPELINE_COMPUTE) {
+        // Cast, shade and write every pixel of the scene in a single pass
+        rlBindImageTexture(G.renderTexture.texture.id, 0, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, false);
+        rlActiveTextureSlot(1);
+        rlEnableTexture(G.tileMapTexture.id);
+        rlEnableShader(G.sceneCompute.id);
+        rlComputeShaderDispatch((unsigned int) ceilf((float) C.columns / SCENE_TILE_SIZE), 1, 1);
+        rlDisableShader();
+        rlDisableTexture();
+        rlActiveTextureSlot(0);
+        // The scene is sampled as a texture right after, and the
+        // columns are read by the sprites
+        X.memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    } else {
+        rlEnableShader(G.wallCompute.id);
+        rlComputeShaderDispatch((unsigned int) ceilf((float) C.columns / 256), 1, 1);
+        rlDisableShader();
+        // The columns are read by the fragment shader right after
+        if (X.memoryBarrier) {
+            X.memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+    }
+    MarkGpuTimestamp(TIMESTAMP_FRAGMENT);
+    EndProfileZone(zone);
+    double fragmentStart = GetBenchTime();
+    zone = BeginProfileZone("fragment");
+    if (O.pipeline == PIPELINE_COMPUTE) {
+        // Stretch the scene over the whole window (the image
+        // was written top to bottom, so it's not upside down)
+        DrawTexturePro(
+            G.renderTexture.texture,
+            (Rectangle) { 0.0f, 0.0f, C.columns, C.rows },
+            (Rectangle) { 0.0f, 0.0f, V.width, V.height },
+            (Vector2) { 0.0f, 0.0f },
+            0.0f,
+            WHITE
+        );
+        rlDrawRenderBatchActive();
+        MarkGpuTimestamp(TIMESTAMP_END);
+    } else {
+        RenderFragmentPass();
+    }
+    EndProfileZone(zone);
+    double spritesStart = GetBenchTime();
+    zone = BeginProfileZone("sprites");
+    RenderSprites();
+    if (U.available) {
+        EndFrameRing();
+    }
+    EndProfileZone(zone);
+    // These only measure how long it takes to submit the work, the GPU
+    // catches up when the frame is presented (which is part of the frame stage)
+    RecordBenchStage(STAGE_UPLOAD, computeStart - uploadStart);
+    RecordBenchStage(STAGE_COMPUTE, fragmentStart - computeStart);
+    RecordBenchStage(STAGE_FRAGMENT, spritesStart - fragmentStart);
+    RecordBenchStage(STAGE_SPRITES, GetBenchTime() - spritesStart);
 
     //#define COLUMNS 256
     //Column col[COLUMNS];
@@ -345,11 +1090,223 @@ static void Render(void) {
     //DrawLine(P.position.x * 64, P.position.y * 64, (P.position.x + C.playerDirection.x) * 64, (P.position.y + C.playerDirection.y) * 64, DARKBLUE);
     //DrawLine((P.position.x + C.playerDirection.x) * 64, (P.position.y + C.playerDirection.y) * 64,(P.position.x + C.playerDirection.x + C.cameraPlane.x) * 64, (P.position.y + C.playerDirection.y + C.cameraPlane.y) * 64, GOLD);
     //DrawLine((P.position.x + C.playerDirection.x) * 64, (P.position.y + C.playerDirection.y) * 64,(P.position.x + C.playerDirection.x - C.cameraPlane.x) * 64, (P.position.y + C.playerDirection.y - C.cameraPlane.y) * 64, GOLD);
+}
+
+static bool InitCameraBatch(int count, int width, int height) {
+    B.count = count;
+    B.width = width;
+    B.height = height;
+    // Lay the views out in a grid as square as possible
+    B.tilesX = (int) ceilf(sqrtf((float) count));
+    int tilesY = (count + B.tilesX - 1) / B.tilesX;
+    B.poses = MemAlloc(count * sizeof(CameraPose));
+    B.frames = MemAlloc(count * sizeof(FrameData));
+    if (!B.poses || !B.frames) {
+        return false;
+    }
+    B.ssboColumnsData = rlLoadShaderBuffer(count * width * sizeof(Column), NULL, RL_DYNAMIC_COPY);
+    B.ssboConstants = rlLoadShaderBuffer(sizeof(Constants), NULL, RL_STATIC_DRAW);
+    UpdateConstants(B.ssboConstants, width, height);
+    B.ssboViewTables = LoadViewTables(width, height);
+    if (!U.available) {
+        B.ssboFrameData = rlLoadShaderBuffer(count * sizeof(FrameData), NULL, RL_DYNAMIC_DRAW);
+    }
+    B.renderTexture = LoadRenderTexture(B.tilesX * width, tilesY * height);
+    return B.ssboColumnsData && B.ssboConstants && B.ssboViewTables && B.renderTexture.id;
+}
 
+static void UnloadCameraBatch(void) {
+    if (!B.count) {
+        return;
+    }
+    if (B.ssboFrameData) {
+        rlUnloadShaderBuffer(B.ssboFrameData);
+    }
+    rlUnloadShaderBuffer(B.ssboViewTables);
+    rlUnloadShaderBuffer(B.ssboConstants);
+    rlUnloadShaderBuffer(B.ssboColumnsData);
+    UnloadRenderTexture(B.renderTexture);
+    MemFree(B.frames);
+    MemFree(B.poses);
+    B = (CameraBatch) {0};
+}
+
+// Renders the views of the first count cameras of the batch into their tiles
+// with a single dispatch of the single pass pipeline (whatever the pipeline
+// picked), then stretches the tiles over the window. The sprites aren't
+// drawn, and the cameras only see the chunks cached around the first one
+static void RenderCameras(const CameraPose *poses, int count) {
+    if (count > B.count) {
+        count = B.count;
+    }
+    if (count <= 0) {
+        return;
+    }
+    double camerasStart = GetBenchTime();
+    ProfileZone zone = BeginProfileZone("cameras");
+    UpdateChunkCache(&K, &M, (int) poses[0].position.x, (int) poses[0].position.y, NULL, NULL);
+    UploadChunks();
+    for (int i = 0; i < count; i++) {
+        Vector2 position = poses[i].position;
+        Vector2 direction = { cosf(poses[i].rotation), sinf(poses[i].rotation) };
+        B.frames[i] = (FrameData) {
+            .playerPosition = position,
+            .playerMapCoords = { (int) position.x, (int) position.y },
+            .playerTileCoords = { position.x - (int) position.x, position.y - (int) position.y },
+            .playerDirection = direction,
+            .cameraPlane = { -direction.y * C.cameraPlaneHalfWidth, +direction.x * C.cameraPlaneHalfWidth },
+            .origin = { (i % B.tilesX) * B.width, (i / B.tilesX) * B.height }
+        };
+    }
+    // All the cameras go in at once, as the array read by the shader
+    if (U.available) {
+        BeginFrameRing();
+        PushFrameRing(B.frames, count * sizeof(FrameData), 4);
+    } else {
+        rlUpdateShaderBufferElements(B.ssboFrameData, B.frames, count * sizeof(FrameData), 0);
+        rlBindShaderBuffer(B.ssboFrameData, 4);
+    }
+    rlBindShaderBuffer(B.ssboColumnsData, 1);
+    rlBindShaderBuffer(B.ssboConstants, 2);
+    rlBindShaderBuffer(G.ssboMapData, 3);
+    rlBindShaderBuffer(G.ssboOccupancy, 5);
+    rlBindShaderBuffer(G.ssboChunkTable, 6);
+    rlBindShaderBuffer(B.ssboViewTables, 7);
+    rlBindShaderBuffer(G.ssboChunkLuxels, 8);
+    // Every row of workgroups draws the view of a camera
+    MarkGpuTimestamp(TIMESTAMP_COMPUTE);
+    rlBindImageTexture(B.renderTexture.texture.id, 0, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, false);
+    rlActiveTextureSlot(1);
+    rlEnableTexture(G.tileMapTexture.id);
+    rlEnableShader(G.sceneCompute.id);
+    rlComputeShaderDispatch((unsigned int) ceilf((float) B.width / SCENE_TILE_SIZE), count, 1);
+    rlDisableShader();
+    rlDisableTexture();
+    rlActiveTextureSlot(0);
+    // The views are sampled as a texture right after
+    X.memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    MarkGpuTimestamp(TIMESTAMP_FRAGMENT);
+    DrawTexturePro(
+        B.renderTexture.texture,
+        (Rectangle) { 0.0f, 0.0f, B.renderTexture.texture.width, B.renderTexture.texture.height },
+        (Rectangle) { 0.0f, 0.0f, V.width, V.height },
+        (Vector2) { 0.0f, 0.0f },
+        0.0f,
+        WHITE
+    );
+    rlDrawRenderBatchActive();
+    MarkGpuTimestamp(TIMESTAMP_END);
+    if (U.available) {
+        EndFrameRing();
+    }
+    EndProfileZone(zone);
+    RecordBenchStage(STAGE_CAMERAS, GetBenchTime() - camerasStart);
+}
+
+static void Render(void) {
+    // With a batch of cameras, show their views instead of the player's
+    if (B.count) {
+        RenderCameras(B.poses, B.count);
+    } else {
+        RenderScene();
+    }
+
+    // Keep the overlays out of the recorded frames
+    if (O.videoFileName) {
+        return;
+    }
     DrawFPS(10, 10);
+    if (O.budget > 0.0f) {
+        DrawText(TextFormat("%dx%d", C.columns, C.rows), 10, 30, 20, LIME);
+    }
+    DrawProfilerOverlay(10, 60);
+}
+
+static void ParseArguments(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--width") && i + 1 < argc) {
+            V.width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--height") && i + 1 < argc) {
+            V.height = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--path") && i + 1 < argc) {
+            O.pathFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--report") && i + 1 < argc) {
+            O.reportFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--timestep") && i + 1 < argc) {
+            O.timestep = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--map") && i + 1 < argc) {
+            O.mapFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--tickrate") && i + 1 < argc) {
+            O.tickRate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--budget") && i + 1 < argc) {
+            O.budget = atof(argv[++i]) / 1000.0f;
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            O.traceFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--watch")) {
+            O.watch = true;
+        } else if (!strcmp(argv[i], "--sprites") && i + 1 < argc) {
+            O.sprites = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cameras") && i + 1 < argc) {
+            O.cameras = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--camera-size") && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &O.cameraWidth, &O.cameraHeight);
+        } else if (!strcmp(argv[i], "--no-pvs")) {
+            O.noVisibility = true;
+        } else if (!strcmp(argv[i], "--video") && i + 1 < argc) {
+            O.videoFileName = argv[++i];
+        } else if (!strcmp(argv[i], "--video-format") && i + 1 < argc) {
+            const char *name = argv[++i];
+            for (int format = 0; format < VIDEO_FORMAT_COUNT; format++) {
+                if (!strcmp(name, GetVideoFormatName(format))) {
+                    O.videoFormat = format;
+                }
+            }
+        } else if (!strcmp(argv[i], "--pipeline") && i + 1 < argc) {
+            const char *name = argv[++i];
+            for (int pipeline = 0; pipeline < PIPELINE_COUNT; pipeline++) {
+                if (!strcmp(name, pipelineNames[pipeline])) {
+                    O.pipeline = pipeline;
+                }
+            }
+        }
+    }
+    if (O.timestep <= 0.0f) {
+        O.timestep = DEFAULT_BENCH_TIMESTEP;
+    }
+    O.resourceDirectory = FindResourceDirectory();
+    // Camera paths are always rendered at the full resolution, and
+    // only write a trace when asked to (interactive runs export it on T)
+    if (O.pathFileName) {
+        O.budget = 0.0f;
+    } else if (!O.traceFileName) {
+        O.traceFileName = DEFAULT_TRACE_FILE;
+    }
+    // Only the frames of a camera path are recorded
+    if (!O.pathFileName) {
+        O.videoFileName = NULL;
+    }
+    if (O.tickRate <= 0.0f) {
+        O.tickRate = DEFAULT_TICK_RATE;
+    }
+    if (O.sprites < 0) {
+        O.sprites = 0;
+    }
+    if (O.cameras < 0) {
+        O.cameras = 0;
+    }
+    if (O.cameraWidth <= 0 || O.cameraHeight <= 0) {
+        O.cameraWidth = DEFAULT_CAMERA_WIDTH;
+        O.cameraHeight = DEFAULT_CAMERA_HEIGHT;
+    }
 }
 
 static void Init(void) {
+    SetProfilerThreadName("main");
+    // Keep the window hidden when following a camera path,
+    // the frames are rendered into an offscreen texture
+    if (O.pathFileName) {
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    }
     // Create window
     InitWindow(
         V.width, 
@@ -357,52 +1314,234 @@ static void Init(void) {
         DEFAULT_WINDOW_TITLE
     );
     // Make window resizable
-    SetWindowState(FLAG_WINDOW_RESIZABLE);
+    if (!O.pathFileName) {
+        SetWindowState(FLAG_WINDOW_RESIZABLE);
+    }
     // Load tilemap
-    G.tileMapTexture = LoadTexture("assets/textures/tilemap.png");
-    // Load fragment shader
-    G.renderPipeline = LoadShader(NULL, "shaders/frag.glsl");
-    // Load wall compute shader
-    char *wallComputeSource = LoadFileText("shaders/wall.glsl");
-    unsigned int wallComputeShader = rlCompileShader(wallComputeSource, RL_COMPUTE_SHADER);
-    G.wallCompute = rlLoadComputeShaderProgram(wallComputeShader);
-    UnloadFileText(wallComputeSource);
-    // Create shader buffers (S.ssboColumnData is created in OnResize())
-    G.ssboMapData = rlLoadShaderBuffer(sizeof(Map) + MAPSZ * sizeof(Tile), NULL, RL_STATIC_DRAW);
+    G.tileMapTexture = LoadTexture(GetResourcePath("assets/textures/tilemap.png"));
+    // Load the shaders, from the binaries cached next to the executable
+    // when they didn't change since the last launch
+    InitProgramCache(TextFormat("%s%s", GetApplicationDirectory(), DEFAULT_PROGRAM_CACHE));
+    LoadPrograms();
+    // Map the map file, its chunks are only read once the player gets close to them
+    const char *mapFileName = (O.mapFileName) ? O.mapFileName : GetResourcePath(DEFAULT_MAP_FILE);
+    if (!LoadMap(&M, mapFileName)) {
+        TraceLog(LOG_FATAL, "MAP: Failed to load %s", mapFileName);
+    }
+    if (!InitChunkCache(&K, &M, DEFAULT_CHUNK_RADIUS)) {
+        TraceLog(LOG_FATAL, "MAP: Failed to allocate the chunk cache");
+    }
+    if (!InitLightmapCache(&Y, &K)) {
+        TraceLog(LOG_FATAL, "LIGHTMAP: Failed to allocate the lightmap cache");
+    }
+    // Scatter the sprites over the empty cells of the map
+    if (!InitSpriteStore(&S, O.sprites, M.width, M.height) || !InitSpriteList(&L, O.sprites)) {
+        TraceLog(LOG_FATAL, "SPRITE: Failed to allocate %d sprites", O.sprites);
+    }
+    ScatterSprites(&S, &M.occupancy, O.sprites, DEFAULT_TILE_MAP_SIZE * DEFAULT_TILE_MAP_SIZE, DEFAULT_SPRITE_SEED);
+    // Load what can be seen from every block of the map and the light reaching
+    // its surfaces from next to the map file, or build them the first time (on
+    // a pool that only lives for the builds). The benchmark waits for the
+    // visibility set, the window builds it in the background instead
+    if (!InitPool(GetProcessorCount() - 1)) {
+        TraceLog(LOG_WARNING, "POOL: Only %d of %d workers could be spawned", GetPoolWorkerCount(), GetProcessorCount() - 1);
+    }
+    if (!O.noVisibility && O.pathFileName && !LoadOrBuildVisibilitySet(&Z, &M, V.dof, TextFormat("%s.pvs", mapFileName))) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to build the visibility set, nothing will be culled");
+    }
+    if (!LoadOrBakeLightmap(&W, &M, TextFormat("%s.lightmap", mapFileName))) {
+        TraceLog(LOG_FATAL, "LIGHTMAP: Failed to bake the lightmap of %s", mapFileName);
+    }
+    ShutdownPool();
+    if (!O.noVisibility && !O.pathFileName && !LoadOrStartVisibilitySet(&Z, &M, V.dof, TextFormat("%s.pvs", mapFileName), GetProcessorCount() - 1)) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to build the visibility set, nothing will be culled");
+    }
+    // Create shader buffers (S.ssboColumnData is created in OnResize()), the map
+    // data only has room for the slots of the cache, not for the whole map
+    size_t mapDataSize = sizeof(MapHeader) + K.capacity * sizeof(ChunkTiles);
+    G.ssboMapData = rlLoadShaderBuffer(mapDataSize, NULL, RL_DYNAMIC_DRAW);
+    G.ssboChunkTable = rlLoadShaderBuffer(K.chunksX * K.chunksY * sizeof(int), NULL, RL_DYNAMIC_DRAW);
+    G.ssboChunkLuxels = rlLoadShaderBuffer(K.capacity * LIGHTMAP_CHUNK_BYTES, NULL, RL_DYNAMIC_DRAW);
     G.ssboConstants = rlLoadShaderBuffer(sizeof(Constants), NULL, RL_STATIC_DRAW);
-    G.ssboFrameData = rlLoadShaderBuffer(sizeof(FrameData), NULL, RL_DYNAMIC_DRAW);
-    // Get tilemap uniform location
-    G.tileMapLocation = GetShaderLocation(G.renderPipeline, "tileMap");
+    // The frame data goes through a ring of mapped buffers when the GL
+    // supports it (with room for the cameras of the batch)
+    LoadGLFunctions();
+    // The single pass pipeline and the camera batches sample the image they
+    // just wrote, which can't be done safely without a memory barrier
+    if (!X.memoryBarrier && (O.pipeline == PIPELINE_COMPUTE || O.cameras > 0)) {
+        TraceLog(LOG_WARNING, "GPU: Memory barriers are not supported, falling back to the fragment pipeline without cameras");
+        O.pipeline = PIPELINE_FRAGMENT;
+        O.cameras = 0;
+    }
+    if (!InitFrameRing(FRAME_RING_SIZE + O.cameras * (int) sizeof(FrameData))) {
+        G.ssboFrameData = rlLoadShaderBuffer(sizeof(FrameData), NULL, RL_DYNAMIC_DRAW);
+    }
+    // Time the compute and fragment passes when the profiler is on
+    InitGpuTimer();
     // Initialize computed values
     OnResize();
-    // Initialize buffers (S.ssboConstants is initialized in OnResize())
-    rlUpdateShaderBufferElements(G.ssboMapData, M, sizeof(Map) + MAPSZ * sizeof(Tile), 0);
-    // Capture mouse
-    DisableCursor();
-    // Initialize previous frame time to now
-    C.prevTime = GetTime();
+    // The header of the occupancy grid matches the buffer layout, the bits follow it
+    size_t occupancyHeaderSize = offsetof(OccupancyGrid, bits);
+    G.ssboOccupancy = rlLoadShaderBuffer(occupancyHeaderSize + M.occupancy.words * sizeof(unsigned int), NULL, RL_STATIC_DRAW);
+    // Initialize buffers (S.ssboConstants is initialized in OnResize()), the
+    // chunk table starts out empty and the chunks are uploaded as they are cached
+    rlUpdateShaderBufferElements(G.ssboMapData, &(MapHeader) {
+        .width = M.width,
+        .height = M.height,
+        .chunksX = M.chunksX,
+        .chunkShift = MAP_CHUNK_SHIFT
+    }, sizeof(MapHeader), 0);
+    rlUpdateShaderBufferElements(G.ssboChunkTable, K.slots, K.chunksX * K.chunksY * sizeof(int), 0);
+    rlUpdateShaderBufferElements(G.ssboOccupancy, &M.occupancy, occupancyHeaderSize, 0);
+    rlUpdateShaderBufferElements(G.ssboOccupancy, M.occupancy.bits, M.occupancy.words * sizeof(unsigned int), occupancyHeaderSize);
+    // Tile the views of the batch of cameras in their own render texture
+    if (O.cameras > 0 && !InitCameraBatch(O.cameras, O.cameraWidth, O.cameraHeight)) {
+        TraceLog(LOG_FATAL, "CAMERA: Failed to allocate %d views of %dx%d", O.cameras, O.cameraWidth, O.cameraHeight);
+    }
+    // Stream the frames rendered along the path, as they look in the offscreen target
+    if (O.videoFileName) {
+        if (!InitVideoWriter(O.videoFileName, O.videoFormat, V.width, V.height, 1.0f / O.timestep, true)) {
+            TraceLog(LOG_FATAL, "VIDEO: Failed to open %s", O.videoFileName);
+        }
+        InitFrameReadback(V.width, V.height);
+    }
+    // Capture mouse and move the player on its own thread at a fixed rate,
+    // so the cost of the simulation never adds up to the frame time
+    if (!O.pathFileName) {
+        DisableCursor();
+        if (!InitSimulation(&P, &M, O.tickRate)) {
+            TraceLog(LOG_FATAL, "SIM: Failed to start the simulation thread");
+        }
+    }
+    // Start at full resolution and let the frame times bring it down
+    if (O.budget > 0.0f) {
+        InitResolutionController(&R, O.budget, DEFAULT_MIN_SCALING, V.scaling);
+    }
 }
 
 static void Shutdown(void) {
-    rlUnloadShaderBuffer(G.ssboFrameData);
+    ShutdownSimulation();
+    ShutdownFrameReadback();
+    ShutdownVideoWriter();
+    ShutdownGpuTimer();
+    ShutdownProfiler();
+    UnloadCameraBatch();
+    ShutdownFrameRing();
+    if (G.ssboFrameData) {
+        rlUnloadShaderBuffer(G.ssboFrameData);
+    }
     rlUnloadShaderBuffer(G.ssboMapData);
+    rlUnloadShaderBuffer(G.ssboOccupancy);
+    rlUnloadShaderBuffer(G.ssboChunkTable);
+    rlUnloadShaderBuffer(G.ssboChunkLuxels);
+    rlUnloadShaderBuffer(G.ssboViewTables);
     rlUnloadShaderBuffer(G.ssboConstants);
     rlUnloadShaderBuffer(G.ssboColumnsData);
-    rlUnloadShaderProgram(G.wallCompute);
-    UnloadShader(G.renderPipeline);
+    UnloadProgram(&G.wallCompute);
+    UnloadProgram(&G.sceneCompute);
+    UnloadProgram(&G.renderPipeline);
+    UnloadProgram(&G.spritePipeline);
     UnloadRenderTexture(G.renderTexture);
+    if (G.offscreenTexture.id) {
+        UnloadRenderTexture(G.offscreenTexture);
+    }
     UnloadTexture(G.tileMapTexture);
+    StopVisibilitySetBuild();
+    UnloadVisibilitySet(&Z);
+    UnloadLightmap(&W);
+    UnloadLightmapCache(&Y);
+    UnloadSpriteList(&L);
+    UnloadSpriteStore(&S);
+    UnloadChunkCache(&K);
+    UnloadMap(&M);
     CloseWindow();
 }
 
+static int RunBenchmark(void) {
+    CameraPath path;
+    if (!LoadCameraPath(O.pathFileName, &path)) {
+        return 1;
+    }
+    // Render a few frames from the start of the path
+    // to warm up the driver before timing
+    SampleCameraPath(&path, 0.0f, &P.position, &P.rotation);
+    UpdateCamera();
+    if (B.count) {
+        SampleCameraPathPoses(&path, 0.0f, B.poses, B.count);
+    }
+    for (int i = 0; i < DEFAULT_BENCH_WARMUP_FRAMES; i++) {
+        BeginDrawing();
+        BeginTextureMode(G.offscreenTexture);
+        Render();
+        EndTextureMode();
+        EndDrawing();
+    }
+    // Follow the path with a fixed timestep
+    int frames = (int) (GetCameraPathDuration(&path) / O.timestep) + 1;
+    InitBench(stageNames, STAGE_COUNT, frames);
+    // With a batch of cameras, every frame renders one view per camera,
+    // the cameras spread evenly along the path
+    if (B.count) {
+        SetBenchViewCount(B.count);
+    }
+    // Only profile the frames that are timed
+    SetProfilerEnabled(O.traceFileName != NULL);
+    for (int frame = 0; IsBenchRunning(); frame++) {
+        double frameStart = GetBenchTime();
+        SampleCameraPath(&path, frame * O.timestep, &P.position, &P.rotation);
+        UpdateCamera();
+        if (B.count) {
+            SampleCameraPathPoses(&path, frame * O.timestep, B.poses, B.count);
+        }
+        RecordBenchStage(STAGE_UPDATE, GetBenchTime() - frameStart);
+        BeginDrawing();
+        BeginTextureMode(G.offscreenTexture);
+        Render();
+        EndTextureMode();
+        if (O.videoFileName) {
+            ReadBackFrame(G.offscreenTexture);
+        }
+        ProfileZone zone = BeginProfileZone("present");
+        EndDrawing();
+        EndProfileZone(zone);
+        ResolveGpuTimestamps();
+        RecordBenchStage(STAGE_FRAME, GetBenchTime() - frameStart);
+        NextBenchFrame();
+    }
+    if (O.videoFileName) {
+        FlushFrameReadback();
+    }
+    // The resolution reported is the one of every view
+    ExportBenchReport(O.reportFileName, "gpu", TextFormat(
+        "\"width\": %d, \"height\": %d, \"columns\": %d, \"rows\": %d, \"pipeline\": \"%s\", \"sprites\": %d, \"pvs\": %s, \"timestep\": %f",
+        V.width, V.height, B.count ? B.width : C.columns, B.count ? B.height : C.rows, pipelineNames[O.pipeline], O.sprites, Z.bits ? "true" : "false", O.timestep
+    ));
+    if (O.traceFileName) {
+        ExportProfilerTrace(O.traceFileName);
+    }
+    ShutdownBench();
+    UnloadCameraPath(&path);
+    return 0;
+}
+
 int main(int argc, char **argv, char **envp) {
+    ParseArguments(argc, argv);
     Init();
+    if (O.pathFileName) {
+        int result = RunBenchmark();
+        Shutdown();
+        return result;
+    }
     while (!WindowShouldClose()) {
         BeginDrawing();
         ProcessInput();
         Update();
         Render();
+        ProfileZone zone = BeginProfileZone("present");
         EndDrawing();
+        EndProfileZone(zone);
+        ResolveGpuTimestamps();
+        NextProfilerFrame();
     }
     Shutdown();
     return 0;
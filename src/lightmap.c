@@ -0,0 +1,351 @@
+#include "lightmap.h"
+#include <raylib.h>
+#include <raymath.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "pool.h"
+
+// Distance between the samples of the area lights (in cells), and the
+// most samples along each side of a light
+#define AREA_SAMPLE_SPACING     0.25f
+#define AREA_MAX_SAMPLES        8
+// Share of the ambient light reaching the faces facing y, so the walls
+// keep the contrast between their sides where no light reaches them
+#define AMBIENT_FACE_Y          0.75f
+// Distance of the points of the faces from the wall, so they start in the empty cell
+#define FACE_OFFSET             1e-3f
+// The luxels start on the page after the header, so every chunk takes whole pages
+#define LUXELS_OFFSET           MAP_CHUNK_ALIGNMENT
+#define CHUNKS_PER_TASK         1
+
+typedef struct {
+    const Map *map;
+    unsigned char *luxels;
+    const int *chunkStart;      // First light of every chunk in chunkLights (plus one past the last)
+    const int *chunkLights;     // Lights reaching every chunk, sorted by chunk
+} LightmapBake;
+
+// Hash of the walls and the lights of the map, a lightmap is only valid for the ones it was baked from
+static uint64_t HashMapLighting(const Map *map) {
+    uint64_t hash = HashMapWalls(map);
+    hash = HashBytes(hash, &map->lighting.ambient, sizeof(float));
+    return HashBytes(hash, map->lighting.lights, map->lighting.lightCount * sizeof(MapLight));
+}
+
+static bool IsWallCell(const Map *map, int x, int y) {
+    return x < 0 || y < 0 || x >= map->width || y >= map->height || IsOccupied(&map->occupancy, 0, x, y);
+}
+
+// Returns whether a wall stands between two points (the walls go from
+// the floor to the ceiling, so only the cells crossed on the map matter)
+static bool IsLightBlocked(const Map *map, float fromX, float fromY, float toX, float toY) {
+    int x = (int) floorf(fromX), y = (int) floorf(fromY);
+    int steps = abs((int) floorf(toX) - x) + abs((int) floorf(toY) - y);
+    float deltaX = toX - fromX, deltaY = toY - fromY;
+    int stepX = (deltaX < 0.0f) ? -1 : +1;
+    int stepY = (deltaY < 0.0f) ? -1 : +1;
+    // Fractions of the segment between two grid lines and up to the next ones
+    float crossingX = (deltaX != 0.0f) ? fabsf(1.0f / deltaX) : INFINITY;
+    float crossingY = (deltaY != 0.0f) ? fabsf(1.0f / deltaY) : INFINITY;
+    float nextX = ((stepX > 0) ? (x + 1.0f - fromX) : (fromX - x)) * crossingX;
+    float nextY = ((stepY > 0) ? (y + 1.0f - fromY) : (fromY - y)) * crossingY;
+    for (int i = 0; i < steps; i++) {
+        if (nextX < nextY) {
+            nextX += crossingX;
+            x += stepX;
+        } else {
+            nextY += crossingY;
+            y += stepY;
+        }
+        if (IsWallCell(map, x, y)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int GetAreaSamples(float size) {
+    int samples = (int) ceilf(size / AREA_SAMPLE_SPACING);
+    return (samples < 1) ? 1 : (samples < AREA_MAX_SAMPLES) ? samples : AREA_MAX_SAMPLES;
+}
+
+// Returns the light a point with the given normal receives from a light,
+// area lights are split in a grid of samples sharing their intensity
+static float GetLightAt(const Map *map, const MapLight *light, Vector3 point, Vector3 normal) {
+    bool area = light->width > 0.0f || light->height > 0.0f;
+    int samplesX = GetAreaSamples(light->width);
+    int samplesY = GetAreaSamples(light->height);
+    float received = 0.0f;
+    for (int sampleY = 0; sampleY < samplesY; sampleY++) {
+        for (int sampleX = 0; sampleX < samplesX; sampleX++) {
+            Vector3 sample = {
+                light->x + light->width * ((sampleX + 0.5f) / samplesX - 0.5f),
+                light->y + light->height * ((sampleY + 0.5f) / samplesY - 0.5f),
+                light->z
+            };
+            Vector3 toLight = Vector3Subtract(sample, point);
+            float distance = Vector3Length(toLight);
+            if (distance <= 0.0f || distance >= light->radius) {
+                continue;
+            }
+            // Lambert's cosine on the surface, and on the light for the area lights (they face down)
+            float cosine = Vector3DotProduct(normal, toLight) / distance;
+            if (area) {
+                cosine *= -toLight.z / distance;
+            }
+            if (cosine <= 0.0f || IsLightBlocked(map, point.x, point.y, sample.x, sample.y)) {
+                continue;
+            }
+            // Fade out smoothly up to the radius
+            float falloff = 1.0f - distance / light->radius;
+            received += cosine * falloff * falloff;
+        }
+    }
+    return light->intensity * received / (samplesX * samplesY);
+}
+
+// Adds up the ambient light and the lights reaching a point, and stores it in a luxel
+static void BakeLuxel(const LightmapBake *bake, int chunk, Vector3 point, Vector3 normal, float ambient, unsigned char *luxel) {
+    float received = ambient;
+    for (int i = bake->chunkStart[chunk]; i < bake->chunkStart[chunk + 1]; i++) {
+        received += GetLightAt(bake->map, &bake->map->lighting.lights[bake->chunkLights[i]], point, normal);
+    }
+    received = (received < 1.0f) ? received : 1.0f;
+    *luxel = (unsigned char) (received * 255.0f + 0.5f);
+}
+
+// Bakes the luxels of the surfaces of a cell that can be seen: the floor and
+// the ceiling of an empty cell, or the faces of a wall next to empty cells
+static void BakeCell(const LightmapBake *bake, int chunk, int x, int y, unsigned char *luxels) {
+    const Map *map = bake->map;
+    float ambient = map->lighting.ambient;
+    if (!IsOccupied(&map->occupancy, 0, x, y)) {
+        for (int v = 0; v < LIGHTMAP_RESOLUTION; v++) {
+            for (int u = 0; u < LIGHTMAP_RESOLUTION; u++) {
+                float pointX = x + (u + 0.5f) / LIGHTMAP_RESOLUTION;
+                float pointY = y + (v + 0.5f) / LIGHTMAP_RESOLUTION;
+                int luxel = v * LIGHTMAP_RESOLUTION + u;
+                BakeLuxel(bake, chunk, (Vector3) { pointX, pointY, 0.0f }, (Vector3) { 0.0f, 0.0f, 1.0f }, ambient,
+                          &luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS + luxel]);
+                BakeLuxel(bake, chunk, (Vector3) { pointX, pointY, 1.0f }, (Vector3) { 0.0f, 0.0f, -1.0f }, ambient,
+                          &luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS + luxel]);
+            }
+        }
+        return;
+    }
+    static const int faceX[4] = { [LIGHTMAP_FACE_LEFT] = -1, [LIGHTMAP_FACE_RIGHT] = +1 };
+    static const int faceY[4] = { [LIGHTMAP_FACE_UP] = -1, [LIGHTMAP_FACE_DOWN] = +1 };
+    for (int face = 0; face < 4; face++) {
+        // The faces against other walls are never seen
+        if (IsWallCell(map, x + faceX[face], y + faceY[face])) {
+            continue;
+        }
+        Vector3 normal = { (float) faceX[face], (float) faceY[face], 0.0f };
+        float faceAmbient = (faceY[face]) ? ambient * AMBIENT_FACE_Y : ambient;
+        for (int v = 0; v < LIGHTMAP_RESOLUTION; v++) {
+            for (int u = 0; u < LIGHTMAP_RESOLUTION; u++) {
+                // Center of the luxel on the face, just off the wall
+                float across = (u + 0.5f) / LIGHTMAP_RESOLUTION;
+                Vector3 point = {
+                    (faceX[face]) ? x + (faceX[face] > 0) + faceX[face] * FACE_OFFSET : x + across,
+                    (faceY[face]) ? y + (faceY[face] > 0) + faceY[face] * FACE_OFFSET : y + across,
+                    1.0f - (v + 0.5f) / LIGHTMAP_RESOLUTION
+                };
+                BakeLuxel(bake, chunk, point, normal, faceAmbient, &luxels[face * LIGHTMAP_SURFACE_LUXELS + v * LIGHTMAP_RESOLUTION + u]);
+            }
+        }
+    }
+}
+
+static void BakeChunks(void *data, int start, int end) {
+    const LightmapBake *bake = data;
+    const Map *map = bake->map;
+    for (int chunk = start; chunk < end; chunk++) {
+        int chunkX = chunk % map->chunksX;
+        int chunkY = chunk / map->chunksX;
+        unsigned char *luxels = &bake->luxels[(size_t) chunk * LIGHTMAP_CHUNK_BYTES];
+        for (int y = 0; y < MAP_CHUNK_SIZE; y++) {
+            for (int x = 0; x < MAP_CHUNK_SIZE; x++) {
+                int cellX = (chunkX << MAP_CHUNK_SHIFT) + x;
+                int cellY = (chunkY << MAP_CHUNK_SHIFT) + y;
+                if (cellX < map->width && cellY < map->height) {
+                    BakeCell(bake, chunk, cellX, cellY, &luxels[((y << MAP_CHUNK_SHIFT) + x) * LIGHTMAP_CELL_LUXELS]);
+                }
+            }
+        }
+    }
+}
+
+// Finds the chunks a light can reach (the ones its radius around it touches)
+static void GetLightChunks(const Map *map, const MapLight *light, int *minX, int *minY, int *maxX, int *maxY) {
+    float reachX = light->width / 2.0f + light->radius;
+    float reachY = light->height / 2.0f + light->radius;
+    *minX = (int) Clamp(floorf(light->x - reachX), 0.0f, map->width - 1.0f) >> MAP_CHUNK_SHIFT;
+    *minY = (int) Clamp(floorf(light->y - reachY), 0.0f, map->height - 1.0f) >> MAP_CHUNK_SHIFT;
+    *maxX = (int) Clamp(floorf(light->x + reachX), 0.0f, map->width - 1.0f) >> MAP_CHUNK_SHIFT;
+    *maxY = (int) Clamp(floorf(light->y + reachY), 0.0f, map->height - 1.0f) >> MAP_CHUNK_SHIFT;
+}
+
+bool BakeLightmap(Lightmap *lightmap, const Map *map) {
+    *lightmap = (Lightmap) {
+        .chunksX = map->chunksX,
+        .chunksY = map->chunksY
+    };
+    int chunkCount = map->chunksX * map->chunksY;
+    const MapLighting *lighting = &map->lighting;
+    // Bucket the lights by the chunks they reach (a counting sort), so every
+    // luxel only looks at the lights around it
+    int *chunkStart = MemAlloc((chunkCount + 1) * sizeof(int));
+    int entries = 0;
+    for (int i = 0; chunkStart && i < lighting->lightCount; i++) {
+        int minX, minY, maxX, maxY;
+        GetLightChunks(map, &lighting->lights[i], &minX, &minY, &maxX, &maxY);
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                chunkStart[y * map->chunksX + x + 1]++;
+                entries++;
+            }
+        }
+    }
+    int *chunkLights = MemAlloc((entries + 1) * sizeof(int));
+    unsigned char *luxels = MemAlloc((size_t) chunkCount * LIGHTMAP_CHUNK_BYTES);
+    if (!chunkStart || !chunkLights || !luxels) {
+        TraceLog(LOG_WARNING, "LIGHTMAP: Failed to allocate the lightmap");
+        MemFree(chunkStart);
+        MemFree(chunkLights);
+        MemFree(luxels);
+        return false;
+    }
+    for (int i = 0; i < chunkCount; i++) {
+        chunkStart[i + 1] += chunkStart[i];
+    }
+    for (int i = 0; i < lighting->lightCount; i++) {
+        int minX, minY, maxX, maxY;
+        GetLightChunks(map, &lighting->lights[i], &minX, &minY, &maxX, &maxY);
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                chunkLights[chunkStart[y * map->chunksX + x]++] = i;
+            }
+        }
+    }
+    // Filling the buckets moved every start to the next one
+    memmove(&chunkStart[1], chunkStart, chunkCount * sizeof(int));
+    chunkStart[0] = 0;
+    // Bake the chunks in parallel, each of them only writes its own luxels
+    double start = GetBenchTime();
+    LightmapBake bake = {
+        .map = map,
+        .luxels = luxels,
+        .chunkStart = chunkStart,
+        .chunkLights = chunkLights
+    };
+    RunPoolTask(BakeChunks, &bake, chunkCount, CHUNKS_PER_TASK);
+    MemFree(chunkStart);
+    MemFree(chunkLights);
+    lightmap->baked = luxels;
+    lightmap->luxels = luxels;
+    TraceLog(LOG_INFO, "LIGHTMAP: Lightmap baked in %.2f s (%d lights, %dx%d chunks)", GetBenchTime() - start, lighting->lightCount, map->chunksX, map->chunksY);
+    return true;
+}
+
+bool LoadLightmap(Lightmap *lightmap, const Map *map, const char *fileName) {
+    *lightmap = (Lightmap) {
+        .chunksX = map->chunksX,
+        .chunksY = map->chunksY
+    };
+    if (!FileExists(fileName) || !OpenMappedFile(&lightmap->file, fileName)) {
+        return false;
+    }
+    // Anything that changed the walls or the lights makes the lightmap stale
+    LightmapFileHeader header = {0};
+    if (lightmap->file.size >= sizeof(header)) {
+        memcpy(&header, lightmap->file.data, sizeof(header));
+    }
+    size_t bytes = (size_t) map->chunksX * map->chunksY * LIGHTMAP_CHUNK_BYTES;
+    if (header.magic != LIGHTMAP_FILE_MAGIC || header.version != LIGHTMAP_FILE_VERSION ||
+        header.width != map->width || header.height != map->height ||
+        header.chunkShift != MAP_CHUNK_SHIFT || header.resolution != LIGHTMAP_RESOLUTION ||
+        header.mapHash != HashMapLighting(map) || lightmap->file.size != LUXELS_OFFSET + bytes) {
+        TraceLog(LOG_INFO, "LIGHTMAP: [%s] Lightmap is missing or stale", fileName);
+        UnloadLightmap(lightmap);
+        return false;
+    }
+    // The luxels are only read from the disk as their chunks get cached
+    lightmap->luxels = lightmap->file.data + LUXELS_OFFSET;
+    TraceLog(LOG_INFO, "LIGHTMAP: [%s] Lightmap mapped successfully", fileName);
+    return true;
+}
+
+bool SaveLightmap(const Lightmap *lightmap, const Map *map, const char *fileName) {
+    LightmapFileHeader header = {
+        .magic = LIGHTMAP_FILE_MAGIC,
+        .version = LIGHTMAP_FILE_VERSION,
+        .width = map->width,
+        .height = map->height,
+        .chunkShift = MAP_CHUNK_SHIFT,
+        .resolution = LIGHTMAP_RESOLUTION,
+        .mapHash = HashMapLighting(map)
+    };
+    size_t bytes = (size_t) lightmap->chunksX * lightmap->chunksY * LIGHTMAP_CHUNK_BYTES;
+    FILE *file = fopen(fileName, "wb");
+    bool saved = file && fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = sizeof(header); saved && i < LUXELS_OFFSET; i++) {
+        saved = fputc(0, file) != EOF;
+    }
+    saved = saved && fwrite(lightmap->luxels, 1, bytes, file) == bytes;
+    if (file) {
+        saved = (fclose(file) == 0) && saved;
+    }
+    if (!saved) {
+        TraceLog(LOG_WARNING, "LIGHTMAP: [%s] Failed to write lightmap file", fileName);
+    }
+    return saved;
+}
+
+bool LoadOrBakeLightmap(Lightmap *lightmap, const Map *map, const char *fileName) {
+    if (LoadLightmap(lightmap, map, fileName)) {
+        return true;
+    }
+    if (!BakeLightmap(lightmap, map)) {
+        return false;
+    }
+    // The lightmap still works when it can't be cached, it's baked again next time
+    SaveLightmap(lightmap, map, fileName);
+    return true;
+}
+
+void UnloadLightmap(Lightmap *lightmap) {
+    MemFree(lightmap->baked);
+    CloseMappedFile(&lightmap->file);
+    *lightmap = (Lightmap) {0};
+}
+
+bool InitLightmapCache(LightmapCache *cache, const ChunkCache *chunks) {
+    // The SIMD kernels fetch the luxels with 32-bit gathers, leave
+    // room for the 3 bytes read past the last one
+    *cache = (LightmapCache) {
+        .capacity = chunks->capacity,
+        .luxels = MemAlloc((size_t) chunks->capacity * LIGHTMAP_CHUNK_BYTES + sizeof(int))
+    };
+    return cache->luxels != NULL;
+}
+
+void UnloadLightmapCache(LightmapCache *cache) {
+    MemFree(cache->luxels);
+    *cache = (LightmapCache) {0};
+}
+
+void UpdateLightmapCache(LightmapCache *cache, const ChunkCache *chunks, const Lightmap *lightmap) {
+    for (int i = 0; i < chunks->loadedCount; i++) {
+        int slot = chunks->loaded[i];
+        size_t offset = (size_t) chunks->chunks[slot] * LIGHTMAP_CHUNK_BYTES;
+        memcpy(&cache->luxels[(size_t) slot * LIGHTMAP_CHUNK_BYTES], &lightmap->luxels[offset], LIGHTMAP_CHUNK_BYTES);
+        // As for the tiles, the pages of a mapped lightmap can be dropped once copied
+        if (lightmap->file.data) {
+            ReleaseMappedRange(&lightmap->file, LUXELS_OFFSET + offset, LIGHTMAP_CHUNK_BYTES);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+#include "mapping.h"
+
+// Every surface of a cell (the floor, the ceiling or a face of a wall) is
+// lit by a grid of LIGHTMAP_RESOLUTION x LIGHTMAP_RESOLUTION luxels
+#define LIGHTMAP_RESOLUTION     2
+#define LIGHTMAP_SURFACE_LUXELS (LIGHTMAP_RESOLUTION * LIGHTMAP_RESOLUTION)
+// Wall cells have 4 faces, empty cells a floor and a ceiling
+#define LIGHTMAP_CELL_LUXELS    (4 * LIGHTMAP_SURFACE_LUXELS)
+#define LIGHTMAP_CHUNK_BYTES    (MAP_CHUNK_CELLS * LIGHTMAP_CELL_LUXELS)
+// "RLMP" read as a little endian integer
+#define LIGHTMAP_FILE_MAGIC     0x504D4C52
+#define LIGHTMAP_FILE_VERSION   1
+
+// Surfaces of an empty cell, the luxels of surface s of a cell start
+// at s * LIGHTMAP_SURFACE_LUXELS
+#define LIGHTMAP_FLOOR          0
+#define LIGHTMAP_CEILING        1
+// Faces of a wall cell, named after the direction they face
+#define LIGHTMAP_FACE_LEFT      0   // -x
+#define LIGHTMAP_FACE_RIGHT     1   // +x
+#define LIGHTMAP_FACE_UP        2   // -y
+#define LIGHTMAP_FACE_DOWN      3   // +y
+
+// Light reaching the surfaces of a map, baked from the lights of the map (see
+// MapLighting) and the walls, one byte per luxel (255 is full brightness).
+// Luxel (u, v) of a surface is at v * LIGHTMAP_RESOLUTION + u: u goes along x
+// (or along y on the faces facing x) and v along y on the floor and the ceiling,
+// and from the top down on the faces. The luxels of every chunk follow the
+// ones of the previous chunk, cell after cell (row by row)
+typedef struct {
+    int chunksX;
+    int chunksY;
+    const unsigned char *luxels;
+    unsigned char *baked;   // Owned luxels (NULL when they are mapped from a file)
+    MappedFile file;
+} Lightmap;
+
+// A lightmap file starts with this header (all the values are little endian),
+// the luxels start on the next page (MAP_CHUNK_ALIGNMENT bytes in). The
+// lightmap is only valid for the walls and the lights it was baked from,
+// mapHash is a hash of both
+typedef struct {
+    uint32_t magic;
+    int32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t chunkShift;
+    int32_t resolution;
+    uint64_t mapHash;
+} LightmapFileHeader;
+
+// Luxels of the chunks in the slots of a chunk cache (see map.h), laid out
+// like the tiles: the luxels of slot s start at s * LIGHTMAP_CHUNK_BYTES
+typedef struct {
+    int capacity;
+    unsigned char *luxels;
+} LightmapCache;
+
+// Bakes the lightmap of the map on all the threads of the pool (see pool.h)
+bool BakeLightmap(Lightmap *lightmap, const Map *map);
+// Maps a lightmap saved by SaveLightmap(), fails if it was baked for other walls or lights
+bool LoadLightmap(Lightmap *lightmap, const Map *map, const char *fileName);
+bool SaveLightmap(const Lightmap *lightmap, const Map *map, const char *fileName);
+// Loads the lightmap cached in fileName, or bakes it and caches it there
+bool LoadOrBakeLightmap(Lightmap *lightmap, const Map *map, const char *fileName);
+void UnloadLightmap(Lightmap *lightmap);
+
+bool InitLightmapCache(LightmapCache *cache, const ChunkCache *chunks);
+void UnloadLightmapCache(LightmapCache *cache);
+// Copies the luxels of the chunks loaded by the last UpdateChunkCache() into their slots
+void UpdateLightmapCache(LightmapCache *cache, const ChunkCache *chunks, const Lightmap *lightmap);
+
+// Returns the offset of the luxels of cell (x, y) inside the luxels of the
+// cache (-1 if its chunk isn't cached), the cell has to be inside the map
+static inline int GetCachedLuxelOffset(const ChunkCache *chunks, int x, int y) {
+    int slot = chunks->slots[(y >> MAP_CHUNK_SHIFT) * chunks->chunksX + (x >> MAP_CHUNK_SHIFT)];
+    if (slot < 0) {
+        return -1;
+    }
+    int cell = ((y & (MAP_CHUNK_SIZE - 1)) << MAP_CHUNK_SHIFT) + (x & (MAP_CHUNK_SIZE - 1));
+    return slot * LIGHTMAP_CHUNK_BYTES + cell * LIGHTMAP_CELL_LUXELS;
+}
+
+// Returns the luxel at a position between 0 and 1 across a surface
+static inline int GetLuxelCoordinate(float position) {
+    int luxel = (int) (position * LIGHTMAP_RESOLUTION);
+    return (luxel < 0) ? 0 : (luxel < LIGHTMAP_RESOLUTION) ? luxel : LIGHTMAP_RESOLUTION - 1;
+}
+
+// Brightness of a luxel in 8.8 fixed point (256 leaves the colors as they are)
+static inline int GetLuxelBrightness(unsigned char luxel) {
+    return luxel + (luxel >> 7);
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include "map.h"
+#include <raylib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Chunks take a page each inside the file
+#define CHUNK_BYTES MAP_CHUNK_ALIGNMENT
+
+_Static_assert(sizeof(ChunkTiles) <= CHUNK_BYTES, "The tiles of a chunk don't fit in a page");
+
+// Lays the levels out one after the other, halving the size (rounding up)
+// until a single block covers the whole map, fails if there are too many
+static bool LayoutOccupancyGrid(OccupancyGrid *grid, int width, int height) {
+    *grid = (OccupancyGrid) {
+        .width = width,
+        .height = height
+    };
+    int levelWidth = width, levelHeight = height;
+    for (int i = 0; i < OCCUPANCY_MAX_LEVELS; i++) {
+        grid->level[i] = (OccupancyLevel) {
+            .offset = grid->words,
+            .stride = (levelWidth + 31) / 32,
+            .width = levelWidth,
+            .height = levelHeight
+        };
+        grid->words += grid->level[i].stride * levelHeight;
+        grid->levels++;
+        if (levelWidth == 1 && levelHeight == 1) {
+            return true;
+        }
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+    return false;
+}
+
+static void SetBit(const OccupancyGrid *grid, unsigned int *bits, int level, int x, int y) {
+    const OccupancyLevel *l = &grid->level[level];
+    bits[l->offset + y * l->stride + (x >> 5)] |= 1u << (x & 31);
+}
+
+static size_t GetChunkOffset(const Map *map, int chunk) {
+    return map->chunksOffset + (size_t) chunk * CHUNK_BYTES;
+}
+
+bool LoadMap(Map *map, const char *fileName) {
+    *map = (Map) {0};
+    if (!OpenMappedFile(&map->file, fileName)) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Failed to open map file", fileName);
+        return false;
+    }
+    // Check the header before trusting any offset in it
+    MapFileHeader header = {0};
+    if (map->file.size >= sizeof(header)) {
+        memcpy(&header, map->file.data, sizeof(header));
+    }
+    if (header.magic != MAP_FILE_MAGIC || header.version != MAP_FILE_VERSION) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Not a map file (or version %d instead of %d)", fileName, header.version, MAP_FILE_VERSION);
+        UnloadMap(map);
+        return false;
+    }
+    if (header.chunkShift != MAP_CHUNK_SHIFT || header.width <= 0 || header.height <= 0 || !LayoutOccupancyGrid(&map->occupancy, header.width, header.height)) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Unsupported map (%dx%d, chunks of %d cells)", fileName, header.width, header.height, 1 << header.chunkShift);
+        UnloadMap(map);
+        return false;
+    }
+    map->width = header.width;
+    map->height = header.height;
+    map->wallHeight = header.wallHeight;
+    map->chunksX = (header.width + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT;
+    map->chunksY = (header.height + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT;
+    size_t occupancyEnd = sizeof(header) + (size_t) map->occupancy.words * sizeof(unsigned int);
+    size_t lightsEnd = occupancyEnd + (size_t) header.lightCount * sizeof(MapLight);
+    size_t chunksEnd = (size_t) header.chunksOffset + (size_t) map->chunksX * map->chunksY * CHUNK_BYTES;
+    if (header.occupancyWords != map->occupancy.words || header.lightCount < 0 || header.chunksOffset < (int64_t) lightsEnd || header.chunksOffset % MAP_CHUNK_ALIGNMENT || chunksEnd > map->file.size) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Map file is truncated or corrupted", fileName);
+        UnloadMap(map);
+        return false;
+    }
+    map->chunksOffset = (size_t) header.chunksOffset;
+    map->occupancy.bits = (const unsigned int *) (map->file.data + sizeof(header));
+    map->lighting = (MapLighting) {
+        .ambient = header.ambient,
+        .lightCount = header.lightCount,
+        .lights = (const MapLight *) (map->file.data + occupancyEnd)
+    };
+    TraceLog(LOG_INFO, "MAP: [%s] Map mapped successfully (%dx%d, %dx%d chunks, %d lights)", fileName, map->width, map->height, map->chunksX, map->chunksY, map->lighting.lightCount);
+    return true;
+}
+
+void UnloadMap(Map *map) {
+    CloseMappedFile(&map->file);
+    *map = (Map) {0};
+}
+
+bool SaveMap(const char *fileName, int width, int height, float wallHeight, const MapLighting *lighting, MapTileFunc tile, void *data) {
+    OccupancyGrid grid;
+    if (width <= 0 || height <= 0 || !LayoutOccupancyGrid(&grid, width, height)) {
+        TraceLog(LOG_WARNING, "MAP: Map too big for the occupancy grid (%dx%d)", width, height);
+        return false;
+    }
+    int chunksX = (width + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT;
+    int chunksY = (height + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT;
+    size_t occupancyEnd = sizeof(MapFileHeader) + (size_t) grid.words * sizeof(unsigned int);
+    size_t lightsEnd = occupancyEnd + (size_t) lighting->lightCount * sizeof(MapLight);
+    MapFileHeader header = {
+        .magic = MAP_FILE_MAGIC,
+        .version = MAP_FILE_VERSION,
+        .width = width,
+        .height = height,
+        .chunkShift = MAP_CHUNK_SHIFT,
+        .wallHeight = wallHeight,
+        .occupancyWords = grid.words,
+        .lightCount = lighting->lightCount,
+        .ambient = lighting->ambient,
+        .chunksOffset = (lightsEnd + MAP_CHUNK_ALIGNMENT - 1) / MAP_CHUNK_ALIGNMENT * MAP_CHUNK_ALIGNMENT
+    };
+    // Fill level 0 from the walls, then OR every 2x2 block into the level above
+    unsigned int *bits = MemAlloc(grid.words * sizeof(unsigned int));
+    unsigned char *page = MemAlloc(CHUNK_BYTES);
+    FILE *file = fopen(fileName, "wb");
+    if (!bits || !page || !file) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Failed to create map file", fileName);
+        MemFree(bits);
+        MemFree(page);
+        if (file) {
+            fclose(file);
+        }
+        return false;
+    }
+    grid.bits = bits;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Tile cell = {0};
+            tile(data, x, y, &cell);
+            if (cell.wall) {
+                SetBit(&grid, bits, 0, x, y);
+            }
+        }
+    }
+    for (int i = 1; i < grid.levels; i++) {
+        const OccupancyLevel *below = &grid.level[i - 1];
+        for (int y = 0; y < below->height; y++) {
+            for (int x = 0; x < below->width; x++) {
+                if (IsOccupied(&grid, i - 1, x, y)) {
+                    SetBit(&grid, bits, i, x >> 1, y >> 1);
+                }
+            }
+        }
+    }
+    // Write the header, the occupancy grid, the lights and the padding before the chunks
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(bits, sizeof(unsigned int), grid.words, file) == (size_t) grid.words
+        && fwrite(lighting->lights, sizeof(MapLight), lighting->lightCount, file) == (size_t) lighting->lightCount;
+    for (size_t i = lightsEnd; success && i < (size_t) header.chunksOffset; i++) {
+        success = fputc(0, file) != EOF;
+    }
+    // Write the chunks one at a time, so the whole map never has to be in memory
+    bool validIds = true;
+    ChunkTiles *chunk = (ChunkTiles *) page;
+    for (int chunkY = 0; success && chunkY < chunksY; chunkY++) {
+        for (int chunkX = 0; success && chunkX < chunksX; chunkX++) {
+            memset(page, 0, CHUNK_BYTES);
+            for (int y = 0; y < MAP_CHUNK_SIZE; y++) {
+                for (int x = 0; x < MAP_CHUNK_SIZE; x++) {
+                    int cellX = (chunkX << MAP_CHUNK_SHIFT) + x;
+                    int cellY = (chunkY << MAP_CHUNK_SHIFT) + y;
+                    if (cellX >= width || cellY >= height) {
+                        continue;
+                    }
+                    Tile cell = {0};
+                    tile(data, cellX, cellY, &cell);
+                    validIds = validIds
+                        && cell.wall >= 0 && cell.wall <= MAP_MAX_TILE_ID
+                        && cell.ceiling >= 0 && cell.ceiling <= MAP_MAX_TILE_ID
+                        && cell.floor >= 0 && cell.floor <= MAP_MAX_TILE_ID;
+                    int cellOffset = (y << MAP_CHUNK_SHIFT) + x;
+                    chunk->walls[cellOffset] = (TileId) cell.wall;
+                    chunk->ceilings[cellOffset] = (TileId) cell.ceiling;
+                    chunk->floors[cellOffset] = (TileId) cell.floor;
+                }
+            }
+            success = validIds && fwrite(page, CHUNK_BYTES, 1, file) == 1;
+        }
+    }
+    success = (fclose(file) == 0) && success;
+    MemFree(bits);
+    MemFree(page);
+    if (!validIds) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Tile ids have to be between 0 and %d", fileName, MAP_MAX_TILE_ID);
+        return false;
+    }
+    if (!success) {
+        TraceLog(LOG_WARNING, "MAP: [%s] Failed to write map file", fileName);
+        return false;
+    }
+    TraceLog(LOG_INFO, "MAP: [%s] Map saved successfully (%dx%d)", fileName, width, height);
+    return true;
+}
+
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t HashMapWalls(const Map *map) {
+    uint64_t hash = HASH_OFFSET_BASIS;
+    hash = HashBytes(hash, &map->width, sizeof(int));
+    hash = HashBytes(hash, &map->height, sizeof(int));
+    return HashBytes(hash, map->occupancy.bits, map->occupancy.words * sizeof(unsigned int));
+}
+
+bool InitChunkCache(ChunkCache *cache, const Map *map, int radius) {
+    // Keep an extra ring of slots, so the chunks the player
+    // just left don't have to be loaded again right away
+    int side = 2 * radius + 2;
+    *cache = (ChunkCache) {
+        .radius = radius,
+        .capacity = side * side,
+        .chunksX = map->chunksX,
+        .chunksY = map->chunksY
+    };
+    int chunkCount = map->chunksX * map->chunksY;
+    if (cache->capacity > chunkCount) {
+        cache->capacity = chunkCount;
+    }
+    // The SIMD kernels fetch the ids with 32-bit gathers, leave
+    // room for the bytes read past the last id of the last slot
+    cache->tiles = MemAlloc(cache->capacity * sizeof(ChunkTiles) + sizeof(int));
+    cache->slots = MemAlloc(chunkCount * sizeof(int));
+    cache->chunks = MemAlloc(cache->capacity * sizeof(int));
+    cache->uses = MemAlloc(cache->capacity * sizeof(unsigned int));
+    cache->loaded = MemAlloc(cache->capacity * sizeof(int));
+    cache->evicted = MemAlloc(cache->capacity * sizeof(int));
+    if (!cache->tiles || !cache->slots || !cache->chunks || !cache->uses || !cache->loaded || !cache->evicted) {
+        UnloadChunkCache(cache);
+        return false;
+    }
+    memset(cache->slots, -1, chunkCount * sizeof(int));
+    memset(cache->chunks, -1, cache->capacity * sizeof(int));
+    cache->walls = cache->tiles[0].walls;
+    cache->ceilings = cache->tiles[0].ceilings;
+    cache->floors = cache->tiles[0].floors;
+    return true;
+}
+
+void UnloadChunkCache(ChunkCache *cache) {
+    MemFree(cache->tiles);
+    MemFree(cache->slots);
+    MemFree(cache->chunks);
+    MemFree(cache->uses);
+    MemFree(cache->loaded);
+    MemFree(cache->evicted);
+    *cache = (ChunkCache) {0};
+}
+
+void UpdateChunkCache(ChunkCache *cache, const Map *map, int x, int y, ChunkFilterFunc filter, void *data) {
+    cache->updates++;
+    cache->loadedCount = 0;
+    cache->evictedCount = 0;
+    // Find the chunks around the player
+    int centerX = x >> MAP_CHUNK_SHIFT, centerY = y >> MAP_CHUNK_SHIFT;
+    int minX = (centerX - cache->radius > 0) ? centerX - cache->radius : 0;
+    int minY = (centerY - cache->radius > 0) ? centerY - cache->radius : 0;
+    int maxX = (centerX + cache->radius < cache->chunksX - 1) ? centerX + cache->radius : cache->chunksX - 1;
+    int maxY = (centerY + cache->radius < cache->chunksY - 1) ? centerY + cache->radius : cache->chunksY - 1;
+    // Mark the chunks that are already cached as used
+    // and start paging in the ones that are missing
+    for (int chunkY = minY; chunkY <= maxY; chunkY++) {
+        for (int chunkX = minX; chunkX <= maxX; chunkX++) {
+            int chunk = chunkY * cache->chunksX + chunkX;
+            if (filter && !filter(data, chunkX, chunkY)) {
+                continue;
+            }
+            if (cache->slots[chunk] >= 0) {
+                cache->uses[cache->slots[chunk]] = cache->updates;
+            } else {
+                PrefetchMappedRange(&map->file, GetChunkOffset(map, chunk), CHUNK_BYTES);
+            }
+        }
+    }
+    // Copy the missing chunks over the least recently used ones (the free slots
+    // come first and the slots used by this update are never picked, there are
+    // more slots than chunks around the player)
+    for (int chunkY = minY; chunkY <= maxY; chunkY++) {
+        for (int chunkX = minX; chunkX <= maxX; chunkX++) {
+            int chunk = chunkY * cache->chunksX + chunkX;
+            if (cache->slots[chunk] >= 0 || (filter && !filter(data, chunkX, chunkY))) {
+                continue;
+            }
+            int slot = 0;
+            for (int i = 1; i < cache->capacity; i++) {
+                if (cache->uses[i] < cache->uses[slot]) {
+                    slot = i;
+                }
+            }
+            if (cache->chunks[slot] >= 0) {
+                cache->slots[cache->chunks[slot]] = -1;
+                cache->evicted[cache->evictedCount++] = cache->chunks[slot];
+            }
+            // The copy is all that's needed from the file,
+            // so its pages can be dropped right after
+            size_t offset = GetChunkOffset(map, chunk);
+            memcpy(&cache->tiles[slot], map->file.data + offset, sizeof(ChunkTiles));
+            ReleaseMappedRange(&map->file, offset, CHUNK_BYTES);
+            cache->slots[chunk] = slot;
+            cache->chunks[slot] = chunk;
+            cache->uses[slot] = cache->updates;
+            cache->loaded[cache->loadedCount++] = slot;
+        }
+    }
+}
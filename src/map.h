@@ -0,0 +1,179 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mapping.h"
+
+// Enough levels for maps up to 32768 cells on each side
+#define OCCUPANCY_MAX_LEVELS    16
+
+// "RMAP" read as a little endian integer
+#define MAP_FILE_MAGIC          0x50414D52
+#define MAP_FILE_VERSION        3
+// Maps are split in chunks of 32x32 cells
+#define MAP_CHUNK_SHIFT         5
+#define MAP_CHUNK_SIZE          (1 << MAP_CHUNK_SHIFT)
+#define MAP_CHUNK_CELLS         (MAP_CHUNK_SIZE * MAP_CHUNK_SIZE)
+// Every chunk takes a whole page of the file, so they can be paged in and out on their own
+#define MAP_CHUNK_ALIGNMENT     4096
+// Ids are stored in a byte, 0 is an empty cell
+#define MAP_MAX_TILE_ID         255
+// Starting value of the hashes built with HashBytes()
+#define HASH_OFFSET_BASIS       0xCBF29CE484222325ull
+
+typedef struct {
+    int offset;     // First word of the level inside bits
+    int stride;     // Words in each row of the level
+    int width;      // Blocks in each row of the level
+    int height;     // Rows of the level
+} OccupancyLevel;
+
+// Bitmap pyramid of the walls of a map: level 0 has 1 bit per cell (set on
+// walls) and every level above covers blocks twice as big (2x2 blocks of the
+// level below OR-ed together), up to a level with a single block. The header
+// matches the Occupancy buffer of the compute shader, so it can be uploaded
+// as is followed by the bits
+typedef struct {
+    int levels;
+    int words;
+    int width;
+    int height;
+    OccupancyLevel level[OCCUPANCY_MAX_LEVELS];
+    const unsigned int *bits;
+} OccupancyGrid;
+
+// Content of a cell while a map is being saved
+typedef struct {
+    int ceiling;
+    int wall;
+    int floor;
+} Tile;
+
+typedef uint8_t TileId;
+
+// Light placed in a map, the baked lightmaps (see lightmap.h) only depend
+// on the lights and the walls. Point lights have no size, area lights are
+// rectangles of width x height facing down (panels on the ceiling)
+typedef struct {
+    float x;                // Center of the light
+    float y;
+    float z;                // Height, from 0 on the floor to 1 on the ceiling
+    float width;
+    float height;
+    float radius;           // Nothing further away than this is lit
+    float intensity;        // Light received right next to it (1 is full brightness)
+} MapLight;
+
+// Lights of a map, on top of the ambient light that reaches every surface
+typedef struct {
+    float ambient;
+    int lightCount;
+    const MapLight *lights;
+} MapLighting;
+
+// Ids of the cells of a chunk (row by row), split in layers so that reading
+// one kind of id only touches the bytes of that layer
+typedef struct {
+    TileId walls[MAP_CHUNK_CELLS];
+    TileId ceilings[MAP_CHUNK_CELLS];
+    TileId floors[MAP_CHUNK_CELLS];
+} ChunkTiles;
+
+// A map file starts with this header (all the values are little endian),
+// then come the bits of the occupancy grid, the lights and then, starting at
+// chunksOffset, the tiles of every chunk (a ChunkTiles at the start of
+// each page). The chunks are stored row after row, and the chunks on the
+// right and bottom borders are padded with empty tiles
+typedef struct {
+    uint32_t magic;
+    int32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t chunkShift;
+    float wallHeight;
+    int32_t occupancyWords;
+    int32_t lightCount;
+    float ambient;
+    int32_t reserved;
+    int64_t chunksOffset;
+} MapFileHeader;
+
+// Map file mapped in memory, nothing is read from the disk until it's used
+typedef struct {
+    int width;
+    int height;
+    float wallHeight;
+    int chunksX;            // Chunks in each row of chunks
+    int chunksY;            // Rows of chunks
+    size_t chunksOffset;    // Offset of the first chunk inside the file
+    OccupancyGrid occupancy;    // The bits point inside the file
+    MapLighting lighting;   // The lights point inside the file
+    MappedFile file;
+} Map;
+
+// Fills tile with the content of cell (x, y) of the map being saved
+typedef void (*MapTileFunc)(void *data, int x, int y, Tile *tile);
+// Returns whether chunk (x, y) of the map has to be cached
+typedef bool (*ChunkFilterFunc)(void *data, int x, int y);
+
+// Keeps copies of the chunks around the player in a fixed number of slots,
+// replacing the least recently needed chunks as the player moves. The slots
+// are packed one after the other, so they can be uploaded to the GPU as they are
+typedef struct {
+    int radius;             // Chunks kept around the one of the player
+    int capacity;           // Number of slots
+    int chunksX;
+    int chunksY;
+    ChunkTiles *tiles;      // Tiles of every slot
+    const TileId *walls;    // Layers of the first slot, see GetCachedTileOffset()
+    const TileId *ceilings;
+    const TileId *floors;
+    int *slots;             // Slot of every chunk of the map (-1 if it isn't cached)
+    int *chunks;            // Chunk held by every slot (-1 if the slot is free)
+    unsigned int *uses;     // Last update that needed every slot
+    unsigned int updates;
+    int loadedCount;
+    int *loaded;            // Slots filled by the last update
+    int evictedCount;
+    int *evicted;           // Chunks dropped by the last update
+} ChunkCache;
+
+// Maps a map file in memory, only the header is read
+bool LoadMap(Map *map, const char *fileName);
+void UnloadMap(Map *map);
+// Writes a map file calling tile for every cell (twice, so it
+// has to return the same tile every time it's called on a cell)
+bool SaveMap(const char *fileName, int width, int height, float wallHeight, const MapLighting *lighting, MapTileFunc tile, void *data);
+
+// Returns whether block (x, y) of the level contains any wall,
+// the coordinates have to be inside the level
+static inline bool IsOccupied(const OccupancyGrid *grid, int level, int x, int y) {
+    const OccupancyLevel *l = &grid->level[level];
+    return (grid->bits[l->offset + y * l->stride + (x >> 5)] >> (x & 31)) & 1;
+}
+
+// Adds size bytes to a 64-bit FNV-1a hash
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size);
+// Returns the hash of the size and the walls of a map, the files built
+// from a map store it to tell if they are stale
+uint64_t HashMapWalls(const Map *map);
+
+bool InitChunkCache(ChunkCache *cache, const Map *map, int radius);
+void UnloadChunkCache(ChunkCache *cache);
+// Makes sure the chunks within radius of the chunk of cell (x, y) are cached,
+// leaving out the ones filter rejects (if any, they can be evicted)
+void UpdateChunkCache(ChunkCache *cache, const Map *map, int x, int y, ChunkFilterFunc filter, void *data);
+
+// Returns the offset of cell (x, y) inside the layers of the cache (-1 if its
+// chunk isn't cached), the cell has to be inside the map. The ids of the cell
+// are walls[offset], ceilings[offset] and floors[offset]
+static inline int GetCachedTileOffset(const ChunkCache *cache, int x, int y) {
+    int slot = cache->slots[(y >> MAP_CHUNK_SHIFT) * cache->chunksX + (x >> MAP_CHUNK_SHIFT)];
+    if (slot < 0) {
+        return -1;
+    }
+    return slot * (int) sizeof(ChunkTiles) + ((y & (MAP_CHUNK_SIZE - 1)) << MAP_CHUNK_SHIFT) + (x & (MAP_CHUNK_SIZE - 1));
+}
+
+#endif
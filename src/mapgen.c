@@ -0,0 +1,221 @@
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "map.h"
+
+// Defaults
+#define DEFAULT_WALL_HEIGHT     800.0f
+#define DEFAULT_RANDOM_DENSITY  0.05f
+#define DEFAULT_RANDOM_SEED     1
+// Without lights every surface gets the full ambient light
+#define DEFAULT_AMBIENT         1.0f
+// Random maps get a dim ambient light and a light in the middle of every
+// block of 16x16 cells (unless there's a wall there)
+#define RANDOM_AMBIENT          0.25f
+#define RANDOM_LIGHT_SPACING    16
+#define RANDOM_LIGHT_HEIGHT     0.5f
+#define RANDOM_LIGHT_RADIUS     10.0f
+#define RANDOM_LIGHT_INTENSITY  1.0f
+
+typedef struct {
+    int width;
+    int height;
+    float wallHeight;
+    Tile *tiles;
+    float ambient;
+    int lightCount;
+    MapLight *lights;
+} TextMap;
+
+typedef struct {
+    unsigned int threshold;
+    unsigned int seed;
+    int width;
+    int height;
+} RandomMap;
+
+// Integer hash (lowbias32), the random maps are generated from the
+// coordinates of the cells so that every call returns the same tile
+static unsigned int Hash(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static void GetTextMapTile(void *data, int x, int y, Tile *tile) {
+    TextMap *map = data;
+    *tile = map->tiles[y * map->width + x];
+}
+
+static void GetRandomMapTile(void *data, int x, int y, Tile *tile) {
+    RandomMap *map = data;
+    unsigned int hash = Hash(Hash(map->seed ^ (unsigned int) x) ^ (unsigned int) y);
+    // Wall the borders in, leave the spawn cell (1, 1) and the cells around it empty
+    bool border = x == 0 || y == 0 || x == map->width - 1 || y == map->height - 1;
+    bool spawn = x <= 2 && y <= 2;
+    tile->wall = border || (!spawn && (hash & 0xFFFF) < map->threshold);
+    tile->ceiling = ((hash >> 16) & 3) == 0;
+    tile->floor = ((hash >> 18) & 3) != 0;
+}
+
+// Adds a light to a text map, growing the array as needed
+static bool AddTextMapLight(TextMap *map, MapLight light) {
+    if ((map->lightCount & (map->lightCount - 1)) == 0) {
+        int capacity = (map->lightCount) ? 2 * map->lightCount : 1;
+        MapLight *lights = MemRealloc(map->lights, capacity * sizeof(MapLight));
+        if (!lights) {
+            return false;
+        }
+        map->lights = lights;
+    }
+    map->lights[map->lightCount++] = light;
+    return true;
+}
+
+// Parses a text map: a "size <width> <height>" line, an optional
+// "wallHeight <height>" line and then a row of "ceiling,wall,floor"
+// cells (separated by spaces) for every row of the map. The lights are
+// "light <x> <y> <z> <radius> <intensity>" lines for point lights and
+// "arealight <x> <y> <z> <width> <height> <radius> <intensity>" lines for
+// panels facing down (centered on x, y), on top of an optional
+// "ambient <level>" line. Lines starting with '#' are skipped
+static bool LoadTextMap(const char *fileName, TextMap *map) {
+    char *text = LoadFileText(fileName);
+    if (!text) {
+        return false;
+    }
+    *map = (TextMap) { .wallHeight = DEFAULT_WALL_HEIGHT, .ambient = DEFAULT_AMBIENT };
+    int row = 0;
+    bool success = true;
+    // Parse the file line by line
+    for (char *line = text; *line && success; ) {
+        char *next = line;
+        while (*next && *next != '\n') {
+            next++;
+        }
+        if (*next) {
+            *next++ = '\0';
+        }
+        int width, height;
+        float wallHeight, ambient;
+        MapLight light = {0};
+        if (*line == '#') {
+            // Comment
+        } else if (sscanf(line, "size %d %d", &width, &height) == 2) {
+            if (map->tiles || width <= 0 || height <= 0) {
+                TraceLog(LOG_WARNING, "MAPGEN: [%s] Invalid map size", fileName);
+                success = false;
+            } else {
+                map->width = width;
+                map->height = height;
+                map->tiles = MemAlloc(width * height * sizeof(Tile));
+            }
+        } else if (sscanf(line, "wallHeight %f", &wallHeight) == 1) {
+            map->wallHeight = wallHeight;
+        } else if (sscanf(line, "ambient %f", &ambient) == 1) {
+            map->ambient = ambient;
+        } else if (sscanf(line, "light %f %f %f %f %f", &light.x, &light.y, &light.z, &light.radius, &light.intensity) == 5 ||
+                   sscanf(line, "arealight %f %f %f %f %f %f %f", &light.x, &light.y, &light.z, &light.width, &light.height, &light.radius, &light.intensity) == 7) {
+            if (light.radius <= 0.0f || light.width < 0.0f || light.height < 0.0f) {
+                TraceLog(LOG_WARNING, "MAPGEN: [%s] Invalid light", fileName);
+                success = false;
+            } else if (!AddTextMapLight(map, light)) {
+                success = false;
+            }
+        } else if (map->tiles && strchr(line, ',')) {
+            if (row == map->height) {
+                TraceLog(LOG_WARNING, "MAPGEN: [%s] Too many rows", fileName);
+                success = false;
+            }
+            // Read the cells of the row one by one
+            char *cursor = line;
+            for (int x = 0; x < map->width && success; x++) {
+                Tile *tile = &map->tiles[row * map->width + x];
+                int consumed = 0;
+                if (sscanf(cursor, " %d,%d,%d%n", &tile->ceiling, &tile->wall, &tile->floor, &consumed) != 3) {
+                    TraceLog(LOG_WARNING, "MAPGEN: [%s] Row %d has less than %d cells", fileName, row, map->width);
+                    success = false;
+                }
+                cursor += consumed;
+            }
+            row++;
+        }
+        line = next;
+    }
+    UnloadFileText(text);
+    if (success && (!map->tiles || row != map->height)) {
+        TraceLog(LOG_WARNING, "MAPGEN: [%s] Expected %d rows, found %d", fileName, map->height, row);
+        success = false;
+    }
+    if (!success) {
+        MemFree(map->tiles);
+        MemFree(map->lights);
+        map->tiles = NULL;
+        map->lights = NULL;
+    }
+    return success;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3) {
+        // Convert a text map
+        TextMap map;
+        if (!LoadTextMap(argv[1], &map)) {
+            return 1;
+        }
+        MapLighting lighting = { map.ambient, map.lightCount, map.lights };
+        bool success = SaveMap(argv[2], map.width, map.height, map.wallHeight, &lighting, GetTextMapTile, &map);
+        MemFree(map.tiles);
+        MemFree(map.lights);
+        return (success) ? 0 : 1;
+    }
+    if (argc >= 5 && !strcmp(argv[1], "--random")) {
+        // Generate a random map, big enough to test the streaming
+        float density = (argc >= 6) ? atof(argv[5]) : DEFAULT_RANDOM_DENSITY;
+        RandomMap map = {
+            .threshold = (unsigned int) (density * 65536.0f),
+            .seed = (argc >= 7) ? (unsigned int) atoi(argv[6]) : DEFAULT_RANDOM_SEED,
+            .width = atoi(argv[2]),
+            .height = atoi(argv[3])
+        };
+        if (map.width <= 0 || map.height <= 0) {
+            TraceLog(LOG_WARNING, "MAPGEN: Invalid map size");
+            return 1;
+        }
+        // Light the middle of every block that isn't a wall
+        int blocksX = (map.width + RANDOM_LIGHT_SPACING - 1) / RANDOM_LIGHT_SPACING;
+        int blocksY = (map.height + RANDOM_LIGHT_SPACING - 1) / RANDOM_LIGHT_SPACING;
+        MapLight *lights = MemAlloc(blocksX * blocksY * sizeof(MapLight));
+        if (!lights) {
+            return 1;
+        }
+        MapLighting lighting = { .ambient = RANDOM_AMBIENT, .lights = lights };
+        for (int y = RANDOM_LIGHT_SPACING / 2; y < map.height; y += RANDOM_LIGHT_SPACING) {
+            for (int x = RANDOM_LIGHT_SPACING / 2; x < map.width; x += RANDOM_LIGHT_SPACING) {
+                Tile tile = {0};
+                GetRandomMapTile(&map, x, y, &tile);
+                if (!tile.wall) {
+                    lights[lighting.lightCount++] = (MapLight) {
+                        .x = x + 0.5f,
+                        .y = y + 0.5f,
+                        .z = RANDOM_LIGHT_HEIGHT,
+                        .radius = RANDOM_LIGHT_RADIUS,
+                        .intensity = RANDOM_LIGHT_INTENSITY
+                    };
+                }
+            }
+        }
+        bool success = SaveMap(argv[4], map.width, map.height, DEFAULT_WALL_HEIGHT, &lighting, GetRandomMapTile, &map);
+        MemFree(lights);
+        return (success) ? 0 : 1;
+    }
+    fprintf(stderr,
+        "usage: %s <map.txt> <map.map>\n"
+        "       %s --random <width> <height> <map.map> [density] [seed]\n",
+        argv[0], argv[0]);
+    return 1;
+}
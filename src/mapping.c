@@ -0,0 +1,115 @@
+#include "mapping.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t GetPageSize(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return (size > 0) ? (size_t) size : 4096;
+#endif
+}
+
+bool OpenMappedFile(MappedFile *file, const char *fileName) {
+    *file = (MappedFile) {0};
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        CloseHandle(handle);
+        return false;
+    }
+    // The view keeps the file open, the handles can be closed right away
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (!mapping) {
+        return false;
+    }
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) {
+        return false;
+    }
+    file->data = data;
+    file->size = (size_t) size.QuadPart;
+#else
+    int descriptor = open(fileName, O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) || status.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+    // The mapping keeps the file open, the descriptor can be closed right away
+    void *data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    // The chunks are read all over the place, don't read ahead of every page fault
+    madvise(data, status.st_size, MADV_RANDOM);
+    file->data = data;
+    file->size = (size_t) status.st_size;
+#endif
+    return true;
+}
+
+void CloseMappedFile(MappedFile *file) {
+    if (file->data) {
+#ifdef _WIN32
+        UnmapViewOfFile(file->data);
+#else
+        munmap((void *) file->data, file->size);
+#endif
+    }
+    *file = (MappedFile) {0};
+}
+
+void PrefetchMappedRange(const MappedFile *file, size_t offset, size_t size) {
+    // Extend the range to whole pages
+    size_t page = GetPageSize();
+    size_t start = offset / page * page;
+    size_t end = (offset + size < file->size) ? (offset + size) : file->size;
+    if (start >= end) {
+        return;
+    }
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range = { (void *) (file->data + start), end - start };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    madvise((void *) (file->data + start), end - start, MADV_WILLNEED);
+#endif
+}
+
+void ReleaseMappedRange(const MappedFile *file, size_t offset, size_t size) {
+    // Shrink the range to whole pages, so the pages shared
+    // with the data around it aren't dropped
+    size_t page = GetPageSize();
+    size_t start = (offset + page - 1) / page * page;
+    size_t end = (offset + size < file->size) ? (offset + size) / page * page : file->size;
+    if (start >= end) {
+        return;
+    }
+#ifdef _WIN32
+    // Unlocking pages that aren't locked removes them from the working set
+    VirtualUnlock((void *) (file->data + start), end - start);
+#else
+    madvise((void *) (file->data + start), end - start, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read only view of a whole file, its pages are only
+// loaded from the disk the first time they are read
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+} MappedFile;
+
+bool OpenMappedFile(MappedFile *file, const char *fileName);
+void CloseMappedFile(MappedFile *file);
+// Hints that a range of the file is going to be read soon,
+// so its pages can be loaded in the background
+void PrefetchMappedRange(const MappedFile *file, size_t offset, size_t size);
+// Drops the pages that are entirely inside a range of the file from
+// memory, they are loaded again if the range is read later on
+void ReleaseMappedRange(const MappedFile *file, size_t offset, size_t size);
+
+#endif
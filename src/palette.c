@@ -0,0 +1,203 @@
+#include "palette.h"
+#include <stdlib.h>
+#include <string.h>
+#include "lightmap.h"
+
+// Texels with less alpha than this are transparent (as for the sprites)
+#define OPAQUE_ALPHA 128
+// Every texel is sampled lit at this many levels spread evenly up to full
+// brightness, so the palette has darker versions of the colors to shade with
+#define SAMPLED_SHADES 4
+
+// Range of the colors being cut, with the extent of its widest channel
+typedef struct {
+    int start;
+    int end;
+    int channel;
+    int extent;
+} ColorBox;
+
+static int CompareRed(const void *a, const void *b) {
+    return ((const Color *) a)->r - ((const Color *) b)->r;
+}
+
+static int CompareGreen(const void *a, const void *b) {
+    return ((const Color *) a)->g - ((const Color *) b)->g;
+}
+
+static int CompareBlue(const void *a, const void *b) {
+    return ((const Color *) a)->b - ((const Color *) b)->b;
+}
+
+// Finds the widest channel of the colors of a box
+static void MeasureColorBox(const Color *colors, ColorBox *box) {
+    unsigned char low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+    for (int i = box->start; i < box->end; i++) {
+        const unsigned char channels[3] = { colors[i].r, colors[i].g, colors[i].b };
+        for (int c = 0; c < 3; c++) {
+            low[c] = (channels[c] < low[c]) ? channels[c] : low[c];
+            high[c] = (channels[c] > high[c]) ? channels[c] : high[c];
+        }
+    }
+    box->channel = 0;
+    for (int c = 1; c < 3; c++) {
+        if (high[c] - low[c] > high[box->channel] - low[box->channel]) {
+            box->channel = c;
+        }
+    }
+    box->extent = high[box->channel] - low[box->channel];
+}
+
+bool BuildPalette(Palette *palette, const TileAtlas *atlas, const Color *fixed, int fixedCount) {
+    *palette = (Palette) {0};
+    int target = PALETTE_COLORS - 1 - fixedCount;
+    if (target <= 0) {
+        return false;
+    }
+    // Gather the opaque texels of every level (the smaller ones are seen from afar)
+    size_t texels = 0;
+    for (int i = 0; i < atlas->levels; i++) {
+        texels += (size_t) atlas->count * atlas->level[i].size * atlas->level[i].size;
+    }
+    Color *colors = MemAlloc(texels * SAMPLED_SHADES * sizeof(Color));
+    ColorBox *boxes = MemAlloc(target * sizeof(ColorBox));
+    if (!colors || !boxes) {
+        MemFree(colors);
+        MemFree(boxes);
+        return false;
+    }
+    int count = 0;
+    for (int i = 0; i < atlas->levels; i++) {
+        const AtlasLevel *level = &atlas->level[i];
+        for (int n = 0; n < atlas->count * level->size * level->size; n++) {
+            if (level->texels[n].a < OPAQUE_ALPHA) {
+                continue;
+            }
+            for (int shade = 1; shade <= SAMPLED_SHADES; shade++) {
+                int brightness = shade * 256 / SAMPLED_SHADES;
+                Color color = level->texels[n];
+                colors[count++] = (Color) { (color.r * brightness) >> 8, (color.g * brightness) >> 8, (color.b * brightness) >> 8, 255 };
+            }
+        }
+    }
+    // Keep splitting the box with the widest channel at the median of that
+    // channel, until there are enough boxes or none can be split anymore
+    static int (*const compare[3])(const void *, const void *) = { CompareRed, CompareGreen, CompareBlue };
+    int boxCount = 0;
+    if (count > 0) {
+        boxes[boxCount] = (ColorBox) { .start = 0, .end = count };
+        MeasureColorBox(colors, &boxes[boxCount++]);
+    }
+    while (boxCount < target) {
+        int widest = -1;
+        for (int i = 0; i < boxCount; i++) {
+            if (boxes[i].end - boxes[i].start > 1 && boxes[i].extent > 0 && (widest < 0 || boxes[i].extent > boxes[widest].extent)) {
+                widest = i;
+            }
+        }
+        if (widest < 0) {
+            break;
+        }
+        ColorBox *box = &boxes[widest];
+        qsort(&colors[box->start], box->end - box->start, sizeof(Color), compare[box->channel]);
+        int median = box->start + (box->end - box->start) / 2;
+        boxes[boxCount] = (ColorBox) { .start = median, .end = box->end };
+        box->end = median;
+        MeasureColorBox(colors, box);
+        MeasureColorBox(colors, &boxes[boxCount++]);
+    }
+    // The transparent color comes first, then the fixed colors and the averages of the boxes
+    int index = PALETTE_TRANSPARENT + 1;
+    for (int i = 0; i < fixedCount; i++) {
+        palette->colors[index++] = (Color) { fixed[i].r, fixed[i].g, fixed[i].b, 255 };
+    }
+    for (int i = 0; i < boxCount; i++) {
+        unsigned int sum[3] = {0};
+        for (int n = boxes[i].start; n < boxes[i].end; n++) {
+            sum[0] += colors[n].r;
+            sum[1] += colors[n].g;
+            sum[2] += colors[n].b;
+        }
+        unsigned int size = boxes[i].end - boxes[i].start;
+        palette->colors[index++] = (Color) { (sum[0] + size / 2) / size, (sum[1] + size / 2) / size, (sum[2] + size / 2) / size, 255 };
+    }
+    // Fill the entries left unused (when there are few colors) with black
+    while (index < PALETTE_COLORS) {
+        palette->colors[index++] = (Color) { 0, 0, 0, 255 };
+    }
+    MemFree(colors);
+    MemFree(boxes);
+    // Light every color at every level like the full color mode lights it with
+    // the luxel in the middle of the ones of the level, except for the first
+    // and last levels, which go all the way to black and to the colors as they are
+    for (int level = 0; level < PALETTE_SHADES; level++) {
+        int luxel = (level == 0) ? 0 : (level == PALETTE_SHADES - 1) ? 255 : (2 * level + 1) * 128 / PALETTE_SHADES;
+        int brightness = GetLuxelBrightness((unsigned char) luxel);
+        unsigned char *shades = &palette->shades[level * PALETTE_COLORS];
+        shades[PALETTE_TRANSPARENT] = PALETTE_TRANSPARENT;
+        for (int i = 0; i < PALETTE_COLORS; i++) {
+            if (i == PALETTE_TRANSPARENT) {
+                continue;
+            }
+            Color color = palette->colors[i];
+            shades[i] = FindPaletteColor(palette, (Color) {
+                (color.r * brightness) >> 8,
+                (color.g * brightness) >> 8,
+                (color.b * brightness) >> 8,
+                255
+            });
+        }
+    }
+    TraceLog(LOG_INFO, "PALETTE: Palette built successfully (%d colors from %d texels, %d shades)", fixedCount + boxCount, count, PALETTE_SHADES);
+    return true;
+}
+
+unsigned char FindPaletteColor(const Palette *palette, Color color) {
+    int best = -1, bestDistance = 0;
+    for (int i = 0; i < PALETTE_COLORS; i++) {
+        if (i == PALETTE_TRANSPARENT) {
+            continue;
+        }
+        int r = color.r - palette->colors[i].r;
+        int g = color.g - palette->colors[i].g;
+        int b = color.b - palette->colors[i].b;
+        int distance = r * r + g * g + b * b;
+        if (best < 0 || distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return (unsigned char) best;
+}
+
+bool IndexTileAtlas(TileAtlas *atlas, const Palette *palette) {
+    // Same layout as the colors, in a single allocation (the SIMD
+    // kernels fetch the indices with 32-bit gathers, leave room for
+    // the bytes read past the last one)
+    size_t texels = 0;
+    for (int i = 0; i < atlas->levels; i++) {
+        texels += (size_t) atlas->count * atlas->level[i].size * atlas->level[i].size;
+    }
+    unsigned char *data = MemAlloc(2 * texels + sizeof(int));
+    if (!data) {
+        return false;
+    }
+    for (int i = 0; i < atlas->levels; i++) {
+        AtlasLevel *level = &atlas->level[i];
+        int size = atlas->count * level->size * level->size;
+        level->indices = data;
+        level->indexColumns = data + texels;
+        for (int n = 0; n < size; n++) {
+            level->indices[n] = (level->texels[n].a >= OPAQUE_ALPHA) ? FindPaletteColor(palette, level->texels[n]) : PALETTE_TRANSPARENT;
+            level->indexColumns[n] = (level->columns[n].a >= OPAQUE_ALPHA) ? FindPaletteColor(palette, level->columns[n]) : PALETTE_TRANSPARENT;
+        }
+        data += size;
+    }
+    return true;
+}
+
+void ExpandPaletteIndices(const Palette *palette, const unsigned char *indices, Color *pixels, int count) {
+    for (int i = 0; i < count; i++) {
+        pixels[i] = palette->colors[indices[i]];
+    }
+}
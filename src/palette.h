@@ -0,0 +1,41 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include "atlas.h"
+
+#define PALETTE_COLORS      256
+// Light levels of the shade table, every level covers 256 / PALETTE_SHADES luxels
+#define PALETTE_SHADES      32
+// Index of the transparent texels, the sprites skip them
+#define PALETTE_TRANSPARENT 0
+
+// Colors of the paletted mode, with a table of the closest color to every
+// color of the palette at every light level (like the colormaps of Doom), so
+// lighting an indexed texel is a single lookup
+typedef struct {
+    // Lit index of color i at level l is at l * PALETTE_COLORS + i (first, the
+    // SIMD kernels fetch them with 32-bit gathers and read past the last one)
+    unsigned char shades[PALETTE_SHADES * PALETTE_COLORS];
+    Color colors[PALETTE_COLORS];
+} Palette;
+
+// Builds a palette for the opaque texels of every level of the atlas (with a
+// median cut), the fixed colors are part of it as they are
+bool BuildPalette(Palette *palette, const TileAtlas *atlas, const Color *fixed, int fixedCount);
+// Returns the index of the opaque color of the palette closest to color
+unsigned char FindPaletteColor(const Palette *palette, Color color);
+// Fills indices and indexColumns of every level of the atlas with the indices of
+// the closest colors (the mostly transparent texels get PALETTE_TRANSPARENT)
+bool IndexTileAtlas(TileAtlas *atlas, const Palette *palette);
+// Converts count indices to their colors
+void ExpandPaletteIndices(const Palette *palette, const unsigned char *indices, Color *pixels, int count);
+
+// Returns the offset of the row of the shade table lighting the colors like a
+// luxel (see lightmap.h), the row is indexed by the unlit colors
+static inline int GetShadeOffset(unsigned char luxel) {
+    return (luxel * PALETTE_SHADES / 256) * PALETTE_COLORS;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define CACHE_LINE_SIZE 64
+
+// Chunks owned by a thread, the owner takes them from the front
+// and once it runs out it steals them from the other queues.
+// Every queue lives on its own cache line to avoid false sharing
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int next;
+    int end;
+} Queue;
+
+typedef struct {
+    int workerCount;
+    bool running;
+    unsigned int generation;
+    int active;
+    PoolTask task;
+    void *data;
+    int items;
+    int grain;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t threads[POOL_MAX_WORKERS];
+    // The last queue belongs to the thread calling RunPoolTask()
+    Queue queues[POOL_MAX_WORKERS + 1];
+} Pool;
+
+// Singletons
+static Pool W = {0};
+
+static void ProcessQueues(int self) {
+    int participants = W.workerCount + 1;
+    // Drain our own queue first, then go around the
+    // other queues and steal whatever is left
+    for (int i = 0; i < participants; i++) {
+        Queue *queue = &W.queues[(self + i) % participants];
+        int chunk;
+        while ((chunk = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed)) < queue->end) {
+            int start = chunk * W.grain;
+            int end = (start + W.grain < W.items) ? (start + W.grain) : W.items;
+            W.task(W.data, start, end);
+        }
+    }
+}
+
+static void *WorkerMain(void *arg) {
+    int self = (int) (intptr_t) arg;
+    unsigned int generation = 0;
+    pthread_mutex_lock(&W.mutex);
+    for (;;) {
+        // Sleep until a new task is submitted or the pool shuts down
+        while (W.running && W.generation == generation) {
+            pthread_cond_wait(&W.start, &W.mutex);
+        }
+        if (!W.running) {
+            break;
+        }
+        generation = W.generation;
+        pthread_mutex_unlock(&W.mutex);
+        ProcessQueues(self);
+        pthread_mutex_lock(&W.mutex);
+        // The last worker to finish wakes up the submitting thread
+        if (--W.active == 0) {
+            pthread_cond_signal(&W.done);
+        }
+    }
+    pthread_mutex_unlock(&W.mutex);
+    return NULL;
+}
+
+int GetProcessorCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (int) count : 1;
+#endif
+}
+
+bool InitPool(int workers) {
+    if (workers < 0) {
+        workers = 0;
+    } else if (workers > POOL_MAX_WORKERS) {
+        workers = POOL_MAX_WORKERS;
+    }
+    pthread_mutex_init(&W.mutex, NULL);
+    pthread_cond_init(&W.start, NULL);
+    pthread_cond_init(&W.done, NULL);
+    W.running = true;
+    W.generation = 0;
+    W.workerCount = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&W.threads[i], NULL, WorkerMain, (void *) (intptr_t) i)) {
+            // Leave the workers spawned so far running, the caller can
+            // check how many there are with GetPoolWorkerCount()
+            return false;
+        }
+        W.workerCount++;
+    }
+    return true;
+}
+
+void ShutdownPool(void) {
+    pthread_mutex_lock(&W.mutex);
+    W.running = false;
+    pthread_cond_broadcast(&W.start);
+    pthread_mutex_unlock(&W.mutex);
+    for (int i = 0; i < W.workerCount; i++) {
+        pthread_join(W.threads[i], NULL);
+    }
+    W.workerCount = 0;
+    pthread_cond_destroy(&W.done);
+    pthread_cond_destroy(&W.start);
+    pthread_mutex_destroy(&W.mutex);
+}
+
+int GetPoolWorkerCount(void) {
+    return W.workerCount;
+}
+
+void RunPoolTask(PoolTask task, void *data, int items, int grain) {
+    if (items <= 0) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+    int chunks = (items + grain - 1) / grain;
+    // Don't bother waking up the workers if there's nothing to share
+    if (!W.workerCount || chunks == 1) {
+        for (int start = 0; start < items; start += grain) {
+            task(data, start, (start + grain < items) ? (start + grain) : items);
+        }
+        return;
+    }
+    int participants = W.workerCount + 1;
+    pthread_mutex_lock(&W.mutex);
+    W.task = task;
+    W.data = data;
+    W.items = items;
+    W.grain = grain;
+    // Hand each thread an equal contiguous range of chunks,
+    // uneven chunks get balanced out by stealing
+    for (int i = 0; i < participants; i++) {
+        atomic_store_explicit(&W.queues[i].next, chunks * i / participants, memory_order_relaxed);
+        W.queues[i].end = chunks * (i + 1) / participants;
+    }
+    W.active = W.workerCount;
+    W.generation++;
+    pthread_cond_broadcast(&W.start);
+    pthread_mutex_unlock(&W.mutex);
+    // Work on our own queue while the workers wake up
+    ProcessQueues(W.workerCount);
+    // Join the workers before returning
+    pthread_mutex_lock(&W.mutex);
+    while (W.active > 0) {
+        pthread_cond_wait(&W.done, &W.mutex);
+    }
+    pthread_mutex_unlock(&W.mutex);
+}
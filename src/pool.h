@@ -0,0 +1,27 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+
+// Upper bound on the number of worker threads the pool can spawn
+#define POOL_MAX_WORKERS    255
+
+// Function executed by the pool on every chunk of items, it has to
+// process the items in the range [start, end) (never more than grain)
+typedef void (*PoolTask)(void *data, int start, int end);
+
+// Returns the number of logical processors available
+int GetProcessorCount(void);
+// Spawns the worker threads (the calling thread always takes
+// part in the work, so 0 workers means single threaded), returns
+// false if only some of them could be spawned (they keep running)
+bool InitPool(int workers);
+// Stops and joins all the worker threads
+void ShutdownPool(void);
+// Returns the number of worker threads currently running
+int GetPoolWorkerCount(void);
+// Splits items in chunks of grain items and processes them on all
+// the threads, returns only once every chunk has been processed
+void RunPoolTask(PoolTask task, void *data, int items, int grain);
+
+#endif
@@ -0,0 +1,220 @@
+#include "profile.h"
+#include <raylib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+#define CACHE_LINE_SIZE             64
+// Threads that can record zones (the GPU track included)
+#define PROFILER_MAX_THREADS        64
+// Zones kept by every thread, a power of two
+#define PROFILER_RING_SIZE          16384
+// Distinct zone names shown by the overlay
+#define PROFILER_MAX_STATS          32
+// Weight of the last frame in the averages of the overlay
+#define PROFILER_SMOOTHING          0.05f
+
+typedef struct {
+    const char *name;
+    double start;
+    double end;
+} ProfileEvent;
+
+// Zones of a single thread: only the owner writes them and then moves the
+// head forward, the other threads read the zones before the head
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head;
+    unsigned int drained;   // Zones already added up by NextProfilerFrame()
+    int id;
+    const char *name;
+    ProfileEvent events[PROFILER_RING_SIZE];
+} ProfileRing;
+
+typedef struct {
+    const char *name;
+    double frameTotal;
+    float average;          // Seconds per frame
+} ProfileStat;
+
+typedef struct {
+    atomic_bool enabled;
+    atomic_int ringCount;
+    _Atomic(ProfileRing *) rings[PROFILER_MAX_THREADS];
+    ProfileRing *gpuRing;
+    int statCount;
+    ProfileStat stats[PROFILER_MAX_STATS];
+} Profiler;
+
+// Singletons
+static Profiler Q = {0};
+static _Thread_local ProfileRing *threadRing = NULL;
+static _Thread_local const char *threadName = NULL;
+
+static ProfileRing *CreateRing(const char *name) {
+    int id = atomic_fetch_add_explicit(&Q.ringCount, 1, memory_order_relaxed);
+    if (id >= PROFILER_MAX_THREADS) {
+        return NULL;
+    }
+    ProfileRing *ring = MemAlloc(sizeof(ProfileRing));
+    if (!ring) {
+        return NULL;
+    }
+    ring->id = id;
+    ring->name = name;
+    atomic_store_explicit(&Q.rings[id], ring, memory_order_release);
+    return ring;
+}
+
+static void PushEvent(ProfileRing *ring, const char *name, double start, double end) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head & (PROFILER_RING_SIZE - 1)] = (ProfileEvent) { name, start, end };
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void SetProfilerEnabled(bool enabled) {
+    atomic_store_explicit(&Q.enabled, enabled, memory_order_relaxed);
+}
+
+bool IsProfilerEnabled(void) {
+    return atomic_load_explicit(&Q.enabled, memory_order_relaxed);
+}
+
+void SetProfilerThreadName(const char *name) {
+    threadName = name;
+    if (threadRing) {
+        threadRing->name = name;
+    }
+}
+
+void ShutdownProfiler(void) {
+    atomic_store_explicit(&Q.enabled, false, memory_order_relaxed);
+    int count = atomic_load_explicit(&Q.ringCount, memory_order_relaxed);
+    for (int i = 0; i < count && i < PROFILER_MAX_THREADS; i++) {
+        MemFree(atomic_load_explicit(&Q.rings[i], memory_order_relaxed));
+        atomic_store_explicit(&Q.rings[i], NULL, memory_order_relaxed);
+    }
+    atomic_store_explicit(&Q.ringCount, 0, memory_order_relaxed);
+    Q.gpuRing = NULL;
+    Q.statCount = 0;
+    threadRing = NULL;
+}
+
+ProfileZone BeginProfileZone(const char *name) {
+    if (!atomic_load_explicit(&Q.enabled, memory_order_relaxed)) {
+        return (ProfileZone) { name, 0.0 };
+    }
+    return (ProfileZone) { name, GetBenchTime() };
+}
+
+void EndProfileZone(ProfileZone zone) {
+    if (zone.start == 0.0) {
+        return;
+    }
+    double end = GetBenchTime();
+    // The ring of a thread is created the first time it records a zone
+    if (!threadRing && !(threadRing = CreateRing(threadName))) {
+        return;
+    }
+    PushEvent(threadRing, zone.name, zone.start, end);
+}
+
+void RecordGpuProfileZone(const char *name, double start, double end) {
+    if (!atomic_load_explicit(&Q.enabled, memory_order_relaxed)) {
+        return;
+    }
+    if (!Q.gpuRing && !(Q.gpuRing = CreateRing("gpu"))) {
+        return;
+    }
+    PushEvent(Q.gpuRing, name, start, end);
+}
+
+static ProfileStat *GetStat(const char *name) {
+    for (int i = 0; i < Q.statCount; i++) {
+        if (Q.stats[i].name == name || !strcmp(Q.stats[i].name, name)) {
+            return &Q.stats[i];
+        }
+    }
+    if (Q.statCount == PROFILER_MAX_STATS) {
+        return NULL;
+    }
+    Q.stats[Q.statCount] = (ProfileStat) { .name = name };
+    return &Q.stats[Q.statCount++];
+}
+
+void NextProfilerFrame(void) {
+    if (!atomic_load_explicit(&Q.enabled, memory_order_relaxed)) {
+        return;
+    }
+    // Add up the time spent in every zone since the last frame, on all the threads
+    int count = atomic_load_explicit(&Q.ringCount, memory_order_relaxed);
+    for (int i = 0; i < count && i < PROFILER_MAX_THREADS; i++) {
+        ProfileRing *ring = atomic_load_explicit(&Q.rings[i], memory_order_acquire);
+        if (!ring) {
+            continue;
+        }
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        // Skip the zones that were already overwritten
+        if (head - ring->drained > PROFILER_RING_SIZE) {
+            ring->drained = head - PROFILER_RING_SIZE;
+        }
+        for (; ring->drained != head; ring->drained++) {
+            const ProfileEvent *event = &ring->events[ring->drained & (PROFILER_RING_SIZE - 1)];
+            ProfileStat *stat = GetStat(event->name);
+            if (stat) {
+                stat->frameTotal += event->end - event->start;
+            }
+        }
+    }
+    for (int i = 0; i < Q.statCount; i++) {
+        ProfileStat *stat = &Q.stats[i];
+        stat->average += ((float) stat->frameTotal - stat->average) * PROFILER_SMOOTHING;
+        stat->frameTotal = 0.0;
+    }
+}
+
+void DrawProfilerOverlay(int x, int y) {
+    if (!atomic_load_explicit(&Q.enabled, memory_order_relaxed)) {
+        return;
+    }
+    DrawRectangle(x - 5, y - 5, 220, Q.statCount * 20 + 10, Fade(BLACK, 0.6f));
+    for (int i = 0; i < Q.statCount; i++) {
+        DrawText(TextFormat("%-12s %6.2f ms", Q.stats[i].name, Q.stats[i].average * 1000.0f), x, y + i * 20, 20, LIME);
+    }
+}
+
+bool ExportProfilerTrace(const char *fileName) {
+    FILE *file = fopen(fileName, "w");
+    if (!file) {
+        TraceLog(LOG_WARNING, "PROFILE: [%s] Failed to open the trace file", fileName);
+        return false;
+    }
+    fprintf(file, "{\"traceEvents\": [\n");
+    int written = 0;
+    int count = atomic_load_explicit(&Q.ringCount, memory_order_relaxed);
+    for (int i = 0; i < count && i < PROFILER_MAX_THREADS; i++) {
+        ProfileRing *ring = atomic_load_explicit(&Q.rings[i], memory_order_acquire);
+        if (!ring) {
+            continue;
+        }
+        // Name the track of the thread
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+            (written++) ? ",\n" : "", ring->id, (ring->name) ? ring->name : TextFormat("thread %d", ring->id));
+        // The owner may still be recording, leave the oldest zones out
+        // since they are the next ones to be overwritten
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        unsigned int first = (head > PROFILER_RING_SIZE / 2) ? (head - PROFILER_RING_SIZE / 2) : 0;
+        for (unsigned int n = first; n != head; n++) {
+            const ProfileEvent *event = &ring->events[n & (PROFILER_RING_SIZE - 1)];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                event->name, ring->id, event->start * 1e6, (event->end - event->start) * 1e6);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool success = !ferror(file);
+    fclose(file);
+    if (success) {
+        TraceLog(LOG_INFO, "PROFILE: [%s] Trace exported successfully", fileName);
+    }
+    return success;
+}
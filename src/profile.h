@@ -0,0 +1,37 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+// Zone being timed, names have to outlive the profiler (string literals)
+typedef struct {
+    const char *name;
+    double start;           // 0 when the profiler was disabled
+} ProfileZone;
+
+// The profiler starts disabled, while it's disabled zones are not recorded
+void SetProfilerEnabled(bool enabled);
+bool IsProfilerEnabled(void);
+// Names the track of the calling thread in the traces
+void SetProfilerThreadName(const char *name);
+// Frees the buffers of every thread, no zone can be timed anymore
+void ShutdownProfiler(void);
+
+// Starts and ends timing a zone on the calling thread, every thread records
+// into its own ring buffer (the oldest zones are overwritten when it's full)
+ProfileZone BeginProfileZone(const char *name);
+void EndProfileZone(ProfileZone zone);
+// Records a zone timed on the GPU (already converted to the GetBenchTime()
+// clock) on its own track, it can only be called from a single thread
+void RecordGpuProfileZone(const char *name, double start, double end);
+
+// Adds up the zones recorded since the last call for the overlay,
+// has to be called once per frame by the thread that draws it
+void NextProfilerFrame(void);
+// Draws the average time spent per frame in every zone
+void DrawProfilerOverlay(int x, int y);
+// Writes the zones still in the ring buffers in the Chrome trace event
+// format (open it with chrome://tracing or https://ui.perfetto.dev)
+bool ExportProfilerTrace(const char *fileName);
+
+#endif
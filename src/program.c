@@ -0,0 +1,351 @@
+#include "program.h"
+#include <rlgl.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "map.h"
+
+// Tells the cached binaries apart from anything else in the cache directory
+#define PROGRAM_BINARY_MAGIC    0x42504352u     // "RCPB"
+#define PROGRAM_LOG_SIZE        4096
+
+// GL entry points that rlgl doesn't wrap (program binaries and build logs)
+#ifndef APIENTRY
+#ifdef _WIN32
+#define APIENTRY __stdcall
+#else
+#define APIENTRY
+#endif
+#endif
+#define GL_VENDOR                   0x1F00
+#define GL_RENDERER                 0x1F01
+#define GL_VERSION                  0x1F02
+#define GL_COMPILE_STATUS           0x8B81
+#define GL_LINK_STATUS              0x8B82
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH    0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef const unsigned char *(APIENTRY *GetStringFunc)(unsigned int name);
+typedef void (APIENTRY *GetIntegervFunc)(unsigned int name, int *value);
+typedef unsigned int (APIENTRY *CreateShaderFunc)(unsigned int type);
+typedef void (APIENTRY *ShaderSourceFunc)(unsigned int shader, int count, const char *const *sources, const int *lengths);
+typedef void (APIENTRY *CompileShaderFunc)(unsigned int shader);
+typedef void (APIENTRY *GetShaderivFunc)(unsigned int shader, unsigned int name, int *value);
+typedef void (APIENTRY *GetShaderInfoLogFunc)(unsigned int shader, int size, int *length, char *log);
+typedef void (APIENTRY *DeleteShaderFunc)(unsigned int shader);
+typedef unsigned int (APIENTRY *CreateProgramFunc)(void);
+typedef void (APIENTRY *AttachShaderFunc)(unsigned int program, unsigned int shader);
+typedef void (APIENTRY *DetachShaderFunc)(unsigned int program, unsigned int shader);
+typedef void (APIENTRY *LinkProgramFunc)(unsigned int program);
+typedef void (APIENTRY *GetProgramivFunc)(unsigned int program, unsigned int name, int *value);
+typedef void (APIENTRY *GetProgramInfoLogFunc)(unsigned int program, int size, int *length, char *log);
+typedef void (APIENTRY *DeleteProgramFunc)(unsigned int program);
+typedef void (APIENTRY *ProgramParameteriFunc)(unsigned int program, unsigned int name, int value);
+typedef void (APIENTRY *GetProgramBinaryFunc)(unsigned int program, int size, int *length, unsigned int *format, void *binary);
+typedef void (APIENTRY *ProgramBinaryFunc)(unsigned int program, unsigned int format, const void *binary, int length);
+typedef void (*GLFWglproc)(void);
+GLFWglproc glfwGetProcAddress(const char *procname);
+
+// Header of the cache files, the binary follows it
+typedef struct {
+    unsigned int magic;
+    unsigned int format;        // Driver specific format of the binary
+    unsigned int size;
+} ProgramBinaryHeader;
+
+typedef struct {
+    bool binaries;              // Whether binaries are saved and loaded
+    char directory[PROGRAM_MAX_PATH];
+    uint64_t driverHash;        // Binaries only work with the driver that built them
+    GetStringFunc getString;
+    GetIntegervFunc getIntegerv;
+    CreateShaderFunc createShader;
+    ShaderSourceFunc shaderSource;
+    CompileShaderFunc compileShader;
+    GetShaderivFunc getShaderiv;
+    GetShaderInfoLogFunc getShaderInfoLog;
+    DeleteShaderFunc deleteShader;
+    CreateProgramFunc createProgram;
+    AttachShaderFunc attachShader;
+    DetachShaderFunc detachShader;
+    LinkProgramFunc linkProgram;
+    GetProgramivFunc getProgramiv;
+    GetProgramInfoLogFunc getProgramInfoLog;
+    DeleteProgramFunc deleteProgram;
+    ProgramParameteriFunc programParameteri;
+    GetProgramBinaryFunc getProgramBinary;
+    ProgramBinaryFunc programBinary;
+} ProgramCache;
+
+// Singletons
+static ProgramCache L = {0};
+
+static bool CreateCacheDirectory(const char *directory) {
+    if (DirectoryExists(directory)) {
+        return true;
+    }
+#ifdef _WIN32
+    return !_mkdir(directory);
+#else
+    return !mkdir(directory, 0755);
+#endif
+}
+
+void InitProgramCache(const char *directory) {
+    L.getString = (GetStringFunc) glfwGetProcAddress("glGetString");
+    L.getIntegerv = (GetIntegervFunc) glfwGetProcAddress("glGetIntegerv");
+    L.createShader = (CreateShaderFunc) glfwGetProcAddress("glCreateShader");
+    L.shaderSource = (ShaderSourceFunc) glfwGetProcAddress("glShaderSource");
+    L.compileShader = (CompileShaderFunc) glfwGetProcAddress("glCompileShader");
+    L.getShaderiv = (GetShaderivFunc) glfwGetProcAddress("glGetShaderiv");
+    L.getShaderInfoLog = (GetShaderInfoLogFunc) glfwGetProcAddress("glGetShaderInfoLog");
+    L.deleteShader = (DeleteShaderFunc) glfwGetProcAddress("glDeleteShader");
+    L.createProgram = (CreateProgramFunc) glfwGetProcAddress("glCreateProgram");
+    L.attachShader = (AttachShaderFunc) glfwGetProcAddress("glAttachShader");
+    L.detachShader = (DetachShaderFunc) glfwGetProcAddress("glDetachShader");
+    L.linkProgram = (LinkProgramFunc) glfwGetProcAddress("glLinkProgram");
+    L.getProgramiv = (GetProgramivFunc) glfwGetProcAddress("glGetProgramiv");
+    L.getProgramInfoLog = (GetProgramInfoLogFunc) glfwGetProcAddress("glGetProgramInfoLog");
+    L.deleteProgram = (DeleteProgramFunc) glfwGetProcAddress("glDeleteProgram");
+    L.programParameteri = (ProgramParameteriFunc) glfwGetProcAddress("glProgramParameteri");
+    L.getProgramBinary = (GetProgramBinaryFunc) glfwGetProcAddress("glGetProgramBinary");
+    L.programBinary = (ProgramBinaryFunc) glfwGetProcAddress("glProgramBinary");
+    L.binaries = false;
+    if (!directory) {
+        return;
+    }
+    // Program binaries are core since GL 4.1, but drivers may support no format at all
+    int formats = 0;
+    if (L.programParameteri && L.getProgramBinary && L.programBinary) {
+        L.getIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    if (formats <= 0) {
+        TraceLog(LOG_WARNING, "PROGRAM: Program binaries are not supported, the shaders will be built on every launch");
+        return;
+    }
+    if (!CreateCacheDirectory(directory)) {
+        TraceLog(LOG_WARNING, "PROGRAM: [%s] Failed to create the program cache directory", directory);
+        return;
+    }
+    // A driver update invalidates every binary, so it's part of their key
+    L.driverHash = HASH_OFFSET_BASIS;
+    unsigned int names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (int i = 0; i < 3; i++) {
+        const char *name = (const char *) L.getString(names[i]);
+        L.driverHash = HashBytes(L.driverHash, name, (name) ? strlen(name) + 1 : 0);
+    }
+    strncpy(L.directory, directory, PROGRAM_MAX_PATH - 1);
+    L.binaries = true;
+}
+
+static const char *GetCacheFileName(uint64_t key) {
+    return TextFormat("%s/%016llx.bin", L.directory, (unsigned long long) key);
+}
+
+// Returns 0 when the binary isn't cached or the driver rejects it
+static unsigned int LoadCachedProgram(uint64_t key) {
+    if (!L.binaries) {
+        return 0;
+    }
+    const char *fileName = GetCacheFileName(key);
+    if (!FileExists(fileName)) {
+        return 0;
+    }
+    unsigned int size = 0;
+    unsigned char *data = LoadFileData(fileName, &size);
+    if (!data) {
+        return 0;
+    }
+    unsigned int id = 0;
+    const ProgramBinaryHeader *header = (const ProgramBinaryHeader *) data;
+    if (size >= sizeof(ProgramBinaryHeader) && header->magic == PROGRAM_BINARY_MAGIC && header->size == size - sizeof(ProgramBinaryHeader)) {
+        id = L.createProgram();
+        L.programBinary(id, header->format, data + sizeof(ProgramBinaryHeader), header->size);
+        int linked = 0;
+        L.getProgramiv(id, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            L.deleteProgram(id);
+            id = 0;
+        }
+    }
+    UnloadFileData(data);
+    return id;
+}
+
+static void SaveCachedProgram(unsigned int id, uint64_t key) {
+    int size = 0;
+    L.getProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) {
+        return;
+    }
+    unsigned char *data = MemAlloc(sizeof(ProgramBinaryHeader) + size);
+    if (!data) {
+        return;
+    }
+    ProgramBinaryHeader *header = (ProgramBinaryHeader *) data;
+    int length = 0;
+    unsigned int format = 0;
+    L.getProgramBinary(id, size, &length, &format, data + sizeof(ProgramBinaryHeader));
+    *header = (ProgramBinaryHeader) {
+        .magic = PROGRAM_BINARY_MAGIC,
+        .format = format,
+        .size = length
+    };
+    if (length > 0) {
+        SaveFileData(GetCacheFileName(key), data, sizeof(ProgramBinaryHeader) + length);
+    }
+    MemFree(data);
+}
+
+static unsigned int CompileStage(const char *fileName, const char *source, unsigned int type) {
+    unsigned int shader = L.createShader(type);
+    L.shaderSource(shader, 1, &source, NULL);
+    L.compileShader(shader);
+    int compiled = 0;
+    L.getShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[PROGRAM_LOG_SIZE] = {0};
+        L.getShaderInfoLog(shader, PROGRAM_LOG_SIZE, NULL, log);
+        TraceLog(LOG_WARNING, "PROGRAM: [%s] Failed to compile shader: %s", fileName, log);
+        L.deleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static unsigned int LinkStages(const Program *program, char **sources) {
+    unsigned int shaders[PROGRAM_MAX_STAGES] = {0};
+    unsigned int id = 0;
+    int compiled = 0;
+    while (compiled < program->stageCount && (shaders[compiled] = CompileStage(program->fileNames[compiled], sources[compiled], program->stages[compiled]))) {
+        compiled++;
+    }
+    if (compiled == program->stageCount) {
+        id = L.createProgram();
+        for (int i = 0; i < program->stageCount; i++) {
+            L.attachShader(id, shaders[i]);
+        }
+        if (L.binaries) {
+            L.programParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, 1);
+        }
+        L.linkProgram(id);
+        for (int i = 0; i < program->stageCount; i++) {
+            L.detachShader(id, shaders[i]);
+        }
+        int linked = 0;
+        L.getProgramiv(id, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            char log[PROGRAM_LOG_SIZE] = {0};
+            L.getProgramInfoLog(id, PROGRAM_LOG_SIZE, NULL, log);
+            TraceLog(LOG_WARNING, "PROGRAM: [%s] Failed to link program: %s", program->fileNames[program->stageCount - 1], log);
+            L.deleteProgram(id);
+            id = 0;
+        }
+    }
+    for (int i = 0; i < compiled; i++) {
+        L.deleteShader(shaders[i]);
+    }
+    return id;
+}
+
+// Builds the program from the current version of its files, returns 0 on failure
+static unsigned int BuildProgram(Program *program) {
+    char *sources[PROGRAM_MAX_STAGES] = {0};
+    bool loaded = true;
+    uint64_t key = L.driverHash;
+    for (int i = 0; i < program->stageCount; i++) {
+        // Read the time first, so a change while reading is picked up by the next reload
+        program->modTimes[i] = GetFileModTime(program->fileNames[i]);
+        sources[i] = LoadFileText(program->fileNames[i]);
+        if (!sources[i]) {
+            loaded = false;
+            break;
+        }
+        key = HashBytes(key, &program->stages[i], sizeof(unsigned int));
+        key = HashBytes(key, sources[i], strlen(sources[i]) + 1);
+    }
+    unsigned int id = 0;
+    const char *fileName = program->fileNames[program->stageCount - 1];
+    if (loaded && (id = LoadCachedProgram(key))) {
+        TraceLog(LOG_INFO, "PROGRAM: [%s] Program loaded from the cache", fileName);
+    } else if (loaded && (id = LinkStages(program, sources))) {
+        TraceLog(LOG_INFO, "PROGRAM: [%s] Program built successfully", fileName);
+        if (L.binaries) {
+            SaveCachedProgram(id, key);
+        }
+    }
+    for (int i = 0; i < program->stageCount; i++) {
+        if (sources[i]) {
+            UnloadFileText(sources[i]);
+        }
+    }
+    return id;
+}
+
+static void GetProgramLocations(Program *program) {
+    for (int i = 0; i < PROGRAM_MAX_LOCATIONS; i++) {
+        program->locations[i] = -1;
+    }
+    // The same locations LoadShader() looks up
+    program->locations[SHADER_LOC_VERTEX_POSITION] = rlGetLocationAttrib(program->id, "vertexPosition");
+    program->locations[SHADER_LOC_VERTEX_TEXCOORD01] = rlGetLocationAttrib(program->id, "vertexTexCoord");
+    program->locations[SHADER_LOC_VERTEX_COLOR] = rlGetLocationAttrib(program->id, "vertexColor");
+    program->locations[SHADER_LOC_MATRIX_MVP] = rlGetLocationUniform(program->id, "mvp");
+    program->locations[SHADER_LOC_COLOR_DIFFUSE] = rlGetLocationUniform(program->id, "colDiffuse");
+    program->locations[SHADER_LOC_MAP_DIFFUSE] = rlGetLocationUniform(program->id, "texture0");
+}
+
+static bool LoadProgram(Program *program, int stageCount, const unsigned int *stages, const char **fileNames) {
+    *program = (Program) { .stageCount = stageCount };
+    for (int i = 0; i < stageCount; i++) {
+        program->stages[i] = stages[i];
+        strncpy(program->fileNames[i], fileNames[i], PROGRAM_MAX_PATH - 1);
+    }
+    program->id = BuildProgram(program);
+    GetProgramLocations(program);
+    return program->id != 0;
+}
+
+bool LoadComputeProgram(Program *program, const char *fileName) {
+    return LoadProgram(program, 1, (unsigned int[]) { RL_COMPUTE_SHADER }, (const char *[]) { fileName });
+}
+
+bool LoadRenderProgram(Program *program, const char *vsFileName, const char *fsFileName) {
+    return LoadProgram(program, 2, (unsigned int[]) { RL_VERTEX_SHADER, RL_FRAGMENT_SHADER }, (const char *[]) { vsFileName, fsFileName });
+}
+
+void UnloadProgram(Program *program) {
+    if (program->id) {
+        L.deleteProgram(program->id);
+    }
+    *program = (Program) {0};
+}
+
+bool ReloadProgram(Program *program) {
+    bool modified = false;
+    for (int i = 0; i < program->stageCount; i++) {
+        modified |= GetFileModTime(program->fileNames[i]) != program->modTimes[i];
+    }
+    if (!modified) {
+        return false;
+    }
+    unsigned int id = BuildProgram(program);
+    if (!id) {
+        TraceLog(LOG_WARNING, "PROGRAM: [%s] Failed to reload program, keeping the previous one", program->fileNames[program->stageCount - 1]);
+        return false;
+    }
+    if (program->id) {
+        L.deleteProgram(program->id);
+    }
+    program->id = id;
+    GetProgramLocations(program);
+    return true;
+}
+
+Shader GetProgramShader(Program *program) {
+    return (Shader) { program->id, program->locations };
+}
@@ -0,0 +1,44 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <raylib.h>
+#include <stdbool.h>
+
+// Shader stages of a program, compute or vertex and fragment
+#define PROGRAM_MAX_STAGES      2
+#define PROGRAM_MAX_PATH        512
+// Same as RL_MAX_SHADER_LOCATIONS (the size raylib expects for Shader.locs)
+#define PROGRAM_MAX_LOCATIONS   32
+
+// GL program built from shader files, it keeps track of them so it can be
+// rebuilt when they change
+typedef struct {
+    unsigned int id;                // 0 if it couldn't be built
+    int stageCount;
+    unsigned int stages[PROGRAM_MAX_STAGES];    // GL shader type of every file
+    char fileNames[PROGRAM_MAX_STAGES][PROGRAM_MAX_PATH];
+    long modTimes[PROGRAM_MAX_STAGES];  // Of the files the program was built from
+    int locations[PROGRAM_MAX_LOCATIONS];   // Default raylib locations (see Shader)
+} Program;
+
+// Loads the GL entry points and keeps the binaries of the programs built
+// from now on in directory (created if needed), NULL only builds them from
+// source. Needs a GL context, so it has to be called after InitWindow()
+void InitProgramCache(const char *directory);
+
+// Builds a program from its shader files, or loads its binary from the
+// cache when neither the sources nor the driver changed since it was cached
+bool LoadComputeProgram(Program *program, const char *fileName);
+// The vertex shader has to use the raylib attribute locations (position 0,
+// texture coordinates 1 and color 3) for the program to draw raylib batches
+bool LoadRenderProgram(Program *program, const char *vsFileName, const char *fsFileName);
+void UnloadProgram(Program *program);
+// Rebuilds the program if any of its files changed since it was built,
+// returns true when it was replaced. If the new sources fail to build the
+// old program is kept (and the files aren't tried again until they change)
+bool ReloadProgram(Program *program);
+// Returns a raylib shader of a render program (for BeginShaderMode()),
+// valid until the program is reloaded or unloaded
+Shader GetProgramShader(Program *program);
+
+#endif
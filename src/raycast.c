@@ -0,0 +1,1139 @@
+#include "raycast.h"
+#include <math.h>
+#include <string.h>
+#include "lightmap.h"
+#include "palette.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RAYCAST_X86
+#include <immintrin.h>
+#endif
+
+#define absf(x) ((x < 0.0f) ? -x : x)
+// Jumping costs more than a couple of steps, so the rays only
+// jump over empty blocks of at least 4x4 cells
+#define JUMP_MIN_LEVEL 2
+
+typedef void (*CastRaysFunc)(const RayCastParams *params, RayHit *hits, int start, int end);
+typedef void (*CastRowFunc)(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end);
+typedef void (*CastIndexedRowFunc)(const RowCastParams *params, Vector2 start, Vector2 step, unsigned char *ceilingRow, unsigned char *floorRow, int first, int end);
+
+// Returns how many grid lines (placed every delta along the ray, starting at distance)
+// the ray crosses strictly before limit, at most max. Multiplying by the inverse
+// can round up a crossing that happens exactly at the limit (the ray goes through
+// a corner), which is dropped so that the following steps resolve the tie
+static inline int CountCrossings(float distance, float delta, float inverseDelta, float limit, int max) {
+    if (!(limit > distance)) {
+        return 0;
+    }
+    // Same as ceilf() (the value is positive) without calling into libm
+    float exact = (limit - distance) * inverseDelta;
+    int crossings = (int) exact;
+    crossings += ((float) crossings < exact);
+    if (distance + (float) (crossings - 1) * delta >= limit) {
+        crossings--;
+    }
+    return (crossings < max) ? crossings : max;
+}
+
+// Returns the wall id of cell (x, y), which has to be inside the map,
+// the walls of the chunks that aren't cached read as empty
+static inline int GetWallId(const ChunkCache *chunks, int x, int y) {
+    int offset = GetCachedTileOffset(chunks, x, y);
+    return (offset >= 0) ? chunks->walls[offset] : 0;
+}
+
+static void CastRaysScalar(const RayCastParams *params, RayHit *hits, int start, int end) {
+    for (int n = start; n < end; n++) {
+        // cameraX = coordinate (between -1 and 1) of the ray on the x-axis
+        //           of the camera plane
+        float cameraX = params->cameraX[n];
+        // Compute the ray direction
+        Vector2 rayDirection = {
+            params->direction.x + params->cameraPlane.x * cameraX,
+            params->direction.y + params->cameraPlane.y * cameraX
+        };
+
+        // Compute the distance along the ray direction to the next intersection
+        // with the y-axis
+        float yDeltaDistance = absf(1.0f / rayDirection.x);
+        // Compute the distance along the ray direction to the next intersection
+        // with the x-axis
+        float xDeltaDistance = absf(1.0f / rayDirection.y);
+
+        // Compute the distance in the horizontal direction of the ray to
+        // the border of the cell
+        float xDistance = (rayDirection.x > 0.0f) ? (1.0f - params->tileCoords.x) : params->tileCoords.x;
+        // Compute the distance in the vertical direction of the ray to
+        // the border of the cell
+        float yDistance = (rayDirection.y > 0.0f) ? (1.0f - params->tileCoords.y) : params->tileCoords.y;
+
+        // Compute the distance along the ray direction to the first intersection
+        // with the y-axis
+        float yIntersectionDistance = yDeltaDistance * xDistance;
+        // Compute the distance along the ray direction to the first intersection
+        // with the x-axis
+        float xIntersectionDistance = xDeltaDistance * yDistance;
+
+        // Find the direction we are moving in the map
+        int stepX = (rayDirection.x < 0.0f) ? -1 : +1;
+        int stepY = (rayDirection.y < 0.0f) ? -1 : +1;
+
+        // Find map coordinates
+        int mapX = params->mapX;
+        int mapY = params->mapY;
+
+        // Step the rays until one hits, they move up the occupancy pyramid
+        // after leaving an empty block and down when a block isn't empty
+        const OccupancyGrid *grid = params->occupancy;
+        int topLevel = grid->levels - 1;
+        int level = 0;
+        int cellId = 0;
+        bool vertical = true;
+        for (int i = 0; i < params->dof; i++) {
+            int xSkip = 0, ySkip = 0;
+            if (mapX >= 0 && mapX < params->mapWidth && mapY >= 0 && mapY < params->mapHeight) {
+                if (IsOccupied(grid, level, mapX >> level, mapY >> level)) {
+                    if (!level) {
+                        cellId = GetWallId(params->chunks, mapX, mapY);
+                        break;
+                    }
+                    // Look at the smaller blocks inside this one
+                    level--;
+                    continue;
+                }
+                // Count the cells left in the empty block, in the stepping direction
+                if (level >= JUMP_MIN_LEVEL) {
+                    int blockMask = (1 << level) - 1;
+                    xSkip = (stepX > 0) ? (blockMask - (mapX & blockMask)) : (mapX & blockMask);
+                    ySkip = (stepY > 0) ? (blockMask - (mapY & blockMask)) : (mapY & blockMask);
+                }
+            } else if (((stepX < 0) ? (mapX < 0) : (mapX >= params->mapWidth)) || ((stepY < 0) ? (mapY < 0) : (mapY >= params->mapHeight))) {
+                // The ray left the map and moves away from it
+                break;
+            }
+            // Jump straight to the last cell the ray crosses inside the block...
+            if (xSkip || ySkip) {
+                float yLimit = yIntersectionDistance + (float) xSkip * yDeltaDistance;
+                float xLimit = xIntersectionDistance + (float) ySkip * xDeltaDistance;
+                float limit = (yLimit < xLimit) ? yLimit : xLimit;
+                int xSteps = CountCrossings(yIntersectionDistance, yDeltaDistance, absf(rayDirection.x), limit, xSkip);
+                int ySteps = CountCrossings(xIntersectionDistance, xDeltaDistance, absf(rayDirection.y), limit, ySkip);
+                if (xSteps) {
+                    yIntersectionDistance += (float) xSteps * yDeltaDistance;
+                    mapX += xSteps * stepX;
+                }
+                if (ySteps) {
+                    xIntersectionDistance += (float) ySteps * xDeltaDistance;
+                    mapY += ySteps * stepY;
+                }
+            }
+            // ...and step out of it
+            if (yIntersectionDistance < xIntersectionDistance) {
+                yIntersectionDistance += yDeltaDistance;
+                mapX += stepX;
+                vertical = true;
+            } else {
+                xIntersectionDistance += xDeltaDistance;
+                mapY += stepY;
+                vertical = false;
+            }
+            level = (level < topLevel) ? (level + 1) : topLevel;
+        }
+
+        RayHit *hit = &hits[n - start];
+        hit->cellId = cellId;
+        hit->vertical = vertical;
+        hit->mapX = mapX;
+        hit->mapY = mapY;
+        // The delta distance is subracted from the total to
+        // obtain the distance projected onto the camera direction
+        // This is done to fix the fisheye effect
+        hit->distance = (vertical) ? (yIntersectionDistance - yDeltaDistance) : (xIntersectionDistance - xDeltaDistance);
+    }
+}
+
+// Scales a color by a brightness in 8.8 fixed point, keeping its alpha
+static inline Color ShadeColor(Color color, int brightness) {
+    return (Color) {
+        (color.r * brightness) >> 8,
+        (color.g * brightness) >> 8,
+        (color.b * brightness) >> 8,
+        color.a
+    };
+}
+
+// Casts the pixels first to end - 1 of a row, the SIMD kernels use it for the leftovers
+static void CastRowScalar(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end) {
+    int textureSize = params->textureSize;
+    for (int x = first; x < end; x++) {
+        // Compute the position of the pixel on the map
+        float positionX = start.x + step.x * (float) x;
+        float positionY = start.y + step.y * (float) x;
+        // Get the current cell position and check if it's inside the map
+        float cellX = floorf(positionX);
+        float cellY = floorf(positionY);
+        int ceilingId = 0, floorId = 0, texel = 0;
+        const unsigned char *luxels = NULL;
+        if (cellX >= 0.0f && cellX < params->mapWidth && cellY >= 0.0f && cellY < params->mapHeight) {
+            int offset = GetCachedTileOffset(params->chunks, (int) cellX, (int) cellY);
+            if (offset >= 0) {
+                ceilingId = params->chunks->ceilings[offset];
+                floorId = params->chunks->floors[offset];
+                // Find the luxel of the pixel, at the same place on the floor and the ceiling
+                luxels = &params->luxels[GetCachedLuxelOffset(params->chunks, (int) cellX, (int) cellY)
+                    + GetLuxelCoordinate(positionY - cellY) * LIGHTMAP_RESOLUTION + GetLuxelCoordinate(positionX - cellX)];
+            }
+            // Compute the texture coordinates
+            int textureX = (int) ((positionX - cellX) * textureSize);
+            int textureY = (int) ((positionY - cellY) * textureSize);
+            textureX = (textureX < textureSize) ? textureX : (textureSize - 1);
+            textureY = (textureY < textureSize) ? textureY : (textureSize - 1);
+            texel = textureY * textureSize + textureX;
+        }
+        // Sample and light the textures, empty cells (or unknown ids) get the default colors
+        ceilingRow[x] = (ceilingId > 0 && ceilingId <= params->textureCount)
+            ? ShadeColor(params->texels[(ceilingId - 1) * textureSize * textureSize + texel], GetLuxelBrightness(luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS]))
+            : params->ceilingColor;
+        floorRow[x] = (floorId > 0 && floorId <= params->textureCount)
+            ? ShadeColor(params->texels[(floorId - 1) * textureSize * textureSize + texel], GetLuxelBrightness(luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS]))
+            : params->floorColor;
+    }
+}
+
+// Same as CastRowScalar() with palette indices, the texels are lit with the shade table
+static void CastIndexedRowScalar(const RowCastParams *params, Vector2 start, Vector2 step, unsigned char *ceilingRow, unsigned char *floorRow, int first, int end) {
+    int textureSize = params->textureSize;
+    for (int x = first; x < end; x++) {
+        // Compute the position of the pixel on the map
+        float positionX = start.x + step.x * (float) x;
+        float positionY = start.y + step.y * (float) x;
+        // Get the current cell position and check if it's inside the map
+        float cellX = floorf(positionX);
+        float cellY = floorf(positionY);
+        int ceilingId = 0, floorId = 0, texel = 0;
+        const unsigned char *luxels = NULL;
+        if (cellX >= 0.0f && cellX < params->mapWidth && cellY >= 0.0f && cellY < params->mapHeight) {
+            int offset = GetCachedTileOffset(params->chunks, (int) cellX, (int) cellY);
+            if (offset >= 0) {
+                ceilingId = params->chunks->ceilings[offset];
+                floorId = params->chunks->floors[offset];
+                // Find the luxel of the pixel, at the same place on the floor and the ceiling
+                luxels = &params->luxels[GetCachedLuxelOffset(params->chunks, (int) cellX, (int) cellY)
+                    + GetLuxelCoordinate(positionY - cellY) * LIGHTMAP_RESOLUTION + GetLuxelCoordinate(positionX - cellX)];
+            }
+            // Compute the texture coordinates
+            int textureX = (int) ((positionX - cellX) * textureSize);
+            int textureY = (int) ((positionY - cellY) * textureSize);
+            textureX = (textureX < textureSize) ? textureX : (textureSize - 1);
+            textureY = (textureY < textureSize) ? textureY : (textureSize - 1);
+            texel = textureY * textureSize + textureX;
+        }
+        // Sample and light the textures, empty cells (or unknown ids) get the default colors
+        ceilingRow[x] = (ceilingId > 0 && ceilingId <= params->textureCount)
+            ? params->shades[GetShadeOffset(luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS]) + params->indices[(ceilingId - 1) * textureSize * textureSize + texel]]
+            : params->ceilingIndex;
+        floorRow[x] = (floorId > 0 && floorId <= params->textureCount)
+            ? params->shades[GetShadeOffset(luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS]) + params->indices[(floorId - 1) * textureSize * textureSize + texel]]
+            : params->floorIndex;
+    }
+}
+
+#ifdef RAYCAST_X86
+
+// The SIMD kernels march a packet of adjacent columns together and every lane
+// follows exactly the same steps as CastRaysScalar(). Instead of freezing the
+// lanes that hit a wall (which would make every step wait for the map loads)
+// all lanes keep stepping and the state of each lane is recorded the first time
+// it hits, so the loads of consecutive steps can overlap. The packet stops once
+// every lane has hit something and whatever is left after the last full packet
+// goes through the scalar kernel. Each lane walks the occupancy pyramid at its
+// own level and the wall ids are only read for the cells that were hit.
+
+// Vector versions of CountCrossings(), lanes where limit isn't past distance get 0
+
+__attribute__((target("sse4.1")))
+static inline __m128i CountCrossingsSSE(__m128 distance, __m128 delta, __m128 inverseDelta, __m128 limit, __m128i max) {
+    __m128i crossings = _mm_cvttps_epi32(_mm_ceil_ps(_mm_mul_ps(_mm_sub_ps(limit, distance), inverseDelta)));
+    __m128 last = _mm_add_ps(distance, _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(crossings, _mm_set1_epi32(1))), delta));
+    crossings = _mm_add_epi32(crossings, _mm_castps_si128(_mm_cmpge_ps(last, limit)));
+    return _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(limit, distance)), _mm_min_epi32(crossings, max));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i CountCrossingsAVX2(__m256 distance, __m256 delta, __m256 inverseDelta, __m256 limit, __m256i max) {
+    __m256i crossings = _mm256_cvttps_epi32(_mm256_ceil_ps(_mm256_mul_ps(_mm256_sub_ps(limit, distance), inverseDelta)));
+    __m256 last = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(crossings, _mm256_set1_epi32(1))), delta));
+    crossings = _mm256_add_epi32(crossings, _mm256_castps_si256(_mm256_cmp_ps(last, limit, _CMP_GE_OQ)));
+    return _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(limit, distance, _CMP_GT_OQ)), _mm256_min_epi32(crossings, max));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i CountCrossingsAVX512(__m512 distance, __m512 delta, __m512 inverseDelta, __m512 limit, __m512i max) {
+    __m512 rounded = _mm512_roundscale_ps(_mm512_mul_ps(_mm512_sub_ps(limit, distance), inverseDelta), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+    __m512i crossings = _mm512_cvttps_epi32(rounded);
+    __m512 last = _mm512_add_ps(distance, _mm512_mul_ps(_mm512_sub_ps(rounded, _mm512_set1_ps(1.0f)), delta));
+    crossings = _mm512_mask_sub_epi32(crossings, _mm512_cmp_ps_mask(last, limit, _CMP_GE_OQ), crossings, _mm512_set1_epi32(1));
+    return _mm512_maskz_min_epi32(_mm512_cmp_ps_mask(limit, distance, _CMP_GT_OQ), crossings, max);
+}
+
+// Reads the wall ids of the lanes that hit (mapX is -1 for the others)
+// and stores the results of a packet
+static inline void StoreHits(const RayCastParams *params, RayHit *hits, int lanes, const int *verticals, const int *mapXs, const int *mapYs, const float *distances) {
+    for (int lane = 0; lane < lanes; lane++) {
+        hits[lane] = (RayHit) {
+            .cellId = (mapXs[lane] >= 0) ? GetWallId(params->chunks, mapXs[lane], mapYs[lane]) : 0,
+            .vertical = verticals[lane] != 0,
+            .mapX = mapXs[lane],
+            .mapY = mapYs[lane],
+            .distance = distances[lane]
+        };
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void CastRaysSSE(const RayCastParams *params, RayHit *hits, int start, int end) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i allOnes = _mm_set1_epi32(-1);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128i mapWidth = _mm_set1_epi32(params->mapWidth);
+    const __m128i mapHeight = _mm_set1_epi32(params->mapHeight);
+    const OccupancyGrid *grid = params->occupancy;
+    const __m128i topLevel = _mm_set1_epi32(grid->levels - 1);
+    const __m128i jumpLevel = _mm_set1_epi32(JUMP_MIN_LEVEL - 1);
+    int n = start;
+    for (; n + 4 <= end; n += 4) {
+        // Compute the ray directions
+        __m128 cameraX = _mm_loadu_ps(&params->cameraX[n]);
+        __m128 rayDirectionX = _mm_add_ps(_mm_set1_ps(params->direction.x), _mm_mul_ps(_mm_set1_ps(params->cameraPlane.x), cameraX));
+        __m128 rayDirectionY = _mm_add_ps(_mm_set1_ps(params->direction.y), _mm_mul_ps(_mm_set1_ps(params->cameraPlane.y), cameraX));
+        // Compute the delta distances
+        __m128 yDeltaDistance = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), rayDirectionX), absMask);
+        __m128 xDeltaDistance = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), rayDirectionY), absMask);
+        // Compute the distances to the first intersections
+        __m128 positiveX = _mm_cmpgt_ps(rayDirectionX, _mm_setzero_ps());
+        __m128 positiveY = _mm_cmpgt_ps(rayDirectionY, _mm_setzero_ps());
+        __m128 xDistance = _mm_blendv_ps(_mm_set1_ps(params->tileCoords.x), _mm_set1_ps(1.0f - params->tileCoords.x), positiveX);
+        __m128 yDistance = _mm_blendv_ps(_mm_set1_ps(params->tileCoords.y), _mm_set1_ps(1.0f - params->tileCoords.y), positiveY);
+        __m128 yIntersectionDistance = _mm_mul_ps(yDeltaDistance, xDistance);
+        __m128 xIntersectionDistance = _mm_mul_ps(xDeltaDistance, yDistance);
+        // Find the direction we are moving in the map
+        __m128i negativeX = _mm_castps_si128(_mm_cmplt_ps(rayDirectionX, _mm_setzero_ps()));
+        __m128i negativeY = _mm_castps_si128(_mm_cmplt_ps(rayDirectionY, _mm_setzero_ps()));
+        __m128i stepX = _mm_or_si128(negativeX, one);
+        __m128i stepY = _mm_or_si128(negativeY, one);
+        // Find the last row and column before leaving the map, in the stepping direction
+        // (mapX * stepX is past exitX once the ray left the map and moves away from it)
+        __m128i exitX = _mm_andnot_si128(negativeX, _mm_sub_epi32(mapWidth, one));
+        __m128i exitY = _mm_andnot_si128(negativeY, _mm_sub_epi32(mapHeight, one));
+        __m128 absDirectionX = _mm_and_ps(rayDirectionX, absMask);
+        __m128 absDirectionY = _mm_and_ps(rayDirectionY, absMask);
+        // Step the rays until all of them hit
+        __m128i mapX = _mm_set1_epi32(params->mapX);
+        __m128i mapY = _mm_set1_epi32(params->mapY);
+        __m128i level = zero;
+        __m128i vertical = allOnes;
+        __m128i pending = allOnes;
+        __m128i hitVertical = zero, hitMapX = allOnes, hitMapY = zero;
+        __m128 hitYIntersection = _mm_setzero_ps(), hitXIntersection = _mm_setzero_ps();
+        for (int i = 0; i < params->dof; i++) {
+            __m128i inside = _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(mapX, allOnes), _mm_cmplt_epi32(mapX, mapWidth)),
+                _mm_and_si128(_mm_cmpgt_epi32(mapY, allOnes), _mm_cmplt_epi32(mapY, mapHeight))
+            );
+            // There are no gathers or per lane shifts before AVX2, look up the
+            // block of each lane at its level one by one (lanes outside the map
+            // look at the first block and are ignored)
+            int xs[4], ys[4], levels[4];
+            _mm_storeu_si128((__m128i *) xs, _mm_and_si128(mapX, inside));
+            _mm_storeu_si128((__m128i *) ys, _mm_and_si128(mapY, inside));
+            _mm_storeu_si128((__m128i *) levels, level);
+            __m128i occupied = _mm_and_si128(inside, _mm_setr_epi32(
+                -IsOccupied(grid, levels[0], xs[0] >> levels[0], ys[0] >> levels[0]),
+                -IsOccupied(grid, levels[1], xs[1] >> levels[1], ys[1] >> levels[1]),
+                -IsOccupied(grid, levels[2], xs[2] >> levels[2], ys[2] >> levels[2]),
+                -IsOccupied(grid, levels[3], xs[3] >> levels[3], ys[3] >> levels[3])
+            ));
+            __m128i atCell = _mm_cmpeq_epi32(level, zero);
+            // Record the state of the lanes that hit for the first time
+            __m128i hit = _mm_and_si128(_mm_and_si128(occupied, atCell), pending);
+            hitVertical = _mm_blendv_epi8(hitVertical, vertical, hit);
+            hitMapX = _mm_blendv_epi8(hitMapX, mapX, hit);
+            hitMapY = _mm_blendv_epi8(hitMapY, mapY, hit);
+            hitYIntersection = _mm_blendv_ps(hitYIntersection, yIntersectionDistance, _mm_castsi128_ps(hit));
+            hitXIntersection = _mm_blendv_ps(hitXIntersection, xIntersectionDistance, _mm_castsi128_ps(hit));
+            // Lanes that left the map and move away from it can't hit anything anymore
+            __m128i escaped = _mm_andnot_si128(inside, _mm_or_si128(
+                _mm_cmpgt_epi32(_mm_sign_epi32(mapX, stepX), exitX),
+                _mm_cmpgt_epi32(_mm_sign_epi32(mapY, stepY), exitY)
+            ));
+            pending = _mm_andnot_si128(_mm_or_si128(hit, escaped), pending);
+            if (_mm_testz_si128(pending, pending)) {
+                break;
+            }
+            // Lanes in big enough empty blocks jump to the last cell they cross inside
+            __m128i jump = _mm_andnot_si128(occupied, _mm_and_si128(inside, _mm_cmpgt_epi32(level, jumpLevel)));
+            if (!_mm_testz_si128(jump, jump)) {
+                __m128i blockMask = _mm_and_si128(jump, _mm_setr_epi32(
+                    (1 << levels[0]) - 1, (1 << levels[1]) - 1, (1 << levels[2]) - 1, (1 << levels[3]) - 1
+                ));
+                __m128i xSkip = _mm_xor_si128(_mm_and_si128(mapX, blockMask), _mm_andnot_si128(negativeX, blockMask));
+                __m128i ySkip = _mm_xor_si128(_mm_and_si128(mapY, blockMask), _mm_andnot_si128(negativeY, blockMask));
+                __m128 yLimit = _mm_add_ps(yIntersectionDistance, _mm_mul_ps(_mm_cvtepi32_ps(xSkip), yDeltaDistance));
+                __m128 xLimit = _mm_add_ps(xIntersectionDistance, _mm_mul_ps(_mm_cvtepi32_ps(ySkip), xDeltaDistance));
+                __m128 limit = _mm_min_ps(yLimit, xLimit);
+                __m128i xSteps = CountCrossingsSSE(yIntersectionDistance, yDeltaDistance, absDirectionX, limit, xSkip);
+                __m128i ySteps = CountCrossingsSSE(xIntersectionDistance, xDeltaDistance, absDirectionY, limit, ySkip);
+                yIntersectionDistance = _mm_blendv_ps(yIntersectionDistance, _mm_add_ps(yIntersectionDistance, _mm_mul_ps(_mm_cvtepi32_ps(xSteps), yDeltaDistance)), _mm_castsi128_ps(_mm_cmpgt_epi32(xSteps, zero)));
+                xIntersectionDistance = _mm_blendv_ps(xIntersectionDistance, _mm_add_ps(xIntersectionDistance, _mm_mul_ps(_mm_cvtepi32_ps(ySteps), xDeltaDistance)), _mm_castsi128_ps(_mm_cmpgt_epi32(ySteps, zero)));
+                mapX = _mm_add_epi32(mapX, _mm_sign_epi32(xSteps, stepX));
+                mapY = _mm_add_epi32(mapY, _mm_sign_epi32(ySteps, stepY));
+            }
+            // Lanes on occupied blocks look at the smaller blocks inside,
+            // the others step to the next cell and move up a level
+            __m128i move = _mm_andnot_si128(_mm_andnot_si128(atCell, occupied), allOnes);
+            __m128i stepVertical = _mm_castps_si128(_mm_cmplt_ps(yIntersectionDistance, xIntersectionDistance));
+            __m128i moveX = _mm_and_si128(move, stepVertical);
+            __m128i moveY = _mm_andnot_si128(stepVertical, move);
+            yIntersectionDistance = _mm_blendv_ps(yIntersectionDistance, _mm_add_ps(yIntersectionDistance, yDeltaDistance), _mm_castsi128_ps(moveX));
+            xIntersectionDistance = _mm_blendv_ps(xIntersectionDistance, _mm_add_ps(xIntersectionDistance, xDeltaDistance), _mm_castsi128_ps(moveY));
+            mapX = _mm_add_epi32(mapX, _mm_and_si128(moveX, stepX));
+            mapY = _mm_add_epi32(mapY, _mm_and_si128(moveY, stepY));
+            vertical = _mm_blendv_epi8(vertical, stepVertical, move);
+            level = _mm_blendv_epi8(_mm_sub_epi32(level, one), _mm_min_epi32(_mm_add_epi32(level, one), topLevel), move);
+        }
+        // Compute the distances projected onto the camera direction
+        __m128 distance = _mm_blendv_ps(
+            _mm_sub_ps(hitXIntersection, xDeltaDistance),
+            _mm_sub_ps(hitYIntersection, yDeltaDistance),
+            _mm_castsi128_ps(hitVertical)
+        );
+        int verticals[4], mapXs[4], mapYs[4];
+        float distances[4];
+        _mm_storeu_si128((__m128i *) verticals, hitVertical);
+        _mm_storeu_si128((__m128i *) mapXs, hitMapX);
+        _mm_storeu_si128((__m128i *) mapYs, hitMapY);
+        _mm_storeu_ps(distances, distance);
+        StoreHits(params, &hits[n - start], 4, verticals, mapXs, mapYs, distances);
+    }
+    CastRaysScalar(params, &hits[n - start], n, end);
+}
+
+__attribute__((target("avx2")))
+static void CastRaysAVX2(const RayCastParams *params, RayHit *hits, int start, int end) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i allOnes = _mm256_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    const __m256i mapWidth = _mm256_set1_epi32(params->mapWidth);
+    const __m256i mapHeight = _mm256_set1_epi32(params->mapHeight);
+    const OccupancyGrid *grid = params->occupancy;
+    const __m256i topLevel = _mm256_set1_epi32(grid->levels - 1);
+    const __m256i jumpLevel = _mm256_set1_epi32(JUMP_MIN_LEVEL - 1);
+    // Keep the offset and the stride of every level in registers (levels
+    // 0-7 and 8-15), lanes look them up with a permute instead of a gather
+    int offsets[OCCUPANCY_MAX_LEVELS] = {0}, strides[OCCUPANCY_MAX_LEVELS] = {0};
+    for (int i = 0; i < grid->levels; i++) {
+        offsets[i] = grid->level[i].offset;
+        strides[i] = grid->level[i].stride;
+    }
+    const __m256i lowOffsets = _mm256_loadu_si256((const __m256i *) &offsets[0]);
+    const __m256i highOffsets = _mm256_loadu_si256((const __m256i *) &offsets[8]);
+    const __m256i lowStrides = _mm256_loadu_si256((const __m256i *) &strides[0]);
+    const __m256i highStrides = _mm256_loadu_si256((const __m256i *) &strides[8]);
+    const __m256i seven = _mm256_set1_epi32(7);
+    int n = start;
+    for (; n + 8 <= end; n += 8) {
+        // Compute the ray directions
+        __m256 cameraX = _mm256_loadu_ps(&params->cameraX[n]);
+        __m256 rayDirectionX = _mm256_add_ps(_mm256_set1_ps(params->direction.x), _mm256_mul_ps(_mm256_set1_ps(params->cameraPlane.x), cameraX));
+        __m256 rayDirectionY = _mm256_add_ps(_mm256_set1_ps(params->direction.y), _mm256_mul_ps(_mm256_set1_ps(params->cameraPlane.y), cameraX));
+        // Compute the delta distances
+        __m256 yDeltaDistance = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.0f), rayDirectionX), absMask);
+        __m256 xDeltaDistance = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.0f), rayDirectionY), absMask);
+        // Compute the distances to the first intersections
+        __m256 positiveX = _mm256_cmp_ps(rayDirectionX, _mm256_setzero_ps(), _CMP_GT_OQ);
+        __m256 positiveY = _mm256_cmp_ps(rayDirectionY, _mm256_setzero_ps(), _CMP_GT_OQ);
+        __m256 xDistance = _mm256_blendv_ps(_mm256_set1_ps(params->tileCoords.x), _mm256_set1_ps(1.0f - params->tileCoords.x), positiveX);
+        __m256 yDistance = _mm256_blendv_ps(_mm256_set1_ps(params->tileCoords.y), _mm256_set1_ps(1.0f - params->tileCoords.y), positiveY);
+        __m256 yIntersectionDistance = _mm256_mul_ps(yDeltaDistance, xDistance);
+        __m256 xIntersectionDistance = _mm256_mul_ps(xDeltaDistance, yDistance);
+        // Find the direction we are moving in the map
+        __m256i negativeX = _mm256_castps_si256(_mm256_cmp_ps(rayDirectionX, _mm256_setzero_ps(), _CMP_LT_OQ));
+        __m256i negativeY = _mm256_castps_si256(_mm256_cmp_ps(rayDirectionY, _mm256_setzero_ps(), _CMP_LT_OQ));
+        __m256i stepX = _mm256_or_si256(negativeX, one);
+        __m256i stepY = _mm256_or_si256(negativeY, one);
+        // Find the last row and column before leaving the map, in the stepping direction
+        // (mapX * stepX is past exitX once the ray left the map and moves away from it)
+        __m256i exitX = _mm256_andnot_si256(negativeX, _mm256_sub_epi32(mapWidth, one));
+        __m256i exitY = _mm256_andnot_si256(negativeY, _mm256_sub_epi32(mapHeight, one));
+        __m256 absDirectionX = _mm256_and_ps(rayDirectionX, absMask);
+        __m256 absDirectionY = _mm256_and_ps(rayDirectionY, absMask);
+        // Step the rays until all of them hit
+        __m256i mapX = _mm256_set1_epi32(params->mapX);
+        __m256i mapY = _mm256_set1_epi32(params->mapY);
+        __m256i level = zero;
+        __m256i vertical = allOnes;
+        __m256i pending = allOnes;
+        __m256i hitVertical = zero, hitMapX = allOnes, hitMapY = zero;
+        __m256 hitYIntersection = _mm256_setzero_ps(), hitXIntersection = _mm256_setzero_ps();
+        for (int i = 0; i < params->dof; i++) {
+            __m256i inside = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi32(mapX, allOnes), _mm256_cmpgt_epi32(mapWidth, mapX)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(mapY, allOnes), _mm256_cmpgt_epi32(mapHeight, mapY))
+            );
+            // Look up the block of each lane at its level (lanes outside
+            // the map read the first word and are ignored)
+            __m256i blockX = _mm256_srav_epi32(mapX, level);
+            __m256i blockY = _mm256_srav_epi32(mapY, level);
+            __m256i highLevel = _mm256_cmpgt_epi32(level, seven);
+            __m256i offset = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(lowOffsets, level), _mm256_permutevar8x32_epi32(highOffsets, level), highLevel);
+            __m256i stride = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(lowStrides, level), _mm256_permutevar8x32_epi32(highStrides, level), highLevel);
+            __m256i word = _mm256_add_epi32(_mm256_add_epi32(offset, _mm256_mullo_epi32(blockY, stride)), _mm256_srli_epi32(blockX, 5));
+            __m256i bits = _mm256_i32gather_epi32((const int *) grid->bits, _mm256_and_si256(word, inside), 4);
+            __m256i occupied = _mm256_and_si256(inside, _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_and_si256(blockX, _mm256_set1_epi32(31))), one), one));
+            __m256i atCell = _mm256_cmpeq_epi32(level, zero);
+            // Record the state of the lanes that hit for the first time
+            __m256i hit = _mm256_and_si256(_mm256_and_si256(occupied, atCell), pending);
+            hitVertical = _mm256_blendv_epi8(hitVertical, vertical, hit);
+            hitMapX = _mm256_blendv_epi8(hitMapX, mapX, hit);
+            hitMapY = _mm256_blendv_epi8(hitMapY, mapY, hit);
+            hitYIntersection = _mm256_blendv_ps(hitYIntersection, yIntersectionDistance, _mm256_castsi256_ps(hit));
+            hitXIntersection = _mm256_blendv_ps(hitXIntersection, xIntersectionDistance, _mm256_castsi256_ps(hit));
+            // Lanes that left the map and move away from it can't hit anything anymore
+            __m256i escaped = _mm256_andnot_si256(inside, _mm256_or_si256(
+                _mm256_cmpgt_epi32(_mm256_sign_epi32(mapX, stepX), exitX),
+                _mm256_cmpgt_epi32(_mm256_sign_epi32(mapY, stepY), exitY)
+            ));
+            pending = _mm256_andnot_si256(_mm256_or_si256(hit, escaped), pending);
+            if (_mm256_testz_si256(pending, pending)) {
+                break;
+            }
+            // Lanes in big enough empty blocks jump to the last cell they cross inside
+            __m256i jump = _mm256_andnot_si256(occupied, _mm256_and_si256(inside, _mm256_cmpgt_epi32(level, jumpLevel)));
+            if (!_mm256_testz_si256(jump, jump)) {
+                __m256i blockMask = _mm256_and_si256(jump, _mm256_sub_epi32(_mm256_sllv_epi32(one, level), one));
+                __m256i xSkip = _mm256_xor_si256(_mm256_and_si256(mapX, blockMask), _mm256_andnot_si256(negativeX, blockMask));
+                __m256i ySkip = _mm256_xor_si256(_mm256_and_si256(mapY, blockMask), _mm256_andnot_si256(negativeY, blockMask));
+                __m256 yLimit = _mm256_add_ps(yIntersectionDistance, _mm256_mul_ps(_mm256_cvtepi32_ps(xSkip), yDeltaDistance));
+                __m256 xLimit = _mm256_add_ps(xIntersectionDistance, _mm256_mul_ps(_mm256_cvtepi32_ps(ySkip), xDeltaDistance));
+                __m256 limit = _mm256_min_ps(yLimit, xLimit);
+                __m256i xSteps = CountCrossingsAVX2(yIntersectionDistance, yDeltaDistance, absDirectionX, limit, xSkip);
+                __m256i ySteps = CountCrossingsAVX2(xIntersectionDistance, xDeltaDistance, absDirectionY, limit, ySkip);
+                yIntersectionDistance = _mm256_blendv_ps(yIntersectionDistance, _mm256_add_ps(yIntersectionDistance, _mm256_mul_ps(_mm256_cvtepi32_ps(xSteps), yDeltaDistance)), _mm256_castsi256_ps(_mm256_cmpgt_epi32(xSteps, zero)));
+                xIntersectionDistance = _mm256_blendv_ps(xIntersectionDistance, _mm256_add_ps(xIntersectionDistance, _mm256_mul_ps(_mm256_cvtepi32_ps(ySteps), xDeltaDistance)), _mm256_castsi256_ps(_mm256_cmpgt_epi32(ySteps, zero)));
+                mapX = _mm256_add_epi32(mapX, _mm256_sign_epi32(xSteps, stepX));
+                mapY = _mm256_add_epi32(mapY, _mm256_sign_epi32(ySteps, stepY));
+            }
+            // Lanes on occupied blocks look at the smaller blocks inside,
+            // the others step to the next cell and move up a level
+            __m256i move = _mm256_andnot_si256(_mm256_andnot_si256(atCell, occupied), allOnes);
+            __m256i stepVertical = _mm256_castps_si256(_mm256_cmp_ps(yIntersectionDistance, xIntersectionDistance, _CMP_LT_OQ));
+            __m256i moveX = _mm256_and_si256(move, stepVertical);
+            __m256i moveY = _mm256_andnot_si256(stepVertical, move);
+            yIntersectionDistance = _mm256_blendv_ps(yIntersectionDistance, _mm256_add_ps(yIntersectionDistance, yDeltaDistance), _mm256_castsi256_ps(moveX));
+            xIntersectionDistance = _mm256_blendv_ps(xIntersectionDistance, _mm256_add_ps(xIntersectionDistance, xDeltaDistance), _mm256_castsi256_ps(moveY));
+            mapX = _mm256_add_epi32(mapX, _mm256_and_si256(moveX, stepX));
+            mapY = _mm256_add_epi32(mapY, _mm256_and_si256(moveY, stepY));
+            vertical = _mm256_blendv_epi8(vertical, stepVertical, move);
+            level = _mm256_blendv_epi8(_mm256_sub_epi32(level, one), _mm256_min_epi32(_mm256_add_epi32(level, one), topLevel), move);
+        }
+        // Compute the distances projected onto the camera direction
+        __m256 distance = _mm256_blendv_ps(
+            _mm256_sub_ps(hitXIntersection, xDeltaDistance),
+            _mm256_sub_ps(hitYIntersection, yDeltaDistance),
+            _mm256_castsi256_ps(hitVertical)
+        );
+        int verticals[8], mapXs[8], mapYs[8];
+        float distances[8];
+        _mm256_storeu_si256((__m256i *) verticals, hitVertical);
+        _mm256_storeu_si256((__m256i *) mapXs, hitMapX);
+        _mm256_storeu_si256((__m256i *) mapYs, hitMapY);
+        _mm256_storeu_ps(distances, distance);
+        StoreHits(params, &hits[n - start], 8, verticals, mapXs, mapYs, distances);
+    }
+    CastRaysScalar(params, &hits[n - start], n, end);
+}
+
+__attribute__((target("avx512f")))
+static void CastRaysAVX512(const RayCastParams *params, RayHit *hits, int start, int end) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i absMask = _mm512_set1_epi32(0x7FFFFFFF);
+    const __m512i mapWidth = _mm512_set1_epi32(params->mapWidth);
+    const __m512i mapHeight = _mm512_set1_epi32(params->mapHeight);
+    const OccupancyGrid *grid = params->occupancy;
+    const __m512i topLevel = _mm512_set1_epi32(grid->levels - 1);
+    const __m512i jumpLevel = _mm512_set1_epi32(JUMP_MIN_LEVEL);
+    // There are at most 16 levels, so the offset and the stride of
+    // every level fit in a register and lanes can look them up directly
+    int offsets[OCCUPANCY_MAX_LEVELS] = {0}, strides[OCCUPANCY_MAX_LEVELS] = {0};
+    for (int i = 0; i < grid->levels; i++) {
+        offsets[i] = grid->level[i].offset;
+        strides[i] = grid->level[i].stride;
+    }
+    const __m512i levelOffsets = _mm512_loadu_si512(offsets);
+    const __m512i levelStrides = _mm512_loadu_si512(strides);
+    int n = start;
+    for (; n + 16 <= end; n += 16) {
+        // Compute the ray directions
+        __m512 cameraX = _mm512_loadu_ps(&params->cameraX[n]);
+        __m512 rayDirectionX = _mm512_add_ps(_mm512_set1_ps(params->direction.x), _mm512_mul_ps(_mm512_set1_ps(params->cameraPlane.x), cameraX));
+        __m512 rayDirectionY = _mm512_add_ps(_mm512_set1_ps(params->direction.y), _mm512_mul_ps(_mm512_set1_ps(params->cameraPlane.y), cameraX));
+        // Compute the delta distances
+        __m512 yDeltaDistance = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_div_ps(_mm512_set1_ps(1.0f), rayDirectionX)), absMask));
+        __m512 xDeltaDistance = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_div_ps(_mm512_set1_ps(1.0f), rayDirectionY)), absMask));
+        // Compute the distances to the first intersections
+        __mmask16 positiveX = _mm512_cmp_ps_mask(rayDirectionX, _mm512_setzero_ps(), _CMP_GT_OQ);
+        __mmask16 positiveY = _mm512_cmp_ps_mask(rayDirectionY, _mm512_setzero_ps(), _CMP_GT_OQ);
+        __m512 xDistance = _mm512_mask_blend_ps(positiveX, _mm512_set1_ps(params->tileCoords.x), _mm512_set1_ps(1.0f - params->tileCoords.x));
+        __m512 yDistance = _mm512_mask_blend_ps(positiveY, _mm512_set1_ps(params->tileCoords.y), _mm512_set1_ps(1.0f - params->tileCoords.y));
+        __m512 yIntersectionDistance = _mm512_mul_ps(yDeltaDistance, xDistance);
+        __m512 xIntersectionDistance = _mm512_mul_ps(xDeltaDistance, yDistance);
+        // Find the direction we are moving in the map
+        __mmask16 negativeX = _mm512_cmp_ps_mask(rayDirectionX, _mm512_setzero_ps(), _CMP_LT_OQ);
+        __mmask16 negativeY = _mm512_cmp_ps_mask(rayDirectionY, _mm512_setzero_ps(), _CMP_LT_OQ);
+        __m512i stepX = _mm512_mask_blend_epi32(negativeX, one, _mm512_set1_epi32(-1));
+        __m512i stepY = _mm512_mask_blend_epi32(negativeY, one, _mm512_set1_epi32(-1));
+        __m512 absDirectionX = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(rayDirectionX), absMask));
+        __m512 absDirectionY = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(rayDirectionY), absMask));
+        // Step the rays until all of them hit
+        __m512i mapX = _mm512_set1_epi32(params->mapX);
+        __m512i mapY = _mm512_set1_epi32(params->mapY);
+        __m512i level = zero;
+        __mmask16 vertical = 0xFFFF;
+        __mmask16 pending = 0xFFFF;
+        __mmask16 hitVertical = 0;
+        __m512i hitMapX = _mm512_set1_epi32(-1), hitMapY = zero;
+        __m512 hitYIntersection = _mm512_setzero_ps(), hitXIntersection = _mm512_setzero_ps();
+        for (int i = 0; i < params->dof; i++) {
+            __mmask16 inside = _mm512_cmpge_epi32_mask(mapX, zero) & _mm512_cmplt_epi32_mask(mapX, mapWidth)
+                & _mm512_cmpge_epi32_mask(mapY, zero) & _mm512_cmplt_epi32_mask(mapY, mapHeight);
+            // Look up the block of each lane at its level (lanes
+            // outside the map are not loaded at all)
+            __m512i blockX = _mm512_srav_epi32(mapX, level);
+            __m512i blockY = _mm512_srav_epi32(mapY, level);
+            __m512i offset = _mm512_permutexvar_epi32(level, levelOffsets);
+            __m512i stride = _mm512_permutexvar_epi32(level, levelStrides);
+            __m512i word = _mm512_add_epi32(_mm512_add_epi32(offset, _mm512_mullo_epi32(blockY, stride)), _mm512_srli_epi32(blockX, 5));
+            __m512i bits = _mm512_mask_i32gather_epi32(zero, inside, word, grid->bits, 4);
+            __mmask16 occupied = _mm512_test_epi32_mask(_mm512_srlv_epi32(bits, _mm512_and_si512(blockX, _mm512_set1_epi32(31))), one);
+            __mmask16 atCell = _mm512_cmpeq_epi32_mask(level, zero);
+            // Record the state of the lanes that hit for the first time
+            __mmask16 hit = occupied & atCell & pending;
+            hitVertical = (hitVertical & ~hit) | (vertical & hit);
+            hitMapX = _mm512_mask_mov_epi32(hitMapX, hit, mapX);
+            hitMapY = _mm512_mask_mov_epi32(hitMapY, hit, mapY);
+            hitYIntersection = _mm512_mask_mov_ps(hitYIntersection, hit, yIntersectionDistance);
+            hitXIntersection = _mm512_mask_mov_ps(hitXIntersection, hit, xIntersectionDistance);
+            // Lanes that left the map and move away from it can't hit anything anymore
+            __mmask16 escaped = ~inside & (
+                _mm512_mask_cmplt_epi32_mask(negativeX, mapX, zero) | _mm512_mask_cmpge_epi32_mask(~negativeX, mapX, mapWidth) |
+                _mm512_mask_cmplt_epi32_mask(negativeY, mapY, zero) | _mm512_mask_cmpge_epi32_mask(~negativeY, mapY, mapHeight)
+            );
+            pending &= ~(hit | escaped);
+            if (!pending) {
+                break;
+            }
+            // Lanes in big enough empty blocks jump to the last cell they cross inside
+            __mmask16 jump = _mm512_mask_cmpge_epi32_mask(inside & ~occupied, level, jumpLevel);
+            if (jump) {
+                __m512i blockMask = _mm512_maskz_sub_epi32(jump, _mm512_sllv_epi32(one, level), one);
+                __m512i xSkip = _mm512_mask_xor_epi32(_mm512_and_si512(mapX, blockMask), ~negativeX, _mm512_and_si512(mapX, blockMask), blockMask);
+                __m512i ySkip = _mm512_mask_xor_epi32(_mm512_and_si512(mapY, blockMask), ~negativeY, _mm512_and_si512(mapY, blockMask), blockMask);
+                __m512 yLimit = _mm512_add_ps(yIntersectionDistance, _mm512_mul_ps(_mm512_cvtepi32_ps(xSkip), yDeltaDistance));
+                __m512 xLimit = _mm512_add_ps(xIntersectionDistance, _mm512_mul_ps(_mm512_cvtepi32_ps(ySkip), xDeltaDistance));
+                __m512 limit = _mm512_min_ps(yLimit, xLimit);
+                __m512i xSteps = CountCrossingsAVX512(yIntersectionDistance, yDeltaDistance, absDirectionX, limit, xSkip);
+                __m512i ySteps = CountCrossingsAVX512(xIntersectionDistance, xDeltaDistance, absDirectionY, limit, ySkip);
+                yIntersectionDistance = _mm512_mask_add_ps(yIntersectionDistance, _mm512_cmpgt_epi32_mask(xSteps, zero), yIntersectionDistance, _mm512_mul_ps(_mm512_cvtepi32_ps(xSteps), yDeltaDistance));
+                xIntersectionDistance = _mm512_mask_add_ps(xIntersectionDistance, _mm512_cmpgt_epi32_mask(ySteps, zero), xIntersectionDistance, _mm512_mul_ps(_mm512_cvtepi32_ps(ySteps), xDeltaDistance));
+                mapX = _mm512_add_epi32(mapX, _mm512_mullo_epi32(xSteps, stepX));
+                mapY = _mm512_add_epi32(mapY, _mm512_mullo_epi32(ySteps, stepY));
+            }
+            // Lanes on occupied blocks look at the smaller blocks inside,
+            // the others step to the next cell and move up a level
+            __mmask16 move = ~(occupied & ~atCell);
+            __mmask16 stepVertical = _mm512_cmp_ps_mask(yIntersectionDistance, xIntersectionDistance, _CMP_LT_OQ);
+            __mmask16 moveX = move & stepVertical;
+            __mmask16 moveY = move & ~stepVertical;
+            yIntersectionDistance = _mm512_mask_add_ps(yIntersectionDistance, moveX, yIntersectionDistance, yDeltaDistance);
+            xIntersectionDistance = _mm512_mask_add_ps(xIntersectionDistance, moveY, xIntersectionDistance, xDeltaDistance);
+            mapX = _mm512_mask_add_epi32(mapX, moveX, mapX, stepX);
+            mapY = _mm512_mask_add_epi32(mapY, moveY, mapY, stepY);
+            vertical = (vertical & ~move) | (stepVertical & move);
+            level = _mm512_mask_blend_epi32(move, _mm512_sub_epi32(level, one), _mm512_min_epi32(_mm512_add_epi32(level, one), topLevel));
+        }
+        // Compute the distances projected onto the camera direction
+        __m512 distance = _mm512_mask_blend_ps(
+            hitVertical,
+            _mm512_sub_ps(hitXIntersection, xDeltaDistance),
+            _mm512_sub_ps(hitYIntersection, yDeltaDistance)
+        );
+        int verticals[16], mapXs[16], mapYs[16];
+        float distances[16];
+        _mm512_storeu_si512(verticals, _mm512_maskz_mov_epi32(hitVertical, _mm512_set1_epi32(-1)));
+        _mm512_storeu_si512(mapXs, hitMapX);
+        _mm512_storeu_si512(mapYs, hitMapY);
+        _mm512_storeu_ps(distances, distance);
+        StoreHits(params, &hits[n - start], 16, verticals, mapXs, mapYs, distances);
+    }
+    CastRaysScalar(params, &hits[n - start], n, end);
+}
+
+// The scanline kernels sample 4, 8 or 16 pixels of both the ceiling
+// and the floor row at once, doing the stepping, the cell lookup and
+// the texture fetches together. Lanes outside the map or on empty cells
+// fetch index 0 and get replaced by the default colors.
+
+// Vector versions of ShadeColor(), every lane of luxels holds the luxel of a
+// pixel. The channels are widened to 16 bits for the multiply, then the alpha
+// of the pixels is put back
+
+__attribute__((target("sse4.1")))
+static inline __m128i ShadePixelsSSE(__m128i pixels, __m128i luxels) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i brightness = _mm_add_epi32(luxels, _mm_srli_epi32(luxels, 7));
+    __m128i pairs = _mm_or_si128(brightness, _mm_slli_epi32(brightness, 16));
+    __m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi32(pairs, pairs)), 8);
+    __m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi32(pairs, pairs)), 8);
+    return _mm_blendv_epi8(_mm_packus_epi16(low, high), pixels, _mm_set1_epi32((int) 0xFF000000));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ShadePixelsAVX2(__m256i pixels, __m256i luxels) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i brightness = _mm256_add_epi32(luxels, _mm256_srli_epi32(luxels, 7));
+    __m256i pairs = _mm256_or_si256(brightness, _mm256_slli_epi32(brightness, 16));
+    __m256i low = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), _mm256_unpacklo_epi32(pairs, pairs)), 8);
+    __m256i high = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), _mm256_unpackhi_epi32(pairs, pairs)), 8);
+    return _mm256_blendv_epi8(_mm256_packus_epi16(low, high), pixels, _mm256_set1_epi32((int) 0xFF000000));
+}
+
+// AVX-512F has no 16-bit multiplies, the two halves go through the AVX2 version
+__attribute__((target("avx512f")))
+static inline __m512i ShadePixelsAVX512(__m512i pixels, __m512i luxels) {
+    __m256i low = ShadePixelsAVX2(_mm512_castsi512_si256(pixels), _mm512_castsi512_si256(luxels));
+    __m256i high = ShadePixelsAVX2(_mm512_extracti64x4_epi64(pixels, 1), _mm512_extracti64x4_epi64(luxels, 1));
+    return _mm512_inserti64x4(_mm512_castsi256_si512(low), high, 1);
+}
+
+__attribute__((target("sse4.1")))
+static void CastRowSSE(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 mapWidth = _mm_set1_ps((float) params->mapWidth);
+    const __m128 mapHeight = _mm_set1_ps((float) params->mapHeight);
+    const __m128 textureSize = _mm_set1_ps((float) params->textureSize);
+    const __m128i textureMax = _mm_set1_epi32(params->textureSize - 1);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i textureEnd = _mm_set1_epi32(params->textureCount + 1);
+    const __m128i textureArea = _mm_set1_epi32(params->textureSize * params->textureSize);
+    const __m128 luxelScale = _mm_set1_ps((float) LIGHTMAP_RESOLUTION);
+    const __m128i luxelMax = _mm_set1_epi32(LIGHTMAP_RESOLUTION - 1);
+    const int *texels = (const int *) params->texels;
+    int ceilingColor, floorColor;
+    memcpy(&ceilingColor, &params->ceilingColor, sizeof(int));
+    memcpy(&floorColor, &params->floorColor, sizeof(int));
+    int x = first;
+    for (; x + 4 <= end; x += 4) {
+        // Compute the positions of the pixels on the map
+        __m128 lane = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)));
+        __m128 positionX = _mm_add_ps(_mm_set1_ps(start.x), _mm_mul_ps(_mm_set1_ps(step.x), lane));
+        __m128 positionY = _mm_add_ps(_mm_set1_ps(start.y), _mm_mul_ps(_mm_set1_ps(step.y), lane));
+        // Get the cell positions and check if they are inside the map
+        __m128 cellX = _mm_floor_ps(positionX);
+        __m128 cellY = _mm_floor_ps(positionY);
+        __m128i inside = _mm_castps_si128(_mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(cellX, _mm_setzero_ps()), _mm_cmplt_ps(cellX, mapWidth)),
+            _mm_and_ps(_mm_cmpge_ps(cellY, _mm_setzero_ps()), _mm_cmplt_ps(cellY, mapHeight))
+        ));
+        int cellXs[4], cellYs[4], insides[4];
+        _mm_storeu_si128((__m128i *) cellXs, _mm_cvttps_epi32(cellX));
+        _mm_storeu_si128((__m128i *) cellYs, _mm_cvttps_epi32(cellY));
+        _mm_storeu_si128((__m128i *) insides, inside);
+        // Compute the texture coordinates
+        __m128i textureX = _mm_min_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(positionX, cellX), textureSize)), textureMax);
+        __m128i textureY = _mm_min_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(positionY, cellY), textureSize)), textureMax);
+        __m128i texel = _mm_add_epi32(_mm_mullo_epi32(textureY, _mm_set1_epi32(params->textureSize)), textureX);
+        // Find the luxels of the pixels inside of their cells
+        __m128i luxelX = _mm_min_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(positionX, cellX), luxelScale)), luxelMax);
+        __m128i luxelY = _mm_min_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(positionY, cellY), luxelScale)), luxelMax);
+        int luxels[4];
+        _mm_storeu_si128((__m128i *) luxels, _mm_add_epi32(_mm_mullo_epi32(luxelY, _mm_set1_epi32(LIGHTMAP_RESOLUTION)), luxelX));
+        // There's no gather instruction before AVX2, look the lanes up one by one
+        // (the cells outside the map or in chunks that aren't cached stay empty)
+        int ceilingIds[4] = {0}, floorIds[4] = {0}, ceilingLuxels[4] = {0}, floorLuxels[4] = {0};
+        for (int lane = 0; lane < 4; lane++) {
+            int offset = (insides[lane]) ? GetCachedTileOffset(params->chunks, cellXs[lane], cellYs[lane]) : -1;
+            if (offset >= 0) {
+                ceilingIds[lane] = params->chunks->ceilings[offset];
+                floorIds[lane] = params->chunks->floors[offset];
+                const unsigned char *cellLuxels = &params->luxels[GetCachedLuxelOffset(params->chunks, cellXs[lane], cellYs[lane]) + luxels[lane]];
+                ceilingLuxels[lane] = cellLuxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS];
+                floorLuxels[lane] = cellLuxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS];
+            }
+        }
+        __m128i ceilingId = _mm_loadu_si128((const __m128i *) ceilingIds);
+        __m128i floorId = _mm_loadu_si128((const __m128i *) floorIds);
+        __m128i hasCeiling = _mm_and_si128(_mm_cmpgt_epi32(ceilingId, zero), _mm_cmpgt_epi32(textureEnd, ceilingId));
+        __m128i hasFloor = _mm_and_si128(_mm_cmpgt_epi32(floorId, zero), _mm_cmpgt_epi32(textureEnd, floorId));
+        __m128i ceilingTexel = _mm_and_si128(hasCeiling, _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(ceilingId, one), textureArea), texel));
+        __m128i floorTexel = _mm_and_si128(hasFloor, _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(floorId, one), textureArea), texel));
+        // Sample the textures
+        __m128i ceilingPixels = _mm_setr_epi32(
+            texels[_mm_extract_epi32(ceilingTexel, 0)],
+            texels[_mm_extract_epi32(ceilingTexel, 1)],
+            texels[_mm_extract_epi32(ceilingTexel, 2)],
+            texels[_mm_extract_epi32(ceilingTexel, 3)]
+        );
+        __m128i floorPixels = _mm_setr_epi32(
+            texels[_mm_extract_epi32(floorTexel, 0)],
+            texels[_mm_extract_epi32(floorTexel, 1)],
+            texels[_mm_extract_epi32(floorTexel, 2)],
+            texels[_mm_extract_epi32(floorTexel, 3)]
+        );
+        // Light them
+        ceilingPixels = ShadePixelsSSE(ceilingPixels, _mm_loadu_si128((const __m128i *) ceilingLuxels));
+        floorPixels = ShadePixelsSSE(floorPixels, _mm_loadu_si128((const __m128i *) floorLuxels));
+        _mm_storeu_si128((__m128i *) &ceilingRow[x], _mm_blendv_epi8(_mm_set1_epi32(ceilingColor), ceilingPixels, hasCeiling));
+        _mm_storeu_si128((__m128i *) &floorRow[x], _mm_blendv_epi8(_mm_set1_epi32(floorColor), floorPixels, hasFloor));
+    }
+    CastRowScalar(params, start, step, ceilingRow, floorRow, x, end);
+}
+
+__attribute__((target("avx2")))
+static void CastRowAVX2(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 mapWidth = _mm256_set1_ps((float) params->mapWidth);
+    const __m256 mapHeight = _mm256_set1_ps((float) params->mapHeight);
+    const __m256 textureSize = _mm256_set1_ps((float) params->textureSize);
+    const __m256i textureMax = _mm256_set1_epi32(params->textureSize - 1);
+    const __m256i textureEnd = _mm256_set1_epi32(params->textureCount + 1);
+    const __m256i textureArea = _mm256_set1_epi32(params->textureSize * params->textureSize);
+    const __m256i chunksX = _mm256_set1_epi32(params->chunks->chunksX);
+    const __m256i chunkMask = _mm256_set1_epi32(MAP_CHUNK_SIZE - 1);
+    const __m256i slotSize = _mm256_set1_epi32(sizeof(ChunkTiles));
+    const __m256i idMask = _mm256_set1_epi32(0xFF);
+    const __m256 luxelScale = _mm256_set1_ps((float) LIGHTMAP_RESOLUTION);
+    const __m256i luxelMax = _mm256_set1_epi32(LIGHTMAP_RESOLUTION - 1);
+    const __m256i chunkLuxels = _mm256_set1_epi32(LIGHTMAP_CHUNK_BYTES);
+    const int *texels = (const int *) params->texels;
+    int ceilingColor, floorColor;
+    memcpy(&ceilingColor, &params->ceilingColor, sizeof(int));
+    memcpy(&floorColor, &params->floorColor, sizeof(int));
+    int x = first;
+    for (; x + 8 <= end; x += 8) {
+        // Compute the positions of the pixels on the map
+        __m256 lane = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        __m256 positionX = _mm256_add_ps(_mm256_set1_ps(start.x), _mm256_mul_ps(_mm256_set1_ps(step.x), lane));
+        __m256 positionY = _mm256_add_ps(_mm256_set1_ps(start.y), _mm256_mul_ps(_mm256_set1_ps(step.y), lane));
+        // Get the cell positions and check if they are inside the map
+        __m256 cellX = _mm256_floor_ps(positionX);
+        __m256 cellY = _mm256_floor_ps(positionY);
+        __m256i inside = _mm256_castps_si256(_mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(cellX, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(cellX, mapWidth, _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(cellY, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(cellY, mapHeight, _CMP_LT_OQ))
+        ));
+        // Look up the slots of the chunks of the cells (the lanes outside
+        // the map read the slot of the first chunk and are dropped)
+        __m256i mapX = _mm256_and_si256(inside, _mm256_cvttps_epi32(cellX));
+        __m256i mapY = _mm256_and_si256(inside, _mm256_cvttps_epi32(cellY));
+        __m256i chunk = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_srli_epi32(mapY, MAP_CHUNK_SHIFT), chunksX),
+            _mm256_srli_epi32(mapX, MAP_CHUNK_SHIFT)
+        );
+        __m256i slot = _mm256_i32gather_epi32(params->chunks->slots, chunk, 4);
+        __m256i cached = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, slot), inside);
+        __m256i cell = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(mapY, chunkMask), MAP_CHUNK_SHIFT), _mm256_and_si256(mapX, chunkMask));
+        __m256i cellOffset = _mm256_and_si256(cached, _mm256_add_epi32(_mm256_mullo_epi32(slot, slotSize), cell));
+        // Compute the texture coordinates
+        __m256i textureX = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionX, cellX), textureSize)), textureMax);
+        __m256i textureY = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionY, cellY), textureSize)), textureMax);
+        __m256i texel = _mm256_add_epi32(_mm256_mullo_epi32(textureY, _mm256_set1_epi32(params->textureSize)), textureX);
+        // Find the luxels of the pixels inside of their cells
+        __m256i luxelX = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionX, cellX), luxelScale)), luxelMax);
+        __m256i luxelY = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionY, cellY), luxelScale)), luxelMax);
+        __m256i luxelOffset = _mm256_and_si256(cached, _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(slot, chunkLuxels), _mm256_mullo_epi32(cell, _mm256_set1_epi32(LIGHTMAP_CELL_LUXELS))),
+            _mm256_add_epi32(_mm256_mullo_epi32(luxelY, _mm256_set1_epi32(LIGHTMAP_RESOLUTION)), luxelX)
+        ));
+        // Fetch the ceiling and floor ids and luxels of the cells (the gathers
+        // read 4 bytes at a time, only the lowest one belongs to the cell)
+        __m256i ceilingId = _mm256_and_si256(cached, _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) params->chunks->ceilings, cellOffset, 1)));
+        __m256i floorId = _mm256_and_si256(cached, _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) params->chunks->floors, cellOffset, 1)));
+        __m256i ceilingLuxel = _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) &params->luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS], luxelOffset, 1));
+        __m256i floorLuxel = _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) &params->luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS], luxelOffset, 1));
+        __m256i hasCeiling = _mm256_and_si256(_mm256_cmpgt_epi32(ceilingId, zero), _mm256_cmpgt_epi32(textureEnd, ceilingId));
+        __m256i hasFloor = _mm256_and_si256(_mm256_cmpgt_epi32(floorId, zero), _mm256_cmpgt_epi32(textureEnd, floorId));
+        __m256i ceilingTexel = _mm256_and_si256(hasCeiling, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(ceilingId, one), textureArea), texel));
+        __m256i floorTexel = _mm256_and_si256(hasFloor, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(floorId, one), textureArea), texel));
+        // Sample the textures
+        __m256i ceilingPixels = ShadePixelsAVX2(_mm256_i32gather_epi32(texels, ceilingTexel, 4), ceilingLuxel);
+        __m256i floorPixels = ShadePixelsAVX2(_mm256_i32gather_epi32(texels, floorTexel, 4), floorLuxel);
+        _mm256_storeu_si256((__m256i *) &ceilingRow[x], _mm256_blendv_epi8(_mm256_set1_epi32(ceilingColor), ceilingPixels, hasCeiling));
+        _mm256_storeu_si256((__m256i *) &floorRow[x], _mm256_blendv_epi8(_mm256_set1_epi32(floorColor), floorPixels, hasFloor));
+    }
+    CastRowScalar(params, start, step, ceilingRow, floorRow, x, end);
+}
+
+// Same as CastRowAVX2() with palette indices: both the texels and their lit
+// versions are fetched with byte gathers, then the lanes are packed to bytes
+__attribute__((target("avx2")))
+static void CastIndexedRowAVX2(const RowCastParams *params, Vector2 start, Vector2 step, unsigned char *ceilingRow, unsigned char *floorRow, int first, int end) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 mapWidth = _mm256_set1_ps((float) params->mapWidth);
+    const __m256 mapHeight = _mm256_set1_ps((float) params->mapHeight);
+    const __m256 textureSize = _mm256_set1_ps((float) params->textureSize);
+    const __m256i textureMax = _mm256_set1_epi32(params->textureSize - 1);
+    const __m256i textureEnd = _mm256_set1_epi32(params->textureCount + 1);
+    const __m256i textureArea = _mm256_set1_epi32(params->textureSize * params->textureSize);
+    const __m256i chunksX = _mm256_set1_epi32(params->chunks->chunksX);
+    const __m256i chunkMask = _mm256_set1_epi32(MAP_CHUNK_SIZE - 1);
+    const __m256i slotSize = _mm256_set1_epi32(sizeof(ChunkTiles));
+    const __m256i idMask = _mm256_set1_epi32(0xFF);
+    const __m256 luxelScale = _mm256_set1_ps((float) LIGHTMAP_RESOLUTION);
+    const __m256i luxelMax = _mm256_set1_epi32(LIGHTMAP_RESOLUTION - 1);
+    const __m256i chunkLuxels = _mm256_set1_epi32(LIGHTMAP_CHUNK_BYTES);
+    // Moves the lowest byte of every lane to the first 4 bytes of its half, then the halves together
+    const __m256i packBytes = _mm256_setr_epi8(
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+    );
+    const __m256i packHalves = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    const int *indices = (const int *) params->indices;
+    const int *shades = (const int *) params->shades;
+    int x = first;
+    for (; x + 8 <= end; x += 8) {
+        // Compute the positions of the pixels on the map
+        __m256 lane = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        __m256 positionX = _mm256_add_ps(_mm256_set1_ps(start.x), _mm256_mul_ps(_mm256_set1_ps(step.x), lane));
+        __m256 positionY = _mm256_add_ps(_mm256_set1_ps(start.y), _mm256_mul_ps(_mm256_set1_ps(step.y), lane));
+        // Get the cell positions and check if they are inside the map
+        __m256 cellX = _mm256_floor_ps(positionX);
+        __m256 cellY = _mm256_floor_ps(positionY);
+        __m256i inside = _mm256_castps_si256(_mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(cellX, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(cellX, mapWidth, _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(cellY, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(cellY, mapHeight, _CMP_LT_OQ))
+        ));
+        // Look up the slots of the chunks of the cells (the lanes outside
+        // the map read the slot of the first chunk and are dropped)
+        __m256i mapX = _mm256_and_si256(inside, _mm256_cvttps_epi32(cellX));
+        __m256i mapY = _mm256_and_si256(inside, _mm256_cvttps_epi32(cellY));
+        __m256i chunk = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_srli_epi32(mapY, MAP_CHUNK_SHIFT), chunksX),
+            _mm256_srli_epi32(mapX, MAP_CHUNK_SHIFT)
+        );
+        __m256i slot = _mm256_i32gather_epi32(params->chunks->slots, chunk, 4);
+        __m256i cached = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, slot), inside);
+        __m256i cell = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(mapY, chunkMask), MAP_CHUNK_SHIFT), _mm256_and_si256(mapX, chunkMask));
+        __m256i cellOffset = _mm256_and_si256(cached, _mm256_add_epi32(_mm256_mullo_epi32(slot, slotSize), cell));
+        // Compute the texture coordinates
+        __m256i textureX = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionX, cellX), textureSize)), textureMax);
+        __m256i textureY = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionY, cellY), textureSize)), textureMax);
+        __m256i texel = _mm256_add_epi32(_mm256_mullo_epi32(textureY, _mm256_set1_epi32(params->textureSize)), textureX);
+        // Find the luxels of the pixels inside of their cells
+        __m256i luxelX = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionX, cellX), luxelScale)), luxelMax);
+        __m256i luxelY = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(positionY, cellY), luxelScale)), luxelMax);
+        __m256i luxelOffset = _mm256_and_si256(cached, _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(slot, chunkLuxels), _mm256_mullo_epi32(cell, _mm256_set1_epi32(LIGHTMAP_CELL_LUXELS))),
+            _mm256_add_epi32(_mm256_mullo_epi32(luxelY, _mm256_set1_epi32(LIGHTMAP_RESOLUTION)), luxelX)
+        ));
+        // Fetch the ceiling and floor ids and luxels of the cells (the gathers
+        // read 4 bytes at a time, only the lowest one belongs to the cell)
+        __m256i ceilingId = _mm256_and_si256(cached, _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) params->chunks->ceilings, cellOffset, 1)));
+        __m256i floorId = _mm256_and_si256(cached, _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) params->chunks->floors, cellOffset, 1)));
+        __m256i ceilingLuxel = _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) &params->luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS], luxelOffset, 1));
+        __m256i floorLuxel = _mm256_and_si256(idMask, _mm256_i32gather_epi32((const int *) &params->luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS], luxelOffset, 1));
+        __m256i hasCeiling = _mm256_and_si256(_mm256_cmpgt_epi32(ceilingId, zero), _mm256_cmpgt_epi32(textureEnd, ceilingId));
+        __m256i hasFloor = _mm256_and_si256(_mm256_cmpgt_epi32(floorId, zero), _mm256_cmpgt_epi32(textureEnd, floorId));
+        __m256i ceilingTexel = _mm256_and_si256(hasCeiling, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(ceilingId, one), textureArea), texel));
+        __m256i floorTexel = _mm256_and_si256(hasFloor, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(floorId, one), textureArea), texel));
+        // Sample the textures and light them, the shade table rows are
+        // PALETTE_COLORS apart (see GetShadeOffset())
+        __m256i ceilingIndex = _mm256_and_si256(idMask, _mm256_i32gather_epi32(indices, ceilingTexel, 1));
+        __m256i floorIndex = _mm256_and_si256(idMask, _mm256_i32gather_epi32(indices, floorTexel, 1));
+        __m256i ceilingShade = _mm256_add_epi32(_mm256_slli_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(ceilingLuxel, _mm256_set1_epi32(PALETTE_SHADES)), 8), 8), ceilingIndex);
+        __m256i floorShade = _mm256_add_epi32(_mm256_slli_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(floorLuxel, _mm256_set1_epi32(PALETTE_SHADES)), 8), 8), floorIndex);
+        __m256i ceilingPixels = _mm256_blendv_epi8(_mm256_set1_epi32(params->ceilingIndex), _mm256_i32gather_epi32(shades, ceilingShade, 1), hasCeiling);
+        __m256i floorPixels = _mm256_blendv_epi8(_mm256_set1_epi32(params->floorIndex), _mm256_i32gather_epi32(shades, floorShade, 1), hasFloor);
+        // Keep the lowest byte of every lane
+        ceilingPixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(ceilingPixels, packBytes), packHalves);
+        floorPixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(floorPixels, packBytes), packHalves);
+        _mm_storel_epi64((__m128i *) &ceilingRow[x], _mm256_castsi256_si128(ceilingPixels));
+        _mm_storel_epi64((__m128i *) &floorRow[x], _mm256_castsi256_si128(floorPixels));
+    }
+    CastIndexedRowScalar(params, start, step, ceilingRow, floorRow, x, end);
+}
+
+__attribute__((target("avx512f")))
+static void CastRowAVX512(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512 mapWidth = _mm512_set1_ps((float) params->mapWidth);
+    const __m512 mapHeight = _mm512_set1_ps((float) params->mapHeight);
+    const __m512 textureSize = _mm512_set1_ps((float) params->textureSize);
+    const __m512i textureMax = _mm512_set1_epi32(params->textureSize - 1);
+    const __m512i textureEnd = _mm512_set1_epi32(params->textureCount + 1);
+    const __m512i textureArea = _mm512_set1_epi32(params->textureSize * params->textureSize);
+    const __m512i chunksX = _mm512_set1_epi32(params->chunks->chunksX);
+    const __m512i chunkMask = _mm512_set1_epi32(MAP_CHUNK_SIZE - 1);
+    const __m512i slotSize = _mm512_set1_epi32(sizeof(ChunkTiles));
+    const __m512i idMask = _mm512_set1_epi32(0xFF);
+    const __m512 luxelScale = _mm512_set1_ps((float) LIGHTMAP_RESOLUTION);
+    const __m512i luxelMax = _mm512_set1_epi32(LIGHTMAP_RESOLUTION - 1);
+    const __m512i chunkLuxels = _mm512_set1_epi32(LIGHTMAP_CHUNK_BYTES);
+    const int *texels = (const int *) params->texels;
+    int ceilingColor, floorColor;
+    memcpy(&ceilingColor, &params->ceilingColor, sizeof(int));
+    memcpy(&floorColor, &params->floorColor, sizeof(int));
+    int x = first;
+    for (; x + 16 <= end; x += 16) {
+        // Compute the positions of the pixels on the map
+        __m512 lane = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(x), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)));
+        __m512 positionX = _mm512_add_ps(_mm512_set1_ps(start.x), _mm512_mul_ps(_mm512_set1_ps(step.x), lane));
+        __m512 positionY = _mm512_add_ps(_mm512_set1_ps(start.y), _mm512_mul_ps(_mm512_set1_ps(step.y), lane));
+        // Get the cell positions and check if they are inside the map
+        __m512 cellX = _mm512_floor_ps(positionX);
+        __m512 cellY = _mm512_floor_ps(positionY);
+        __mmask16 inside = _mm512_cmp_ps_mask(cellX, _mm512_setzero_ps(), _CMP_GE_OQ)
+            & _mm512_cmp_ps_mask(cellX, mapWidth, _CMP_LT_OQ)
+            & _mm512_cmp_ps_mask(cellY, _mm512_setzero_ps(), _CMP_GE_OQ)
+            & _mm512_cmp_ps_mask(cellY, mapHeight, _CMP_LT_OQ);
+        // Look up the slots of the chunks of the cells inside the map
+        __m512i mapX = _mm512_cvttps_epi32(cellX);
+        __m512i mapY = _mm512_cvttps_epi32(cellY);
+        __m512i chunk = _mm512_add_epi32(
+            _mm512_mullo_epi32(_mm512_srai_epi32(mapY, MAP_CHUNK_SHIFT), chunksX),
+            _mm512_srai_epi32(mapX, MAP_CHUNK_SHIFT)
+        );
+        __m512i slot = _mm512_mask_i32gather_epi32(_mm512_set1_epi32(-1), inside, chunk, params->chunks->slots, 4);
+        __mmask16 cached = _mm512_cmpge_epi32_mask(slot, zero);
+        __m512i cell = _mm512_add_epi32(_mm512_slli_epi32(_mm512_and_si512(mapY, chunkMask), MAP_CHUNK_SHIFT), _mm512_and_si512(mapX, chunkMask));
+        __m512i cellOffset = _mm512_add_epi32(_mm512_mullo_epi32(slot, slotSize), cell);
+        // Compute the texture coordinates
+        __m512i textureX = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(_mm512_sub_ps(positionX, cellX), textureSize)), textureMax);
+        __m512i textureY = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(_mm512_sub_ps(positionY, cellY), textureSize)), textureMax);
+        __m512i texel = _mm512_add_epi32(_mm512_mullo_epi32(textureY, _mm512_set1_epi32(params->textureSize)), textureX);
+        // Find the luxels of the pixels inside of their cells
+        __m512i luxelX = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(_mm512_sub_ps(positionX, cellX), luxelScale)), luxelMax);
+        __m512i luxelY = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(_mm512_sub_ps(positionY, cellY), luxelScale)), luxelMax);
+        __m512i luxelOffset = _mm512_add_epi32(
+            _mm512_add_epi32(_mm512_mullo_epi32(slot, chunkLuxels), _mm512_mullo_epi32(cell, _mm512_set1_epi32(LIGHTMAP_CELL_LUXELS))),
+            _mm512_add_epi32(_mm512_mullo_epi32(luxelY, _mm512_set1_epi32(LIGHTMAP_RESOLUTION)), luxelX)
+        );
+        // Fetch the ceiling and floor ids and luxels of the cells in cached chunks
+        // (the gathers read 4 bytes at a time, only the lowest one belongs to the cell)
+        __m512i ceilingId = _mm512_maskz_and_epi32(cached, idMask, _mm512_mask_i32gather_epi32(zero, cached, cellOffset, params->chunks->ceilings, 1));
+        __m512i floorId = _mm512_maskz_and_epi32(cached, idMask, _mm512_mask_i32gather_epi32(zero, cached, cellOffset, params->chunks->floors, 1));
+        __m512i ceilingLuxel = _mm512_maskz_and_epi32(cached, idMask, _mm512_mask_i32gather_epi32(zero, cached, luxelOffset, &params->luxels[LIGHTMAP_CEILING * LIGHTMAP_SURFACE_LUXELS], 1));
+        __m512i floorLuxel = _mm512_maskz_and_epi32(cached, idMask, _mm512_mask_i32gather_epi32(zero, cached, luxelOffset, &params->luxels[LIGHTMAP_FLOOR * LIGHTMAP_SURFACE_LUXELS], 1));
+        __mmask16 hasCeiling = _mm512_cmpgt_epi32_mask(ceilingId, zero) & _mm512_cmplt_epi32_mask(ceilingId, textureEnd);
+        __mmask16 hasFloor = _mm512_cmpgt_epi32_mask(floorId, zero) & _mm512_cmplt_epi32_mask(floorId, textureEnd);
+        __m512i ceilingTexel = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_sub_epi32(ceilingId, one), textureArea), texel);
+        __m512i floorTexel = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_sub_epi32(floorId, one), textureArea), texel);
+        // Sample and light the textures, the default colors fill the lanes that aren't fetched
+        __m512i ceilingPixels = ShadePixelsAVX512(_mm512_mask_i32gather_epi32(zero, hasCeiling, ceilingTexel, texels, 4), ceilingLuxel);
+        __m512i floorPixels = ShadePixelsAVX512(_mm512_mask_i32gather_epi32(zero, hasFloor, floorTexel, texels, 4), floorLuxel);
+        _mm512_storeu_si512(&ceilingRow[x], _mm512_mask_blend_epi32(hasCeiling, _mm512_set1_epi32(ceilingColor), ceilingPixels));
+        _mm512_storeu_si512(&floorRow[x], _mm512_mask_blend_epi32(hasFloor, _mm512_set1_epi32(floorColor), floorPixels));
+    }
+    CastRowScalar(params, start, step, ceilingRow, floorRow, x, end);
+}
+
+#endif
+
+static const char *kernelNames[RAYCAST_KERNEL_COUNT] = {
+    [RAYCAST_KERNEL_SCALAR] = "scalar",
+    [RAYCAST_KERNEL_SSE] = "sse",
+    [RAYCAST_KERNEL_AVX2] = "avx2",
+    [RAYCAST_KERNEL_AVX512] = "avx512",
+};
+
+static const CastRaysFunc kernels[RAYCAST_KERNEL_COUNT] = {
+    [RAYCAST_KERNEL_SCALAR] = CastRaysScalar,
+#ifdef RAYCAST_X86
+    [RAYCAST_KERNEL_SSE] = CastRaysSSE,
+    [RAYCAST_KERNEL_AVX2] = CastRaysAVX2,
+    [RAYCAST_KERNEL_AVX512] = CastRaysAVX512,
+#endif
+};
+
+static const CastRowFunc rowKernels[RAYCAST_KERNEL_COUNT] = {
+    [RAYCAST_KERNEL_SCALAR] = CastRowScalar,
+#ifdef RAYCAST_X86
+    [RAYCAST_KERNEL_SSE] = CastRowSSE,
+    [RAYCAST_KERNEL_AVX2] = CastRowAVX2,
+    [RAYCAST_KERNEL_AVX512] = CastRowAVX512,
+#endif
+};
+
+// SSE has no gathers (looking the lanes up one by one is no faster than
+// the scalar kernel) and the AVX-512 kernel would only pack more bytes
+static const CastIndexedRowFunc indexedRowKernels[RAYCAST_KERNEL_COUNT] = {
+    [RAYCAST_KERNEL_SCALAR] = CastIndexedRowScalar,
+    [RAYCAST_KERNEL_SSE] = CastIndexedRowScalar,
+#ifdef RAYCAST_X86
+    [RAYCAST_KERNEL_AVX2] = CastIndexedRowAVX2,
+    [RAYCAST_KERNEL_AVX512] = CastIndexedRowAVX2,
+#endif
+};
+
+// Singletons
+static RayCastKernel selectedKernel = RAYCAST_KERNEL_SCALAR;
+
+bool IsRayCastKernelSupported(RayCastKernel kernel) {
+    switch (kernel) {
+        case RAYCAST_KERNEL_SCALAR:
+            return true;
+#ifdef RAYCAST_X86
+        case RAYCAST_KERNEL_SSE:
+            return __builtin_cpu_supports("sse4.1");
+        case RAYCAST_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case RAYCAST_KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+RayCastKernel GetBestRayCastKernel(void) {
+    for (int kernel = RAYCAST_KERNEL_COUNT - 1; kernel > RAYCAST_KERNEL_SCALAR; kernel--) {
+        if (IsRayCastKernelSupported(kernel)) {
+            return kernel;
+        }
+    }
+    return RAYCAST_KERNEL_SCALAR;
+}
+
+bool SetRayCastKernel(RayCastKernel kernel) {
+    if (kernel < 0 || kernel >= RAYCAST_KERNEL_COUNT || !IsRayCastKernelSupported(kernel)) {
+        return false;
+    }
+    selectedKernel = kernel;
+    return true;
+}
+
+RayCastKernel GetRayCastKernel(void) {
+    return selectedKernel;
+}
+
+const char *GetRayCastKernelName(RayCastKernel kernel) {
+    return (kernel >= 0 && kernel < RAYCAST_KERNEL_COUNT) ? kernelNames[kernel] : "unknown";
+}
+
+void CastRays(const RayCastParams *params, RayHit *hits, int start, int end) {
+    kernels[selectedKernel](params, hits, start, end);
+}
+
+void CastRow(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end) {
+    rowKernels[selectedKernel](params, start, step, ceilingRow, floorRow, first, end);
+}
+
+void CastIndexedRow(const RowCastParams *params, Vector2 start, Vector2 step, unsigned char *ceilingRow, unsigned char *floorRow, int first, int end) {
+    indexedRowKernels[selectedKernel](params, start, step, ceilingRow, floorRow, first, end);
+}
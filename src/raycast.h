@@ -0,0 +1,76 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include "map.h"
+
+typedef enum {
+    RAYCAST_KERNEL_SCALAR,
+    RAYCAST_KERNEL_SSE,
+    RAYCAST_KERNEL_AVX2,
+    RAYCAST_KERNEL_AVX512,
+    RAYCAST_KERNEL_COUNT
+} RayCastKernel;
+
+// Everything the traversal needs to know about the map and the camera,
+// ray n goes through the camera plane at cameraX[n] (between -1 and 1)
+typedef struct {
+    const ChunkCache *chunks;   // Tiles around the player (walls outside of them read as empty)
+    const OccupancyGrid *occupancy; // Walls of the whole map as a bitmap pyramid
+    int mapWidth;
+    int mapHeight;
+    int dof;                // Maximum number of steps (moving between levels of the pyramid counts as one)
+    const float *cameraX;   // Offset of every column along the camera plane
+    int mapX;
+    int mapY;
+    Vector2 tileCoords;
+    Vector2 direction;
+    Vector2 cameraPlane;
+} RayCastParams;
+
+typedef struct {
+    int cellId;             // Wall id of the hit cell (0 if nothing was hit)
+    int vertical;           // Whether the ray hit a vertical (x-side) face
+    int mapX;
+    int mapY;
+    float distance;         // Distance projected onto the camera direction
+} RayHit;
+
+// Everything the floor casting needs to know about the map and the tile
+// textures, pixel x of a row samples the map at start + step * x. The
+// textured pixels are scaled by the luxel of the lightmap they fall on
+// (or looked up in the shade table of the palette, when casting indices)
+typedef struct {
+    const ChunkCache *chunks;   // Tiles around the player (cells outside of them read as empty)
+    const unsigned char *luxels;    // Luxels of the slots of the cache (see LightmapCache)
+    int mapWidth;
+    int mapHeight;
+    const Color *texels;    // Square tile textures stored one after the other
+    int textureSize;
+    int textureCount;
+    Color ceilingColor;     // Color of the cells without a ceiling texture
+    Color floorColor;       // Color of the cells without a floor texture
+    const unsigned char *indices;   // Same as texels as palette indices (paletted mode only, see palette.h)
+    const unsigned char *shades;    // Shade table of the palette
+    unsigned char ceilingIndex;     // Palette indices of the default colors
+    unsigned char floorIndex;
+} RowCastParams;
+
+// Returns the fastest kernel supported by the running CPU
+RayCastKernel GetBestRayCastKernel(void);
+// Returns whether the running CPU supports the kernel
+bool IsRayCastKernelSupported(RayCastKernel kernel);
+// Selects the kernel used by CastRays(), fails if it isn't supported
+bool SetRayCastKernel(RayCastKernel kernel);
+RayCastKernel GetRayCastKernel(void);
+const char *GetRayCastKernelName(RayCastKernel kernel);
+// Casts rays start to end - 1 and stores the result of ray n in hits[n - start]
+void CastRays(const RayCastParams *params, RayHit *hits, int start, int end);
+// Casts the floor and the ceiling of a scanline in the same pass and
+// writes pixels first to end - 1 of both ceilingRow and floorRow
+void CastRow(const RowCastParams *params, Vector2 start, Vector2 step, Color *ceilingRow, Color *floorRow, int first, int end);
+// Same as CastRow() but writes lit palette indices instead of colors
+void CastIndexedRow(const RowCastParams *params, Vector2 start, Vector2 step, unsigned char *ceilingRow, unsigned char *floorRow, int first, int end);
+
+#endif
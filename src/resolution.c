@@ -0,0 +1,75 @@
+#include "resolution.h"
+#include <math.h>
+
+// Weight of the last frame in the average frame time
+#define RESOLUTION_SMOOTHING    0.1f
+// Largest frame time fed to the average, relative to the average
+#define RESOLUTION_MAX_SPIKE    1.5f
+// The scale goes up only once the average drops under this fraction of the budget
+#define RESOLUTION_HEADROOM     0.8f
+// Largest relative change of the scale in a single step
+#define RESOLUTION_MAX_STEP     0.1f
+// Frames in a row the average has to stay out of the band before the scale changes
+#define RESOLUTION_PATIENCE     5
+// Frames to wait after a change before changing the scale again
+#define RESOLUTION_COOLDOWN     15
+// The scale is a multiple of this, so it settles on a few distinct sizes
+#define RESOLUTION_QUANTUM      (1.0f / 64.0f)
+
+void InitResolutionController(ResolutionController *controller, float budget, float minScale, float maxScale) {
+    *controller = (ResolutionController) {
+        .budget = budget,
+        .minScale = minScale,
+        .maxScale = maxScale,
+        .scale = maxScale,
+        .average = budget
+    };
+}
+
+bool UpdateResolutionController(ResolutionController *controller, float frameTime) {
+    // A single frame that took far too long (the window was moved, the process
+    // was suspended) shouldn't throw the average off, cap how far it can pull it.
+    // A lasting slowdown still gets through after a few frames
+    if (frameTime > RESOLUTION_MAX_SPIKE * controller->average) {
+        frameTime = RESOLUTION_MAX_SPIKE * controller->average;
+    }
+    controller->average += (frameTime - controller->average) * RESOLUTION_SMOOTHING;
+    if (controller->cooldown > 0) {
+        controller->cooldown--;
+        return false;
+    }
+    // Leave the scale alone while the average stays within the band,
+    // or until it has been out of it for a few frames in a row
+    if (controller->average <= controller->budget && controller->average >= controller->budget * RESOLUTION_HEADROOM) {
+        controller->outside = 0;
+        return false;
+    }
+    if (++controller->outside < RESOLUTION_PATIENCE) {
+        return false;
+    }
+    // The cost of a frame grows with the number of pixels (the square of the
+    // scale), aim for the middle of the band
+    float target = controller->budget * (1.0f + RESOLUTION_HEADROOM) / 2.0f;
+    float scale = controller->scale * sqrtf(target / controller->average);
+    // Take small steps and snap to the quantum (away from the current scale,
+    // or the steps could round back to it)
+    float lowest = controller->scale * (1.0f - RESOLUTION_MAX_STEP);
+    float highest = controller->scale * (1.0f + RESOLUTION_MAX_STEP);
+    scale = (scale < lowest) ? lowest : (scale > highest) ? highest : scale;
+    if (scale < controller->scale) {
+        scale = floorf(scale / RESOLUTION_QUANTUM) * RESOLUTION_QUANTUM;
+    } else {
+        scale = ceilf(scale / RESOLUTION_QUANTUM) * RESOLUTION_QUANTUM;
+    }
+    scale = (scale < controller->minScale) ? controller->minScale : (scale > controller->maxScale) ? controller->maxScale : scale;
+    if (scale == controller->scale) {
+        return false;
+    }
+    // Guess the frame time at the new scale, so the average doesn't
+    // keep pushing in the same direction while it catches up
+    controller->average *= (scale * scale) / (controller->scale * controller->scale);
+    controller->scale = scale;
+    controller->cooldown = RESOLUTION_COOLDOWN;
+    controller->outside = 0;
+    return true;
+}
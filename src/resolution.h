@@ -0,0 +1,25 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <stdbool.h>
+
+// Scales the resolution to keep the frame time under a budget. The frame
+// times are smoothed and the scale only changes when the average leaves
+// a band under the budget, by small steps and with a pause after every
+// change (so that a single slow frame or the cost of the change itself
+// doesn't make the scale go back and forth)
+typedef struct {
+    float budget;       // Target frame time in seconds
+    float minScale;
+    float maxScale;
+    float scale;        // Fraction of the window resolution to render at
+    float average;      // Smoothed frame time in seconds
+    int outside;        // Frames in a row the average has been out of the band
+    int cooldown;       // Frames left before the scale can change again
+} ResolutionController;
+
+void InitResolutionController(ResolutionController *controller, float budget, float minScale, float maxScale);
+// Feeds the time of the last frame, returns true when the scale changed
+bool UpdateResolutionController(ResolutionController *controller, float frameTime);
+
+#endif
@@ -0,0 +1,187 @@
+#include "sim.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "bench.h"
+#include "collision.h"
+#include "profile.h"
+
+// Set on the middle slot of a triple buffer when it's newer than the front one
+#define TRIPLE_BUFFER_FRESH     4
+// Ticks the simulation can fall behind before it skips them instead of catching up
+#define SIMULATION_MAX_BEHIND   8
+
+// Lock-free triple buffer: the writer fills its back slot and swaps it with
+// the middle one, the reader swaps the middle slot with its front one when
+// the writer published something since the last swap. Neither side ever
+// waits for the other and the reader always gets the latest complete slot
+typedef struct {
+    int back;               // Slot owned by the writer
+    int front;              // Slot owned by the reader
+    atomic_int middle;      // Slot in between (plus TRIPLE_BUFFER_FRESH)
+} TripleBuffer;
+
+typedef struct {
+    bool started;
+    atomic_bool running;
+    float duration;
+    double next;
+    const Map *map;
+    Player player;
+    double xMouse;              // Mouse motion consumed by the ticks so far
+    pthread_t thread;
+    TripleBuffer inputBuffer;   // Written by the main thread
+    PlayerInput inputs[3];
+    TripleBuffer snapshotBuffer;    // Written by the simulation thread
+    PlayerSnapshot snapshots[3];
+} Simulation;
+
+// Singletons
+static Simulation S = {0};
+
+static void InitTripleBuffer(TripleBuffer *buffer) {
+    buffer->back = 0;
+    buffer->front = 1;
+    atomic_store_explicit(&buffer->middle, 2, memory_order_relaxed);
+}
+
+// Publishes the back slot, returns the slot to write next
+static int PublishSlot(TripleBuffer *buffer) {
+    buffer->back = atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel) & 3;
+    return buffer->back;
+}
+
+// Returns the latest published slot
+static int AcquireSlot(TripleBuffer *buffer) {
+    if (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) {
+        buffer->front = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel) & 3;
+    }
+    return buffer->front;
+}
+
+static void SleepUntil(double time) {
+    double remaining = time - GetBenchTime();
+    if (remaining > 0.0) {
+        struct timespec duration = {
+            .tv_sec = (time_t) remaining,
+            .tv_nsec = (long) ((remaining - (time_t) remaining) * 1e9)
+        };
+        nanosleep(&duration, NULL);
+    }
+}
+
+static void StepPlayer(Player *player, const PlayerInput *input, float xMouseDelta, float delta, const Map *map) {
+    // Camera horizontal rotation
+    player->rotation += xMouseDelta * player->rotationSpeed * delta;
+    if (player->rotation < 0.0f) {
+        player->rotation += 2.0f * PI;
+    } else if (player->rotation > 2.0f * PI) {
+        player->rotation -= 2.0f * PI;
+    }
+    // Compute player direction
+    Vector2 direction = { cosf(player->rotation), sinf(player->rotation) };
+    // Walk along the direction and strafe perpendicular to it
+    float distance = delta * player->movementSpeed;
+    Vector2 displacement = {
+        (direction.x * input->forward - direction.y * input->right) * distance,
+        (direction.y * input->forward + direction.x * input->right) * distance
+    };
+    // Collisions are checked against the occupancy grid, which
+    // covers the whole map (unlike the chunks in the cache)
+    player->position = MoveBody(&map->occupancy, player->position, displacement, player->radius);
+}
+
+static void *SimulationMain(void *arg) {
+    unsigned int tick = 0;
+    SetProfilerThreadName("simulation");
+    while (atomic_load_explicit(&S.running, memory_order_relaxed)) {
+        SleepUntil(S.next);
+        ProfileZone zone = BeginProfileZone("tick");
+        // Consume the mouse motion since the last tick along with the latest keys
+        const PlayerInput *input = &S.inputs[AcquireSlot(&S.inputBuffer)];
+        float xMouseDelta = (float) (input->xMouse - S.xMouse);
+        S.xMouse = input->xMouse;
+        Player previous = S.player;
+        StepPlayer(&S.player, input, xMouseDelta, S.duration, S.map);
+        // Publish the new state, the render thread picks it up whenever it's ready
+        S.snapshots[S.snapshotBuffer.back] = (PlayerSnapshot) {
+            .tick = ++tick,
+            .time = S.next,
+            .duration = S.duration,
+            .previous = previous,
+            .current = S.player
+        };
+        PublishSlot(&S.snapshotBuffer);
+        EndProfileZone(zone);
+        // Skip the ticks we fell too far behind on (e.g. the process was
+        // suspended) instead of running them all back to back
+        S.next += S.duration;
+        double now = GetBenchTime();
+        if (now - S.next > SIMULATION_MAX_BEHIND * S.duration) {
+            S.next = now;
+        }
+    }
+    return NULL;
+}
+
+bool InitSimulation(const Player *player, const Map *map, float tickRate) {
+    S.map = map;
+    S.player = *player;
+    S.duration = 1.0f / tickRate;
+    S.xMouse = 0.0;
+    InitTripleBuffer(&S.inputBuffer);
+    InitTripleBuffer(&S.snapshotBuffer);
+    for (int i = 0; i < 3; i++) {
+        S.inputs[i] = (PlayerInput) {0};
+    }
+    // Publish the starting state, so there's always a snapshot to render
+    double now = GetBenchTime();
+    S.snapshots[S.snapshotBuffer.back] = (PlayerSnapshot) {
+        .time = now,
+        .duration = S.duration,
+        .previous = *player,
+        .current = *player
+    };
+    PublishSlot(&S.snapshotBuffer);
+    S.next = now + S.duration;
+    atomic_store_explicit(&S.running, true, memory_order_relaxed);
+    S.started = !pthread_create(&S.thread, NULL, SimulationMain, NULL);
+    return S.started;
+}
+
+void ShutdownSimulation(void) {
+    atomic_store_explicit(&S.running, false, memory_order_relaxed);
+    if (S.started) {
+        pthread_join(S.thread, NULL);
+        S.started = false;
+    }
+}
+
+void SubmitPlayerInput(const PlayerInput *input) {
+    S.inputs[S.inputBuffer.back] = *input;
+    PublishSlot(&S.inputBuffer);
+}
+
+const PlayerSnapshot *GetPlayerSnapshot(void) {
+    return &S.snapshots[AcquireSlot(&S.snapshotBuffer)];
+}
+
+void SamplePlayerSnapshot(const PlayerSnapshot *snapshot, double time, Vector2 *position, float *rotation) {
+    // Rendering a tick behind puts time between the previous and the current
+    // state, unless the next tick is late (then it stops at the current one)
+    float t = (float) ((time - snapshot->time) / snapshot->duration);
+    t = (t < 0.0f) ? 0.0f : (t > 1.0f) ? 1.0f : t;
+    const Player *from = &snapshot->previous;
+    const Player *to = &snapshot->current;
+    position->x = from->position.x + (to->position.x - from->position.x) * t;
+    position->y = from->position.y + (to->position.y - from->position.y) * t;
+    // Rotate the shortest way around and wrap the result between 0 and 2*PI
+    float delta = to->rotation - from->rotation;
+    if (delta > PI) {
+        delta -= 2.0f * PI;
+    } else if (delta < -PI) {
+        delta += 2.0f * PI;
+    }
+    *rotation = fmodf(from->rotation + delta * t + 2.0f * PI, 2.0f * PI);
+}
@@ -0,0 +1,48 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include "map.h"
+
+typedef struct {
+    Vector2 position;
+    float rotation;
+    float movementSpeed;
+    float rotationSpeed;
+    float radius;           // Of the circle that collides with the walls
+} Player;
+
+typedef struct {
+    int forward;
+    int right;
+    // Horizontal mouse motion since the simulation started (a float
+    // would round the small motions away in long sessions)
+    double xMouse;
+} PlayerInput;
+
+// State of the player at the end of a tick, along with its state at the end
+// of the tick before so it can be interpolated without waiting for the next one
+typedef struct {
+    unsigned int tick;
+    double time;            // When the tick ended (on the GetBenchTime() clock)
+    float duration;         // Seconds between two ticks
+    Player previous;
+    Player current;
+} PlayerSnapshot;
+
+// Spawns the thread that steps the player tickRate times per second,
+// the map has to stay loaded until the simulation is shut down
+bool InitSimulation(const Player *player, const Map *map, float tickRate);
+// Stops and joins the simulation thread
+void ShutdownSimulation(void);
+// Hands the latest input to the simulation thread (never blocks)
+void SubmitPlayerInput(const PlayerInput *input);
+// Returns the latest snapshot published by the simulation thread (never
+// blocks), it stays valid until the next call. Only one thread can read
+const PlayerSnapshot *GetPlayerSnapshot(void);
+// Interpolates the player between the two ticks of the snapshot, time is
+// shifted back by a tick so that it always falls between them
+void SamplePlayerSnapshot(const PlayerSnapshot *snapshot, double time, Vector2 *position, float *rotation);
+
+#endif
@@ -0,0 +1,305 @@
+#include "sprite.h"
+#include <math.h>
+#include <string.h>
+
+// Bits of the sort keys sorted by every pass of the radix sort
+#define RADIX_BITS              8
+#define RADIX_BUCKETS           (1 << RADIX_BITS)
+#define RADIX_PASSES            (32 / RADIX_BITS)
+// Smallest sprite ScatterSprites() places (the largest is SPRITE_MAX_SIZE)
+#define SCATTER_MIN_SIZE        0.25f
+// Attempts at finding an empty cell for every sprite before giving up
+#define SCATTER_ATTEMPTS        64
+
+// Integer hash (lowbias32), the same seed always scatters the same sprites
+static unsigned int Hash(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Returns a number between 0 and 1 from the hash
+static inline float HashToFloat(unsigned int hash) {
+    return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+// Returns the cell of the grid containing the position (clamped to the
+// grid, the sprites are supposed to be inside of the map)
+static inline int GetSpriteCell(const SpriteStore *store, float x, float y) {
+    int cellX = (int) floorf(x) >> SPRITE_GRID_SHIFT;
+    int cellY = (int) floorf(y) >> SPRITE_GRID_SHIFT;
+    cellX = (cellX < 0) ? 0 : (cellX >= store->gridWidth) ? store->gridWidth - 1 : cellX;
+    cellY = (cellY < 0) ? 0 : (cellY >= store->gridHeight) ? store->gridHeight - 1 : cellY;
+    return cellY * store->gridWidth + cellX;
+}
+
+bool InitSpriteStore(SpriteStore *store, int capacity, int mapWidth, int mapHeight) {
+    int cellSize = 1 << SPRITE_GRID_SHIFT;
+    *store = (SpriteStore) {
+        .capacity = capacity,
+        .gridWidth = (mapWidth + cellSize - 1) / cellSize,
+        .gridHeight = (mapHeight + cellSize - 1) / cellSize
+    };
+    store->gridWidth = (store->gridWidth > 0) ? store->gridWidth : 1;
+    store->gridHeight = (store->gridHeight > 0) ? store->gridHeight : 1;
+    // Empty stores still get (empty) arrays, so nothing has to check for them
+    int allocated = (capacity > 0) ? capacity : 1;
+    store->x = MemAlloc(allocated * sizeof(float));
+    store->y = MemAlloc(allocated * sizeof(float));
+    store->size = MemAlloc(allocated * sizeof(float));
+    store->textureId = MemAlloc(allocated * sizeof(int));
+    store->cellStart = MemAlloc((store->gridWidth * store->gridHeight + 1) * sizeof(int));
+    store->cellSprites = MemAlloc(allocated * sizeof(int));
+    if (!store->x || !store->y || !store->size || !store->textureId || !store->cellStart || !store->cellSprites) {
+        UnloadSpriteStore(store);
+        return false;
+    }
+    return true;
+}
+
+void UnloadSpriteStore(SpriteStore *store) {
+    MemFree(store->x);
+    MemFree(store->y);
+    MemFree(store->size);
+    MemFree(store->textureId);
+    MemFree(store->cellStart);
+    MemFree(store->cellSprites);
+    *store = (SpriteStore) {0};
+}
+
+int AddSprite(SpriteStore *store, Vector2 position, float size, int textureId) {
+    if (store->count >= store->capacity) {
+        return -1;
+    }
+    int n = store->count++;
+    store->x[n] = position.x;
+    store->y[n] = position.y;
+    store->size[n] = (size < SPRITE_MAX_SIZE) ? size : SPRITE_MAX_SIZE;
+    store->textureId[n] = textureId;
+    return n;
+}
+
+void BuildSpriteGrid(SpriteStore *store) {
+    int cells = store->gridWidth * store->gridHeight;
+    // Count the sprites of every cell, then turn the counts into offsets
+    // (cellStart[c + 1] is the end of cell c while the sprites are placed)
+    memset(store->cellStart, 0, (cells + 1) * sizeof(int));
+    for (int n = 0; n < store->count; n++) {
+        store->cellStart[GetSpriteCell(store, store->x[n], store->y[n]) + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        store->cellStart[c + 1] += store->cellStart[c];
+    }
+    // Place the sprites, moving the start of their cells along (which leaves
+    // every start at the end of its cell, so shift them back afterwards)
+    for (int n = 0; n < store->count; n++) {
+        int cell = GetSpriteCell(store, store->x[n], store->y[n]);
+        store->cellSprites[store->cellStart[cell]++] = n;
+    }
+    memmove(&store->cellStart[1], &store->cellStart[0], cells * sizeof(int));
+    store->cellStart[0] = 0;
+}
+
+void ScatterSprites(SpriteStore *store, const OccupancyGrid *grid, int count, int textureCount, unsigned int seed) {
+    const OccupancyLevel *level = &grid->level[0];
+    unsigned int hash = Hash(seed);
+    for (int n = 0; n < count && textureCount > 0; n++) {
+        for (int attempt = 0; attempt < SCATTER_ATTEMPTS; attempt++) {
+            int x = (hash = Hash(hash)) % level->width;
+            int y = (hash = Hash(hash)) % level->height;
+            if (IsOccupied(grid, 0, x, y)) {
+                continue;
+            }
+            // Keep the whole sprite inside its cell, so it never pokes into a wall
+            float size = SCATTER_MIN_SIZE + (SPRITE_MAX_SIZE - SCATTER_MIN_SIZE) * HashToFloat(hash = Hash(hash));
+            float margin = size / 2.0f;
+            Vector2 position = {
+                x + margin + (1.0f - size) * HashToFloat(hash = Hash(hash)),
+                y + margin + (1.0f - size) * HashToFloat(hash = Hash(hash))
+            };
+            AddSprite(store, position, size, (hash = Hash(hash)) % textureCount);
+            break;
+        }
+    }
+    BuildSpriteGrid(store);
+}
+
+bool InitSpriteList(SpriteList *list, int capacity) {
+    int allocated = (capacity > 0) ? capacity : 1;
+    *list = (SpriteList) { .capacity = capacity };
+    list->sprites = MemAlloc(allocated * sizeof(ProjectedSprite));
+    list->unsorted = MemAlloc(allocated * sizeof(ProjectedSprite));
+    for (int i = 0; i < 2; i++) {
+        list->keys[i] = MemAlloc(allocated * sizeof(unsigned int));
+        list->order[i] = MemAlloc(allocated * sizeof(int));
+    }
+    if (!list->sprites || !list->unsorted || !list->keys[0] || !list->keys[1] || !list->order[0] || !list->order[1]) {
+        UnloadSpriteList(list);
+        return false;
+    }
+    return true;
+}
+
+void UnloadSpriteList(SpriteList *list) {
+    MemFree(list->sprites);
+    MemFree(list->unsorted);
+    for (int i = 0; i < 2; i++) {
+        MemFree(list->keys[i]);
+        MemFree(list->order[i]);
+    }
+    *list = (SpriteList) {0};
+}
+
+// Returns the largest value a*x + b*y takes over a cell of the grid, relative to origin
+static inline float GetCellMaximum(float a, float b, Vector2 origin, int cellX, int cellY) {
+    float halfSize = (1 << SPRITE_GRID_SHIFT) / 2.0f;
+    float centerX = ((cellX << SPRITE_GRID_SHIFT) + halfSize) - origin.x;
+    float centerY = ((cellY << SPRITE_GRID_SHIFT) + halfSize) - origin.y;
+    return a * centerX + b * centerY + (fabsf(a) + fabsf(b)) * halfSize;
+}
+
+// Sorts the keys in ascending order with a least significant digit radix sort
+// and returns the order of the elements. The histograms of every digit are
+// built in a single pass, and the digits all the keys share are skipped
+// (the high bits of depths in the same range are usually the same)
+static int *SortKeys(SpriteList *list, int count) {
+    unsigned int histograms[RADIX_PASSES][RADIX_BUCKETS] = {0};
+    unsigned int *keys = list->keys[0];
+    int *order = list->order[0];
+    for (int i = 0; i < count; i++) {
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            histograms[pass][(keys[i] >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
+        order[i] = i;
+    }
+    int current = 0;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        int shift = pass * RADIX_BITS;
+        unsigned int *histogram = histograms[pass];
+        if (histogram[(keys[0] >> shift) & (RADIX_BUCKETS - 1)] == (unsigned int) count) {
+            continue;
+        }
+        // Turn the counts into the offset of every bucket
+        unsigned int offset = 0;
+        for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+            unsigned int bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+        // Scatter the keys (with their elements) in their buckets, keeping their order
+        const unsigned int *fromKeys = list->keys[current];
+        const int *fromOrder = list->order[current];
+        unsigned int *toKeys = list->keys[current ^ 1];
+        int *toOrder = list->order[current ^ 1];
+        for (int i = 0; i < count; i++) {
+            unsigned int destination = histogram[(fromKeys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            toKeys[destination] = fromKeys[i];
+            toOrder[destination] = fromOrder[i];
+        }
+        current ^= 1;
+        keys = list->keys[current];
+    }
+    return list->order[current];
+}
+
+int ProjectSprites(const SpriteStore *store, const SpriteCamera *camera, SpriteList *list) {
+    Vector2 d = camera->direction;
+    Vector2 q = camera->cameraPlane;
+    float planeSquared = q.x * q.x + q.y * q.y;
+    float planeLength = sqrtf(planeSquared);
+    // Normals of the sides of the frustum: a point at depth z and at offset
+    // s along the camera plane is on screen when |s| <= z * |cameraPlane|,
+    // so it's inside both sides when dot(normal, point) >= 0
+    Vector2 right = { planeSquared * d.x - q.x, planeSquared * d.y - q.y };
+    Vector2 left = { planeSquared * d.x + q.x, planeSquared * d.y + q.y };
+    // A sprite can reach into the frustum from up to half its size outside of it
+    float margin = (SPRITE_MAX_SIZE / 2.0f) * planeLength;
+    // Find the cells of the grid around the frustum (a triangle from
+    // the camera to the two corners of the far plane)
+    float far = camera->farPlane;
+    Vector2 p = camera->position;
+    float cornerX[3] = { p.x, p.x + far * (d.x - q.x), p.x + far * (d.x + q.x) };
+    float cornerY[3] = { p.y, p.y + far * (d.y - q.y), p.y + far * (d.y + q.y) };
+    float minX = fminf(cornerX[0], fminf(cornerX[1], cornerX[2])) - SPRITE_MAX_SIZE;
+    float maxX = fmaxf(cornerX[0], fmaxf(cornerX[1], cornerX[2])) + SPRITE_MAX_SIZE;
+    float minY = fminf(cornerY[0], fminf(cornerY[1], cornerY[2])) - SPRITE_MAX_SIZE;
+    float maxY = fmaxf(cornerY[0], fmaxf(cornerY[1], cornerY[2])) + SPRITE_MAX_SIZE;
+    int fromX = (int) fmaxf(floorf(minX) / (1 << SPRITE_GRID_SHIFT), 0.0f);
+    int fromY = (int) fmaxf(floorf(minY) / (1 << SPRITE_GRID_SHIFT), 0.0f);
+    int toX = (int) fminf(floorf(maxX) / (1 << SPRITE_GRID_SHIFT), store->gridWidth - 1);
+    int toY = (int) fminf(floorf(maxY) / (1 << SPRITE_GRID_SHIFT), store->gridHeight - 1);
+    float halfColumns = camera->columns / 2.0f;
+    int count = 0;
+    for (int cellY = fromY; cellY <= toY; cellY++) {
+        for (int cellX = fromX; cellX <= toX; cellX++) {
+            int cell = cellY * store->gridWidth + cellX;
+            int start = store->cellStart[cell];
+            int end = store->cellStart[cell + 1];
+            if (start == end) {
+                continue;
+            }
+            // Skip the cells completely behind the near plane, past the
+            // far plane or outside of one of the sides
+            if (GetCellMaximum(d.x, d.y, p, cellX, cellY) < SPRITE_NEAR_PLANE ||
+                GetCellMaximum(-d.x, -d.y, p, cellX, cellY) < -far ||
+                GetCellMaximum(right.x, right.y, p, cellX, cellY) + margin < 0.0f ||
+                GetCellMaximum(left.x, left.y, p, cellX, cellY) + margin < 0.0f) {
+                continue;
+            }
+            // Skip the cells where nothing can be seen from the camera (the
+            // sprites can reach one map cell out of their cell of the grid)
+            int cellMinX = cellX << SPRITE_GRID_SHIFT, cellMinY = cellY << SPRITE_GRID_SHIFT;
+            if (camera->visible && !IsAreaVisible(camera->visible, cellMinX - 1, cellMinY - 1,
+                                                  cellMinX + (1 << SPRITE_GRID_SHIFT), cellMinY + (1 << SPRITE_GRID_SHIFT))) {
+                continue;
+            }
+            for (int i = start; i < end && count < list->capacity; i++) {
+                int n = store->cellSprites[i];
+                float x = store->x[n] - p.x;
+                float y = store->y[n] - p.y;
+                // Project the sprite with the inverse of the camera matrix
+                // [cameraPlane direction]: its depth along the direction,
+                // and the offset along the camera plane at that depth
+                float depth = x * d.x + y * d.y;
+                if (depth < SPRITE_NEAR_PLANE || depth > far) {
+                    continue;
+                }
+                float size = store->size[n];
+                if (camera->visible && !IsAreaVisible(camera->visible,
+                                                      (int) (store->x[n] - size / 2.0f), (int) (store->y[n] - size / 2.0f),
+                                                      (int) (store->x[n] + size / 2.0f), (int) (store->y[n] + size / 2.0f))) {
+                    continue;
+                }
+                float cameraX = (x * q.x + y * q.y) / (planeSquared * depth);
+                float halfWidth = (size / 2.0f) / (planeLength * depth);
+                if (cameraX + halfWidth <= -1.0f || cameraX - halfWidth >= 1.0f) {
+                    continue;
+                }
+                list->unsorted[count] = (ProjectedSprite) {
+                    .depth = depth,
+                    .center = (cameraX + 1.0f) * halfColumns,
+                    .halfWidth = halfWidth * halfColumns,
+                    .size = size,
+                    .textureId = store->textureId[n]
+                };
+                // Positive floats sort like their bits, flip them to sort back to front
+                unsigned int bits;
+                memcpy(&bits, &depth, sizeof(bits));
+                list->keys[0][count] = ~bits;
+                count++;
+            }
+        }
+    }
+    list->count = count;
+    if (count == 0) {
+        return 0;
+    }
+    const int *order = SortKeys(list, count);
+    for (int i = 0; i < count; i++) {
+        list->sprites[i] = list->unsorted[order[i]];
+    }
+    return count;
+}
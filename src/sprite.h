@@ -0,0 +1,85 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include "map.h"
+#include "visibility.h"
+
+// Sprites are bucketed in a grid of 2^SPRITE_GRID_SHIFT x 2^SPRITE_GRID_SHIFT cells
+#define SPRITE_GRID_SHIFT       3
+// Sprites are at most as large as a cell (their size is the fraction of a wall they cover)
+#define SPRITE_MAX_SIZE         1.0f
+// Sprites closer than this to the camera plane are culled (they would cover the screen)
+#define SPRITE_NEAR_PLANE       0.05f
+
+// Billboards standing on the floor, stored as a structure of arrays so
+// culling only touches the positions. The sprites are bucketed by cell
+// of the grid (a counting sort rebuilt by BuildSpriteGrid())
+typedef struct {
+    int count;
+    int capacity;
+    float *x;
+    float *y;
+    float *size;            // Width and height, as a fraction of the size of a wall
+    int *textureId;         // Tile of the tile map
+    int gridWidth;
+    int gridHeight;
+    int *cellStart;         // First sprite of every cell in cellSprites (plus one past the last)
+    int *cellSprites;       // Sprites sorted by cell
+} SpriteStore;
+
+// Camera to project the sprites with, the same as the one of the rays:
+// column n of columns looks through position + direction + cameraPlane * cameraX,
+// with cameraX going from -1 (column 0) to +1 (column columns)
+typedef struct {
+    Vector2 position;
+    Vector2 direction;
+    Vector2 cameraPlane;
+    int columns;
+    float farPlane;         // Sprites further away than this are culled
+    const VisibleBlocks *visible;   // Sprites outside of these blocks are culled (none if NULL)
+} SpriteCamera;
+
+// Sprite projected on the screen, horizontally it covers the columns from
+// center - halfWidth to center + halfWidth (it can be partially off screen)
+typedef struct {
+    float depth;            // Distance projected onto the camera direction, as for the walls
+    float center;
+    float halfWidth;
+    float size;
+    int textureId;
+} ProjectedSprite;
+
+// Sprites that survived the culling, back to front (so drawing them in
+// order and skipping the pixels behind the walls gets the occlusion right)
+typedef struct {
+    int count;
+    int capacity;
+    ProjectedSprite *sprites;
+    ProjectedSprite *unsorted;
+    unsigned int *keys[2];  // Radix sort ping-pong buffers
+    int *order[2];
+} SpriteList;
+
+bool InitSpriteStore(SpriteStore *store, int capacity, int mapWidth, int mapHeight);
+void UnloadSpriteStore(SpriteStore *store);
+// Returns the index of the new sprite, -1 if the store is full. The position
+// has to be inside of the map, and the sprite isn't culled correctly until
+// the grid is rebuilt
+int AddSprite(SpriteStore *store, Vector2 position, float size, int textureId);
+// Buckets the sprites by cell of the grid, call it after adding or moving sprites
+void BuildSpriteGrid(SpriteStore *store);
+// Adds count sprites of random sizes and textures in cells without walls (the
+// same seed always places the same sprites), then rebuilds the grid
+void ScatterSprites(SpriteStore *store, const OccupancyGrid *grid, int count, int textureCount, unsigned int seed);
+
+bool InitSpriteList(SpriteList *list, int capacity);
+void UnloadSpriteList(SpriteList *list);
+// Culls the sprites outside of the camera frustum or of the potentially visible
+// blocks (whole cells of the grid at a time, then sprite by sprite), projects
+// the rest and sorts them back to front with a radix sort on their depth.
+// Returns how many are visible
+int ProjectSprites(const SpriteStore *store, const SpriteCamera *camera, SpriteList *list);
+
+#endif
@@ -0,0 +1,245 @@
+#include "video.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#else
+#include <unistd.h>
+#endif
+#include "profile.h"
+
+// Frames are queued in a ring: the renderer fills the slot after the last
+// queued one while the writer thread converts and writes the first one, so
+// encoding a frame overlaps rendering the next ones
+typedef struct {
+    bool started;
+    bool stopping;
+    bool failed;            // Only touched by the writer thread
+    VideoFormat format;
+    int width;
+    int height;
+    bool bottomUp;
+    const char *fileName;
+    FILE *file;
+    int written;
+    int next;               // Slot of the first queued frame
+    int queued;
+    Color *frames[VIDEO_QUEUE_FRAMES];
+    unsigned char *output;  // Frame converted to the output format
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;   // Signaled when a frame is queued or the writer has to stop
+    pthread_cond_t done;    // Signaled when a frame has been written
+} VideoWriter;
+
+static const char *formatNames[VIDEO_FORMAT_COUNT] = {
+    [VIDEO_FORMAT_Y4M] = "y4m",
+    [VIDEO_FORMAT_RGB] = "rgb",
+};
+
+// Singletons
+static VideoWriter E = {0};
+
+static int GreatestCommonDivisor(int a, int b) {
+    while (b) {
+        int remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+// Returns the pixels of row y of a frame, counting from the top
+static inline const Color *GetFrameRow(const Color *frame, int y) {
+    return &frame[((E.bottomUp) ? (E.height - 1 - y) : y) * E.width];
+}
+
+// Converts a frame to BT.601 (limited range) Y, U and V planes, every chroma
+// sample being the average of a block of 2x2 pixels
+static size_t ConvertFrameY4M(const Color *frame) {
+    static const char header[] = "FRAME\n";
+    int chromaWidth = (E.width + 1) / 2;
+    int chromaHeight = (E.height + 1) / 2;
+    unsigned char *y = E.output + sizeof(header) - 1;
+    unsigned char *u = y + E.width * E.height;
+    unsigned char *v = u + chromaWidth * chromaHeight;
+    memcpy(E.output, header, sizeof(header) - 1);
+    for (int row = 0; row < E.height; row++) {
+        const Color *pixels = GetFrameRow(frame, row);
+        for (int x = 0; x < E.width; x++) {
+            y[row * E.width + x] = (unsigned char) (((66 * pixels[x].r + 129 * pixels[x].g + 25 * pixels[x].b + 128) >> 8) + 16);
+        }
+    }
+    for (int row = 0; row < chromaHeight; row++) {
+        const Color *top = GetFrameRow(frame, 2 * row);
+        const Color *bottom = GetFrameRow(frame, (2 * row + 1 < E.height) ? 2 * row + 1 : 2 * row);
+        for (int x = 0; x < chromaWidth; x++) {
+            // The last column and row are repeated when the size is odd
+            int left = 2 * x;
+            int right = (left + 1 < E.width) ? left + 1 : left;
+            int r = (top[left].r + top[right].r + bottom[left].r + bottom[right].r + 2) >> 2;
+            int g = (top[left].g + top[right].g + bottom[left].g + bottom[right].g + 2) >> 2;
+            int b = (top[left].b + top[right].b + bottom[left].b + bottom[right].b + 2) >> 2;
+            // Offset by 128 before shifting, so the sums are never negative
+            u[row * chromaWidth + x] = (unsigned char) ((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+            v[row * chromaWidth + x] = (unsigned char) ((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+        }
+    }
+    return (sizeof(header) - 1) + E.width * E.height + 2 * chromaWidth * chromaHeight;
+}
+
+// Drops the alpha of the pixels
+static size_t ConvertFrameRGB(const Color *frame) {
+    unsigned char *rgb = E.output;
+    for (int row = 0; row < E.height; row++) {
+        const Color *pixels = GetFrameRow(frame, row);
+        for (int x = 0; x < E.width; x++) {
+            *rgb++ = pixels[x].r;
+            *rgb++ = pixels[x].g;
+            *rgb++ = pixels[x].b;
+        }
+    }
+    return (size_t) E.width * E.height * 3;
+}
+
+static void *VideoWriterMain(void *arg) {
+    SetProfilerThreadName("video");
+    pthread_mutex_lock(&E.mutex);
+    for (;;) {
+        // Sleep until a frame is queued, and only stop once they are all written
+        while (!E.queued && !E.stopping) {
+            pthread_cond_wait(&E.ready, &E.mutex);
+        }
+        if (!E.queued) {
+            break;
+        }
+        const Color *frame = E.frames[E.next];
+        pthread_mutex_unlock(&E.mutex);
+        ProfileZone zone = BeginProfileZone("video frame");
+        if (!E.failed) {
+            size_t size = (E.format == VIDEO_FORMAT_Y4M) ? ConvertFrameY4M(frame) : ConvertFrameRGB(frame);
+            if (fwrite(E.output, 1, size, E.file) == size) {
+                E.written++;
+            } else {
+                // Keep taking the frames so the renderer never waits forever
+                TraceLog(LOG_WARNING, "VIDEO: [%s] Failed to write frame %d, the next frames are dropped", E.fileName, E.written);
+                E.failed = true;
+            }
+        }
+        EndProfileZone(zone);
+        pthread_mutex_lock(&E.mutex);
+        E.next = (E.next + 1) % VIDEO_QUEUE_FRAMES;
+        E.queued--;
+        pthread_cond_signal(&E.done);
+    }
+    pthread_mutex_unlock(&E.mutex);
+    return NULL;
+}
+
+bool InitVideoWriter(const char *fileName, VideoFormat format, int width, int height, float frameRate, bool bottomUp) {
+    E = (VideoWriter) {
+        .format = format,
+        .width = width,
+        .height = height,
+        .bottomUp = bottomUp,
+        .fileName = fileName
+    };
+    if (format < 0 || format >= VIDEO_FORMAT_COUNT || width <= 0 || height <= 0) {
+        return false;
+    }
+    if (!strcmp(fileName, "-")) {
+        // Keep the frames on stdout and send whatever else is printed to stderr
+        fflush(stdout);
+        int fd = dup(fileno(stdout));
+        if (fd >= 0 && dup2(fileno(stderr), fileno(stdout)) >= 0) {
+#ifdef _WIN32
+            _setmode(fd, _O_BINARY);
+#endif
+            E.file = fdopen(fd, "wb");
+        }
+    } else {
+        E.file = fopen(fileName, "wb");
+    }
+    if (!E.file) {
+        return false;
+    }
+    // Converted frames are at most as large as the raw RGB ones (the Y4M
+    // ones are half as large, plus a short header)
+    size_t frameSize = (size_t) width * height * sizeof(Color);
+    E.output = MemAlloc((size_t) width * height * 3 + 16);
+    bool allocated = E.output != NULL;
+    for (int i = 0; i < VIDEO_QUEUE_FRAMES; i++) {
+        E.frames[i] = MemAlloc(frameSize);
+        allocated = allocated && E.frames[i];
+    }
+    if (!allocated) {
+        ShutdownVideoWriter();
+        return false;
+    }
+    // Y4M stores the frame rate as a ratio, the usual rates are whole numbers
+    if (format == VIDEO_FORMAT_Y4M) {
+        int numerator = (int) roundf(frameRate * 1000.0f);
+        numerator = (numerator > 0) ? numerator : 1000;
+        int divisor = GreatestCommonDivisor(numerator, 1000);
+        fprintf(E.file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", width, height, numerator / divisor, 1000 / divisor);
+    }
+    pthread_mutex_init(&E.mutex, NULL);
+    pthread_cond_init(&E.ready, NULL);
+    pthread_cond_init(&E.done, NULL);
+    E.started = !pthread_create(&E.thread, NULL, VideoWriterMain, NULL);
+    if (!E.started) {
+        ShutdownVideoWriter();
+        return false;
+    }
+    TraceLog(LOG_INFO, "VIDEO: [%s] Writing %dx%d %s frames", fileName, width, height, formatNames[format]);
+    return true;
+}
+
+void ShutdownVideoWriter(void) {
+    if (E.started) {
+        pthread_mutex_lock(&E.mutex);
+        E.stopping = true;
+        pthread_cond_signal(&E.ready);
+        pthread_mutex_unlock(&E.mutex);
+        pthread_join(E.thread, NULL);
+        pthread_cond_destroy(&E.done);
+        pthread_cond_destroy(&E.ready);
+        pthread_mutex_destroy(&E.mutex);
+        TraceLog(LOG_INFO, "VIDEO: [%s] Wrote %d frames", E.fileName, E.written);
+    }
+    if (E.file) {
+        fclose(E.file);
+    }
+    for (int i = 0; i < VIDEO_QUEUE_FRAMES; i++) {
+        MemFree(E.frames[i]);
+    }
+    MemFree(E.output);
+    E = (VideoWriter) {0};
+}
+
+Color *BeginVideoFrame(void) {
+    pthread_mutex_lock(&E.mutex);
+    while (E.queued == VIDEO_QUEUE_FRAMES) {
+        pthread_cond_wait(&E.done, &E.mutex);
+    }
+    Color *frame = E.frames[(E.next + E.queued) % VIDEO_QUEUE_FRAMES];
+    pthread_mutex_unlock(&E.mutex);
+    return frame;
+}
+
+void EndVideoFrame(void) {
+    pthread_mutex_lock(&E.mutex);
+    E.queued++;
+    pthread_cond_signal(&E.ready);
+    pthread_mutex_unlock(&E.mutex);
+}
+
+const char *GetVideoFormatName(VideoFormat format) {
+    return (format >= 0 && format < VIDEO_FORMAT_COUNT) ? formatNames[format] : "unknown";
+}
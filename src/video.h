@@ -0,0 +1,30 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <raylib.h>
+#include <stdbool.h>
+
+// Frames queued for the writer thread before the renderer has to wait for it
+#define VIDEO_QUEUE_FRAMES  4
+
+typedef enum {
+    VIDEO_FORMAT_Y4M,       // YUV4MPEG2 with 4:2:0 chroma, readable by most encoders
+    VIDEO_FORMAT_RGB,       // Raw 8-bit RGB frames one after the other, without any header
+    VIDEO_FORMAT_COUNT
+} VideoFormat;
+
+// Spawns the thread that converts the frames and writes them to fileName ("-"
+// for stdout, then whatever else is printed goes to stderr). The frames are
+// width x height RGBA pixels, from the top row down unless bottomUp is set
+// (as read back from the GPU). Y4M files are tagged with the frame rate
+bool InitVideoWriter(const char *fileName, VideoFormat format, int width, int height, float frameRate, bool bottomUp);
+// Writes the frames still queued, then stops and joins the writer thread
+void ShutdownVideoWriter(void);
+// Returns the pixels of the next frame to fill, waits for the writer thread
+// when VIDEO_QUEUE_FRAMES frames are already queued
+Color *BeginVideoFrame(void);
+// Queues the frame returned by the last BeginVideoFrame() (never blocks)
+void EndVideoFrame(void);
+const char *GetVideoFormatName(VideoFormat format);
+
+#endif
@@ -0,0 +1,552 @@
+#include "visibility.h"
+#include <raylib.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "pool.h"
+#include "profile.h"
+
+// The lines leaving a block are walked in line space: every quadrant of
+// directions (within 45 degrees of one of the axes) is a bundle of lines
+// walked away from the block a column of cells at a time, and split around
+// the walls of every column into the bundles that pass above and below
+// them. The bundles are convex polygons of lines, so the split is exact
+#define BUNDLE_VERTICES         16
+#define BUNDLE_STACK_SIZE       256
+// Margin of the tests against rounding, always in favor of visibility
+#define EPSILON                 1e-4f
+#define BLOCKS_PER_TASK         16
+// The progress of a build is logged every tenth of the blocks
+#define BUILD_PROGRESS_STEPS    10
+
+typedef enum {
+    QUADRANT_RIGHT,
+    QUADRANT_LEFT,
+    QUADRANT_DOWN,
+    QUADRANT_UP,
+    QUADRANT_COUNT
+} Quadrant;
+
+// Lines v = c + m * t for the (m, c) inside of a convex polygon, where t
+// is the distance from the side of the block along the axis of the quadrant
+// and v the coordinate across it. The lines are inside of the current
+// column of cells for t in [column, column + 1]. The slopes of a bundle
+// all have the same sign, so the lowest and highest points of its lines
+// inside of a column are always at the same ends of it
+typedef struct {
+    float m[BUNDLE_VERTICES];
+    float c[BUNDLE_VERTICES];
+    int count;
+    int column;
+    bool rising;            // The slopes are positive
+} Bundle;
+
+// A quadrant of the lines leaving a block, along with where they can go
+typedef struct {
+    const Map *map;
+    const VisibilitySet *set;
+    unsigned int *bits;     // Window of the block
+    int windowX;            // Block at the top left corner of the window
+    int windowY;
+    bool vertical;          // The columns are rows of cells
+    int step;               // Direction of the quadrant along its axis (+1 or -1)
+    int start;              // Column of cells right after the side of the block
+    int columns;            // Columns until the edge of the window or of the map
+    float length;           // Size of the block along the axis
+    float minV;             // Extent of the block across the axis
+    float maxV;
+} LineWalk;
+
+typedef struct {
+    const Map *map;
+    VisibilitySet *set;
+    double start;
+    atomic_int built;           // Blocks built so far
+    atomic_int reported;        // Steps of progress logged so far
+} VisibilityBuild;
+
+// Set built on threads of its own while the renderer goes on without it,
+// the threads take BLOCKS_PER_TASK blocks at a time until none are left and
+// the last one to finish caches the set
+typedef struct {
+    bool started;
+    int threadCount;
+    pthread_t threads[POOL_MAX_WORKERS];
+    atomic_int next;            // First block no thread took yet
+    atomic_int finished;        // Threads out of blocks
+    atomic_bool stopping;
+    atomic_bool done;           // The set is built and cached
+    VisibilitySet set;
+    VisibilityBuild build;
+    char fileName[512];
+} VisibilityBuilder;
+
+// Singletons
+static VisibilityBuilder D = {0};
+
+static bool AllocateVisibilitySet(VisibilitySet *set, const Map *map, int distance) {
+    int radius = 1 + (distance + VISIBILITY_BLOCK_SIZE - 1) / VISIBILITY_BLOCK_SIZE;
+    int size = 2 * radius + 1;
+    *set = (VisibilitySet) {
+        .blocksX = (map->width + VISIBILITY_BLOCK_SIZE - 1) >> VISIBILITY_BLOCK_SHIFT,
+        .blocksY = (map->height + VISIBILITY_BLOCK_SIZE - 1) >> VISIBILITY_BLOCK_SHIFT,
+        .distance = distance,
+        .radius = radius,
+        .size = size,
+        .words = (size * size + 31) / 32
+    };
+    set->bits = MemAlloc((size_t) set->blocksX * set->blocksY * set->words * sizeof(unsigned int));
+    return set->bits != NULL;
+}
+
+static void MarkBlock(unsigned int *bits, int size, int x, int y) {
+    if (x < 0 || y < 0 || x >= size || y >= size) {
+        return;
+    }
+    int bit = y * size + x;
+    bits[bit >> 5] |= 1u << (bit & 31);
+}
+
+// Returns whether the cell at row v of a column is a wall, the outside of the map is one
+static bool IsWallCell(const LineWalk *walk, int column, int v) {
+    const Map *map = walk->map;
+    int u = walk->start + walk->step * column;
+    int x = (walk->vertical) ? v : u;
+    int y = (walk->vertical) ? u : v;
+    if (x < 0 || y < 0 || x >= map->width || y >= map->height) {
+        return true;
+    }
+    return IsOccupied(&map->occupancy, 0, x, y);
+}
+
+// Marks the blocks of the cells from row first to row last of a column
+static void MarkColumn(const LineWalk *walk, int column, int first, int last) {
+    int u = (walk->start + walk->step * column) >> VISIBILITY_BLOCK_SHIFT;
+    first = (first > 0) ? first : 0;
+    for (int v = first >> VISIBILITY_BLOCK_SHIFT; v <= last >> VISIBILITY_BLOCK_SHIFT; v++) {
+        if (walk->vertical) {
+            MarkBlock(walk->bits, walk->set->size, v - walk->windowX, u - walk->windowY);
+        } else {
+            MarkBlock(walk->bits, walk->set->size, u - walk->windowX, v - walk->windowY);
+        }
+    }
+}
+
+// Keeps the lines of a bundle for which side * (c + m * t - limit) >= 0
+static void ClipBundle(const Bundle *bundle, Bundle *clipped, float t, float limit, float side) {
+    clipped->count = 0;
+    clipped->column = bundle->column;
+    clipped->rising = bundle->rising;
+    for (int i = 0; i < bundle->count; i++) {
+        int j = (i + 1 < bundle->count) ? i + 1 : 0;
+        float a = side * (bundle->c[i] + bundle->m[i] * t - limit);
+        float b = side * (bundle->c[j] + bundle->m[j] * t - limit);
+        // Keep the whole bundle when the polygon is full, rather than lose lines
+        if (clipped->count + 2 > BUNDLE_VERTICES) {
+            *clipped = *bundle;
+            return;
+        }
+        if (a >= 0.0f) {
+            clipped->m[clipped->count] = bundle->m[i];
+            clipped->c[clipped->count] = bundle->c[i];
+            clipped->count++;
+        }
+        if ((a >= 0.0f) != (b >= 0.0f)) {
+            float f = a / (a - b);
+            clipped->m[clipped->count] = bundle->m[i] + (bundle->m[j] - bundle->m[i]) * f;
+            clipped->c[clipped->count] = bundle->c[i] + (bundle->c[j] - bundle->c[i]) * f;
+            clipped->count++;
+        }
+    }
+    if (clipped->count < 3) {
+        clipped->count = 0;
+    }
+}
+
+// Returns the lowest and highest values of c + m * t over the lines of a bundle
+static void GetBundleRange(const Bundle *bundle, float t, float *min, float *max) {
+    *min = *max = bundle->c[0] + bundle->m[0] * t;
+    for (int i = 1; i < bundle->count; i++) {
+        float v = bundle->c[i] + bundle->m[i] * t;
+        *min = fminf(*min, v);
+        *max = fmaxf(*max, v);
+    }
+}
+
+// Walks the lines of a bundle across the columns, marking the blocks of the
+// cells they cross until the walls stop all of them
+static void WalkBundle(const LineWalk *walk, const Bundle *bundle) {
+    Bundle stack[BUNDLE_STACK_SIZE];
+    int count = 0;
+    stack[count++] = *bundle;
+    while (count > 0) {
+        Bundle b = stack[--count];
+        if (b.column >= walk->columns) {
+            continue;
+        }
+        // The lowest point of a line inside of the column is at tLow
+        // and the highest at tHigh, which depends on the sign of the slopes
+        float tLow = (b.rising) ? b.column : b.column + 1.0f;
+        float tHigh = (b.rising) ? b.column + 1.0f : b.column;
+        float minLow, maxLow, minHigh, maxHigh;
+        GetBundleRange(&b, tLow, &minLow, &maxLow);
+        GetBundleRange(&b, tHigh, &minHigh, &maxHigh);
+        // The cells crossed by any of the lines (walls included) can be seen
+        int first = (int) floorf(minLow - EPSILON);
+        int last = (int) floorf(maxHigh + EPSILON);
+        MarkColumn(walk, b.column, first, last);
+        // Go up the walls of the column: the lines passing below a wall go
+        // on to the next column, the ones above it can still cross the next
+        // walls, and the ones crossing it stop there
+        Bundle rest = b;
+        rest.column++;
+        for (int v = first; v <= last && rest.count > 0; v++) {
+            if (!IsWallCell(walk, b.column, v)) {
+                continue;
+            }
+            // Out of room, let the lines through the walls rather than lose any
+            if (count + 2 > BUNDLE_STACK_SIZE) {
+                break;
+            }
+            // The lines grazing a corner of the wall go on, unless the cell
+            // diagonally across the corner is a wall too: the lines missing
+            // this wall by a hair run into that one (only the lines through
+            // the corner itself slip between them, the rays never do). When
+            // that cell is in the next column, it's marked for those lines
+            int side = (b.rising) ? 1 : -1;
+            bool belowClosed = IsWallCell(walk, b.column + side, v - 1);
+            bool aboveClosed = IsWallCell(walk, b.column - side, v + 1);
+            if (b.column + 1 < walk->columns) {
+                if (belowClosed && b.rising) {
+                    MarkColumn(walk, b.column + 1, v - 1, v - 1);
+                }
+                if (aboveClosed && !b.rising) {
+                    MarkColumn(walk, b.column + 1, v + 1, v + 1);
+                }
+            }
+            Bundle *below = &stack[count];
+            ClipBundle(&rest, below, tHigh, (belowClosed) ? v - EPSILON : v + EPSILON, -1.0f);
+            count += below->count > 0;
+            Bundle above;
+            ClipBundle(&rest, &above, tLow, (aboveClosed) ? v + 1.0f + EPSILON : v + 1.0f - EPSILON, 1.0f);
+            rest = above;
+        }
+        if (rest.count > 0) {
+            stack[count++] = rest;
+        }
+    }
+}
+
+// Counts the blocks just built and logs every step of progress they complete
+static void ReportBuildProgress(VisibilityBuild *build, int blocks) {
+    int total = build->set->blocksX * build->set->blocksY;
+    int built = atomic_fetch_add_explicit(&build->built, blocks, memory_order_relaxed) + blocks;
+    int step = (int) ((long long) built * BUILD_PROGRESS_STEPS / total);
+    int reported = atomic_load_explicit(&build->reported, memory_order_relaxed);
+    // Only the thread that moves the progress forward logs it (the end is logged with the time it took)
+    while (reported < step && step < BUILD_PROGRESS_STEPS) {
+        if (atomic_compare_exchange_weak_explicit(&build->reported, &reported, step, memory_order_relaxed, memory_order_relaxed)) {
+            TraceLog(LOG_INFO, "VISIBILITY: Building the visibility set, %d%% done in %.2f s", step * 100 / BUILD_PROGRESS_STEPS, GetBenchTime() - build->start);
+            break;
+        }
+    }
+}
+
+static void BuildBlocks(void *data, int start, int end) {
+    VisibilityBuild *build = data;
+    const Map *map = build->map;
+    VisibilitySet *set = build->set;
+    for (int n = start; n < end; n++) {
+        int blockX = n % set->blocksX;
+        int blockY = n / set->blocksX;
+        unsigned int *bits = &set->bits[(size_t) n * set->words];
+        // Cells of the block, the blocks on the right and bottom borders can be cut by the map
+        int minX = blockX << VISIBILITY_BLOCK_SHIFT;
+        int minY = blockY << VISIBILITY_BLOCK_SHIFT;
+        int maxX = (minX + VISIBILITY_BLOCK_SIZE < map->width) ? minX + VISIBILITY_BLOCK_SIZE : map->width;
+        int maxY = (minY + VISIBILITY_BLOCK_SIZE < map->height) ? minY + VISIBILITY_BLOCK_SIZE : map->height;
+        // Nothing can stand inside of a block full of walls, don't cull anything from it
+        bool full = true;
+        for (int y = minY; y < maxY && full; y++) {
+            for (int x = minX; x < maxX && full; x++) {
+                full = IsOccupied(&map->occupancy, 0, x, y);
+            }
+        }
+        if (full) {
+            memset(bits, 0xFF, set->words * sizeof(unsigned int));
+            continue;
+        }
+        // The block sees itself and its neighbors (the lines leaving it are
+        // only walked from its sides on, they can clip its neighbors before)
+        for (int y = set->radius - 1; y <= set->radius + 1; y++) {
+            for (int x = set->radius - 1; x <= set->radius + 1; x++) {
+                MarkBlock(bits, set->size, x, y);
+            }
+        }
+        // The window ends radius blocks away from the block
+        int windowX = blockX - set->radius;
+        int windowY = blockY - set->radius;
+        int windowMinX = (windowX > 0) ? windowX << VISIBILITY_BLOCK_SHIFT : 0;
+        int windowMinY = (windowY > 0) ? windowY << VISIBILITY_BLOCK_SHIFT : 0;
+        int windowMaxX = ((blockX + set->radius + 1) << VISIBILITY_BLOCK_SHIFT < map->width) ? (blockX + set->radius + 1) << VISIBILITY_BLOCK_SHIFT : map->width;
+        int windowMaxY = ((blockY + set->radius + 1) << VISIBILITY_BLOCK_SHIFT < map->height) ? (blockY + set->radius + 1) << VISIBILITY_BLOCK_SHIFT : map->height;
+        for (int quadrant = 0; quadrant < QUADRANT_COUNT; quadrant++) {
+            bool vertical = quadrant == QUADRANT_DOWN || quadrant == QUADRANT_UP;
+            LineWalk walk = {
+                .map = map,
+                .set = set,
+                .bits = bits,
+                .windowX = windowX,
+                .windowY = windowY,
+                .vertical = vertical,
+                .length = (vertical) ? maxY - minY : maxX - minX,
+                .minV = (vertical) ? minX : minY,
+                .maxV = (vertical) ? maxX : maxY
+            };
+            switch (quadrant) {
+                case QUADRANT_RIGHT:
+                    walk.step = 1;
+                    walk.start = maxX;
+                    walk.columns = windowMaxX - maxX;
+                    break;
+                case QUADRANT_LEFT:
+                    walk.step = -1;
+                    walk.start = minX - 1;
+                    walk.columns = minX - windowMinX;
+                    break;
+                case QUADRANT_DOWN:
+                    walk.step = 1;
+                    walk.start = maxY;
+                    walk.columns = windowMaxY - maxY;
+                    break;
+                default:
+                    walk.step = -1;
+                    walk.start = minY - 1;
+                    walk.columns = minY - windowMinY;
+                    break;
+            }
+            // Slopes up to 1 (the other quadrants take the steeper lines), and
+            // offsets that take the lines through the block: inside of it t
+            // goes from -length to 0, so v goes from c - m * length to c
+            float minC = walk.minV - walk.length;
+            float maxC = walk.maxV + walk.length;
+            Bundle falling = { { -1.0f, 0.0f, 0.0f, -1.0f }, { minC, minC, maxC, maxC }, 4, 0, false };
+            Bundle rising = { { 0.0f, 1.0f, 1.0f, 0.0f }, { minC, minC, maxC, maxC }, 4, 0, true };
+            Bundle clipped;
+            // Falling lines: c <= maxV and c - m * length >= minV
+            ClipBundle(&falling, &clipped, 0.0f, walk.maxV + EPSILON, -1.0f);
+            ClipBundle(&clipped, &falling, -walk.length, walk.minV - EPSILON, 1.0f);
+            // Rising lines: c >= minV and c - m * length <= maxV
+            ClipBundle(&rising, &clipped, 0.0f, walk.minV - EPSILON, 1.0f);
+            ClipBundle(&clipped, &rising, -walk.length, walk.maxV + EPSILON, -1.0f);
+            WalkBundle(&walk, &falling);
+            WalkBundle(&walk, &rising);
+        }
+    }
+    ReportBuildProgress(build, end - start);
+}
+
+static void *BuildVisibilitySetMain(void *arg) {
+    SetProfilerThreadName("visibility");
+    int total = D.set.blocksX * D.set.blocksY;
+    while (!atomic_load_explicit(&D.stopping, memory_order_relaxed)) {
+        int start = atomic_fetch_add_explicit(&D.next, BLOCKS_PER_TASK, memory_order_relaxed);
+        if (start >= total) {
+            break;
+        }
+        ProfileZone zone = BeginProfileZone("visibility blocks");
+        BuildBlocks(&D.build, start, (start + BLOCKS_PER_TASK < total) ? start + BLOCKS_PER_TASK : total);
+        EndProfileZone(zone);
+    }
+    // The last thread out caches the set, unless the build was stopped halfway
+    if (atomic_fetch_add_explicit(&D.finished, 1, memory_order_acq_rel) + 1 == D.threadCount &&
+        !atomic_load_explicit(&D.stopping, memory_order_relaxed)) {
+        TraceLog(LOG_INFO, "VISIBILITY: Visibility set built in %.2f s (%dx%d blocks, windows of %dx%d blocks)", GetBenchTime() - D.build.start, D.set.blocksX, D.set.blocksY, D.set.size, D.set.size);
+        SaveVisibilitySet(&D.set, D.build.map, D.fileName);
+        atomic_store_explicit(&D.done, true, memory_order_release);
+    }
+    return NULL;
+}
+
+bool BuildVisibilitySet(VisibilitySet *set, const Map *map, int distance) {
+    if (!AllocateVisibilitySet(set, map, distance)) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to allocate the visibility set");
+        return false;
+    }
+    VisibilityBuild build = { .map = map, .set = set, .start = GetBenchTime() };
+    RunPoolTask(BuildBlocks, &build, set->blocksX * set->blocksY, BLOCKS_PER_TASK);
+    TraceLog(LOG_INFO, "VISIBILITY: Visibility set built in %.2f s (%dx%d blocks, windows of %dx%d blocks)", GetBenchTime() - build.start, set->blocksX, set->blocksY, set->size, set->size);
+    return true;
+}
+
+bool LoadVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName) {
+    if (!FileExists(fileName)) {
+        return false;
+    }
+    unsigned int size = 0;
+    unsigned char *data = LoadFileData(fileName, &size);
+    if (!data) {
+        return false;
+    }
+    bool loaded = false;
+    VisibilityFileHeader header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+        // Anything that changed the walls or the window makes the set stale
+        if (header.magic == VISIBILITY_FILE_MAGIC && header.version == VISIBILITY_FILE_VERSION &&
+            header.width == map->width && header.height == map->height &&
+            header.blockShift == VISIBILITY_BLOCK_SHIFT && header.distance == distance &&
+            header.mapHash == HashMapWalls(map) && AllocateVisibilitySet(set, map, distance)) {
+            size_t bytes = (size_t) set->blocksX * set->blocksY * set->words * sizeof(unsigned int);
+            if (size == sizeof(header) + bytes) {
+                memcpy(set->bits, data + sizeof(header), bytes);
+                loaded = true;
+            } else {
+                UnloadVisibilitySet(set);
+            }
+        }
+    }
+    UnloadFileData(data);
+    if (loaded) {
+        TraceLog(LOG_INFO, "VISIBILITY: [%s] Visibility set loaded successfully", fileName);
+    } else {
+        TraceLog(LOG_INFO, "VISIBILITY: [%s] Visibility set is missing or stale", fileName);
+    }
+    return loaded;
+}
+
+bool SaveVisibilitySet(const VisibilitySet *set, const Map *map, const char *fileName) {
+    size_t bytes = (size_t) set->blocksX * set->blocksY * set->words * sizeof(unsigned int);
+    unsigned char *data = MemAlloc(sizeof(VisibilityFileHeader) + bytes);
+    if (!data) {
+        return false;
+    }
+    VisibilityFileHeader header = {
+        .magic = VISIBILITY_FILE_MAGIC,
+        .version = VISIBILITY_FILE_VERSION,
+        .width = map->width,
+        .height = map->height,
+        .blockShift = VISIBILITY_BLOCK_SHIFT,
+        .distance = set->distance,
+        .mapHash = HashMapWalls(map)
+    };
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), set->bits, bytes);
+    bool saved = SaveFileData(fileName, data, sizeof(header) + bytes);
+    MemFree(data);
+    if (!saved) {
+        TraceLog(LOG_WARNING, "VISIBILITY: [%s] Failed to write visibility file", fileName);
+    }
+    return saved;
+}
+
+bool LoadOrBuildVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName) {
+    if (LoadVisibilitySet(set, map, distance, fileName)) {
+        return true;
+    }
+    if (!BuildVisibilitySet(set, map, distance)) {
+        return false;
+    }
+    // The set still works when it can't be cached, it's built again next time
+    SaveVisibilitySet(set, map, fileName);
+    return true;
+}
+
+bool LoadOrStartVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName, int threads) {
+    if (LoadVisibilitySet(set, map, distance, fileName)) {
+        return true;
+    }
+    StopVisibilitySetBuild();
+    if (!AllocateVisibilitySet(&D.set, map, distance)) {
+        TraceLog(LOG_WARNING, "VISIBILITY: Failed to allocate the visibility set");
+        return false;
+    }
+    D.build = (VisibilityBuild) { .map = map, .set = &D.set, .start = GetBenchTime() };
+    snprintf(D.fileName, sizeof(D.fileName), "%s", fileName);
+    threads = (threads < 1) ? 1 : (threads > POOL_MAX_WORKERS) ? POOL_MAX_WORKERS : threads;
+    D.threadCount = threads;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&D.threads[i], NULL, BuildVisibilitySetMain, NULL)) {
+            // The threads spawned so far can't finish the build on their own
+            D.threadCount = i;
+            StopVisibilitySetBuild();
+            TraceLog(LOG_WARNING, "VISIBILITY: Failed to start the threads building the visibility set");
+            return false;
+        }
+    }
+    D.started = true;
+    TraceLog(LOG_INFO, "VISIBILITY: Building the visibility set in the background (%d threads), nothing is culled until it's done", threads);
+    return true;
+}
+
+bool FinishVisibilitySetBuild(VisibilitySet *set) {
+    if (!D.started || !atomic_load_explicit(&D.done, memory_order_acquire)) {
+        return false;
+    }
+    for (int i = 0; i < D.threadCount; i++) {
+        pthread_join(D.threads[i], NULL);
+    }
+    UnloadVisibilitySet(set);
+    *set = D.set;
+    D = (VisibilityBuilder) {0};
+    return true;
+}
+
+void StopVisibilitySetBuild(void) {
+    atomic_store_explicit(&D.stopping, true, memory_order_relaxed);
+    for (int i = 0; i < D.threadCount; i++) {
+        pthread_join(D.threads[i], NULL);
+    }
+    UnloadVisibilitySet(&D.set);
+    D = (VisibilityBuilder) {0};
+}
+
+void UnloadVisibilitySet(VisibilitySet *set) {
+    MemFree(set->bits);
+    *set = (VisibilitySet) {0};
+}
+
+VisibleBlocks GetVisibleBlocks(const VisibilitySet *set, const Map *map, int x, int y) {
+    if (!set->bits || x < 0 || y < 0 || x >= map->width || y >= map->height || IsOccupied(&map->occupancy, 0, x, y)) {
+        return (VisibleBlocks) {0};
+    }
+    int blockX = x >> VISIBILITY_BLOCK_SHIFT;
+    int blockY = y >> VISIBILITY_BLOCK_SHIFT;
+    return (VisibleBlocks) {
+        .bits = &set->bits[(size_t) (blockY * set->blocksX + blockX) * set->words],
+        .x = blockX - set->radius,
+        .y = blockY - set->radius,
+        .size = set->size
+    };
+}
+
+bool IsAreaVisible(const VisibleBlocks *visible, int minX, int minY, int maxX, int maxY) {
+    if (!visible->bits) {
+        return true;
+    }
+    // The blocks outside of the window are always potentially visible
+    minX >>= VISIBILITY_BLOCK_SHIFT;
+    minY >>= VISIBILITY_BLOCK_SHIFT;
+    maxX >>= VISIBILITY_BLOCK_SHIFT;
+    maxY >>= VISIBILITY_BLOCK_SHIFT;
+    if (minX < visible->x || minY < visible->y || maxX >= visible->x + visible->size || maxY >= visible->y + visible->size) {
+        return true;
+    }
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            if (IsBlockVisible(visible, x, y)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool IsChunkVisible(void *data, int x, int y) {
+    int minX = x << MAP_CHUNK_SHIFT;
+    int minY = y << MAP_CHUNK_SHIFT;
+    return IsAreaVisible(data, minX, minY, minX + MAP_CHUNK_SIZE - 1, minY + MAP_CHUNK_SIZE - 1);
+}
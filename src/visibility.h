@@ -0,0 +1,92 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Visibility is stored per block of 4x4 cells (the blocks of level 2 of the occupancy grid)
+#define VISIBILITY_BLOCK_SHIFT      2
+#define VISIBILITY_BLOCK_SIZE       (1 << VISIBILITY_BLOCK_SHIFT)
+// "RPVS" read as a little endian integer
+#define VISIBILITY_FILE_MAGIC       0x53565052
+#define VISIBILITY_FILE_VERSION     1
+
+// Potentially visible set of a map: for every block, the blocks that can be
+// seen from anywhere inside of it, within a window of blocks centered on it
+// (the blocks outside of the window are always potentially visible). The set
+// is conservative, it walks the bundles of lines going through every block
+// cell by cell and stops them exactly where walls block them
+typedef struct {
+    int blocksX;
+    int blocksY;
+    int distance;           // Cells the window reaches on each side of a block
+    int radius;             // Blocks of the window on each side of a block
+    int size;               // Blocks on each side of the window (2 * radius + 1)
+    int words;              // Words of the bitmap of every block
+    unsigned int *bits;     // Window of every block (row by row, 1 bit per block)
+} VisibilitySet;
+
+// A visibility file holds this header (all the values are little endian)
+// followed by the bits of the set. The set is only valid for the walls it
+// was built from, mapHash is a hash of the occupancy grid of the map
+typedef struct {
+    uint32_t magic;
+    int32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t blockShift;
+    int32_t distance;
+    uint64_t mapHash;
+} VisibilityFileHeader;
+
+// Blocks potentially visible from a cell, see GetVisibleBlocks()
+typedef struct {
+    const unsigned int *bits;   // Window of the block of the cell, NULL when nothing can be culled
+    int x;                      // Block at the top left corner of the window
+    int y;
+    int size;
+} VisibleBlocks;
+
+// Builds the set on all the threads of the pool (see pool.h), the blocks
+// up to distance cells away from a block are in its window
+bool BuildVisibilitySet(VisibilitySet *set, const Map *map, int distance);
+// Loads a set saved by SaveVisibilitySet(), fails if it was built for other
+// walls or another distance
+bool LoadVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName);
+bool SaveVisibilitySet(const VisibilitySet *set, const Map *map, const char *fileName);
+// Loads the set cached in fileName, or builds it and caches it there
+bool LoadOrBuildVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName);
+// Same, but builds the set in the background on threads of its own (not
+// the pool, which can go on rendering) and returns right away: set stays
+// empty, so nothing is culled, until FinishVisibilitySetBuild() takes it
+bool LoadOrStartVisibilitySet(VisibilitySet *set, const Map *map, int distance, const char *fileName, int threads);
+// Moves the set built in the background into set once it's built and
+// cached, returns whether it did (never blocks)
+bool FinishVisibilitySetBuild(VisibilitySet *set);
+// Stops the build going on in the background, if any, and drops the set
+void StopVisibilitySetBuild(void);
+void UnloadVisibilitySet(VisibilitySet *set);
+
+// Returns the blocks potentially visible from cell (x, y), nothing is culled
+// when the set is empty or the cell is outside of the map or inside a wall
+VisibleBlocks GetVisibleBlocks(const VisibilitySet *set, const Map *map, int x, int y);
+// Returns whether any block of the rectangle of cells from (minX, minY) to
+// (maxX, maxY) included is potentially visible
+bool IsAreaVisible(const VisibleBlocks *visible, int minX, int minY, int maxX, int maxY);
+// Chunk filter for UpdateChunkCache() (data is a VisibleBlocks), leaves
+// out the chunks where nothing is potentially visible
+bool IsChunkVisible(void *data, int x, int y);
+
+// Returns whether block (x, y) is potentially visible
+static inline bool IsBlockVisible(const VisibleBlocks *visible, int x, int y) {
+    x -= visible->x;
+    y -= visible->y;
+    if (!visible->bits || x < 0 || y < 0 || x >= visible->size || y >= visible->size) {
+        return true;
+    }
+    int bit = y * visible->size + x;
+    return (visible->bits[bit >> 5] >> (bit & 31)) & 1;
+}
+
+#endif